@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+# Load test for the osmo-hlr GSUP server: keep many idle GSUP clients connected, while a number of
+# active clients send Send Auth Info requests back-to-back, and report the request rate and latency.
+# Run it once with --idle 0 and once with --idle 800: with the epoll based GSUP server, both should
+# show about the same rate and latency.
+#
+# (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+#
+# All Rights Reserved
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+import argparse
+import resource
+import selectors
+import socket
+import struct
+import sys
+import time
+
+IPAC_PROTO_IPACCESS = 0xfe
+IPAC_PROTO_OSMO = 0xee
+IPAC_PROTO_EXT_GSUP = 0x05
+
+IPAC_MSGT_PING = 0x00
+IPAC_MSGT_PONG = 0x01
+IPAC_MSGT_ID_GET = 0x04
+IPAC_MSGT_ID_RESP = 0x05
+
+IPAC_IDTAG_SERNR = 0x00
+IPAC_IDTAG_UNITNAME = 0x01
+
+GSUP_SAI_REQ = 0x08
+GSUP_IMSI_IE = 0x01
+
+def ipa_msg(proto, data):
+	return struct.pack('>HB', len(data), proto) + data
+
+def id_resp(name):
+	data = bytes([IPAC_MSGT_ID_RESP])
+	value = name.encode() + b'\0'
+	for tag in (IPAC_IDTAG_SERNR, IPAC_IDTAG_UNITNAME):
+		data += struct.pack('>HB', len(value) + 1, tag) + value
+	return ipa_msg(IPAC_PROTO_IPACCESS, data)
+
+def bcd(digits):
+	if len(digits) % 2:
+		digits += 'f'
+	return bytes(int(digits[i + 1], 16) << 4 | int(digits[i], 16) for i in range(0, len(digits), 2))
+
+def sai_req(imsi):
+	imsi_enc = bcd(imsi)
+	gsup = bytes([GSUP_SAI_REQ, GSUP_IMSI_IE, len(imsi_enc)]) + imsi_enc
+	return ipa_msg(IPAC_PROTO_OSMO, bytes([IPAC_PROTO_EXT_GSUP]) + gsup)
+
+class Client:
+	def __init__(self, bench, idx, active):
+		self.bench = bench
+		self.name = 'gsup-bench-%s-%d' % ('active' if active else 'idle', idx)
+		self.active = active
+		self.rxbuf = b''
+		self.sent_at = None
+		self.sock = socket.create_connection((bench.args.host, bench.args.port))
+		self.sock.setblocking(False)
+		bench.sel.register(self.sock, selectors.EVENT_READ, self)
+
+	def send(self, data):
+		# messages are small, a full socket buffer means the HLR is not reading at all
+		self.sock.sendall(data)
+
+	def send_request(self):
+		self.sent_at = time.monotonic()
+		self.send(sai_req(self.bench.args.imsi))
+
+	def readable(self):
+		data = self.sock.recv(65536)
+		if not data:
+			sys.exit('%s: connection closed by the HLR' % self.name)
+		self.rxbuf += data
+		while len(self.rxbuf) >= 3:
+			l, proto = struct.unpack('>HB', self.rxbuf[:3])
+			if len(self.rxbuf) < 3 + l:
+				break
+			msg = self.rxbuf[3:3 + l]
+			self.rxbuf = self.rxbuf[3 + l:]
+			self.rx(proto, msg)
+
+	def rx(self, proto, msg):
+		if proto == IPAC_PROTO_IPACCESS:
+			if msg[0] == IPAC_MSGT_ID_GET:
+				self.send(id_resp(self.name))
+				if self.active:
+					self.send_request()
+			elif msg[0] == IPAC_MSGT_PING:
+				self.send(ipa_msg(IPAC_PROTO_IPACCESS, bytes([IPAC_MSGT_PONG])))
+			return
+		if proto != IPAC_PROTO_OSMO or msg[0] != IPAC_PROTO_EXT_GSUP or self.sent_at is None:
+			return
+		# result or error, both are an answer
+		self.bench.answered(time.monotonic() - self.sent_at)
+		self.send_request()
+
+class Bench:
+	def __init__(self, args):
+		self.args = args
+		self.sel = selectors.DefaultSelector()
+		self.latencies = []
+		self.clients = []
+
+	def answered(self, latency):
+		self.latencies.append(latency)
+
+	def poll(self, timeout):
+		for key, mask in self.sel.select(timeout):
+			key.data.readable()
+
+	def run(self):
+		for i in range(self.args.idle):
+			self.clients.append(Client(self, i, False))
+			if i % 100 == 99:
+				self.poll(0)
+		print('%d idle clients connected' % self.args.idle)
+
+		for i in range(self.args.active):
+			self.clients.append(Client(self, i, True))
+
+		# let the first requests settle before measuring
+		end = time.monotonic() + 1
+		while time.monotonic() < end:
+			self.poll(0.1)
+		self.latencies = []
+
+		start = time.monotonic()
+		end = start + self.args.duration
+		while time.monotonic() < end:
+			self.poll(0.1)
+		elapsed = time.monotonic() - start
+
+		lat = sorted(self.latencies)
+		if not lat:
+			sys.exit('no answers received')
+		pct = lambda p: lat[min(len(lat) - 1, int(len(lat) * p / 100))] * 1e6
+		print('%d idle + %d active clients: %d requests in %.1f s, %.0f/s, latency p50 %.0f us, p90 %.0f us, p99 %.0f us'
+		      % (self.args.idle, self.args.active, len(lat), elapsed, len(lat) / elapsed, pct(50), pct(90), pct(99)))
+
+def main():
+	parser = argparse.ArgumentParser(description="Load test for the osmo-hlr GSUP server")
+	parser.add_argument('--host', default='127.0.0.1', help='GSUP server address')
+	parser.add_argument('--port', type=int, default=4222, help='GSUP server port')
+	parser.add_argument('--idle', type=int, default=800, help='number of idle clients')
+	parser.add_argument('--active', type=int, default=100,
+			    help='number of clients sending one request after the other')
+	parser.add_argument('--duration', type=float, default=10, help='seconds to measure')
+	parser.add_argument('--imsi', default='901700000000001',
+			    help='IMSI to request auth info for; unknown IMSIs are answered with an error')
+	args = parser.parse_args()
+
+	soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+	need = args.idle + args.active + 16
+	if soft < need:
+		resource.setrlimit(resource.RLIMIT_NOFILE, (min(need, hard), hard))
+
+	Bench(args).run()
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,264 @@
+#!/usr/bin/env python3
+# Replay GSUP traffic recorded by osmo-hlr's 'gsup-record start FILE' against an HLR, typically a test
+# instance running on a copy of the recorded HLR's database. Each recorded peer is impersonated by one GSUP
+# client with the same IPA name. Requests the peers sent are sent at their recorded times, optionally sped
+# up; answers the peers gave to the HLR's requests (e.g. Insert Subscriber Data) are sent when the HLR sends
+# the corresponding request. The throughput, and the latency and answers compared to the recording, are
+# reported.
+#
+# (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+#
+# All Rights Reserved
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+import argparse
+import collections
+import selectors
+import socket
+import struct
+import sys
+import time
+
+# see src/gsup_record.h
+GSUP_RECORD_MAGIC = b'GSUPREC1'
+GSUP_RECORD_F_TX = 0x01
+
+IPAC_PROTO_IPACCESS = 0xfe
+IPAC_PROTO_OSMO = 0xee
+IPAC_PROTO_EXT_GSUP = 0x05
+
+IPAC_MSGT_PING = 0x00
+IPAC_MSGT_PONG = 0x01
+IPAC_MSGT_ID_GET = 0x04
+IPAC_MSGT_ID_RESP = 0x05
+
+IPAC_IDTAG_SERNR = 0x00
+IPAC_IDTAG_UNITNAME = 0x01
+
+GSUP_IMSI_IE = 0x01
+
+Record = collections.namedtuple('Record', 't tx name data')
+
+def read_capture(path):
+	records = []
+	with open(path, 'rb') as f:
+		if f.read(len(GSUP_RECORD_MAGIC)) != GSUP_RECORD_MAGIC:
+			sys.exit('%s: not a GSUP capture file' % path)
+		while True:
+			hdr = f.read(12)
+			if len(hdr) < 12:
+				break
+			sec, usec, flags, name_len, l = struct.unpack('>IIBBH', hdr)
+			name = f.read(name_len).decode(errors='replace')
+			data = f.read(l)
+			if len(data) < l:
+				break
+			records.append(Record(sec + usec / 1e6, bool(flags & GSUP_RECORD_F_TX), name, data))
+	return records
+
+def ipa_msg(proto, data):
+	return struct.pack('>HB', len(data), proto) + data
+
+def id_resp(name):
+	data = bytes([IPAC_MSGT_ID_RESP])
+	value = name.encode() + b'\0'
+	for tag in (IPAC_IDTAG_SERNR, IPAC_IDTAG_UNITNAME):
+		data += struct.pack('>HB', len(value) + 1, tag) + value
+	return ipa_msg(IPAC_PROTO_IPACCESS, data)
+
+def gsup_key(data):
+	'''Message type without the request/result/error bits, and the encoded IMSI, as osmo_gsup_encode() puts
+	   the IMSI IE first.'''
+	imsi = b''
+	if len(data) >= 3 and data[1] == GSUP_IMSI_IE:
+		imsi = data[3:3 + data[2]]
+	return (data[0] & ~3, imsi)
+
+def is_request(msg_type):
+	return msg_type & 3 == 0
+
+def percentiles(lat):
+	lat = sorted(lat)
+	if not lat:
+		return 'no answers'
+	pct = lambda p: lat[min(len(lat) - 1, int(len(lat) * p / 100))] * 1e6
+	return 'p50 %.0f us, p90 %.0f us, p99 %.0f us' % (pct(50), pct(90), pct(99))
+
+class Peer:
+	def __init__(self, replay, name):
+		self.replay = replay
+		self.name = name
+		self.identified = False
+		self.rxbuf = b''
+		# recorded answers of this peer to the HLR's requests, by gsup_key()
+		self.answers = collections.defaultdict(collections.deque)
+		# requests sent, by gsup_key(): (time sent, recorded answer type, recorded latency)
+		self.pending = collections.defaultdict(collections.deque)
+		self.sock = socket.create_connection((replay.args.host, replay.args.port))
+		self.sock.setblocking(False)
+		replay.sel.register(self.sock, selectors.EVENT_READ, self)
+
+	def send(self, data):
+		self.sock.sendall(data)
+
+	def send_gsup(self, data):
+		self.send(ipa_msg(IPAC_PROTO_OSMO, bytes([IPAC_PROTO_EXT_GSUP]) + data))
+
+	def send_request(self, data, orig_answer, orig_latency):
+		self.pending[gsup_key(data)].append((time.monotonic(), orig_answer, orig_latency))
+		self.send_gsup(data)
+		self.replay.sent += 1
+
+	def readable(self):
+		data = self.sock.recv(65536)
+		if not data:
+			sys.exit('%s: connection closed by the HLR' % self.name)
+		self.rxbuf += data
+		while len(self.rxbuf) >= 3:
+			l, proto = struct.unpack('>HB', self.rxbuf[:3])
+			if len(self.rxbuf) < 3 + l:
+				break
+			msg = self.rxbuf[3:3 + l]
+			self.rxbuf = self.rxbuf[3 + l:]
+			self.rx(proto, msg)
+
+	def rx(self, proto, msg):
+		if proto == IPAC_PROTO_IPACCESS:
+			if msg[0] == IPAC_MSGT_ID_GET:
+				self.send(id_resp(self.name))
+				self.identified = True
+			elif msg[0] == IPAC_MSGT_PING:
+				self.send(ipa_msg(IPAC_PROTO_IPACCESS, bytes([IPAC_MSGT_PONG])))
+			return
+		if proto != IPAC_PROTO_OSMO or len(msg) < 2 or msg[0] != IPAC_PROTO_EXT_GSUP:
+			return
+		self.rx_gsup(msg[1:])
+
+	def rx_gsup(self, data):
+		key = gsup_key(data)
+		if is_request(data[0]):
+			# the HLR asks, answer as recorded
+			if self.answers[key]:
+				self.send_gsup(self.answers[key].popleft())
+			return
+		if not self.pending[key]:
+			return
+		sent, orig_answer, orig_latency = self.pending[key].popleft()
+		self.replay.answered(time.monotonic() - sent, orig_latency, orig_answer, data[0])
+
+class Replay:
+	def __init__(self, args, records):
+		self.args = args
+		self.sel = selectors.DefaultSelector()
+		self.records = records
+		self.peers = {}
+		self.sent = 0
+		self.latency = []
+		self.orig_latency = []
+		self.divergent = collections.Counter()
+
+	def answered(self, latency, orig_latency, orig_answer, answer):
+		self.latency.append(latency)
+		if orig_latency is not None:
+			self.orig_latency.append(orig_latency)
+		if orig_answer != answer:
+			self.divergent[(orig_answer, answer)] += 1
+
+	def poll(self, timeout):
+		for key, mask in self.sel.select(timeout):
+			key.data.readable()
+
+	def prepare(self):
+		'''Split the recording into requests to send on schedule, with the HLR's original answer and
+		   latency, and answers to send on demand.'''
+		requests = []
+		# requests of each peer not answered yet in the recording, by gsup_key()
+		waiting = collections.defaultdict(collections.deque)
+		for r in self.records:
+			if not r.data:
+				continue
+			if r.name not in self.peers:
+				self.peers[r.name] = Peer(self, r.name)
+			peer = self.peers[r.name]
+			key = (r.name,) + gsup_key(r.data)
+			if r.tx:
+				if not is_request(r.data[0]) and waiting[key]:
+					req = waiting[key].popleft()
+					req[2] = r.data[0]
+					req[3] = r.t - req[0]
+				continue
+			if is_request(r.data[0]):
+				req = [r.t, r, None, None]
+				requests.append(req)
+				waiting[key].append(req)
+			else:
+				peer.answers[gsup_key(r.data)].append(r.data)
+		return requests
+
+	def run(self):
+		requests = self.prepare()
+		if not requests:
+			sys.exit('no requests in the capture file')
+
+		# wait for all peers to be identified by the HLR
+		end = time.monotonic() + 5
+		while not all(p.identified for p in self.peers.values()):
+			if time.monotonic() > end:
+				sys.exit('timeout waiting for the HLR to identify all peers')
+			self.poll(0.1)
+		self.poll(0.1)
+
+		t0 = requests[0][0]
+		start = time.monotonic()
+		for t, r, orig_answer, orig_latency in requests:
+			due = start + (t - t0) / self.args.speed
+			while True:
+				now = time.monotonic()
+				if now >= due:
+					break
+				self.poll(due - now)
+			self.poll(0)
+			self.peers[r.name].send_request(r.data, orig_answer, orig_latency)
+
+		end = time.monotonic() + self.args.timeout
+		while len(self.latency) < self.sent and time.monotonic() < end:
+			self.poll(0.1)
+		elapsed = time.monotonic() - start
+		orig_elapsed = requests[-1][0] - t0
+
+		print('%d peers, %d requests in %.1f s (recorded: %.1f s), %.0f answers/s'
+		      % (len(self.peers), self.sent, elapsed, orig_elapsed, len(self.latency) / elapsed))
+		print('unanswered: %d' % (self.sent - len(self.latency)))
+		print('latency recorded: %s' % percentiles(self.orig_latency))
+		print('latency replayed: %s' % percentiles(self.latency))
+		for (orig, now), n in sorted(self.divergent.items(), key=lambda i: (i[0][0] or 0, i[0][1])):
+			print('answered 0x%02x instead of %s: %d' % (now, 'nothing' if orig is None else '0x%02x' % orig, n))
+
+def main():
+	parser = argparse.ArgumentParser(description='Replay recorded GSUP traffic against an HLR')
+	parser.add_argument('capture', help='file written by the gsup-record VTY command')
+	parser.add_argument('--host', default='127.0.0.1', help='GSUP server address')
+	parser.add_argument('--port', type=int, default=4222, help='GSUP server port')
+	parser.add_argument('--speed', type=float, default=1, help='replay N times faster than recorded')
+	parser.add_argument('--timeout', type=float, default=5,
+			    help='seconds to wait for outstanding answers after the last request')
+	args = parser.parse_args()
+	if args.speed <= 0:
+		parser.error('--speed must be positive')
+
+	Replay(args, read_capture(args.capture)).run()
+
+if __name__ == '__main__':
+	main()
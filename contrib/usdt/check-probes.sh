@@ -0,0 +1,58 @@
+#!/bin/sh
+# Check that the probe names used in contrib/usdt/ exist in osmo-hlr, and that the HLR_PROBE*() macros of
+# src/probes.h compile to nothing without USDT support. Run by 'make check'.
+# Usage: check-probes.sh <top_srcdir> [<cc>]
+set -e
+top_srcdir="${1:?top_srcdir}"
+CC="${2:-cc}"
+usdt_dir="$top_srcdir/contrib/usdt"
+probes_h="$top_srcdir/src/probes.h"
+tmp="$(mktemp -d)"
+trap 'rm -rf "$tmp"' EXIT
+rc=0
+
+# probes fired in the code, as HLR_PROBEn(name, ...)
+grep -oh 'HLR_PROBE[0-9]([a-z_]*' "$top_srcdir"/src/*.c | sed 's/.*(//' | sort -u > "$tmp/used"
+# probes listed in the comment of src/probes.h
+sed -n 's/^ \*   \([a-z_]*\)(.*/\1/p' "$probes_h" | sort -u > "$tmp/documented"
+# probes attached to by the bpftrace scripts
+sed -n 's/^usdt:[^:]*:osmo_hlr:\([a-z_]*\).*/\1/p' "$usdt_dir"/*.bt | sort -u > "$tmp/bt"
+# probes added by hlr-perf.sh
+sed -n '/for probe in/,/; do/p' "$usdt_dir/hlr-perf.sh" | sed 's/for probe in//; s/; do//; s/\\//' | tr -s ' \t' '\n' \
+	| grep . | sort -u > "$tmp/perf"
+
+if ! diff -u "$tmp/used" "$tmp/documented"; then
+	echo "$probes_h does not list exactly the probes used in src/*.c" >&2
+	rc=1
+fi
+if ! diff -u "$tmp/used" "$tmp/perf"; then
+	echo "$usdt_dir/hlr-perf.sh does not add exactly the probes used in src/*.c" >&2
+	rc=1
+fi
+for probe in $(comm -23 "$tmp/bt" "$tmp/used"); do
+	echo "$usdt_dir/*.bt attach to probe $probe, which src/*.c does not fire" >&2
+	rc=1
+done
+
+# Without HAVE_USDT, the macros must not need sys/sdt.h nor evaluate their arguments
+cat > "$tmp/probes_off.c" <<EOF
+#include "probes.h"
+#ifdef _SYS_SDT_H
+#error "sys/sdt.h included without HAVE_USDT"
+#endif
+int main(int argc, char **argv)
+{
+	if (argc)
+		HLR_PROBE1(p1, not_declared);
+	else
+		HLR_PROBE2(p2, not_declared, argv);
+	HLR_PROBE3(p3, not_declared, argc, argv);
+	return 0;
+}
+EOF
+if ! $CC -UHAVE_USDT -I"$top_srcdir/src" -c -o "$tmp/probes_off.o" "$tmp/probes_off.c"; then
+	echo "The HLR_PROBE*() macros of $probes_h do not compile away without HAVE_USDT" >&2
+	rc=1
+fi
+
+exit $rc
@@ -0,0 +1,15 @@
+#!/bin/sh
+# Record all USDT probes of a running osmo-hlr with perf for a number of seconds (default 10), then print them
+# with perf script. Needs root; set OSMO_HLR to the binary if it is not /usr/bin/osmo-hlr.
+set -e
+OSMO_HLR="${OSMO_HLR:-/usr/bin/osmo-hlr}"
+SECONDS_TO_RECORD="${1:-10}"
+
+perf buildid-cache --add "$OSMO_HLR"
+for probe in gsup_rx gsup_tx gsup_dispatch gsup_dispatch_done db_stmt_start db_stmt_done \
+	     auc_compute_start auc_compute_done lu_op_state ss_session_start ss_session_end; do
+	perf probe --quiet --add "sdt_osmo_hlr:$probe" 2>/dev/null || true
+done
+
+perf record -e 'sdt_osmo_hlr:*' -p "$(pidof osmo-hlr)" -o osmo-hlr-usdt.data -- sleep "$SECONDS_TO_RECORD"
+perf script -i osmo-hlr-usdt.data
@@ -21,7 +21,9 @@
  */
 #pragma once
 
+#include <osmocom/core/linuxlist.h>
 #include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
 #include <osmocom/gsm/oap_client.h>
 #include <osmocom/gsm/ipa.h>
 #include <osmocom/gsm/gsup.h>
@@ -32,13 +34,27 @@
 #define OSMO_GSUP_CLIENT_RECONNECT_INTERVAL 1
 #define OSMO_GSUP_CLIENT_PING_INTERVAL 20
 
+/* Number of hash buckets for requests waiting for their response, see osmo_gsup_client_request() */
+#define OSMO_GSUP_CLIENT_TRANS_BUCKETS 1024
+
 struct msgb;
 struct ipa_client_conn;
 struct osmo_gsup_client;
+struct osmo_gsup_client_trans;
+struct osmo_gsup_client_av_cache;
 
 /* Expects message in msg->l2h */
 typedef int (*osmo_gsup_client_read_cb_t)(struct osmo_gsup_client *gsupc, struct msgb *msg);
 
+/*! Completion of a request sent with osmo_gsup_client_request().
+ * \param[in] gsupc  GSUP client the request was sent on.
+ * \param[in] rc  0 if a response was received, -ETIMEDOUT if none arrived in time, -ENOTCONN if the link was
+ *                lost before.
+ * \param[in] resp  Decoded result or error message if rc == 0, NULL otherwise; only valid during the call.
+ * \param[in] data  As passed to osmo_gsup_client_request(). */
+typedef void (*osmo_gsup_client_resp_cb_t)(struct osmo_gsup_client *gsupc, int rc,
+					   const struct osmo_gsup_message *resp, void *data);
+
 struct osmo_gsup_client {
 	const char *unit_name; /* same as ipa_dev->unit_name, for backwards compat */
 
@@ -54,6 +70,14 @@ struct osmo_gsup_client {
 	int got_ipa_pong;
 
 	struct ipaccess_unit *ipa_dev; /* identification information sent to IPA server */
+
+	/* Requests waiting for their response, hashed by IMSI, message type and session id; allocated with the
+	 * first request */
+	struct llist_head *trans_buckets;
+	unsigned int num_trans;
+
+	/* see osmo_gsup_client_av_cache_enable(), NULL if disabled */
+	struct osmo_gsup_client_av_cache *av_cache;
 };
 
 struct osmo_gsup_client *osmo_gsup_client_create2(void *talloc_ctx,
@@ -75,3 +99,82 @@ int osmo_gsup_client_enc_send(struct osmo_gsup_client *gsupc,
 			      const struct osmo_gsup_message *gsup_msg);
 struct msgb *osmo_gsup_client_msgb_alloc(void);
 
+struct osmo_gsup_client_trans *osmo_gsup_client_request(struct osmo_gsup_client *gsupc,
+							 const struct osmo_gsup_message *gsup_msg,
+							 unsigned int timeout_ms,
+							 osmo_gsup_client_resp_cb_t resp_cb, void *data);
+void osmo_gsup_client_trans_cancel(struct osmo_gsup_client_trans *trans);
+
+
+/* Auth vectors of earlier Send Auth Info results, handed out one by one to later Send Auth Info requests for
+ * the same IMSI, see osmo_gsup_client_av_cache_enable(). Like other fixed size caches, each IMSI hashes to one
+ * slot and replaces the IMSI that was there before. */
+struct osmo_gsup_client_av_cache {
+	struct osmo_gsup_client *gsupc;
+	struct osmo_gsup_client_av_cache_entry *slots;
+	unsigned int num_slots;
+	/* seconds after which unused vectors are discarded */
+	unsigned int ttl;
+	/* fetch the next vectors from the server when no more than this many are left */
+	unsigned int low_water;
+
+	/* results answered from the cache, passed on from the main loop */
+	struct llist_head deliver_queue;
+	struct osmo_timer_list deliver_timer;
+
+	struct {
+		unsigned long hits;
+		unsigned long misses;
+		unsigned long prefetches;
+	} stats;
+};
+
+struct osmo_gsup_client_av_cache *osmo_gsup_client_av_cache_enable(struct osmo_gsup_client *gsupc,
+								    unsigned int num_slots, unsigned int ttl,
+								    unsigned int low_water);
+
+/* Which server of an osmo_gsup_client_pool to send a message to */
+enum osmo_gsup_client_pool_policy {
+	/* the first connected server in the list, the others are standby */
+	OSMO_GSUP_CLIENT_POOL_ACTIVE_STANDBY,
+	/* each connected server in turn */
+	OSMO_GSUP_CLIENT_POOL_ROUND_ROBIN,
+	/* the same server for the same IMSI, as long as it is connected */
+	OSMO_GSUP_CLIENT_POOL_IMSI_HASH,
+};
+
+extern const struct value_string osmo_gsup_client_pool_policy_names[];
+
+struct osmo_gsup_client_pool_server {
+	const char *ip_addr;
+	unsigned int tcp_port;
+};
+
+/* Connections to several GSUP servers serving the same subscribers. Each has its own osmo_gsup_client with the
+ * usual reconnecting and IPA ping/pong; only connected ones are picked. */
+struct osmo_gsup_client_pool {
+	enum osmo_gsup_client_pool_policy policy;
+	struct osmo_gsup_client **clients;
+	unsigned int num_clients;
+	/* next client for OSMO_GSUP_CLIENT_POOL_ROUND_ROBIN */
+	unsigned int next;
+	void *data;
+};
+
+struct osmo_gsup_client_pool *osmo_gsup_client_pool_create(void *talloc_ctx,
+							   struct ipaccess_unit *ipa_dev,
+							   const struct osmo_gsup_client_pool_server *servers,
+							   unsigned int num_servers,
+							   enum osmo_gsup_client_pool_policy policy,
+							   osmo_gsup_client_read_cb_t read_cb);
+void osmo_gsup_client_pool_destroy(struct osmo_gsup_client_pool *pool);
+struct osmo_gsup_client *osmo_gsup_client_pool_pick(struct osmo_gsup_client_pool *pool, const char *imsi);
+int osmo_gsup_client_pool_enc_send(struct osmo_gsup_client_pool *pool,
+				   const struct osmo_gsup_message *gsup_msg);
+
+struct osmo_gsup_client_pool_trans;
+struct osmo_gsup_client_pool_trans *osmo_gsup_client_pool_request(struct osmo_gsup_client_pool *pool,
+								   const struct osmo_gsup_message *gsup_msg,
+								   unsigned int timeout_ms,
+								   osmo_gsup_client_resp_cb_t resp_cb, void *data);
+void osmo_gsup_client_pool_trans_cancel(struct osmo_gsup_client_pool_trans *ptrans);
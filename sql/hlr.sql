@@ -40,9 +40,15 @@ CREATE TABLE subscriber (
 	-- Chapter 2.7.6
 	ms_purged_ps	BOOLEAN NOT NULL DEFAULT 0,
 
-	-- Timestamp of last location update seen from subscriber
-	-- The value is a string which encodes a UTC timestamp in granularity of seconds.
-	last_lu_seen TIMESTAMP default NULL
+	-- Timestamp of last location update seen from subscriber,
+	-- in seconds since the epoch (UTC). See subscriber_compat for a datetime() string.
+	last_lu_seen INTEGER default NULL,
+
+	-- imsi and msisdn as integer with a '1' prepended to keep leading zeros, see
+	-- db_digits_to_int() in src/db.c. osmo-hlr looks up subscribers by these.
+	-- NULL if the string is not all digits or longer than 18 digits.
+	imsi_int	INTEGER default NULL,
+	msisdn_int	INTEGER default NULL
 );
 
 CREATE TABLE subscriber_apn (
@@ -72,8 +78,96 @@ CREATE TABLE auc_3g (
 	ind_bitlen	INTEGER NOT NULL DEFAULT 5	-- nr of index bits at lower SQN end
 );
 
+-- With the IND space partitioned between several HLR nodes ('cluster' in the
+-- VTY), each node keeps its own SQN here instead of in auc_3g.sqn.
+CREATE TABLE auc_3g_sqn (
+	subscriber_id	INTEGER,		-- subscriber.id
+	node		INTEGER,		-- the cluster node's node-id
+	sqn		INTEGER NOT NULL,	-- sequence number of key usage on that node
+	PRIMARY KEY (subscriber_id, node)
+);
+
+CREATE TRIGGER auc_3g_sqn_del AFTER DELETE ON auc_3g
+	BEGIN DELETE FROM auc_3g_sqn WHERE subscriber_id = OLD.subscriber_id; END;
+
 CREATE UNIQUE INDEX idx_subscr_imsi ON subscriber (imsi);
+-- Uniqueness is already enforced on the imsi and msisdn strings.
+CREATE INDEX idx_subscr_imsi_int ON subscriber (imsi_int);
+CREATE INDEX idx_subscr_msisdn_int ON subscriber (msisdn_int);
+
+CREATE INDEX idx_subscr_last_lu_seen ON subscriber (last_lu_seen);
+
+-- For tools written against schema version 3 and older, which expect last_lu_seen
+-- as a UTC datetime() string like '2019-01-31 12:34:56'.
+CREATE VIEW subscriber_compat AS SELECT
+	id, imsi, msisdn, imeisv, imei, vlr_number, hlr_number, sgsn_number, sgsn_address,
+	ggsn_number, gmlc_number, smsc_number, periodic_lu_tmr, periodic_rau_tau_tmr,
+	nam_cs, nam_ps, lmsi, ms_purged_cs, ms_purged_ps,
+	datetime(last_lu_seen, 'unixepoch') AS last_lu_seen
+	FROM subscriber;
+
+-- Fill imsi_int and msisdn_int for rows written without them, e.g. by other tools.
+-- (Keep each trigger's inner ';' off the line end, see src/db_sql2c.sed.)
+CREATE TRIGGER subscriber_digits_int_ins AFTER INSERT ON subscriber
+	WHEN NEW.imsi_int IS NULL
+	BEGIN UPDATE subscriber SET
+		imsi_int = CASE WHEN NEW.imsi GLOB '[0-9]*' AND NOT NEW.imsi GLOB '*[^0-9]*' AND length(NEW.imsi) <= 18
+				THEN CAST('1' || NEW.imsi AS INTEGER) END,
+		msisdn_int = CASE WHEN NEW.msisdn GLOB '[0-9]*' AND NOT NEW.msisdn GLOB '*[^0-9]*' AND length(NEW.msisdn) <= 18
+				THEN CAST('1' || NEW.msisdn AS INTEGER) END
+		WHERE id = NEW.id; END;
+CREATE TRIGGER subscriber_digits_int_upd AFTER UPDATE OF imsi, msisdn ON subscriber
+	WHEN NEW.imsi_int IS OLD.imsi_int AND NEW.msisdn_int IS OLD.msisdn_int
+	BEGIN UPDATE subscriber SET
+		imsi_int = CASE WHEN NEW.imsi GLOB '[0-9]*' AND NOT NEW.imsi GLOB '*[^0-9]*' AND length(NEW.imsi) <= 18
+				THEN CAST('1' || NEW.imsi AS INTEGER) END,
+		msisdn_int = CASE WHEN NEW.msisdn GLOB '[0-9]*' AND NOT NEW.msisdn GLOB '*[^0-9]*' AND length(NEW.msisdn) <= 18
+				THEN CAST('1' || NEW.msisdn AS INTEGER) END
+		WHERE id = NEW.id; END;
+
+-- Change log of subscriber data, written by the triggers below in the same
+-- transaction as the change itself. Consumers ask for the rows after the last
+-- seq they have seen, see 'subscriber-changes' on the CTRL interface.
+CREATE TABLE subscriber_change (
+	seq		INTEGER PRIMARY KEY AUTOINCREMENT,	-- never reused, not even after trimming the log
+	ts		INTEGER NOT NULL DEFAULT (CAST(strftime('%s', 'now') AS INTEGER)),	-- seconds since the epoch
+	subscriber_id	INTEGER NOT NULL,	-- subscriber.id
+	imsi		VARCHAR(15),
+	change		VARCHAR(16) NOT NULL,	-- 'create', 'delete' or what changed, e.g. 'msisdn'
+	value		VARCHAR			-- new value, if any
+);
+
+CREATE TRIGGER subscriber_change_create AFTER INSERT ON subscriber
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change) VALUES (NEW.id, NEW.imsi, 'create'); END;
+CREATE TRIGGER subscriber_change_delete AFTER DELETE ON subscriber
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change) VALUES (OLD.id, OLD.imsi, 'delete'); END;
+CREATE TRIGGER subscriber_change_msisdn AFTER UPDATE OF msisdn ON subscriber WHEN NEW.msisdn IS NOT OLD.msisdn
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'msisdn', NEW.msisdn); END;
+CREATE TRIGGER subscriber_change_imei AFTER UPDATE OF imei ON subscriber WHEN NEW.imei IS NOT OLD.imei
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'imei', NEW.imei); END;
+CREATE TRIGGER subscriber_change_vlr AFTER UPDATE OF vlr_number ON subscriber WHEN NEW.vlr_number IS NOT OLD.vlr_number
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'vlr_number', NEW.vlr_number); END;
+CREATE TRIGGER subscriber_change_sgsn AFTER UPDATE OF sgsn_number ON subscriber WHEN NEW.sgsn_number IS NOT OLD.sgsn_number
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'sgsn_number', NEW.sgsn_number); END;
+CREATE TRIGGER subscriber_change_nam_cs AFTER UPDATE OF nam_cs ON subscriber WHEN NEW.nam_cs IS NOT OLD.nam_cs
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'nam_cs', NEW.nam_cs); END;
+CREATE TRIGGER subscriber_change_nam_ps AFTER UPDATE OF nam_ps ON subscriber WHEN NEW.nam_ps IS NOT OLD.nam_ps
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'nam_ps', NEW.nam_ps); END;
+CREATE TRIGGER subscriber_change_purged_cs AFTER UPDATE OF ms_purged_cs ON subscriber WHEN NEW.ms_purged_cs IS NOT OLD.ms_purged_cs
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'ms_purged_cs', NEW.ms_purged_cs); END;
+CREATE TRIGGER subscriber_change_purged_ps AFTER UPDATE OF ms_purged_ps ON subscriber WHEN NEW.ms_purged_ps IS NOT OLD.ms_purged_ps
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.id, NEW.imsi, 'ms_purged_ps', NEW.ms_purged_ps); END;
+-- Key material stays out of the log, only the algorithm is recorded. Removing the auth data of a deleted
+-- subscriber is covered by its 'delete' entry.
+CREATE TRIGGER subscriber_change_aud2g_ins AFTER INSERT ON auc_2g
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.subscriber_id, (SELECT imsi FROM subscriber WHERE id = NEW.subscriber_id), 'aud2g', NEW.algo_id_2g); END;
+CREATE TRIGGER subscriber_change_aud2g_del AFTER DELETE ON auc_2g WHEN EXISTS (SELECT 1 FROM subscriber WHERE id = OLD.subscriber_id)
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change) VALUES (OLD.subscriber_id, (SELECT imsi FROM subscriber WHERE id = OLD.subscriber_id), 'aud2g'); END;
+CREATE TRIGGER subscriber_change_aud3g_ins AFTER INSERT ON auc_3g
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value) VALUES (NEW.subscriber_id, (SELECT imsi FROM subscriber WHERE id = NEW.subscriber_id), 'aud3g', NEW.algo_id_3g); END;
+CREATE TRIGGER subscriber_change_aud3g_del AFTER DELETE ON auc_3g WHEN EXISTS (SELECT 1 FROM subscriber WHERE id = OLD.subscriber_id)
+	BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change) VALUES (OLD.subscriber_id, (SELECT imsi FROM subscriber WHERE id = OLD.subscriber_id), 'aud3g'); END;
 
 -- Set HLR database schema version number
 -- Note: This constant is currently duplicated in src/db.c and must be kept in sync!
-PRAGMA user_version = 2;
+PRAGMA user_version = 6;
@@ -19,31 +19,35 @@
 
 #include <string.h>
 #include <inttypes.h>
+#include <stdbool.h>
 
 #include <osmocom/core/utils.h>
 #include <osmocom/crypt/auth.h>
 
 #include "logging.h"
 #include "rand.h"
+#include "probes.h"
+#include "logring.h"
 
-#define hexb(buf) osmo_hexdump_nospc((void*)buf, sizeof(buf))
-#define hex(buf,sz) osmo_hexdump_nospc((void*)buf, sz)
+#define hexb(buf) LOGRING_HEXDUMP_NOSPC(buf, sizeof(buf))
+#define hex(buf,sz) LOGRING_HEXDUMP_NOSPC(buf, sz)
 
-/* compute given number of vectors using either aud2g or aud2g or a combination
- * of both.  Handles re-synchronization if rand_auts and auts are set */
-int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
-			struct osmo_sub_auth_data *aud2g,
-			struct osmo_sub_auth_data *aud3g,
-			const uint8_t *rand_auts, const uint8_t *auts)
+static int _auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
+				struct osmo_sub_auth_data *aud2g,
+				struct osmo_sub_auth_data *aud3g,
+				const uint8_t *rand_auts, const uint8_t *auts,
+				bool log)
 {
 	unsigned int i;
 	uint8_t rand[16];
 	struct osmo_auth_vector vtmp;
 	int rc;
 
-	/* no need to iterate the log categories all the time */
-	int dbg = log_check_level(DAUC, LOGL_DEBUG);
-#define DBGP(args ...) if (dbg) DEBUGP(DAUC, ##args)
+	/* no need to iterate the log categories all the time. The worker threads (!log) may still log to their
+	 * log ring. */
+	int dbg = logring_check_level(DAUC, LOGL_DEBUG, log);
+#define ERRP(args ...) if (log) LOGP(DAUC, LOGL_ERROR, ##args)
+#define DBGP(args ...) if (dbg) LOGPR_COND(log, DAUC, LOGL_DEBUG, ##args)
 #define DBGVB(member) DBGP("vector [%u]: " #member " = %s\n", \
 			   i, hexb(vec[i].member))
 #define DBGVV(fmt, member) DBGP("vector [%u]: " #member " = " fmt "\n", \
@@ -57,31 +61,31 @@ int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
 		aud3g = NULL;
 
 	if (!aud2g && !aud3g) {
-		LOGP(DAUC, LOGL_ERROR, "auc_compute_vectors() called"
+		ERRP("auc_compute_vectors() called"
 		     " with neither 2G nor 3G auth data available\n");
 		return -1;
 	}
 
 	if (aud2g && aud2g->type != OSMO_AUTH_TYPE_GSM) {
-		LOGP(DAUC, LOGL_ERROR, "auc_compute_vectors() called"
+		ERRP("auc_compute_vectors() called"
 		     " with non-2G auth data passed for aud2g arg\n");
 		return -1;
 	}
 
 	if (aud3g && aud3g->type != OSMO_AUTH_TYPE_UMTS) {
-		LOGP(DAUC, LOGL_ERROR, "auc_compute_vectors() called"
+		ERRP("auc_compute_vectors() called"
 		     " with non-3G auth data passed for aud3g arg\n");
 		return -1;
 	}
 
 	if ((rand_auts != NULL) != (auts != NULL)) {
-		LOGP(DAUC, LOGL_ERROR, "auc_compute_vectors() with only one"
+		ERRP("auc_compute_vectors() with only one"
 		     " of AUTS and AUTS_RAND given, need both or neither\n");
 		return -1;
 	}
 
 	if (auts && !aud3g) {
-		LOGP(DAUC, LOGL_ERROR, "auc_compute_vectors() with AUTS called"
+		ERRP("auc_compute_vectors() with AUTS called"
 		     " but no 3G auth data passed\n");
 		return -1;
 	}
@@ -106,7 +110,7 @@ int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
 	for (i = 0; i < num_vec; i++) {
 		rc = rand_get(rand, sizeof(rand));
 		if (rc != sizeof(rand)) {
-			LOGP(DAUC, LOGL_ERROR, "Unable to read %zu random "
+			ERRP("Unable to read %zu random "
 			     "bytes: rc=%d\n", sizeof(rand), rc);
 			goto out;
 		}
@@ -129,7 +133,7 @@ int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
 				rc = osmo_auth_gen_vec(vec+i, aud3g, rand);
 			}
 			if (rc < 0) {
-				LOGP(DAUC, LOGL_ERROR, "Error in 3G vector "
+				ERRP("Error in 3G vector "
 				     "generation: [%u]: rc = %d\n", i, rc);
 				goto out;
 			}
@@ -156,7 +160,7 @@ int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
 
 			rc = osmo_auth_gen_vec(&vtmp, aud2g, rand);
 			if (rc < 0) {
-				LOGP(DAUC, LOGL_ERROR, "Error in 2G vector"
+				ERRP("Error in 2G vector"
 				     "generation: [%u]: rc = %d\n", i, rc);
 				goto out;
 			}
@@ -167,7 +171,7 @@ int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
 			/* 2G only case */
 			rc = osmo_auth_gen_vec(vec+i, aud2g, rand);
 			if (rc < 0) {
-				LOGP(DAUC, LOGL_ERROR, "Error in 2G vector "
+				ERRP("Error in 2G vector "
 				     "generation: [%u]: rc = %d\n", i, rc);
 				goto out;
 			}
@@ -182,4 +186,35 @@ out:
 #undef DBGVV
 #undef DBGVB
 #undef DBGP
+#undef ERRP
+}
+
+/* compute given number of vectors using either aud2g or aud2g or a combination
+ * of both.  Handles re-synchronization if rand_auts and auts are set */
+int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
+			struct osmo_sub_auth_data *aud2g,
+			struct osmo_sub_auth_data *aud3g,
+			const uint8_t *rand_auts, const uint8_t *auts)
+{
+	int rc;
+
+	HLR_PROBE2(auc_compute_start, num_vec, auts != NULL);
+	rc = _auc_compute_vectors(vec, num_vec, aud2g, aud3g, rand_auts, auts, true);
+	HLR_PROBE1(auc_compute_done, rc);
+	return rc;
+}
+
+/* Same as auc_compute_vectors(), but without logging, so that it may run outside of the main thread. A
+ * return value smaller than num_vec means an error. */
+int auc_compute_vectors_nolog(struct osmo_auth_vector *vec, unsigned int num_vec,
+			      struct osmo_sub_auth_data *aud2g,
+			      struct osmo_sub_auth_data *aud3g,
+			      const uint8_t *rand_auts, const uint8_t *auts)
+{
+	int rc;
+
+	HLR_PROBE2(auc_compute_start, num_vec, auts != NULL);
+	rc = _auc_compute_vectors(vec, num_vec, aud2g, aud3g, rand_auts, auts, false);
+	HLR_PROBE1(auc_compute_done, rc);
+	return rc;
 }
@@ -0,0 +1,485 @@
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <inttypes.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/crypt/auth.h>
+
+#include "logging.h"
+#include "auc_image.h"
+
+#define LOGAUC(imsi, level, fmt, args ...)	LOGP(DAUC, level, "IMSI='%s': " fmt, imsi, ## args)
+
+/* Give up building the perfect hash if a bucket cannot be placed with this many seeds. */
+#define AUC_IMAGE_MAX_DISP	(1 << 20)
+
+struct auc_image {
+	char *path;
+	int fd;
+	void *map;
+	size_t map_len;
+	const struct auc_image_hdr *hdr;
+	const uint32_t *disp;
+	const uint32_t *slots;
+	const struct auc_image_rec *recs;
+
+	char *sqn_path;
+	int sqn_fd;
+	void *sqn_map;
+	size_t sqn_map_len;
+	uint64_t *sqn;
+};
+
+#define ALIGN8(x) (((x) + 7) & ~((uint64_t)7))
+
+/* FNV-1a over the IMSI digits, seeded, with a final avalanche so that the low
+ * bits used for the modulo are well distributed. */
+static uint64_t auc_image_hash(const char *imsi, uint32_t seed)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ ((uint64_t)seed * 0x9e3779b97f4a7c15ULL);
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 0x100000001b3ULL;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+	const struct auc_image_rec *ra = a;
+	const struct auc_image_rec *rb = b;
+	return strncmp(ra->imsi, rb->imsi, sizeof(ra->imsi));
+}
+
+struct bucket_order {
+	uint32_t bucket;
+	uint32_t size;
+};
+
+static int bucket_order_cmp(const void *a, const void *b)
+{
+	const struct bucket_order *oa = a;
+	const struct bucket_order *ob = b;
+	if (oa->size != ob->size)
+		return oa->size > ob->size ? -1 : 1;
+	return oa->bucket < ob->bucket ? -1 : (oa->bucket > ob->bucket);
+}
+
+/* Build a hash-and-displace perfect hash over the (sorted) records: each IMSI
+ * hashes to a bucket, and each bucket gets a seed so that all of its IMSIs land
+ * in distinct, previously unused slots. Buckets are placed largest first. */
+static int build_index(void *ctx, const struct auc_image_rec *recs, uint32_t num_recs,
+		       uint32_t *disp, uint32_t num_buckets, uint32_t *slots, uint32_t num_slots)
+{
+	uint32_t *rec_bucket = talloc_array(ctx, uint32_t, num_recs);
+	uint32_t *bucket_start = talloc_zero_array(ctx, uint32_t, num_buckets + 1);
+	uint32_t *bucket_recs = talloc_array(ctx, uint32_t, num_recs);
+	uint32_t *fill = talloc_zero_array(ctx, uint32_t, num_buckets);
+	uint32_t *tried = talloc_array(ctx, uint32_t, num_recs);
+	struct bucket_order *order = talloc_array(ctx, struct bucket_order, num_buckets);
+	uint32_t i, b;
+
+	if (!rec_bucket || !bucket_start || !bucket_recs || !fill || !tried || !order)
+		return -ENOMEM;
+
+	for (i = 0; i < num_slots; i++)
+		slots[i] = UINT32_MAX;
+	memset(disp, 0, num_buckets * sizeof(*disp));
+
+	/* counting sort of record indexes by bucket */
+	for (i = 0; i < num_recs; i++) {
+		rec_bucket[i] = auc_image_hash(recs[i].imsi, 0) % num_buckets;
+		bucket_start[rec_bucket[i] + 1]++;
+	}
+	for (b = 0; b < num_buckets; b++)
+		bucket_start[b + 1] += bucket_start[b];
+	for (i = 0; i < num_recs; i++) {
+		b = rec_bucket[i];
+		bucket_recs[bucket_start[b] + fill[b]++] = i;
+	}
+
+	for (b = 0; b < num_buckets; b++) {
+		order[b].bucket = b;
+		order[b].size = bucket_start[b + 1] - bucket_start[b];
+	}
+	qsort(order, num_buckets, sizeof(*order), bucket_order_cmp);
+
+	for (b = 0; b < num_buckets && order[b].size; b++) {
+		uint32_t bucket = order[b].bucket;
+		const uint32_t *members = &bucket_recs[bucket_start[bucket]];
+		uint32_t size = order[b].size;
+		uint32_t d;
+
+		for (d = 1; d < AUC_IMAGE_MAX_DISP; d++) {
+			uint32_t placed;
+			for (placed = 0; placed < size; placed++) {
+				uint32_t slot = auc_image_hash(recs[members[placed]].imsi, d) % num_slots;
+				if (slots[slot] != UINT32_MAX)
+					break;
+				slots[slot] = members[placed];
+				tried[placed] = slot;
+			}
+			if (placed == size)
+				break;
+			/* collision, undo this attempt and try the next seed */
+			while (placed--)
+				slots[tried[placed]] = UINT32_MAX;
+		}
+		if (d == AUC_IMAGE_MAX_DISP) {
+			LOGP(DAUC, LOGL_ERROR, "AUC image: cannot place hash bucket of %u IMSIs\n", size);
+			return -ENOSPC;
+		}
+		disp[bucket] = d;
+	}
+	return 0;
+}
+
+static int write_all(FILE *f, const void *data, size_t len)
+{
+	if (len && fwrite(data, len, 1, f) != 1)
+		return -EIO;
+	return 0;
+}
+
+/*! Write an AUC image file.
+ * \param[in] ctx  talloc context for temporary buffers.
+ * \param[in] path  File to write; it is first written to "<path>.tmp" and then renamed.
+ * \param[in,out] recs  Records to store; are sorted by IMSI in-place.
+ * \param[in] num_recs  Number of entries in recs.
+ * \returns 0 on success, negative errno on failure; -EINVAL on duplicate IMSIs.
+ */
+int auc_image_write(void *ctx, const char *path, struct auc_image_rec *recs, uint32_t num_recs)
+{
+	void *tmp_ctx = talloc_named_const(ctx, 0, "auc_image_write");
+	struct auc_image_hdr hdr = {
+		.magic = AUC_IMAGE_MAGIC,
+		.version = AUC_IMAGE_VERSION,
+		.byte_order = AUC_IMAGE_BYTE_ORDER,
+		.num_recs = num_recs,
+		.num_buckets = num_recs / 4 + 1,
+		.num_slots = num_recs + num_recs / 4 + 1,
+	};
+	static const uint8_t zeros[8] = {};
+	uint32_t *disp;
+	uint32_t *slots;
+	char *tmp_path;
+	struct timespec now;
+	FILE *f = NULL;
+	uint32_t i;
+	int rc;
+
+	qsort(recs, num_recs, sizeof(*recs), rec_cmp);
+	for (i = 1; i < num_recs; i++) {
+		if (!rec_cmp(&recs[i - 1], &recs[i])) {
+			LOGP(DAUC, LOGL_ERROR, "AUC image: duplicate IMSI %s\n", recs[i].imsi);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	disp = talloc_array(tmp_ctx, uint32_t, hdr.num_buckets);
+	slots = talloc_array(tmp_ctx, uint32_t, hdr.num_slots);
+	if (!disp || !slots) {
+		rc = -ENOMEM;
+		goto out;
+	}
+	rc = build_index(tmp_ctx, recs, num_recs, disp, hdr.num_buckets, slots, hdr.num_slots);
+	if (rc)
+		goto out;
+
+	osmo_clock_gettime(CLOCK_REALTIME, &now);
+	hdr.image_id = ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 20);
+	hdr.disp_ofs = ALIGN8(sizeof(hdr));
+	hdr.slots_ofs = ALIGN8(hdr.disp_ofs + hdr.num_buckets * sizeof(*disp));
+	hdr.recs_ofs = ALIGN8(hdr.slots_ofs + hdr.num_slots * sizeof(*slots));
+
+	tmp_path = talloc_asprintf(tmp_ctx, "%s.tmp", path);
+	f = fopen(tmp_path, "w");
+	if (!f) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: cannot open %s: %s\n", tmp_path, strerror(errno));
+		rc = -EIO;
+		goto out;
+	}
+
+	if ((rc = write_all(f, &hdr, sizeof(hdr)))
+	    || (rc = write_all(f, zeros, hdr.disp_ofs - sizeof(hdr)))
+	    || (rc = write_all(f, disp, hdr.num_buckets * sizeof(*disp)))
+	    || (rc = write_all(f, zeros, hdr.slots_ofs - hdr.disp_ofs - hdr.num_buckets * sizeof(*disp)))
+	    || (rc = write_all(f, slots, hdr.num_slots * sizeof(*slots)))
+	    || (rc = write_all(f, zeros, hdr.recs_ofs - hdr.slots_ofs - hdr.num_slots * sizeof(*slots)))
+	    || (rc = write_all(f, recs, (size_t)num_recs * sizeof(*recs)))) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: error writing %s\n", tmp_path);
+		fclose(f);
+		unlink(tmp_path);
+		goto out;
+	}
+
+	if (fclose(f) || rename(tmp_path, path)) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: cannot store %s: %s\n", path, strerror(errno));
+		unlink(tmp_path);
+		rc = -EIO;
+		goto out;
+	}
+
+	LOGP(DAUC, LOGL_NOTICE, "AUC image: wrote %u subscribers to %s\n", num_recs, path);
+	rc = 0;
+out:
+	talloc_free(tmp_ctx);
+	return rc;
+}
+
+/* Open (or create) the SQN side file. If it does not match the image, it is
+ * re-initialized from the SQNs stored in the image. */
+static int sqn_file_open(struct auc_image *img)
+{
+	const struct auc_image_hdr *hdr = img->hdr;
+	size_t len = sizeof(struct auc_image_sqn_hdr) + (size_t)hdr->num_recs * sizeof(uint64_t);
+	struct auc_image_sqn_hdr *sqn_hdr;
+	struct stat st;
+	uint32_t i;
+
+	img->sqn_fd = open(img->sqn_path, O_RDWR | O_CREAT, 0600);
+	if (img->sqn_fd < 0) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: cannot open SQN file %s: %s\n",
+		     img->sqn_path, strerror(errno));
+		return -EIO;
+	}
+	if (fstat(img->sqn_fd, &st) || (st.st_size != len && ftruncate(img->sqn_fd, len))) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: cannot size SQN file %s: %s\n",
+		     img->sqn_path, strerror(errno));
+		return -EIO;
+	}
+
+	img->sqn_map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, img->sqn_fd, 0);
+	if (img->sqn_map == MAP_FAILED) {
+		img->sqn_map = NULL;
+		LOGP(DAUC, LOGL_ERROR, "AUC image: cannot map SQN file %s: %s\n",
+		     img->sqn_path, strerror(errno));
+		return -EIO;
+	}
+	img->sqn_map_len = len;
+	sqn_hdr = img->sqn_map;
+	img->sqn = (uint64_t *)(sqn_hdr + 1);
+
+	if (st.st_size == len
+	    && !memcmp(sqn_hdr->magic, AUC_IMAGE_SQN_MAGIC, sizeof(sqn_hdr->magic))
+	    && sqn_hdr->image_id == hdr->image_id
+	    && sqn_hdr->num_recs == hdr->num_recs)
+		return 0;
+
+	LOGP(DAUC, LOGL_NOTICE, "AUC image: initializing SQN file %s from image\n", img->sqn_path);
+	for (i = 0; i < hdr->num_recs; i++)
+		img->sqn[i] = img->recs[i].sqn;
+	memset(sqn_hdr, 0, sizeof(*sqn_hdr));
+	memcpy(sqn_hdr->magic, AUC_IMAGE_SQN_MAGIC, sizeof(sqn_hdr->magic));
+	sqn_hdr->num_recs = hdr->num_recs;
+	/* write the image id last, so an interrupted init is detected next time */
+	msync(img->sqn_map, len, MS_SYNC);
+	sqn_hdr->image_id = hdr->image_id;
+	msync(img->sqn_map, len, MS_SYNC);
+	return 0;
+}
+
+/*! Map an AUC image written by auc_image_write().
+ * \param[in] ctx  talloc context to allocate the handle from.
+ * \param[in] path  Image file path.
+ * \param[in] sqn_path  Writable SQN side file, or NULL to use "<path>.sqn".
+ * \returns new handle, or NULL on error.
+ */
+struct auc_image *auc_image_open(void *ctx, const char *path, const char *sqn_path)
+{
+	struct auc_image *img = talloc_zero(ctx, struct auc_image);
+	const struct auc_image_hdr *hdr;
+	struct stat st;
+
+	OSMO_ASSERT(img);
+	img->fd = -1;
+	img->sqn_fd = -1;
+	img->path = talloc_strdup(img, path);
+	img->sqn_path = sqn_path ? talloc_strdup(img, sqn_path) : talloc_asprintf(img, "%s.sqn", path);
+
+	img->fd = open(path, O_RDONLY);
+	if (img->fd < 0 || fstat(img->fd, &st)) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: cannot open %s: %s\n", path, strerror(errno));
+		goto out_free;
+	}
+	if (st.st_size < sizeof(*hdr)) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: %s is too short\n", path);
+		goto out_free;
+	}
+
+	img->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, img->fd, 0);
+	if (img->map == MAP_FAILED) {
+		img->map = NULL;
+		LOGP(DAUC, LOGL_ERROR, "AUC image: cannot map %s: %s\n", path, strerror(errno));
+		goto out_free;
+	}
+	img->map_len = st.st_size;
+	/* lookups are point queries all over the file, don't bother with readahead */
+	madvise(img->map, img->map_len, MADV_RANDOM);
+
+	hdr = img->hdr = img->map;
+	if (memcmp(hdr->magic, AUC_IMAGE_MAGIC, sizeof(hdr->magic))
+	    || hdr->version != AUC_IMAGE_VERSION
+	    || hdr->byte_order != AUC_IMAGE_BYTE_ORDER) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: %s is not a compatible AUC image\n", path);
+		goto out_free;
+	}
+	if (!hdr->num_buckets || !hdr->num_slots
+	    || hdr->disp_ofs + (uint64_t)hdr->num_buckets * sizeof(uint32_t) > hdr->slots_ofs
+	    || hdr->slots_ofs + (uint64_t)hdr->num_slots * sizeof(uint32_t) > hdr->recs_ofs
+	    || hdr->recs_ofs + (uint64_t)hdr->num_recs * sizeof(struct auc_image_rec) != img->map_len) {
+		LOGP(DAUC, LOGL_ERROR, "AUC image: %s is truncated or corrupt\n", path);
+		goto out_free;
+	}
+	img->disp = (const uint32_t *)((const uint8_t *)img->map + hdr->disp_ofs);
+	img->slots = (const uint32_t *)((const uint8_t *)img->map + hdr->slots_ofs);
+	img->recs = (const struct auc_image_rec *)((const uint8_t *)img->map + hdr->recs_ofs);
+
+	if (sqn_file_open(img))
+		goto out_free;
+
+	LOGP(DAUC, LOGL_NOTICE, "AUC image: serving auth data for %u subscribers from %s (SQN in %s)\n",
+	     hdr->num_recs, img->path, img->sqn_path);
+	return img;
+
+out_free:
+	auc_image_close(img);
+	return NULL;
+}
+
+void auc_image_close(struct auc_image *img)
+{
+	if (!img)
+		return;
+	if (img->sqn_map) {
+		msync(img->sqn_map, img->sqn_map_len, MS_SYNC);
+		munmap(img->sqn_map, img->sqn_map_len);
+	}
+	if (img->sqn_fd >= 0)
+		close(img->sqn_fd);
+	if (img->map)
+		munmap(img->map, img->map_len);
+	if (img->fd >= 0)
+		close(img->fd);
+	talloc_free(img);
+}
+
+uint32_t auc_image_num_recs(const struct auc_image *img)
+{
+	return img->hdr->num_recs;
+}
+
+static int auc_image_find(const struct auc_image *img, const char *imsi)
+{
+	const struct auc_image_hdr *hdr = img->hdr;
+	uint32_t d, idx;
+
+	if (!hdr->num_recs)
+		return -ENOENT;
+	d = img->disp[auc_image_hash(imsi, 0) % hdr->num_buckets];
+	if (!d)
+		return -ENOENT;
+	idx = img->slots[auc_image_hash(imsi, d) % hdr->num_slots];
+	/* a perfect hash maps unknown keys to arbitrary slots, so verify the IMSI */
+	if (idx >= hdr->num_recs
+	    || strncmp(img->recs[idx].imsi, imsi, sizeof(img->recs[idx].imsi)))
+		return -ENOENT;
+	return idx;
+}
+
+/*! Obtain the authentication data for a given IMSI from the image.
+ * Same semantics as db_get_auth_data().
+ * \param[out] rec_idx  If non-NULL, the record index to pass to auc_image_update_sqn().
+ * \returns 0 for success, -ENOENT if the IMSI is not known, -ENOKEY if the IMSI
+ *          is known but has no auth data.
+ */
+int auc_image_get_auth_data(struct auc_image *img, const char *imsi,
+			    struct osmo_sub_auth_data *aud2g,
+			    struct osmo_sub_auth_data *aud3g,
+			    int64_t *subscr_id, uint32_t *rec_idx)
+{
+	const struct auc_image_rec *rec;
+	int idx;
+
+	memset(aud2g, 0, sizeof(*aud2g));
+	memset(aud3g, 0, sizeof(*aud3g));
+
+	idx = auc_image_find(img, imsi);
+	if (idx < 0) {
+		LOGAUC(imsi, LOGL_INFO, "No such subscriber\n");
+		return -ENOENT;
+	}
+	rec = &img->recs[idx];
+
+	if (subscr_id)
+		*subscr_id = rec->subscr_id;
+	if (rec_idx)
+		*rec_idx = idx;
+
+	if (rec->flags & AUC_IMAGE_F_2G) {
+		aud2g->algo = rec->algo_2g;
+		memcpy(aud2g->u.gsm.ki, rec->ki, sizeof(aud2g->u.gsm.ki));
+		aud2g->type = OSMO_AUTH_TYPE_GSM;
+	} else
+		LOGAUC(imsi, LOGL_DEBUG, "No 2G Auth Data\n");
+
+	if (rec->flags & AUC_IMAGE_F_3G) {
+		aud3g->algo = rec->algo_3g;
+		memcpy(aud3g->u.umts.k, rec->k, sizeof(aud3g->u.umts.k));
+		memcpy(aud3g->u.umts.opc, rec->opc, sizeof(aud3g->u.umts.opc));
+		aud3g->u.umts.opc_is_op = rec->opc_is_op;
+		aud3g->u.umts.sqn = img->sqn[idx];
+		aud3g->u.umts.ind_bitlen = rec->ind_bitlen;
+		aud3g->type = OSMO_AUTH_TYPE_UMTS;
+	} else
+		LOGAUC(imsi, LOGL_DEBUG, "No 3G Auth Data\n");
+
+	if (aud2g->type == 0 && aud3g->type == 0)
+		return -ENOKEY;
+	return 0;
+}
+
+/*! Store a new SQN in the side file. The write goes to the shared mapping and
+ * reaches the disk via the page cache; losing the latest SQNs on a crash only
+ * causes an AUTS resync, as with any SQN that lags behind the USIM. */
+int auc_image_update_sqn(struct auc_image *img, uint32_t rec_idx, uint64_t new_sqn)
+{
+	if (rec_idx >= img->hdr->num_recs)
+		return -ENOENT;
+	if (!(img->recs[rec_idx].flags & AUC_IMAGE_F_3G))
+		return -ENOENT;
+	img->sqn[rec_idx] = new_sqn;
+	return 0;
+}
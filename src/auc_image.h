@@ -0,0 +1,100 @@
+/* Memory-mapped read-only AUC image */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <osmocom/crypt/auth.h>
+#include <osmocom/gsm/protocol/gsm_23_003.h>
+
+/* An AUC image is a compact, read-only snapshot of the subscriber, auc_2g and
+ * auc_3g tables, as written by 'osmo-hlr-db-tool export-auc-image'. It is
+ * mmap()ed by osmo-hlr to answer Send Auth Info without going through SQLite.
+ *
+ * File layout (host byte order, all sections 8-byte aligned):
+ *   struct auc_image_hdr
+ *   uint32_t disp[num_buckets]      hash-and-displace seeds, one per bucket
+ *   uint32_t slots[num_slots]       record index per hash slot, or UINT32_MAX
+ *   struct auc_image_rec recs[num_recs]   sorted by IMSI
+ *
+ * The SQN of each record changes with every 3G auth, so it is kept in a small
+ * writable side file (by default "<image>.sqn"), which holds one uint64_t per
+ * record after a struct auc_image_sqn_hdr. */
+
+#define AUC_IMAGE_MAGIC		"OHLRAUC"
+#define AUC_IMAGE_SQN_MAGIC	"OHLRSQN"
+#define AUC_IMAGE_VERSION	1
+#define AUC_IMAGE_BYTE_ORDER	0x01020304
+
+struct auc_image_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	/* Random identifier of this image, a side file for another image is discarded. */
+	uint64_t image_id;
+	uint32_t num_recs;
+	uint32_t num_buckets;
+	uint32_t num_slots;
+	uint32_t reserved;
+	uint64_t disp_ofs;
+	uint64_t slots_ofs;
+	uint64_t recs_ofs;
+};
+
+#define AUC_IMAGE_F_2G	0x01
+#define AUC_IMAGE_F_3G	0x02
+
+struct auc_image_rec {
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	int64_t subscr_id;
+	/* SQN at the time of export, only used to initialize a new side file */
+	uint64_t sqn;
+	uint8_t flags;
+	uint8_t algo_2g;
+	uint8_t algo_3g;
+	uint8_t opc_is_op;
+	uint8_t ind_bitlen;
+	uint8_t reserved[3];
+	uint8_t ki[16];
+	uint8_t k[16];
+	uint8_t opc[16];
+};
+
+struct auc_image_sqn_hdr {
+	char magic[8];
+	uint64_t image_id;
+	uint32_t num_recs;
+	uint32_t reserved;
+};
+
+struct auc_image;
+
+int auc_image_write(void *ctx, const char *path, struct auc_image_rec *recs, uint32_t num_recs);
+
+struct auc_image *auc_image_open(void *ctx, const char *path, const char *sqn_path);
+void auc_image_close(struct auc_image *img);
+uint32_t auc_image_num_recs(const struct auc_image *img);
+
+int auc_image_get_auth_data(struct auc_image *img, const char *imsi,
+			    struct osmo_sub_auth_data *aud2g,
+			    struct osmo_sub_auth_data *aud3g,
+			    int64_t *subscr_id, uint32_t *rec_idx);
+int auc_image_update_sqn(struct auc_image *img, uint32_t rec_idx, uint64_t new_sqn);
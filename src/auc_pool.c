@@ -0,0 +1,228 @@
+/* Worker threads computing auth vectors */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* The workers only ever call auc_compute_vectors_nolog() on a job and move it between the queues; all
+ * talloc, logging, database and osmo_fd use stays on the main thread. A worker wakes up the main thread by
+ * writing to a pipe that is part of the main loop's select(). */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/select.h>
+
+#include "logging.h"
+#include "auc.h"
+#include "auc_pool.h"
+
+struct auc_pool {
+	pthread_t *threads;
+	unsigned int num_threads;
+
+	/* protects queue, done and stop */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* struct auc_job waiting for a worker */
+	struct llist_head queue;
+	/* struct auc_job computed, waiting for the main thread */
+	struct llist_head done;
+	bool stop;
+
+	int wake_pipe[2];
+	struct osmo_fd wake_ofd;
+
+	unsigned int in_flight;
+	unsigned long completed;
+};
+
+static void *auc_worker(void *arg)
+{
+	struct auc_pool *pool = arg;
+	struct auc_job *job;
+
+	while (1) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->stop && llist_empty(&pool->queue))
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		if (pool->stop) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		job = llist_first_entry(&pool->queue, struct auc_job, list);
+		llist_del(&job->list);
+		pthread_mutex_unlock(&pool->lock);
+
+		job->rc = auc_compute_vectors_nolog(job->vec, job->num_vec, &job->aud2g, &job->aud3g,
+						    job->resync ? job->rand_auts : NULL,
+						    job->resync ? job->auts : NULL);
+
+		pthread_mutex_lock(&pool->lock);
+		llist_add_tail(&job->list, &pool->done);
+		pthread_mutex_unlock(&pool->lock);
+
+		/* If the pipe is full, the main thread is going to look at the done list anyway */
+		if (write(pool->wake_pipe[1], "", 1) < 0 && errno != EAGAIN)
+			return NULL;
+	}
+}
+
+/* Main thread: hand the computed jobs to their done_cb, in the order they were computed */
+static int auc_pool_wake_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct auc_pool *pool = ofd->data;
+	struct auc_job *job, *job2;
+	LLIST_HEAD(done);
+	char buf[64];
+
+	while (read(ofd->fd, buf, sizeof(buf)) > 0);
+
+	pthread_mutex_lock(&pool->lock);
+	llist_splice_init(&pool->done, &done);
+	pthread_mutex_unlock(&pool->lock);
+
+	llist_for_each_entry_safe(job, job2, &done, list) {
+		llist_del(&job->list);
+		pool->in_flight--;
+		pool->completed++;
+		job->done_cb(job);
+	}
+	return 0;
+}
+
+/*! Start worker threads for auth vector computation.
+ * \param[in] ctx  talloc context.
+ * \param[in] num_workers  number of threads.
+ * \returns new pool, or NULL on error.
+ */
+struct auc_pool *auc_pool_alloc(void *ctx, unsigned int num_workers)
+{
+	struct auc_pool *pool = talloc_zero(ctx, struct auc_pool);
+	unsigned int i;
+	int rc;
+	OSMO_ASSERT(pool);
+
+	INIT_LLIST_HEAD(&pool->queue);
+	INIT_LLIST_HEAD(&pool->done);
+	/* not registered yet */
+	pool->wake_ofd.fd = -1;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	if (pipe(pool->wake_pipe)) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot create pipe for auth vector workers: %s\n", strerror(errno));
+		pool->wake_pipe[0] = pool->wake_pipe[1] = -1;
+		auc_pool_free(pool);
+		return NULL;
+	}
+	fcntl(pool->wake_pipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(pool->wake_pipe[1], F_SETFL, O_NONBLOCK);
+	pool->wake_ofd.fd = pool->wake_pipe[0];
+	pool->wake_ofd.when = BSC_FD_READ;
+	pool->wake_ofd.cb = auc_pool_wake_cb;
+	pool->wake_ofd.data = pool;
+	osmo_fd_register(&pool->wake_ofd);
+
+	pool->threads = talloc_zero_array(pool, pthread_t, num_workers);
+	OSMO_ASSERT(pool->threads);
+	for (i = 0; i < num_workers; i++) {
+		rc = pthread_create(&pool->threads[i], NULL, auc_worker, pool);
+		if (rc) {
+			LOGP(DAUC, LOGL_ERROR, "Cannot start auth vector worker thread: %s\n", strerror(rc));
+			auc_pool_free(pool);
+			return NULL;
+		}
+		pool->num_threads++;
+	}
+
+	LOGP(DAUC, LOGL_NOTICE, "Computing auth vectors on %u worker threads\n", num_workers);
+	return pool;
+}
+
+/*! Stop the worker threads and free the pool. Jobs not handed to their done_cb yet are dropped. */
+void auc_pool_free(struct auc_pool *pool)
+{
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	if (pool->wake_ofd.fd >= 0)
+		osmo_fd_unregister(&pool->wake_ofd);
+	if (pool->wake_pipe[0] >= 0) {
+		close(pool->wake_pipe[0]);
+		close(pool->wake_pipe[1]);
+	}
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	/* frees all jobs */
+	talloc_free(pool);
+}
+
+/*! Allocate a job with room for num_vec vectors; fill in its input and done_cb, then auc_job_submit() it. */
+struct auc_job *auc_job_alloc(struct auc_pool *pool, unsigned int num_vec)
+{
+	struct auc_job *job = talloc_zero(pool, struct auc_job);
+	OSMO_ASSERT(job);
+	job->pool = pool;
+	job->num_vec = num_vec;
+	job->vec = talloc_zero_array(job, struct osmo_auth_vector, num_vec);
+	OSMO_ASSERT(job->vec);
+	return job;
+}
+
+/*! Queue a job for the next free worker. Jobs are started in the order they are submitted. */
+void auc_job_submit(struct auc_job *job)
+{
+	struct auc_pool *pool = job->pool;
+
+	pool->in_flight++;
+	pthread_mutex_lock(&pool->lock);
+	llist_add_tail(&job->list, &pool->queue);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+unsigned int auc_pool_workers(const struct auc_pool *pool)
+{
+	return pool->num_threads;
+}
+
+/*! Number of jobs submitted but not handed to their done_cb yet. */
+unsigned int auc_pool_in_flight(const struct auc_pool *pool)
+{
+	return pool->in_flight;
+}
+
+unsigned long auc_pool_completed(const struct auc_pool *pool)
+{
+	return pool->completed;
+}
@@ -0,0 +1,62 @@
+/* Worker threads computing auth vectors */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/crypt/auth.h>
+
+struct auc_pool;
+
+/* One auc_compute_vectors() call to run on a worker thread. Everything but the input and output fields belongs
+ * to the main thread. */
+struct auc_job {
+	struct llist_head list;
+	struct auc_pool *pool;
+
+	/* input; the workers advance aud3g.u.umts.sqn like auc_compute_vectors() does */
+	struct osmo_sub_auth_data aud2g;
+	struct osmo_sub_auth_data aud3g;
+	unsigned int num_vec;
+	bool resync;
+	uint8_t rand_auts[16];
+	uint8_t auts[14];
+
+	/* output: number of vectors computed, fewer than num_vec on error */
+	int rc;
+	struct osmo_auth_vector *vec;
+
+	/* Called on the main thread with the computed vectors. Must talloc_free() the job. */
+	void (*done_cb)(struct auc_job *job);
+	void *data;
+};
+
+struct auc_pool *auc_pool_alloc(void *ctx, unsigned int num_workers);
+void auc_pool_free(struct auc_pool *pool);
+struct auc_job *auc_job_alloc(struct auc_pool *pool, unsigned int num_vec);
+void auc_job_submit(struct auc_job *job);
+
+unsigned int auc_pool_workers(const struct auc_pool *pool);
+unsigned int auc_pool_in_flight(const struct auc_pool *pool);
+unsigned long auc_pool_completed(const struct auc_pool *pool);
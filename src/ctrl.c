@@ -21,6 +21,7 @@
  */
 
 #include <stdbool.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <string.h>
@@ -31,12 +32,17 @@
 #include "hlr.h"
 #include "ctrl.h"
 #include "db.h"
+#include "gsup_server.h"
 
 #define SEL_BY "by-"
 #define SEL_BY_IMSI SEL_BY "imsi-"
 #define SEL_BY_MSISDN SEL_BY "msisdn-"
 #define SEL_BY_ID SEL_BY "id-"
 
+#define SUBSCR_CHANGES_SINCE "since-"
+/* Entries per 'subscriber-changes.since-N.list' reply; clients ask again from the last seq they got */
+#define SUBSCR_CHANGES_LIST_MAX 100
+
 #define hexdump_buf(buf) osmo_hexdump_nospc((void*)buf, sizeof(buf))
 
 static bool startswith(const char *str, const char *start)
@@ -351,6 +357,107 @@ static int set_subscr_cs_enabled(struct ctrl_cmd *cmd, void *data)
 	return set_subscr_cs_ps_enabled(cmd, data, false);
 }
 
+CTRL_CMD_DEFINE_RO(subscr_changes_last_seq, "last-seq");
+static int get_subscr_changes_last_seq(struct ctrl_cmd *cmd, void *data)
+{
+	struct hlr *hlr = data;
+	int64_t seq;
+	int rc;
+
+	rc = db_change_last_seq(hlr->dbc, &seq);
+	if (rc == -ENOTSUP) {
+		cmd->reply = "The database backend keeps no change log.";
+		return CTRL_CMD_ERROR;
+	} else if (rc) {
+		cmd->reply = "Cannot read the change log.";
+		return CTRL_CMD_ERROR;
+	}
+
+	cmd->reply = talloc_asprintf(cmd, "%" PRId64, seq);
+	return CTRL_CMD_REPLY;
+}
+
+static int print_subscr_change(const struct db_change *change, void *data)
+{
+	struct ctrl_cmd *cmd = data;
+
+	ctrl_cmd_reply_printf(cmd, "\n%" PRId64 "\t%" PRId64 "\t%" PRId64 "\t%s\t%s\t%s",
+			      change->seq, (int64_t)change->ts, change->subscr_id, change->imsi, change->change,
+			      change->value);
+	return 0;
+}
+
+CTRL_CMD_DEFINE_RO(subscr_changes_list, "list");
+static int get_subscr_changes_list(struct ctrl_cmd *cmd, void *data)
+{
+	struct hlr *hlr = data;
+	const char *since = (const char *)cmd->node + strlen(SUBSCR_CHANGES_SINCE);
+	char *endp;
+	int64_t seq;
+	int rc;
+
+	errno = 0;
+	seq = strtoll(since, &endp, 10);
+	if (errno || !*since || *endp || seq < 0) {
+		cmd->reply = "Invalid value part of 'since-seq' selector.";
+		return CTRL_CMD_ERROR;
+	}
+
+	/* Empty reply if nothing changed since seq */
+	cmd->reply = talloc_strdup(cmd, "");
+	rc = db_change_since(hlr->dbc, seq, SUBSCR_CHANGES_LIST_MAX, print_subscr_change, cmd);
+	if (rc == -ENOTSUP) {
+		cmd->reply = "The database backend keeps no change log.";
+		return CTRL_CMD_ERROR;
+	} else if (rc < 0) {
+		cmd->reply = "Cannot read the change log.";
+		return CTRL_CMD_ERROR;
+	}
+
+	return CTRL_CMD_REPLY;
+}
+
+CTRL_CMD_DEFINE_RO(gsup_connections, "gsup-connections");
+static int get_gsup_connections(struct ctrl_cmd *cmd, void *data)
+{
+	struct hlr *hlr = data;
+	struct osmo_gsup_conn *conn;
+
+	/* Empty reply without connections */
+	cmd->reply = talloc_strdup(cmd, "");
+	if (!hlr->gs)
+		return CTRL_CMD_REPLY;
+
+	llist_for_each_entry(conn, &hlr->gs->clients, list) {
+		const struct gsup_conn_stats *s = &conn->traffic;
+		unsigned int pending_rx, pending_tx;
+		char *name;
+
+		if (osmo_gsup_conn_ccm_get(conn, (uint8_t **) &name, IPAC_IDTAG_SERNR) <= 0)
+			name = "";
+		gsup_stats_pending_count(s, &pending_rx, &pending_tx);
+		ctrl_cmd_reply_printf(cmd, "\n%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%u",
+				      name, conn->auc_3g_ind, pending_rx, pending_tx,
+				      gsup_latency_percentile_us(&s->hlr_latency, 50),
+				      gsup_latency_percentile_us(&s->hlr_latency, 90),
+				      gsup_latency_percentile_us(&s->hlr_latency, 99),
+				      gsup_latency_percentile_us(&s->peer_latency, 50),
+				      gsup_latency_percentile_us(&s->peer_latency, 90),
+				      gsup_latency_percentile_us(&s->peer_latency, 99));
+	}
+	return CTRL_CMD_REPLY;
+}
+
+/* TRAP the newest seq to all CTRL clients whenever there are new changes */
+static void subscr_changes_notify(struct db_context *dbc, int64_t last_seq, void *data)
+{
+	struct ctrl_handle *hdl = data;
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%" PRId64, last_seq);
+	ctrl_cmd_send_trap(hdl, "subscriber-changes.last-seq", buf);
+}
+
 int hlr_ctrl_cmds_install()
 {
 	int rc = 0;
@@ -361,6 +468,11 @@ int hlr_ctrl_cmds_install()
 	rc |= ctrl_cmd_install(CTRL_NODE_SUBSCR_BY, &cmd_subscr_ps_enabled);
 	rc |= ctrl_cmd_install(CTRL_NODE_SUBSCR_BY, &cmd_subscr_cs_enabled);
 
+	rc |= ctrl_cmd_install(CTRL_NODE_SUBSCR_CHANGES, &cmd_subscr_changes_last_seq);
+	rc |= ctrl_cmd_install(CTRL_NODE_SUBSCR_CHANGES_SINCE, &cmd_subscr_changes_list);
+
+	rc |= ctrl_cmd_install(CTRL_NODE_ROOT, &cmd_gsup_connections);
+
 	return rc;
 }
 
@@ -371,6 +483,11 @@ static int hlr_ctrl_node_lookup(void *data, vector vline, int *node_type,
 
 	switch (*node_type) {
 	case CTRL_NODE_ROOT:
+		if (!strcmp(token, "subscriber-changes")) {
+			*node_data = NULL;
+			*node_type = CTRL_NODE_SUBSCR_CHANGES;
+			break;
+		}
 		if (strcmp(token, "subscriber") != 0)
 			return 0;
 		*node_data = NULL;
@@ -382,6 +499,12 @@ static int hlr_ctrl_node_lookup(void *data, vector vline, int *node_type,
 		*node_data = (void*)token;
 		*node_type = CTRL_NODE_SUBSCR_BY;
 		break;
+	case CTRL_NODE_SUBSCR_CHANGES:
+		if (!startswith(token, SUBSCR_CHANGES_SINCE))
+			return 0;
+		*node_data = (void*)token;
+		*node_type = CTRL_NODE_SUBSCR_CHANGES_SINCE;
+		break;
 	default:
 		return 0;
 	}
@@ -404,5 +527,8 @@ struct ctrl_handle *hlr_controlif_setup(struct hlr *hlr)
 	if (rc) /* FIXME: close control interface? */
 		return NULL;
 
+	hlr->dbc->change_log.notify_cb = subscr_changes_notify;
+	hlr->dbc->change_log.notify_data = hdl;
+
 	return hdl;
 }
@@ -27,6 +27,8 @@
 enum hlr_ctrl_node {
 	CTRL_NODE_SUBSCR = _LAST_CTRL_NODE,
 	CTRL_NODE_SUBSCR_BY,
+	CTRL_NODE_SUBSCR_CHANGES,
+	CTRL_NODE_SUBSCR_CHANGES_SINCE,
 	_LAST_CTRL_NODE_HLR
 };
 
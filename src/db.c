@@ -18,17 +18,47 @@
  */
 
 #include <osmocom/core/utils.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stats.h>
 
 #include <stdbool.h>
 #include <sqlite3.h>
 #include <string.h>
+#include <errno.h>
 
 #include "logging.h"
 #include "db.h"
 #include "db_bootstrap.h"
+#include "auc_image.h"
+#include "db_sqlite.h"
+#include "probes.h"
+
+static const struct rate_ctr_desc db_ctr_desc[] = {
+	[DB_CTR_LU_SUPPRESSED] = { "lu:write_suppressed",
+		"Location Updates that did not write to the database: same VLR/SGSN, last LU seen recently" },
+	[DB_CTR_IMEI_SUPPRESSED] = { "imei:write_suppressed",
+		"IMEI updates that did not write to the database: IMEI unchanged" },
+	[DB_CTR_NAM_SUPPRESSED] = { "nam:write_suppressed",
+		"Network access mode updates that did not write to the database: value unchanged" },
+	[DB_CTR_SAI_COALESCED] = { "auc:sai_coalesced",
+		"Send Auth Info requests answered with the vectors just generated for the same IMSI and IND" },
+};
+
+static const struct rate_ctr_group_desc db_ctrg_desc = {
+	.group_name_prefix = "db",
+	.group_description = "HLR database",
+	.class_id = OSMO_STATS_CLASS_GLOBAL,
+	.num_ctr = ARRAY_SIZE(db_ctr_desc),
+	.ctr_desc = db_ctr_desc,
+};
 
 /* This constant is currently duplicated in sql/hlr.sql and must be kept in sync! */
-#define CURRENT_SCHEMA_VERSION	2
+#define CURRENT_SCHEMA_VERSION	6
+
+/* A read-only connection may briefly get SQLITE_BUSY while the writer resets or recovers the WAL */
+#define DB_READONLY_BUSY_TIMEOUT_MS	100
+/* Sleep between retries while the database is busy */
+#define DB_BUSY_RETRY_MS	5
 
 #define SEL_COLUMNS \
 	"id," \
@@ -47,29 +77,52 @@
 	"ms_purged_ps," \
 	"last_lu_seen"
 
+/* The subscriber columns of schema version 3, with last_lu_seen as datetime() text */
+#define SUBSCR_COMPAT_COLUMNS \
+	"id, imsi, msisdn, imeisv, imei, vlr_number, hlr_number, sgsn_number, sgsn_address," \
+	" ggsn_number, gmlc_number, smsc_number, periodic_lu_tmr, periodic_rau_tau_tmr," \
+	" nam_cs, nam_ps, lmsi, ms_purged_cs, ms_purged_ps," \
+	" datetime(last_lu_seen, 'unixepoch') AS last_lu_seen"
+
 static const char *stmt_sql[] = {
-	[DB_STMT_SEL_BY_IMSI] = "SELECT " SEL_COLUMNS " FROM subscriber WHERE imsi = ?",
-	[DB_STMT_SEL_BY_MSISDN] = "SELECT " SEL_COLUMNS " FROM subscriber WHERE msisdn = ?",
+	[DB_STMT_SEL_BY_IMSI] = "SELECT " SEL_COLUMNS " FROM subscriber WHERE imsi_int = ?",
+	[DB_STMT_SEL_BY_MSISDN] = "SELECT " SEL_COLUMNS " FROM subscriber WHERE msisdn_int = ?",
+	/* For MSISDNs db_digits_to_int() cannot encode, e.g. '+49...' written before schema version 3 */
+	[DB_STMT_SEL_BY_MSISDN_TEXT] = "SELECT " SEL_COLUMNS " FROM subscriber WHERE msisdn = ? AND msisdn_int IS NULL",
 	[DB_STMT_SEL_BY_ID] = "SELECT " SEL_COLUMNS " FROM subscriber WHERE id = ?",
 	[DB_STMT_SEL_BY_IMEI] = "SELECT " SEL_COLUMNS " FROM subscriber WHERE imei = ?",
-	[DB_STMT_UPD_VLR_BY_ID] = "UPDATE subscriber SET vlr_number = $number WHERE id = $subscriber_id",
-	[DB_STMT_UPD_SGSN_BY_ID] = "UPDATE subscriber SET sgsn_number = $number WHERE id = $subscriber_id",
-	[DB_STMT_UPD_IMEI_BY_IMSI] = "UPDATE subscriber SET imei = $imei WHERE imsi = $imsi",
+	/* The conditional updates below modify no row when nothing would change; that
+	 * saves the write, and DB_STMT_EXISTS_BY_* tells it apart from a missing subscriber. */
+	[DB_STMT_UPD_VLR_BY_ID] =
+		"UPDATE subscriber SET vlr_number = $number, last_lu_seen = $now"
+		" WHERE id = $subscriber_id"
+		" AND (vlr_number IS NOT $number OR last_lu_seen IS NULL OR last_lu_seen <= $now - $granularity)",
+	[DB_STMT_UPD_SGSN_BY_ID] =
+		"UPDATE subscriber SET sgsn_number = $number, last_lu_seen = $now"
+		" WHERE id = $subscriber_id"
+		" AND (sgsn_number IS NOT $number OR last_lu_seen IS NULL OR last_lu_seen <= $now - $granularity)",
+	[DB_STMT_UPD_IMEI_BY_IMSI] = "UPDATE subscriber SET imei = $imei WHERE imsi_int = $imsi AND imei IS NOT $imei",
 	[DB_STMT_AUC_BY_IMSI] =
-		"SELECT id, algo_id_2g, ki, algo_id_3g, k, op, opc, sqn, ind_bitlen"
+		"SELECT id, algo_id_2g, ki, algo_id_3g, k, op, opc,"
+		" COALESCE(auc_3g_sqn.sqn, auc_3g.sqn), ind_bitlen"
 		" FROM subscriber"
 		" LEFT JOIN auc_2g ON auc_2g.subscriber_id = subscriber.id"
 		" LEFT JOIN auc_3g ON auc_3g.subscriber_id = subscriber.id"
-		" WHERE imsi = $imsi",
+		/* $node stays NULL and matches nothing unless the IND space is partitioned */
+		" LEFT JOIN auc_3g_sqn ON auc_3g_sqn.subscriber_id = subscriber.id AND auc_3g_sqn.node = $node"
+		" WHERE imsi_int = $imsi",
 	[DB_STMT_AUC_UPD_SQN] = "UPDATE auc_3g SET sqn = $sqn WHERE subscriber_id = $subscriber_id",
-	[DB_STMT_UPD_PURGE_CS_BY_IMSI] = "UPDATE subscriber SET ms_purged_cs = $val WHERE imsi = $imsi",
-	[DB_STMT_UPD_PURGE_PS_BY_IMSI] = "UPDATE subscriber SET ms_purged_ps = $val WHERE imsi = $imsi",
-	[DB_STMT_UPD_NAM_CS_BY_IMSI] = "UPDATE subscriber SET nam_cs = $val WHERE imsi = $imsi",
-	[DB_STMT_UPD_NAM_PS_BY_IMSI] = "UPDATE subscriber SET nam_ps = $val WHERE imsi = $imsi",
-	[DB_STMT_SUBSCR_CREATE] = "INSERT INTO subscriber (imsi) VALUES ($imsi)",
+	[DB_STMT_AUC_UPD_SQN_NODE] =
+		"INSERT OR REPLACE INTO auc_3g_sqn (subscriber_id, node, sqn)"
+		" SELECT subscriber_id, $node, $sqn FROM auc_3g WHERE subscriber_id = $subscriber_id",
+	[DB_STMT_UPD_PURGE_CS_BY_IMSI] = "UPDATE subscriber SET ms_purged_cs = $val WHERE imsi_int = $imsi",
+	[DB_STMT_UPD_PURGE_PS_BY_IMSI] = "UPDATE subscriber SET ms_purged_ps = $val WHERE imsi_int = $imsi",
+	[DB_STMT_UPD_NAM_CS_BY_IMSI] = "UPDATE subscriber SET nam_cs = $val WHERE imsi_int = $imsi AND nam_cs IS NOT $val",
+	[DB_STMT_UPD_NAM_PS_BY_IMSI] = "UPDATE subscriber SET nam_ps = $val WHERE imsi_int = $imsi AND nam_ps IS NOT $val",
+	[DB_STMT_SUBSCR_CREATE] = "INSERT INTO subscriber (imsi, imsi_int) VALUES ($imsi, $imsi_int)",
 	[DB_STMT_DEL_BY_ID] = "DELETE FROM subscriber WHERE id = $subscriber_id",
-	[DB_STMT_SET_MSISDN_BY_IMSI] = "UPDATE subscriber SET msisdn = $msisdn WHERE imsi = $imsi",
-	[DB_STMT_DELETE_MSISDN_BY_IMSI] = "UPDATE subscriber SET msisdn = NULL WHERE imsi = $imsi",
+	[DB_STMT_SET_MSISDN_BY_IMSI] = "UPDATE subscriber SET msisdn = $msisdn, msisdn_int = $msisdn_int WHERE imsi_int = $imsi",
+	[DB_STMT_DELETE_MSISDN_BY_IMSI] = "UPDATE subscriber SET msisdn = NULL, msisdn_int = NULL WHERE imsi_int = $imsi",
 	[DB_STMT_AUC_2G_INSERT] =
 		"INSERT INTO auc_2g (subscriber_id, algo_id_2g, ki)"
 		" VALUES($subscriber_id, $algo_id_2g, $ki)",
@@ -78,7 +131,14 @@ static const char *stmt_sql[] = {
 		"INSERT INTO auc_3g (subscriber_id, algo_id_3g, k, op, opc, ind_bitlen)"
 		" VALUES($subscriber_id, $algo_id_3g, $k, $op, $opc, $ind_bitlen)",
 	[DB_STMT_AUC_3G_DELETE] = "DELETE FROM auc_3g WHERE subscriber_id = $subscriber_id",
-	[DB_STMT_SET_LAST_LU_SEEN] = "UPDATE subscriber SET last_lu_seen = datetime($val, 'unixepoch') WHERE id = $subscriber_id",
+	[DB_STMT_EXISTS_BY_ID] = "SELECT 1 FROM subscriber WHERE id = ?",
+	[DB_STMT_EXISTS_BY_IMSI] = "SELECT 1 FROM subscriber WHERE imsi_int = ?",
+	[DB_STMT_CHANGE_LAST_SEQ] = "SELECT COALESCE(MAX(seq), 0) FROM subscriber_change",
+	[DB_STMT_CHANGE_SINCE] =
+		"SELECT seq, ts, subscriber_id, imsi, change, value FROM subscriber_change"
+		" WHERE seq > $seq ORDER BY seq LIMIT $max",
+	[DB_STMT_CHANGE_TRIM] = "DELETE FROM subscriber_change WHERE seq <= $seq",
+	[DB_STMT_SEL_ALL_IMSI] = "SELECT imsi FROM subscriber",
 };
 
 static void sql3_error_log_cb(void *arg, int err_code, const char *msg)
@@ -104,6 +164,176 @@ static void sql3_sql_log_cb(void *arg, sqlite3 *s3, const char *stmt, int type)
 	}
 }
 
+/* In enum stmt_idx order, the trace callback indexes it directly */
+static const struct value_string db_stmt_names[] = {
+	{ DB_STMT_SEL_BY_IMSI,		"SEL_BY_IMSI" },
+	{ DB_STMT_SEL_BY_MSISDN,	"SEL_BY_MSISDN" },
+	{ DB_STMT_SEL_BY_ID,		"SEL_BY_ID" },
+	{ DB_STMT_SEL_BY_IMEI,		"SEL_BY_IMEI" },
+	{ DB_STMT_UPD_VLR_BY_ID,	"UPD_VLR_BY_ID" },
+	{ DB_STMT_UPD_SGSN_BY_ID,	"UPD_SGSN_BY_ID" },
+	{ DB_STMT_UPD_IMEI_BY_IMSI,	"UPD_IMEI_BY_IMSI" },
+	{ DB_STMT_AUC_BY_IMSI,		"AUC_BY_IMSI" },
+	{ DB_STMT_AUC_UPD_SQN,		"AUC_UPD_SQN" },
+	{ DB_STMT_AUC_UPD_SQN_NODE,	"AUC_UPD_SQN_NODE" },
+	{ DB_STMT_UPD_PURGE_CS_BY_IMSI,	"UPD_PURGE_CS_BY_IMSI" },
+	{ DB_STMT_UPD_PURGE_PS_BY_IMSI,	"UPD_PURGE_PS_BY_IMSI" },
+	{ DB_STMT_UPD_NAM_PS_BY_IMSI,	"UPD_NAM_PS_BY_IMSI" },
+	{ DB_STMT_UPD_NAM_CS_BY_IMSI,	"UPD_NAM_CS_BY_IMSI" },
+	{ DB_STMT_SUBSCR_CREATE,	"SUBSCR_CREATE" },
+	{ DB_STMT_DEL_BY_ID,		"DEL_BY_ID" },
+	{ DB_STMT_SET_MSISDN_BY_IMSI,	"SET_MSISDN_BY_IMSI" },
+	{ DB_STMT_DELETE_MSISDN_BY_IMSI, "DELETE_MSISDN_BY_IMSI" },
+	{ DB_STMT_AUC_2G_INSERT,	"AUC_2G_INSERT" },
+	{ DB_STMT_AUC_2G_DELETE,	"AUC_2G_DELETE" },
+	{ DB_STMT_AUC_3G_INSERT,	"AUC_3G_INSERT" },
+	{ DB_STMT_AUC_3G_DELETE,	"AUC_3G_DELETE" },
+	{ DB_STMT_EXISTS_BY_ID,		"EXISTS_BY_ID" },
+	{ DB_STMT_EXISTS_BY_IMSI,	"EXISTS_BY_IMSI" },
+	{ DB_STMT_CHANGE_LAST_SEQ,	"CHANGE_LAST_SEQ" },
+	{ DB_STMT_CHANGE_SINCE,		"CHANGE_SINCE" },
+	{ DB_STMT_CHANGE_TRIM,		"CHANGE_TRIM" },
+	{ DB_STMT_SEL_ALL_IMSI,		"SEL_ALL_IMSI" },
+	{ DB_STMT_SEL_BY_MSISDN_TEXT,	"SEL_BY_MSISDN_TEXT" },
+	{ 0, NULL }
+};
+
+/*! Name of a prepared statement, without the DB_STMT_ prefix */
+const char *db_stmt_name(enum stmt_idx idx)
+{
+	return get_value_string(db_stmt_names, idx);
+}
+
+/*! Zero the counters of all prepared statements */
+void db_stmt_stats_reset(struct db_context *dbc)
+{
+	memset(dbc->stmt_stats.s, 0, sizeof(dbc->stmt_stats.s));
+}
+
+#define DB_STMT_HASH_MASK ((1 << DB_STMT_HASH_BITS) - 1)
+
+static unsigned int db_stmt_hash(const sqlite3_stmt *stmt)
+{
+	/* Fibonacci hashing of the pointer, whose lowest bits are always zero */
+	return ((uint32_t)((uintptr_t)stmt >> 4) * 2654435761U) >> (32 - DB_STMT_HASH_BITS);
+}
+
+static void db_stmt_hash_init(struct db_context *dbc)
+{
+	unsigned int i, h;
+
+	osmo_static_assert((1 << DB_STMT_HASH_BITS) >= 2 * _NUM_DB_STMT, db_stmt_hash_size);
+	memset(dbc->stmt_stats.by_ptr, 0, sizeof(dbc->stmt_stats.by_ptr));
+	for (i = 0; i < ARRAY_SIZE(dbc->stmt); i++) {
+		h = db_stmt_hash(dbc->stmt[i]);
+		while (dbc->stmt_stats.by_ptr[h])
+			h = (h + 1) & DB_STMT_HASH_MASK;
+		dbc->stmt_stats.by_ptr[h] = i + 1;
+	}
+}
+
+static int db_stmt_idx(const struct db_context *dbc, const sqlite3_stmt *stmt)
+{
+	unsigned int h, i;
+
+	for (h = db_stmt_hash(stmt); (i = dbc->stmt_stats.by_ptr[h]); h = (h + 1) & DB_STMT_HASH_MASK) {
+		if (dbc->stmt[i - 1] == stmt)
+			return i - 1;
+	}
+	/* not one of stmt_sql[], e.g. during schema upgrades */
+	return -1;
+}
+
+/* SQLite calls this when a statement starts and when it is done */
+static int db_sqlite_trace_cb(unsigned int type, void *data, void *p, void *x)
+{
+	struct db_context *dbc = data;
+	sqlite3_stmt *stmt = p;
+	struct db_stmt_stats *st;
+	struct timespec now, d;
+	uint64_t us;
+	int idx;
+
+	idx = db_stmt_idx(dbc, stmt);
+	if (idx < 0)
+		return 0;
+	st = &dbc->stmt_stats.s[idx];
+
+	switch (type) {
+	case SQLITE_TRACE_STMT:
+		/* also called when a trigger starts, with the trigger's name as "-- comment" */
+		if (!strncmp(x, "--", 2))
+			break;
+		osmo_clock_gettime(CLOCK_MONOTONIC, &dbc->stmt_stats.start[idx]);
+		dbc->stmt_stats.running = idx;
+		HLR_PROBE2(db_stmt_start, idx, db_stmt_names[idx].str);
+		break;
+	case SQLITE_TRACE_PROFILE:
+		osmo_clock_gettime(CLOCK_MONOTONIC, &now);
+		timespecsub(&now, &dbc->stmt_stats.start[idx], &d);
+		us = (uint64_t)d.tv_sec * 1000000 + d.tv_nsec / 1000;
+		st->count++;
+		st->total_us += us;
+		if (us > st->max_us)
+			st->max_us = us;
+		if (!sqlite3_stmt_readonly(stmt))
+			st->changes += sqlite3_changes(dbc->db);
+		if (dbc->stmt_stats.running == idx)
+			dbc->stmt_stats.running = -1;
+		HLR_PROBE3(db_stmt_done, idx, db_stmt_names[idx].str, us);
+		break;
+	}
+	return 0;
+}
+
+/*! Start or stop accounting each execution of a prepared statement, and firing the db_stmt_start and
+ * db_stmt_done probes. This installs an SQLite trace callback, which costs two clock readings per statement.
+ * \param[in,out] dbc  database context.
+ * \param[in] enable  true to start, false to stop; counters are kept either way.
+ * \returns 0 on success, -ENOTSUP if the storage backend keeps no statement stats, -EIO on SQLite error.
+ */
+int db_stmt_stats_enable(struct db_context *dbc, bool enable)
+{
+	int rc;
+
+	if (!dbc->db)
+		return -ENOTSUP;
+	if (enable == dbc->stmt_stats.enabled)
+		return 0;
+
+	dbc->stmt_stats.running = -1;
+	rc = sqlite3_trace_v2(dbc->db, enable ? SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE : 0,
+			      enable ? db_sqlite_trace_cb : NULL, dbc);
+	if (rc != SQLITE_OK) {
+		LOGP(DDB, LOGL_ERROR, "Unable to set SQLite3 trace callback, no statement stats: %s\n",
+		     sqlite3_errstr(rc));
+		return -EIO;
+	}
+	dbc->stmt_stats.enabled = enable;
+	return 0;
+}
+
+/* Like sqlite3_busy_timeout(), counting the waits */
+static int db_sqlite_busy_cb(void *data, int count)
+{
+	struct db_context *dbc = data;
+	struct db_stmt_stats *st = NULL;
+	unsigned int timeout_ms = dbc->readonly ? DB_READONLY_BUSY_TIMEOUT_MS : 0;
+
+	if (dbc->stmt_stats.running >= 0)
+		st = &dbc->stmt_stats.s[dbc->stmt_stats.running];
+
+	if ((count + 1) * DB_BUSY_RETRY_MS > timeout_ms) {
+		if (st)
+			st->busy_failed++;
+		return 0;
+	}
+	if (st)
+		st->busy_retries++;
+	sqlite3_sleep(DB_BUSY_RETRY_MS);
+	return 1;
+}
+
 /* remove bindings and reset statement to be re-executed */
 void db_remove_reset(sqlite3_stmt *stmt)
 {
@@ -179,7 +409,62 @@ bool db_bind_int64(sqlite3_stmt *stmt, const char *param_name, int64_t nr)
 	return true;
 }
 
-void db_close(struct db_context *dbc)
+/** Encode a string of up to DB_DIGITS_INT_MAX_LEN decimal digits as integer,
+ * for the imsi_int and msisdn_int columns. A '1' is prepended to the digits, so
+ * that leading zeros are preserved: "0123" becomes 10123, "123" becomes 1123.
+ * This must match the subscriber_digits_int_ins and subscriber_digits_int_upd
+ * triggers in sql/hlr.sql, and DIGITS_INT() in db_upgrade_v3().
+ * \param[in] digits  ASCII string of decimal digits.
+ * \param[out] val  The encoded value, if digits is valid.
+ * \returns true on success, false if digits is empty, too long or not all decimal digits.
+ */
+bool db_digits_to_int(const char *digits, int64_t *val)
+{
+	int64_t v = 1;
+	size_t len = 0;
+
+	if (!digits)
+		return false;
+	for (; *digits; digits++, len++) {
+		if (*digits < '0' || *digits > '9' || len >= DB_DIGITS_INT_MAX_LEN)
+			return false;
+		v = v * 10 + (*digits - '0');
+	}
+	if (!len)
+		return false;
+	*val = v;
+	return true;
+}
+
+/** bind a digit string arg encoded by db_digits_to_int() and do proper cleanup
+ * in case of failure. A string that cannot be encoded is bound as NULL, which
+ * matches no row. If param_name is NULL, bind to the first parameter. */
+bool db_bind_digits(sqlite3_stmt *stmt, const char *param_name, const char *digits)
+{
+	int64_t val;
+	int rc;
+	int idx;
+
+	if (db_digits_to_int(digits, &val))
+		return db_bind_int64(stmt, param_name, val);
+
+	idx = param_name ? sqlite3_bind_parameter_index(stmt, param_name) : 1;
+	if (idx < 1) {
+		LOGP(DDB, LOGL_ERROR, "Error composing SQL, cannot bind parameter '%s'\n",
+		     param_name);
+		return false;
+	}
+	rc = sqlite3_bind_null(stmt, idx);
+	if (rc != SQLITE_OK) {
+		LOGP(DDB, LOGL_ERROR, "Error binding NULL to SQL parameter %s: %d\n",
+		     param_name ? param_name : "#1", rc);
+		db_remove_reset(stmt);
+		return false;
+	}
+	return true;
+}
+
+static void db_sqlite_close(struct db_context *dbc)
 {
 	unsigned int i;
 	int rc;
@@ -195,7 +480,57 @@ void db_close(struct db_context *dbc)
 		LOGP(DDB, LOGL_ERROR, "Couldn't close database: (rc=%d) %s\n",
 			rc, sqlite3_errmsg(dbc->db));
 	}
+}
+
+void db_ctr_inc(struct db_context *dbc, enum db_ctr ctr)
+{
+	if (dbc->ctrs)
+		rate_ctr_inc(&dbc->ctrs->ctr[ctr]);
+}
+
+/* Called for each row the db_context's connection changes, also by triggers. The row may still be rolled back,
+ * so only schedule db_change_log_timer_cb(), which reads the newest seq after the transaction ended. */
+static void db_sqlite_update_hook(void *data, int op, const char *db_name, const char *table, sqlite3_int64 rowid)
+{
+	struct db_context *dbc = data;
+
+	if (op != SQLITE_INSERT || strcmp(table, "subscriber_change"))
+		return;
+	if (!osmo_timer_pending(&dbc->change_log.timer))
+		osmo_timer_schedule(&dbc->change_log.timer, 0, 0);
+}
+
+static void db_change_log_timer_cb(void *data)
+{
+	struct db_context *dbc = data;
+	struct timespec now;
+	int64_t last_seq;
+
+	if (db_change_last_seq(dbc, &last_seq))
+		return;
+	if (last_seq == dbc->change_log.last_seq)
+		return;
+	dbc->change_log.last_seq = last_seq;
+
+	/* A DELETE of a few rows per commit would cost about as much as the commit itself */
+	osmo_clock_gettime(CLOCK_MONOTONIC, &now);
+	if (dbc->change_log.keep && last_seq > dbc->change_log.keep
+	    && now.tv_sec - dbc->change_log.trim_time >= DB_CHANGE_LOG_TRIM_INTERVAL) {
+		db_change_trim(dbc, last_seq - dbc->change_log.keep);
+		dbc->change_log.trim_time = now.tv_sec;
+	}
+	if (dbc->change_log.notify_cb)
+		dbc->change_log.notify_cb(dbc, last_seq, dbc->change_log.notify_data);
+}
 
+void db_close(struct db_context *dbc)
+{
+	osmo_timer_del(&dbc->change_log.timer);
+	db_auc_workers_stop(dbc);
+	auc_image_close(dbc->auc_image);
+	dbc->ops->close(dbc);
+	if (dbc->ctrs)
+		rate_ctr_group_free(dbc->ctrs);
 	talloc_free(dbc);
 }
 
@@ -327,6 +662,151 @@ static int db_upgrade_v2(struct db_context *dbc)
 	return rc;
 }
 
+/* Run the statements of a multi-statement schema upgrade in order. The statements
+ * should start a transaction and end with setting the user_version and a COMMIT;
+ * on failure, the transaction is rolled back. Returns SQLITE_DONE on success. */
+static int db_upgrade_stmts(struct db_context *dbc, int to_version, const char **update_stmt_sql,
+			    unsigned int num_stmts)
+{
+	sqlite3_stmt *stmt;
+	unsigned int i;
+	int rc = SQLITE_DONE;
+
+	for (i = 0; i < num_stmts; i++) {
+		rc = sqlite3_prepare_v2(dbc->db, update_stmt_sql[i], -1, &stmt, NULL);
+		if (rc != SQLITE_OK) {
+			LOGP(DDB, LOGL_ERROR, "Unable to prepare SQL statement '%s'\n", update_stmt_sql[i]);
+			break;
+		}
+		rc = sqlite3_step(stmt);
+		db_remove_reset(stmt);
+		sqlite3_finalize(stmt);
+		if (rc != SQLITE_DONE) {
+			LOGP(DDB, LOGL_ERROR, "Unable to update HLR database schema to version %d\n", to_version);
+			break;
+		}
+	}
+
+	if (rc != SQLITE_DONE)
+		sqlite3_exec(dbc->db, "ROLLBACK", NULL, NULL, NULL);
+	return rc;
+}
+
+/* Add integer encoded IMSI and MSISDN columns (see db_digits_to_int()) with an
+ * index each, fill them for existing rows and keep them up to date for rows
+ * written by other tools than osmo-hlr. Same as in sql/hlr.sql. */
+static int db_upgrade_v3(struct db_context *dbc)
+{
+#define DIGITS_INT(col) \
+	"CASE WHEN " col " GLOB '[0-9]*' AND NOT " col " GLOB '*[^0-9]*' AND length(" col ") <= 18" \
+	" THEN CAST('1' || " col " AS INTEGER) END"
+#define UPDATE_DIGITS_INT \
+	" BEGIN UPDATE subscriber SET imsi_int = " DIGITS_INT("NEW.imsi") "," \
+	" msisdn_int = " DIGITS_INT("NEW.msisdn") " WHERE id = NEW.id; END"
+	const char *update_stmt_sql[] = {
+		"BEGIN TRANSACTION",
+		"ALTER TABLE subscriber ADD COLUMN imsi_int INTEGER default NULL",
+		"ALTER TABLE subscriber ADD COLUMN msisdn_int INTEGER default NULL",
+		"UPDATE subscriber SET imsi_int = " DIGITS_INT("imsi") ", msisdn_int = " DIGITS_INT("msisdn"),
+		"CREATE INDEX idx_subscr_imsi_int ON subscriber (imsi_int)",
+		"CREATE INDEX idx_subscr_msisdn_int ON subscriber (msisdn_int)",
+		"CREATE TRIGGER subscriber_digits_int_ins AFTER INSERT ON subscriber"
+			" WHEN NEW.imsi_int IS NULL" UPDATE_DIGITS_INT,
+		"CREATE TRIGGER subscriber_digits_int_upd AFTER UPDATE OF imsi, msisdn ON subscriber"
+			" WHEN NEW.imsi_int IS OLD.imsi_int AND NEW.msisdn_int IS OLD.msisdn_int" UPDATE_DIGITS_INT,
+		"PRAGMA user_version = 3",
+		"COMMIT",
+	};
+#undef UPDATE_DIGITS_INT
+#undef DIGITS_INT
+	return db_upgrade_stmts(dbc, 3, update_stmt_sql, ARRAY_SIZE(update_stmt_sql));
+}
+
+/* Convert last_lu_seen from datetime() text to seconds since the epoch, index it
+ * and provide the old text representation in the subscriber_compat view. Same as
+ * in sql/hlr.sql. */
+static int db_upgrade_v4(struct db_context *dbc)
+{
+	const char *update_stmt_sql[] = {
+		"BEGIN TRANSACTION",
+		"UPDATE subscriber SET last_lu_seen = CAST(strftime('%s', last_lu_seen) AS INTEGER)"
+			" WHERE typeof(last_lu_seen) = 'text'",
+		"CREATE INDEX idx_subscr_last_lu_seen ON subscriber (last_lu_seen)",
+		"CREATE VIEW subscriber_compat AS SELECT " SUBSCR_COMPAT_COLUMNS " FROM subscriber",
+		"PRAGMA user_version = 4",
+		"COMMIT",
+	};
+	return db_upgrade_stmts(dbc, 4, update_stmt_sql, ARRAY_SIZE(update_stmt_sql));
+}
+
+/* Add the auc_3g_sqn table, holding each cluster node's own SQN. Same as in sql/hlr.sql. */
+static int db_upgrade_v5(struct db_context *dbc)
+{
+	const char *update_stmt_sql[] = {
+		"BEGIN TRANSACTION",
+		"CREATE TABLE auc_3g_sqn ("
+			" subscriber_id INTEGER,"
+			" node INTEGER,"
+			" sqn INTEGER NOT NULL,"
+			" PRIMARY KEY (subscriber_id, node))",
+		"CREATE TRIGGER auc_3g_sqn_del AFTER DELETE ON auc_3g"
+			" BEGIN DELETE FROM auc_3g_sqn WHERE subscriber_id = OLD.subscriber_id; END",
+		"PRAGMA user_version = 5",
+		"COMMIT",
+	};
+	return db_upgrade_stmts(dbc, 5, update_stmt_sql, ARRAY_SIZE(update_stmt_sql));
+}
+
+#define CHANGE_INSERT(id, change, value) \
+	" BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change, value)" \
+	" VALUES (" id ", (SELECT imsi FROM subscriber WHERE id = " id "), '" change "', " value "); END"
+#define CHANGE_TRIGGER_SUBSCR_COL(name, col) \
+	"CREATE TRIGGER subscriber_change_" name " AFTER UPDATE OF " col " ON subscriber" \
+	" WHEN NEW." col " IS NOT OLD." col \
+	CHANGE_INSERT("NEW.id", col, "NEW." col)
+
+/* Add the subscriber_change log and the triggers filling it. Same as in sql/hlr.sql, except that the imsi is
+ * always looked up in the subscriber table, which makes no difference for the AFTER triggers. */
+static int db_upgrade_v6(struct db_context *dbc)
+{
+	const char *update_stmt_sql[] = {
+		"BEGIN TRANSACTION",
+		"CREATE TABLE subscriber_change ("
+			" seq INTEGER PRIMARY KEY AUTOINCREMENT,"
+			" ts INTEGER NOT NULL DEFAULT (CAST(strftime('%s', 'now') AS INTEGER)),"
+			" subscriber_id INTEGER NOT NULL,"
+			" imsi VARCHAR(15),"
+			" change VARCHAR(16) NOT NULL,"
+			" value VARCHAR)",
+		"CREATE TRIGGER subscriber_change_create AFTER INSERT ON subscriber"
+			CHANGE_INSERT("NEW.id", "create", "NULL"),
+		"CREATE TRIGGER subscriber_change_delete AFTER DELETE ON subscriber"
+			" BEGIN INSERT INTO subscriber_change (subscriber_id, imsi, change)"
+			" VALUES (OLD.id, OLD.imsi, 'delete'); END",
+		CHANGE_TRIGGER_SUBSCR_COL("msisdn", "msisdn"),
+		CHANGE_TRIGGER_SUBSCR_COL("imei", "imei"),
+		CHANGE_TRIGGER_SUBSCR_COL("vlr", "vlr_number"),
+		CHANGE_TRIGGER_SUBSCR_COL("sgsn", "sgsn_number"),
+		CHANGE_TRIGGER_SUBSCR_COL("nam_cs", "nam_cs"),
+		CHANGE_TRIGGER_SUBSCR_COL("nam_ps", "nam_ps"),
+		CHANGE_TRIGGER_SUBSCR_COL("purged_cs", "ms_purged_cs"),
+		CHANGE_TRIGGER_SUBSCR_COL("purged_ps", "ms_purged_ps"),
+		"CREATE TRIGGER subscriber_change_aud2g_ins AFTER INSERT ON auc_2g"
+			CHANGE_INSERT("NEW.subscriber_id", "aud2g", "NEW.algo_id_2g"),
+		"CREATE TRIGGER subscriber_change_aud2g_del AFTER DELETE ON auc_2g"
+			" WHEN EXISTS (SELECT 1 FROM subscriber WHERE id = OLD.subscriber_id)"
+			CHANGE_INSERT("OLD.subscriber_id", "aud2g", "NULL"),
+		"CREATE TRIGGER subscriber_change_aud3g_ins AFTER INSERT ON auc_3g"
+			CHANGE_INSERT("NEW.subscriber_id", "aud3g", "NEW.algo_id_3g"),
+		"CREATE TRIGGER subscriber_change_aud3g_del AFTER DELETE ON auc_3g"
+			" WHEN EXISTS (SELECT 1 FROM subscriber WHERE id = OLD.subscriber_id)"
+			CHANGE_INSERT("OLD.subscriber_id", "aud3g", "NULL"),
+		"PRAGMA user_version = 6",
+		"COMMIT",
+	};
+	return db_upgrade_stmts(dbc, 6, update_stmt_sql, ARRAY_SIZE(update_stmt_sql));
+}
+
 static int db_get_user_version(struct db_context *dbc)
 {
 	const char *user_version_sql = "PRAGMA user_version";
@@ -351,20 +831,19 @@ static int db_get_user_version(struct db_context *dbc)
 	return version;
 }
 
-struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logging, bool allow_upgrade)
+static int db_sqlite_open(struct db_context *dbc, bool enable_sqlite_logging, bool allow_upgrade)
 {
-	struct db_context *dbc = talloc_zero(ctx, struct db_context);
 	unsigned int i;
 	int rc;
 	bool has_sqlite_config_sqllog = false;
 	int version;
 
-	LOGP(DDB, LOGL_NOTICE, "using database: %s\n", fname);
+	dbc->stmt_stats.running = -1;
+
+	LOGP(DDB, LOGL_NOTICE, "using database: %s\n", dbc->fname);
 	LOGP(DDB, LOGL_INFO, "Compiled against SQLite3 lib version %s\n", SQLITE_VERSION);
 	LOGP(DDB, LOGL_INFO, "Running with SQLite3 lib version %s\n", sqlite3_libversion());
 
-	dbc->fname = talloc_strdup(dbc, fname);
-
 	for (i = 0; i < 0xfffff; i++) {
 		const char *o = sqlite3_compileoption_get(i);
 		if (!o)
@@ -388,11 +867,13 @@ struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logg
 			LOGP(DDB, LOGL_DEBUG, "Not setting SQL log callback:"
 			     " SQLite3 compiled without support for it\n");
 
-	rc = sqlite3_open(dbc->fname, &dbc->db);
+	if (dbc->readonly)
+		rc = sqlite3_open_v2(dbc->fname, &dbc->db, SQLITE_OPEN_READONLY, NULL);
+	else
+		rc = sqlite3_open(dbc->fname, &dbc->db);
 	if (rc != SQLITE_OK) {
 		LOGP(DDB, LOGL_ERROR, "Unable to open DB; rc = %d\n", rc);
-		talloc_free(dbc);
-		return NULL;
+		return -EIO;
 	}
 
 	/* enable extended result codes */
@@ -400,11 +881,19 @@ struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logg
 	if (rc != SQLITE_OK)
 		LOGP(DDB, LOGL_ERROR, "Unable to enable SQLite3 extended result codes\n");
 
-	char *err_msg;
-	rc = sqlite3_exec(dbc->db, "PRAGMA journal_mode=WAL; PRAGMA synchonous = NORMAL;", 0, 0, &err_msg);
+	/* A read-only connection sees each commit of the writing process from its next statement on. With the
+	 * writer in WAL mode (which is persistent in the file), neither blocks the other. */
+	if (!dbc->readonly) {
+		char *err_msg;
+		rc = sqlite3_exec(dbc->db, "PRAGMA journal_mode=WAL; PRAGMA synchonous = NORMAL;", 0, 0, &err_msg);
+		if (rc != SQLITE_OK)
+			LOGP(DDB, LOGL_ERROR, "Unable to set Write-Ahead Logging: %s\n",
+				err_msg);
+	}
+	/* only the read-only connection waits, see db_sqlite_busy_cb() */
+	rc = sqlite3_busy_handler(dbc->db, db_sqlite_busy_cb, dbc);
 	if (rc != SQLITE_OK)
-		LOGP(DDB, LOGL_ERROR, "Unable to set Write-Ahead Logging: %s\n",
-			err_msg);
+		LOGP(DDB, LOGL_ERROR, "Unable to set SQLite3 busy handler\n");
 
 	version = db_get_user_version(dbc);
 	if (version < 0) {
@@ -414,6 +903,10 @@ struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logg
 
 	/* An empty database will always report version zero. */
 	if (version == 0 && !db_is_bootstrapped_v0(dbc)) {
+		if (dbc->readonly) {
+			LOGP(DDB, LOGL_ERROR, "Database '%s' is empty, cannot bootstrap it read-only\n", dbc->fname);
+			goto out_free;
+		}
 		LOGP(DDB, LOGL_NOTICE, "Missing database tables detected; Bootstrapping database '%s'\n", dbc->fname);
 		rc = db_bootstrap(dbc);
 		if (rc != SQLITE_OK) {
@@ -426,7 +919,7 @@ struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logg
 
 	LOGP(DDB, LOGL_NOTICE, "Database '%s' has HLR DB schema version %d\n", dbc->fname, version);
 
-	if (version < CURRENT_SCHEMA_VERSION && allow_upgrade) {
+	if (version < CURRENT_SCHEMA_VERSION && allow_upgrade && !dbc->readonly) {
 		switch (version) {
 		case 0:
 			rc = db_upgrade_v1(dbc);
@@ -446,6 +939,42 @@ struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logg
 			}
 			version = 2;
 			/* fall through */
+		case 2:
+			rc = db_upgrade_v3(dbc);
+			if (rc != SQLITE_DONE) {
+				LOGP(DDB, LOGL_ERROR, "Failed to upgrade HLR DB schema to version 3: (rc=%d) %s\n",
+				     rc, sqlite3_errmsg(dbc->db));
+				goto out_free;
+			}
+			version = 3;
+			/* fall through */
+		case 3:
+			rc = db_upgrade_v4(dbc);
+			if (rc != SQLITE_DONE) {
+				LOGP(DDB, LOGL_ERROR, "Failed to upgrade HLR DB schema to version 4: (rc=%d) %s\n",
+				     rc, sqlite3_errmsg(dbc->db));
+				goto out_free;
+			}
+			version = 4;
+			/* fall through */
+		case 4:
+			rc = db_upgrade_v5(dbc);
+			if (rc != SQLITE_DONE) {
+				LOGP(DDB, LOGL_ERROR, "Failed to upgrade HLR DB schema to version 5: (rc=%d) %s\n",
+				     rc, sqlite3_errmsg(dbc->db));
+				goto out_free;
+			}
+			version = 5;
+			/* fall through */
+		case 5:
+			rc = db_upgrade_v6(dbc);
+			if (rc != SQLITE_DONE) {
+				LOGP(DDB, LOGL_ERROR, "Failed to upgrade HLR DB schema to version 6: (rc=%d) %s\n",
+				     rc, sqlite3_errmsg(dbc->db));
+				goto out_free;
+			}
+			version = 6;
+			/* fall through */
 		/* case N: ... */
 		default:
 			break;
@@ -478,8 +1007,89 @@ struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logg
 		}
 	}
 
-	return dbc;
+	if (!dbc->readonly)
+		sqlite3_update_hook(dbc->db, db_sqlite_update_hook, dbc);
+
+	db_stmt_hash_init(dbc);
+	return 0;
 out_free:
-	db_close(dbc);
-	return NULL;
+	db_sqlite_close(dbc);
+	return -EIO;
+}
+
+const struct db_ops db_sqlite_ops = {
+	.name = "SQLite",
+	.open = db_sqlite_open,
+	.close = db_sqlite_close,
+	.subscr_create = db_sqlite_subscr_create,
+	.subscr_delete_by_id = db_sqlite_subscr_delete_by_id,
+	.subscr_update_msisdn_by_imsi = db_sqlite_subscr_update_msisdn_by_imsi,
+	.subscr_update_aud_by_id = db_sqlite_subscr_update_aud_by_id,
+	.subscr_update_imei_by_imsi = db_sqlite_subscr_update_imei_by_imsi,
+	.subscr_get_by_imsi = db_sqlite_subscr_get_by_imsi,
+	.subscr_get_by_msisdn = db_sqlite_subscr_get_by_msisdn,
+	.subscr_get_by_id = db_sqlite_subscr_get_by_id,
+	.subscr_get_by_imei = db_sqlite_subscr_get_by_imei,
+	.subscr_nam = db_sqlite_subscr_nam,
+	.subscr_lu = db_sqlite_subscr_lu,
+	.subscr_purge = db_sqlite_subscr_purge,
+	.get_auth_data = db_sqlite_get_auth_data,
+	.update_sqn = db_sqlite_update_sqn,
+	.change_last_seq = db_sqlite_change_last_seq,
+	.change_since = db_sqlite_change_since,
+	.change_trim = db_sqlite_change_trim,
+	.subscr_imsi_iter = db_sqlite_subscr_imsi_iter,
+};
+
+/*! Open an HLR database.
+ * \param[in] ctx  talloc context to allocate the db_context from.
+ * \param[in] fname  Database file path; with a DB_LMDB_PREFIX, use the LMDB backend, otherwise SQLite.
+ * \param[in] enable_sqlite_logging  Install SQLite's error log callback.
+ * \param[in] allow_upgrade  Allow upgrading an outdated schema.
+ * \param[in] readonly  Open read-only; the database must exist with the current schema version.
+ * \returns new database context, or NULL on error.
+ */
+struct db_context *db_open2(void *ctx, const char *fname, bool enable_sqlite_logging, bool allow_upgrade,
+			    bool readonly)
+{
+	struct db_context *dbc = talloc_zero(ctx, struct db_context);
+	struct timespec now;
+	OSMO_ASSERT(dbc);
+
+	dbc->readonly = readonly;
+	dbc->change_log.keep = DB_CHANGE_LOG_KEEP_DEFAULT;
+	osmo_clock_gettime(CLOCK_MONOTONIC, &now);
+	dbc->change_log.trim_time = now.tv_sec;
+	osmo_timer_setup(&dbc->change_log.timer, db_change_log_timer_cb, dbc);
+	INIT_LLIST_HEAD(&dbc->sai_coalesce.recent);
+	INIT_LLIST_HEAD(&dbc->auc_async.busy);
+	INIT_LLIST_HEAD(&dbc->auc_async.waiting);
+
+	dbc->ops = &db_sqlite_ops;
+	if (!strncmp(fname, DB_LMDB_PREFIX, strlen(DB_LMDB_PREFIX))) {
+#ifdef HAVE_LMDB
+		dbc->ops = &db_lmdb_ops;
+		fname += strlen(DB_LMDB_PREFIX);
+#else
+		LOGP(DDB, LOGL_ERROR, "Cannot open '%s': osmo-hlr was built without LMDB support\n", fname);
+		talloc_free(dbc);
+		return NULL;
+#endif
+	}
+
+	dbc->fname = talloc_strdup(dbc, fname);
+
+	if (dbc->ops->open(dbc, enable_sqlite_logging, allow_upgrade)) {
+		talloc_free(dbc);
+		return NULL;
+	}
+
+	dbc->ctrs = rate_ctr_group_alloc(dbc, &db_ctrg_desc, 0);
+	return dbc;
+}
+
+/*! Open an HLR database for reading and writing, see db_open2(). */
+struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite_logging, bool allow_upgrade)
+{
+	return db_open2(ctx, fname, enable_sqlite_logging, allow_upgrade, false);
 }
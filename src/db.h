@@ -3,6 +3,8 @@
 #include <stdbool.h>
 #include <sqlite3.h>
 
+#include <osmocom/core/timer.h>
+
 struct hlr;
 
 enum stmt_idx {
@@ -15,6 +17,7 @@ enum stmt_idx {
 	DB_STMT_UPD_IMEI_BY_IMSI,
 	DB_STMT_AUC_BY_IMSI,
 	DB_STMT_AUC_UPD_SQN,
+	DB_STMT_AUC_UPD_SQN_NODE,
 	DB_STMT_UPD_PURGE_CS_BY_IMSI,
 	DB_STMT_UPD_PURGE_PS_BY_IMSI,
 	DB_STMT_UPD_NAM_PS_BY_IMSI,
@@ -27,22 +30,149 @@ enum stmt_idx {
 	DB_STMT_AUC_2G_DELETE,
 	DB_STMT_AUC_3G_INSERT,
 	DB_STMT_AUC_3G_DELETE,
-	DB_STMT_SET_LAST_LU_SEEN,
+	DB_STMT_EXISTS_BY_ID,
+	DB_STMT_EXISTS_BY_IMSI,
+	DB_STMT_CHANGE_LAST_SEQ,
+	DB_STMT_CHANGE_SINCE,
+	DB_STMT_CHANGE_TRIM,
+	DB_STMT_SEL_ALL_IMSI,
+	DB_STMT_SEL_BY_MSISDN_TEXT,
 	_NUM_DB_STMT
 };
 
+/* Slots of db_context.stmt_stats.by_ptr, a power of two of at least twice _NUM_DB_STMT */
+#define DB_STMT_HASH_BITS 6
+
+struct auc_image;
+struct imsi_filter;
+struct auc_pool;
+struct db_ops;
+
+/* Writes skipped because they would not have changed anything, see db_context.ctrs */
+enum db_ctr {
+	DB_CTR_LU_SUPPRESSED,
+	DB_CTR_IMEI_SUPPRESSED,
+	DB_CTR_NAM_SUPPRESSED,
+	DB_CTR_SAI_COALESCED,
+};
+
+/* Executions of one prepared statement, see db_context.stmt_stats */
+struct db_stmt_stats {
+	unsigned long count;
+	/* wall time from the first sqlite3_step() until the statement is done or reset */
+	uint64_t total_us;
+	uint64_t max_us;
+	/* rows changed by INSERT/UPDATE/DELETE */
+	uint64_t changes;
+	/* waits for another connection's lock, and how often it gave up waiting with SQLITE_BUSY */
+	unsigned long busy_retries;
+	unsigned long busy_failed;
+};
+
 struct db_context {
 	char *fname;
+	/* Storage backend, see struct db_ops. */
+	const struct db_ops *ops;
+	/* Backend specific state of non-SQLite backends. */
+	void *priv;
+	/* Opened read-only, e.g. as read replica of another osmo-hlr writing to the same file. */
+	bool readonly;
+	/* SQLite backend state */
 	sqlite3 *db;
 	sqlite3_stmt *stmt[_NUM_DB_STMT];
+	/* Accounting per prepared statement, by SQLite trace callbacks while enabled, see
+	 * db_stmt_stats_enable() */
+	struct {
+		bool enabled;
+		struct db_stmt_stats s[_NUM_DB_STMT];
+		struct timespec start[_NUM_DB_STMT];
+		/* statement that started last and is not done yet, to blame busy waits on; -1 for none */
+		int running;
+		/* index + 1 into stmt[] by hash of the sqlite3_stmt pointer, open addressing; 0 for an empty slot */
+		uint8_t by_ptr[1 << DB_STMT_HASH_BITS];
+	} stmt_stats;
+	/* If set, auth data and SQNs are served from this read-only image instead of the auc tables. */
+	struct auc_image *auc_image;
+	/* db_subscr_lu() refreshes last_lu_seen only when it is at least this many seconds old,
+	 * or when the VLR/SGSN number changes. 0 refreshes on every LU. */
+	unsigned int last_lu_seen_granularity;
+	/* enum db_ctr */
+	struct rate_ctr_group *ctrs;
+	/* When several HLR nodes generate vectors for the same subscribers, each node uses only every
+	 * num_nodes-th IND value, starting at node_id, and keeps its own SQN (see db_get_auc()).
+	 * num_nodes <= 1 means no partitioning. Set with db_ind_partition_set(). */
+	struct {
+		unsigned int node_id;
+		unsigned int num_nodes;
+	} ind_part;
+	/* The subscriber_change table, filled by triggers in the same transaction as each change */
+	struct {
+		/* Keep only this many of the newest changes, 0 to keep all */
+		unsigned int keep;
+		/* Newest change in the log, read from the database after each commit with new changes */
+		int64_t last_seq;
+		/* Trims the log and calls notify_cb once per main loop iteration with new changes, i.e.
+		 * after they were committed */
+		struct osmo_timer_list timer;
+		/* CLOCK_MONOTONIC seconds of the last trim or of db_open2(), see DB_CHANGE_LOG_TRIM_INTERVAL */
+		time_t trim_time;
+		void (*notify_cb)(struct db_context *dbc, int64_t last_seq, void *data);
+		void *notify_data;
+	} change_log;
+	/* A SEND_AUTH_INFO repeated for the same IMSI and IND within window_ms gets the vectors generated for
+	 * the first one instead of new ones, see db_get_auc(). window_ms == 0 generates new vectors each time. */
+	struct {
+		/* set with db_sai_coalesce_window_set() */
+		unsigned int window_ms;
+		/* struct db_sai_recent, oldest first */
+		struct llist_head recent;
+		/* the same, hashed by IMSI and IND; allocated with the first entry */
+		struct llist_head *buckets;
+	} sai_coalesce;
+	/* If set, IMSIs that are certainly not provisioned get -ENOENT from db_subscr_get_by_imsi() and
+	 * db_get_auth_data() without a lookup, see db_imsi_filter_enable(). */
+	struct imsi_filter *imsi_filter;
+	/* Auth vectors computed on worker threads, see db_get_auc_async() */
+	struct {
+		/* NULL when no worker threads are running */
+		struct auc_pool *pool;
+		/* struct db_auc_req */
+		struct llist_head busy;
+		struct llist_head waiting;
+		/* both of them, hashed by IMSI; allocated by db_auc_workers_start() */
+		struct llist_head *buckets;
+	} auc_async;
 };
 
+#define DB_CHANGE_LOG_KEEP_DEFAULT 100000
+/* Trim the change log at most this often, in seconds; it may exceed the 'keep' limit in between */
+#define DB_CHANGE_LOG_TRIM_INTERVAL 60
+
+static inline bool db_ind_partitioned(const struct db_context *dbc)
+{
+	return dbc->ind_part.num_nodes > 1;
+}
+
+/* A database path with this prefix selects the LMDB backend, e.g. "lmdb:/var/lib/osmocom/hlr.mdb". */
+#define DB_LMDB_PREFIX "lmdb:"
+
 void db_remove_reset(sqlite3_stmt *stmt);
 bool db_bind_text(sqlite3_stmt *stmt, const char *param_name, const char *text);
 bool db_bind_int(sqlite3_stmt *stmt, const char *param_name, int nr);
 bool db_bind_int64(sqlite3_stmt *stmt, const char *param_name, int64_t nr);
+bool db_bind_digits(sqlite3_stmt *stmt, const char *param_name, const char *digits);
+
+/* Longest digit string that db_digits_to_int() encodes; 1 followed by 18 digits fits an int64_t. */
+#define DB_DIGITS_INT_MAX_LEN 18
+bool db_digits_to_int(const char *digits, int64_t *val);
 void db_close(struct db_context *dbc);
+void db_ctr_inc(struct db_context *dbc, enum db_ctr ctr);
+const char *db_stmt_name(enum stmt_idx idx);
+int db_stmt_stats_enable(struct db_context *dbc, bool enable);
+void db_stmt_stats_reset(struct db_context *dbc);
 struct db_context *db_open(void *ctx, const char *fname, bool enable_sqlite3_logging, bool allow_upgrades);
+struct db_context *db_open2(void *ctx, const char *fname, bool enable_sqlite3_logging, bool allow_upgrades,
+			    bool readonly);
 
 #include <osmocom/crypt/auth.h>
 
@@ -59,6 +189,17 @@ int db_get_auc(struct db_context *dbc, const char *imsi,
 	       unsigned int auc_3g_ind, struct osmo_auth_vector *vec,
 	       unsigned int num_vec, const uint8_t *rand_auts,
 	       const uint8_t *auts);
+void db_sai_coalesce_window_set(struct db_context *dbc, unsigned int window_ms);
+int db_ind_partition_set(struct db_context *dbc, unsigned int node_id, unsigned int num_nodes);
+
+/* rc as returned by db_get_auc(), vec holds rc vectors */
+typedef void (*db_auc_cb_t)(struct db_context *dbc, const char *imsi, int rc, const struct osmo_auth_vector *vec,
+			    void *data);
+
+int db_get_auc_async(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind, unsigned int num_vec,
+		     const uint8_t *rand_auts, const uint8_t *auts, db_auc_cb_t cb, void *data);
+int db_auc_workers_start(struct db_context *dbc, unsigned int num_workers);
+void db_auc_workers_stop(struct db_context *dbc);
 
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/gsm/protocol/gsm_23_003.h>
@@ -90,11 +231,6 @@ struct hlr_subscriber {
 	time_t		last_lu_seen;
 };
 
-/* A format string for use with strptime(3). This format string is
- * used to parse the last_lu_seen column stored in the HLR database.
- * See https://sqlite.org/lang_datefunc.html, function datetime(). */
-#define DB_LAST_LU_SEEN_FMT "%Y-%m-%d %H:%M:%S"
-
 /* Like struct osmo_sub_auth_data, but the keys are in hexdump representation.
  * This is useful because SQLite requires them in hexdump format, and callers
  * like the VTY and CTRL interface also have them available as hexdump to begin
@@ -141,8 +277,79 @@ int db_subscr_lu(struct db_context *dbc, int64_t subscr_id,
 int db_subscr_purge(struct db_context *dbc, const char *by_imsi,
 		    bool purge_val, bool is_ps);
 
+/* One entry of the subscriber change log */
+struct db_change {
+	int64_t seq;
+	/* seconds since the epoch */
+	time_t ts;
+	int64_t subscr_id;
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	/* 'create', 'delete' or the changed column, e.g. 'msisdn', 'nam_cs', 'aud3g' */
+	char change[16];
+	/* new value, empty if there is none */
+	char value[64];
+};
+
+/* Return nonzero to stop iterating */
+typedef int (*db_change_cb_t)(const struct db_change *change, void *data);
+
+int db_change_last_seq(struct db_context *dbc, int64_t *seq);
+int db_change_since(struct db_context *dbc, int64_t seq, unsigned int max, db_change_cb_t cb, void *data);
+int db_change_trim(struct db_context *dbc, int64_t seq);
+
+/* Return nonzero to stop iterating */
+typedef int (*db_imsi_cb_t)(const char *imsi, void *data);
+
+int db_subscr_imsi_iter(struct db_context *dbc, db_imsi_cb_t cb, void *data);
+int db_imsi_filter_enable(struct db_context *dbc, unsigned int unknown_ttl);
+void db_imsi_filter_disable(struct db_context *dbc);
+
 int hlr_subscr_nam(struct hlr *hlr, struct hlr_subscriber *subscr, bool nam_val, bool is_ps);
 
+/*! Storage backend operations. The db_subscr_*(), db_get_auth_data() and db_update_sqn() API validates
+ * its arguments and then dispatches to these, so a backend only implements storage. Each operation has
+ * the same semantics and return values as the API function of the same name. */
+struct db_ops {
+	const char *name;
+	/*! Open dbc->fname, read-only if dbc->readonly is set; return 0 on success, negative on error. */
+	int (*open)(struct db_context *dbc, bool enable_logging, bool allow_upgrade);
+	void (*close)(struct db_context *dbc);
+
+	int (*subscr_create)(struct db_context *dbc, const char *imsi);
+	int (*subscr_delete_by_id)(struct db_context *dbc, int64_t subscr_id);
+	int (*subscr_update_msisdn_by_imsi)(struct db_context *dbc, const char *imsi, const char *msisdn);
+	int (*subscr_update_aud_by_id)(struct db_context *dbc, int64_t subscr_id,
+				       const struct sub_auth_data_str *aud);
+	int (*subscr_update_imei_by_imsi)(struct db_context *dbc, const char *imsi, const char *imei);
+
+	int (*subscr_get_by_imsi)(struct db_context *dbc, const char *imsi, struct hlr_subscriber *subscr);
+	int (*subscr_get_by_msisdn)(struct db_context *dbc, const char *msisdn, struct hlr_subscriber *subscr);
+	int (*subscr_get_by_id)(struct db_context *dbc, int64_t id, struct hlr_subscriber *subscr);
+	int (*subscr_get_by_imei)(struct db_context *dbc, const char *imei, struct hlr_subscriber *subscr);
+
+	int (*subscr_nam)(struct db_context *dbc, const char *imsi, bool nam_val, bool is_ps);
+	int (*subscr_lu)(struct db_context *dbc, int64_t subscr_id, const char *vlr_or_sgsn_number, bool is_ps);
+	int (*subscr_purge)(struct db_context *dbc, const char *by_imsi, bool purge_val, bool is_ps);
+
+	int (*get_auth_data)(struct db_context *dbc, const char *imsi,
+			     struct osmo_sub_auth_data *aud2g, struct osmo_sub_auth_data *aud3g,
+			     int64_t *subscr_id);
+	int (*update_sqn)(struct db_context *dbc, int64_t subscr_id, uint64_t new_sqn);
+
+	/* Subscriber change log, optional */
+	int (*change_last_seq)(struct db_context *dbc, int64_t *seq);
+	int (*change_since)(struct db_context *dbc, int64_t seq, unsigned int max, db_change_cb_t cb, void *data);
+	int (*change_trim)(struct db_context *dbc, int64_t seq);
+
+	/* Iterating all IMSIs, optional */
+	int (*subscr_imsi_iter)(struct db_context *dbc, db_imsi_cb_t cb, void *data);
+};
+
+extern const struct db_ops db_sqlite_ops;
+#ifdef HAVE_LMDB
+extern const struct db_ops db_lmdb_ops;
+#endif
+
 /*! Call sqlite3_column_text() and copy result to a char[].
  * \param[out] buf  A char[] used as sizeof() arg(!) and osmo_strlcpy() target.
  * \param[in] stmt  An sqlite3_stmt*.
@@ -22,27 +22,43 @@
 #include <errno.h>
 
 #include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
 #include <osmocom/crypt/auth.h>
+#include <osmocom/gsm/protocol/gsm_23_003.h>
 
 #include <sqlite3.h>
 
 #include "logging.h"
 #include "db.h"
+#include "db_sqlite.h"
 #include "auc.h"
 #include "rand.h"
+#include "auc_image.h"
+#include "imsi_filter.h"
+#include "auc_pool.h"
+#include "logring.h"
 
-#define LOGAUC(imsi, level, fmt, args ...)	LOGP(DAUC, level, "IMSI='%s': " fmt, imsi, ## args)
+#define LOGAUC(imsi, level, fmt, args ...)	LOGPR(DAUC, level, "IMSI='%s': " fmt, imsi, ## args)
 
 /* update the SQN for a given subscriber ID */
 int db_update_sqn(struct db_context *dbc, int64_t subscr_id, uint64_t new_sqn)
 {
-	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_AUC_UPD_SQN];
+	return dbc->ops->update_sqn(dbc, subscr_id, new_sqn);
+}
+
+int db_sqlite_update_sqn(struct db_context *dbc, int64_t subscr_id, uint64_t new_sqn)
+{
+	sqlite3_stmt *stmt = dbc->stmt[db_ind_partitioned(dbc) ? DB_STMT_AUC_UPD_SQN_NODE : DB_STMT_AUC_UPD_SQN];
 	int rc;
 	int ret = 0;
 
 	if (!db_bind_int64(stmt, "$sqn", new_sqn))
 		return -EIO;
 
+	if (db_ind_partitioned(dbc) && !db_bind_int(stmt, "$node", dbc->ind_part.node_id))
+		return -EIO;
+
 	if (!db_bind_int64(stmt, "$subscriber_id", subscr_id))
 		return -EIO;
 
@@ -81,6 +97,29 @@ int db_get_auth_data(struct db_context *dbc, const char *imsi,
 		     struct osmo_sub_auth_data *aud2g,
 		     struct osmo_sub_auth_data *aud3g,
 		     int64_t *subscr_id)
+{
+	int rc;
+
+	if (dbc->auc_image)
+		return auc_image_get_auth_data(dbc->auc_image, imsi, aud2g, aud3g, subscr_id, NULL);
+
+	if (dbc->imsi_filter && !imsi_filter_check(dbc->imsi_filter, imsi)) {
+		LOGP(DAUC, LOGL_DEBUG, "IMSI='%s': Unknown according to IMSI filter\n", imsi);
+		memset(aud2g, 0, sizeof(*aud2g));
+		memset(aud3g, 0, sizeof(*aud3g));
+		return -ENOENT;
+	}
+
+	rc = dbc->ops->get_auth_data(dbc, imsi, aud2g, aud3g, subscr_id);
+	if (rc == -ENOENT && dbc->imsi_filter)
+		imsi_filter_unknown_add(dbc->imsi_filter, imsi);
+	return rc;
+}
+
+int db_sqlite_get_auth_data(struct db_context *dbc, const char *imsi,
+			    struct osmo_sub_auth_data *aud2g,
+			    struct osmo_sub_auth_data *aud3g,
+			    int64_t *subscr_id)
 {
 	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_AUC_BY_IMSI];
 	int ret = 0;
@@ -89,7 +128,9 @@ int db_get_auth_data(struct db_context *dbc, const char *imsi,
 	memset(aud2g, 0, sizeof(*aud2g));
 	memset(aud3g, 0, sizeof(*aud3g));
 
-	if (!db_bind_text(stmt, "$imsi", imsi))
+	if (!db_bind_digits(stmt, "$imsi", imsi))
+		return -EIO;
+	if (db_ind_partitioned(dbc) && !db_bind_int(stmt, "$node", dbc->ind_part.node_id))
 		return -EIO;
 
 	/* execute the statement */
@@ -172,9 +213,277 @@ out:
 	return ret;
 }
 
+/* Vectors recently generated by db_get_auc(), in dbc->sai_coalesce.recent */
+struct db_sai_recent {
+	/* dbc->sai_coalesce.recent, oldest first */
+	struct llist_head list;
+	/* dbc->sai_coalesce.buckets[sai_recent_bucket()] */
+	struct llist_head bucket_list;
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	unsigned int auc_3g_ind;
+	/* num_vec the vectors were requested with */
+	unsigned int num_vec_req;
+	struct timespec expires;
+	unsigned int num_vec;
+	struct osmo_auth_vector *vec;
+};
+
+/* Number of hash buckets for dbc->sai_coalesce.recent, a power of two */
+#define SAI_RECENT_BUCKETS 1024
+
+/* FNV-1a, 32 bit, of the IMSI and IND */
+static struct llist_head *sai_recent_bucket(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind)
+{
+	uint32_t h = 0x811c9dc5;
+	unsigned int i;
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 0x01000193;
+	}
+	for (i = 0; i < sizeof(auc_3g_ind); i++) {
+		h ^= (uint8_t)(auc_3g_ind >> (i * 8));
+		h *= 0x01000193;
+	}
+	return &dbc->sai_coalesce.buckets[h & (SAI_RECENT_BUCKETS - 1)];
+}
+
+static bool sai_recent_expired(const struct db_sai_recent *r, const struct timespec *now)
+{
+	return !timespeccmp(now, &r->expires, <);
+}
+
+static void sai_recent_del(struct db_sai_recent *r)
+{
+	llist_del(&r->list);
+	llist_del(&r->bucket_list);
+	talloc_free(r);
+}
+
+/* Drop expired vectors. They are added with the same window, so they expire in the order they were added; only
+ * after the window is shortened, an entry may outlive a later one for a while. */
+static void sai_recent_expire(struct db_context *dbc, const struct timespec *now)
+{
+	struct db_sai_recent *r, *r2;
+
+	llist_for_each_entry_safe(r, r2, &dbc->sai_coalesce.recent, list) {
+		if (!sai_recent_expired(r, now))
+			break;
+		sai_recent_del(r);
+	}
+}
+
+/* Find the vectors generated for the same request within the coalescing window. A continuous stream of
+ * duplicates does not extend the window: once it expires, new vectors are made. */
+static struct db_sai_recent *sai_recent_find(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind,
+					     unsigned int num_vec, const struct timespec *now)
+{
+	struct db_sai_recent *r;
+	struct db_sai_recent *found = NULL;
+
+	if (!dbc->sai_coalesce.buckets)
+		return NULL;
+
+	/* Keep looking, the newest match wins */
+	llist_for_each_entry(r, sai_recent_bucket(dbc, imsi, auc_3g_ind), bucket_list) {
+		if (r->auc_3g_ind == auc_3g_ind && r->num_vec_req == num_vec && !strcmp(r->imsi, imsi)
+		    && !sai_recent_expired(r, now))
+			found = r;
+	}
+	return found;
+}
+
+static void sai_recent_drop(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind)
+{
+	struct db_sai_recent *r, *r2;
+
+	if (!dbc->sai_coalesce.buckets)
+		return;
+
+	llist_for_each_entry_safe(r, r2, sai_recent_bucket(dbc, imsi, auc_3g_ind), bucket_list) {
+		if (r->auc_3g_ind == auc_3g_ind && !strcmp(r->imsi, imsi))
+			sai_recent_del(r);
+	}
+}
+
+static void sai_recent_add(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind,
+			   unsigned int num_vec_req, const struct osmo_auth_vector *vec, unsigned int num_vec,
+			   const struct timespec *now)
+{
+	struct db_sai_recent *r;
+	struct timespec window = {
+		.tv_sec = dbc->sai_coalesce.window_ms / 1000,
+		.tv_nsec = (dbc->sai_coalesce.window_ms % 1000) * 1000000,
+	};
+	unsigned int i;
+
+	if (strlen(imsi) >= sizeof(r->imsi))
+		return;
+
+	if (!dbc->sai_coalesce.buckets) {
+		dbc->sai_coalesce.buckets = talloc_array(dbc, struct llist_head, SAI_RECENT_BUCKETS);
+		OSMO_ASSERT(dbc->sai_coalesce.buckets);
+		for (i = 0; i < SAI_RECENT_BUCKETS; i++)
+			INIT_LLIST_HEAD(&dbc->sai_coalesce.buckets[i]);
+	}
+
+	r = talloc_zero(dbc, struct db_sai_recent);
+	OSMO_ASSERT(r);
+	OSMO_STRLCPY_ARRAY(r->imsi, imsi);
+	r->auc_3g_ind = auc_3g_ind;
+	r->num_vec_req = num_vec_req;
+	timespecadd(now, &window, &r->expires);
+	r->num_vec = num_vec;
+	r->vec = talloc_memdup(r, vec, num_vec * sizeof(*vec));
+	OSMO_ASSERT(r->vec);
+	llist_add_tail(&r->list, &dbc->sai_coalesce.recent);
+	llist_add_tail(&r->bucket_list, sai_recent_bucket(dbc, imsi, auc_3g_ind));
+}
+
+/*! Set the window in which a repeated Send Auth Info request gets the same vectors, see db_get_auc().
+ * \param[in,out] dbc  database context.
+ * \param[in] window_ms  Window in milliseconds, 0 to always generate new vectors and free all remembered ones.
+ */
+void db_sai_coalesce_window_set(struct db_context *dbc, unsigned int window_ms)
+{
+	struct db_sai_recent *r, *r2;
+
+	dbc->sai_coalesce.window_ms = window_ms;
+	if (window_ms)
+		return;
+
+	llist_for_each_entry_safe(r, r2, &dbc->sai_coalesce.recent, list)
+		sai_recent_del(r);
+	talloc_free(dbc->sai_coalesce.buckets);
+	dbc->sai_coalesce.buckets = NULL;
+}
+
+/*! Partition the UMTS SQN IND values between HLR cluster nodes, see auc_fetch().
+ * \param[in,out] dbc  database context.
+ * \param[in] node_id  This node's id, 0 .. num_nodes - 1.
+ * \param[in] num_nodes  Number of HLR nodes sharing the subscribers, 0 or 1 to not partition.
+ * \returns 0 on success, -EINVAL if node_id does not fit num_nodes.
+ */
+int db_ind_partition_set(struct db_context *dbc, unsigned int node_id, unsigned int num_nodes)
+{
+	if (node_id >= OSMO_MAX(num_nodes, 1))
+		return -EINVAL;
+	dbc->ind_part.node_id = node_id;
+	dbc->ind_part.num_nodes = num_nodes;
+	return 0;
+}
+
+/* If a recent request was the same, copy its vectors to vec and return their number, otherwise return 0. Also
+ * set *now for sai_recent_add(). */
+static int sai_coalesced(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind,
+			 struct osmo_auth_vector *vec, unsigned int num_vec, const uint8_t *auts,
+			 struct timespec *now)
+{
+	struct db_sai_recent *r;
+
+	if (!dbc->sai_coalesce.window_ms)
+		return 0;
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, now);
+	sai_recent_expire(dbc, now);
+	if (auts) {
+		/* The USIM rejected the vectors we handed out, don't hand them out again */
+		sai_recent_drop(dbc, imsi, auc_3g_ind);
+		return 0;
+	}
+
+	r = sai_recent_find(dbc, imsi, auc_3g_ind, num_vec, now);
+	if (!r)
+		return 0;
+	LOGAUC(imsi, LOGL_INFO, "Returning the %u vectors generated for the same request"
+	       " less than %u ms ago\n", r->num_vec, dbc->sai_coalesce.window_ms);
+	memcpy(vec, r->vec, r->num_vec * sizeof(*vec));
+	db_ctr_inc(dbc, DB_CTR_SAI_COALESCED);
+	return r->num_vec;
+}
+
+/* Fetch the auth data to generate vectors from, and set the IND to use. Same return values as
+ * db_get_auth_data(), or -1 if the IND does not fit. */
+static int auc_fetch(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind,
+		     struct osmo_sub_auth_data *aud2g, struct osmo_sub_auth_data *aud3g,
+		     int64_t *subscr_id, uint32_t *image_idx)
+{
+	int rc;
+
+	*image_idx = 0;
+	if (dbc->auc_image)
+		rc = auc_image_get_auth_data(dbc->auc_image, imsi, aud2g, aud3g, subscr_id, image_idx);
+	else
+		rc = db_get_auth_data(dbc, imsi, aud2g, aud3g, subscr_id);
+	if (rc)
+		return rc;
+
+	if (aud3g->type == OSMO_AUTH_TYPE_UMTS && db_ind_partitioned(dbc)) {
+		/* Use only this node's IND values: node_id, node_id + num_nodes, node_id + 2 * num_nodes...
+		 * Each IND has its own SEQ on the USIM, so nodes never reuse each other's SQNs. */
+		unsigned int slots = (1U << aud3g->u.umts.ind_bitlen) / dbc->ind_part.num_nodes;
+		if (!slots) {
+			LOGAUC(imsi, LOGL_ERROR, "3G auth: SQN's IND bitlen %u is too small to partition"
+			       " between %u HLR nodes\n", aud3g->u.umts.ind_bitlen, dbc->ind_part.num_nodes);
+			return -1;
+		}
+		if (auc_3g_ind >= slots) {
+			LOGAUC(imsi, LOGL_NOTICE, "3G auth: SQN's IND bitlen %u leaves %u IND values per HLR node,"
+			       " too few to hold an index of %u. Wrapping. This may cause numerous additional"
+			       " AUTS resyncing.\n", aud3g->u.umts.ind_bitlen, slots, auc_3g_ind);
+			auc_3g_ind %= slots;
+		}
+		auc_3g_ind = auc_3g_ind * dbc->ind_part.num_nodes + dbc->ind_part.node_id;
+	}
+
+	aud3g->u.umts.ind = auc_3g_ind;
+	if (aud3g->type == OSMO_AUTH_TYPE_UMTS
+	    && aud3g->u.umts.ind >= (1U << aud3g->u.umts.ind_bitlen)) {
+		LOGAUC(imsi, LOGL_NOTICE, "3G auth: SQN's IND bitlen %u is"
+		       " too small to hold an index of %u. Truncating. This"
+		       " may cause numerous additional AUTS resyncing.\n",
+		       aud3g->u.umts.ind_bitlen, aud3g->u.umts.ind);
+		aud3g->u.umts.ind &= (1U << aud3g->u.umts.ind_bitlen) - 1;
+	}
+	return 0;
+}
+
+/* Whether auc_store_sqn() can store the SQN for aud3g. An AUC image keeps the SQNs in its own file, so a read
+ * replica that loaded one can answer UMTS AKA itself. */
+static bool auc_sqn_writable(const struct db_context *dbc, const struct osmo_sub_auth_data *aud3g)
+{
+	return !dbc->readonly || !aud3g->algo || dbc->auc_image;
+}
+
+/* Store the SQN auc_compute_vectors() advanced aud3g to; return 0 on success */
+static int auc_store_sqn(struct db_context *dbc, const char *imsi, const struct osmo_sub_auth_data *aud3g,
+			 int64_t subscr_id, uint32_t image_idx)
+{
+	int rc;
+
+	if (!aud3g->algo)
+		return 0;
+
+	LOGAUC(imsi, LOGL_DEBUG, "Updating SQN=%" PRIu64 " in DB\n",
+	       aud3g->u.umts.sqn);
+	if (dbc->auc_image)
+		rc = auc_image_update_sqn(dbc->auc_image, image_idx, aud3g->u.umts.sqn);
+	else
+		rc = db_update_sqn(dbc, subscr_id, aud3g->u.umts.sqn);
+	if (rc < 0) {
+		LOGAUC(imsi, LOGL_ERROR, "Error updating SQN: %d\n", rc);
+		return rc;
+	}
+	return 0;
+}
+
 /* return number of vectors generated, negative value on error:
  * -ENOENT if the IMSI is not known, -ENOKEY if the IMSI is known but has no auth data,
- * -EIO on db failure */
+ * -EROFS if the database is read-only, no AUC image is loaded and UMTS AKA would have to store a new SQN, -EIO on
+ * db failure.
+ * A retransmitted request, or the same IMSI asking again on the same IND within dbc->sai_coalesce.window_ms,
+ * gets the vectors generated for the first request, so that the duplicate neither costs another computation
+ * nor uses up more SQNs. A resync (auts != NULL) always generates new vectors. */
 int db_get_auc(struct db_context *dbc, const char *imsi,
 	       unsigned int auc_3g_ind, struct osmo_auth_vector *vec,
 	       unsigned int num_vec, const uint8_t *rand_auts,
@@ -182,22 +491,21 @@ int db_get_auc(struct db_context *dbc, const char *imsi,
 {
 	struct osmo_sub_auth_data aud2g, aud3g;
 	int64_t subscr_id;
+	uint32_t image_idx;
+	unsigned int num_vec_req = num_vec;
+	struct timespec now = {};
 	int ret = 0;
 	int rc;
 
-	rc = db_get_auth_data(dbc, imsi, &aud2g, &aud3g, &subscr_id);
+	rc = sai_coalesced(dbc, imsi, auc_3g_ind, vec, num_vec, auts, &now);
 	if (rc)
 		return rc;
 
-	aud3g.u.umts.ind = auc_3g_ind;
-	if (aud3g.type == OSMO_AUTH_TYPE_UMTS
-	    && aud3g.u.umts.ind >= (1U << aud3g.u.umts.ind_bitlen)) {
-		LOGAUC(imsi, LOGL_NOTICE, "3G auth: SQN's IND bitlen %u is"
-		       " too small to hold an index of %u. Truncating. This"
-		       " may cause numerous additional AUTS resyncing.\n",
-		       aud3g.u.umts.ind_bitlen, aud3g.u.umts.ind);
-		aud3g.u.umts.ind &= (1U << aud3g.u.umts.ind_bitlen) - 1;
-	}
+	rc = auc_fetch(dbc, imsi, auc_3g_ind, &aud2g, &aud3g, &subscr_id, &image_idx);
+	if (rc)
+		return rc;
+	if (!auc_sqn_writable(dbc, &aud3g))
+		return -EROFS;
 
 	LOGAUC(imsi, LOGL_DEBUG, "Calling to generate %u vectors\n", num_vec);
 	rc = auc_compute_vectors(vec, num_vec, &aud2g, &aud3g, rand_auts, auts);
@@ -210,19 +518,229 @@ int db_get_auc(struct db_context *dbc, const char *imsi,
 	}
 	LOGAUC(imsi, LOGL_INFO, "Generated %u vectors\n", num_vec);
 
-	/* Update SQN in database, as needed */
-	if (aud3g.algo) {
-		LOGAUC(imsi, LOGL_DEBUG, "Updating SQN=%" PRIu64 " in DB\n",
-		       aud3g.u.umts.sqn);
-		rc = db_update_sqn(dbc, subscr_id, aud3g.u.umts.sqn);
-		/* don't tell caller we generated any triplets in case of
-		 * update error */
-		if (rc < 0) {
-			LOGAUC(imsi, LOGL_ERROR, "Error updating SQN: %d\n", rc);
-			num_vec = 0;
-			ret = -1;
-		}
+	/* Update SQN in database, as needed. Don't tell caller we generated any triplets in case of update
+	 * error */
+	if (auc_store_sqn(dbc, imsi, &aud3g, subscr_id, image_idx) < 0) {
+		num_vec = 0;
+		ret = -1;
 	}
 
+	if (ret > 0 && !auts && dbc->sai_coalesce.window_ms)
+		sai_recent_add(dbc, imsi, auc_3g_ind, num_vec_req, vec, num_vec, &now);
+
 	return ret;
 }
+
+/* A db_get_auc_async() request, in dbc->auc_async.busy while its vectors are computed, or in
+ * dbc->auc_async.waiting while another request for the same IMSI is busy */
+struct db_auc_req {
+	struct llist_head list;
+	/* dbc->auc_async.buckets[auc_req_bucket()], in the order the requests arrived */
+	struct llist_head bucket_list;
+	struct db_context *dbc;
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	unsigned int auc_3g_ind;
+	unsigned int num_vec;
+	bool resync;
+	uint8_t rand_auts[16];
+	uint8_t auts[14];
+	db_auc_cb_t cb;
+	void *data;
+
+	int64_t subscr_id;
+	uint32_t image_idx;
+	struct timespec now;
+};
+
+/* Number of hash buckets for dbc->auc_async.busy and waiting, a power of two */
+#define AUC_REQ_BUCKETS 256
+
+/* FNV-1a, 32 bit, of the IMSI */
+static struct llist_head *auc_req_bucket(struct db_context *dbc, const char *imsi)
+{
+	uint32_t h = 0x811c9dc5;
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 0x01000193;
+	}
+	return &dbc->auc_async.buckets[h & (AUC_REQ_BUCKETS - 1)];
+}
+
+static bool auc_req_start(struct db_auc_req *req);
+
+/* Return the oldest pending request for the IMSI, busy or waiting */
+static struct db_auc_req *auc_req_find(struct db_context *dbc, const char *imsi)
+{
+	struct db_auc_req *req;
+	llist_for_each_entry(req, auc_req_bucket(dbc, imsi), bucket_list) {
+		if (!strcmp(req->imsi, imsi))
+			return req;
+	}
+	return NULL;
+}
+
+static void auc_req_finish(struct db_auc_req *req, int rc, const struct osmo_auth_vector *vec)
+{
+	llist_del(&req->list);
+	llist_del(&req->bucket_list);
+	req->cb(req->dbc, req->imsi, rc, vec, req->data);
+	talloc_free(req);
+}
+
+/* Main thread, called by the auc_pool */
+static void auc_job_done(struct auc_job *job)
+{
+	struct db_auc_req *req = job->data;
+	struct db_context *dbc = req->dbc;
+	struct db_auc_req *next;
+	char imsi[sizeof(req->imsi)];
+	int ret = job->rc;
+
+	if (job->rc < (int)job->num_vec)
+		LOGAUC(req->imsi, LOGL_ERROR, "Error computing vectors, got %d of %u\n", job->rc, job->num_vec);
+	if (ret < 0)
+		ret = -1;
+	LOGAUC(req->imsi, LOGL_INFO, "Generated %d vectors\n", OSMO_MAX(ret, 0));
+
+	if (auc_store_sqn(dbc, req->imsi, &job->aud3g, req->subscr_id, req->image_idx) < 0)
+		ret = -1;
+
+	if (ret > 0 && !req->resync && dbc->sai_coalesce.window_ms)
+		sai_recent_add(dbc, req->imsi, req->auc_3g_ind, req->num_vec, job->vec, ret, &req->now);
+
+	OSMO_STRLCPY_ARRAY(imsi, req->imsi);
+	auc_req_finish(req, ret, job->vec);
+	talloc_free(job);
+
+	/* Now that the SQN is stored, start the next request for the same IMSI, which may well be answered
+	 * right away from the vectors just generated. The cb may have stopped the workers. */
+	while (dbc->auc_async.pool && (next = auc_req_find(dbc, imsi))) {
+		if (auc_req_start(next))
+			break;
+	}
+}
+
+/* Return true if the request was submitted to a worker, false if it was answered right away */
+static bool auc_req_start(struct db_auc_req *req)
+{
+	struct db_context *dbc = req->dbc;
+	struct auc_job *job = auc_job_alloc(dbc->auc_async.pool, req->num_vec);
+	int rc;
+
+	rc = sai_coalesced(dbc, req->imsi, req->auc_3g_ind, job->vec, req->num_vec,
+			   req->resync ? req->auts : NULL, &req->now);
+	if (rc) {
+		auc_req_finish(req, rc, job->vec);
+		talloc_free(job);
+		return false;
+	}
+
+	rc = auc_fetch(dbc, req->imsi, req->auc_3g_ind, &job->aud2g, &job->aud3g, &req->subscr_id, &req->image_idx);
+	if (!rc && !auc_sqn_writable(dbc, &job->aud3g))
+		rc = -EROFS;
+	if (rc) {
+		talloc_free(job);
+		auc_req_finish(req, rc, NULL);
+		return false;
+	}
+
+	job->resync = req->resync;
+	memcpy(job->rand_auts, req->rand_auts, sizeof(job->rand_auts));
+	memcpy(job->auts, req->auts, sizeof(job->auts));
+	job->done_cb = auc_job_done;
+	job->data = req;
+	LOGAUC(req->imsi, LOGL_DEBUG, "Handing %u vectors to a worker\n", req->num_vec);
+	llist_move_tail(&req->list, &dbc->auc_async.busy);
+	auc_job_submit(job);
+	return true;
+}
+
+/*! Like db_get_auc(), but compute the vectors on the worker threads started by db_auc_workers_start().
+ * Requests for the same IMSI are handled one after the other, in the order they arrive, so that each one
+ * continues from the SQN the previous one stored.
+ * \param[in,out] dbc  database context.
+ * \param[in] cb  called with the return value db_get_auc() would have, and the vectors, from the main loop.
+ *                May be called before db_get_auc_async() returns. Called with -ECANCELED by
+ *                db_auc_workers_stop() if the request was still pending.
+ * \param[in] data  passed on to cb.
+ * \returns 0 if cb will be called, -ENOTSUP if no worker threads are running.
+ */
+int db_get_auc_async(struct db_context *dbc, const char *imsi, unsigned int auc_3g_ind, unsigned int num_vec,
+		     const uint8_t *rand_auts, const uint8_t *auts, db_auc_cb_t cb, void *data)
+{
+	struct db_auc_req *req;
+
+	if (!dbc->auc_async.pool)
+		return -ENOTSUP;
+
+	req = talloc_zero(dbc, struct db_auc_req);
+	OSMO_ASSERT(req);
+	*req = (struct db_auc_req){
+		.dbc = dbc,
+		.auc_3g_ind = auc_3g_ind,
+		.num_vec = num_vec,
+		.resync = auts && rand_auts,
+		.cb = cb,
+		.data = data,
+	};
+	OSMO_STRLCPY_ARRAY(req->imsi, imsi);
+	if (req->resync) {
+		memcpy(req->rand_auts, rand_auts, sizeof(req->rand_auts));
+		memcpy(req->auts, auts, sizeof(req->auts));
+	}
+
+	llist_add_tail(&req->bucket_list, auc_req_bucket(dbc, imsi));
+	if (auc_req_find(dbc, imsi) != req) {
+		LOGAUC(imsi, LOGL_DEBUG, "Waiting for the previous request of this IMSI\n");
+		llist_add_tail(&req->list, &dbc->auc_async.waiting);
+		return 0;
+	}
+
+	llist_add_tail(&req->list, &dbc->auc_async.busy);
+	auc_req_start(req);
+	return 0;
+}
+
+/*! Compute auth vectors requested via db_get_auc_async() on worker threads.
+ * \param[in,out] dbc  database context.
+ * \param[in] num_workers  number of threads.
+ * \returns 0 on success, -EBUSY if already started, -EIO if the threads cannot be started.
+ */
+int db_auc_workers_start(struct db_context *dbc, unsigned int num_workers)
+{
+	unsigned int i;
+
+	if (dbc->auc_async.pool)
+		return -EBUSY;
+	dbc->auc_async.pool = auc_pool_alloc(dbc, num_workers);
+	if (!dbc->auc_async.pool)
+		return -EIO;
+
+	dbc->auc_async.buckets = talloc_array(dbc, struct llist_head, AUC_REQ_BUCKETS);
+	OSMO_ASSERT(dbc->auc_async.buckets);
+	for (i = 0; i < AUC_REQ_BUCKETS; i++)
+		INIT_LLIST_HEAD(&dbc->auc_async.buckets[i]);
+	return 0;
+}
+
+/*! Stop the worker threads; the cb of each request still pending is called with -ECANCELED, busy ones first,
+ * each in the order they arrived. */
+void db_auc_workers_stop(struct db_context *dbc)
+{
+	struct db_auc_req *req;
+
+	if (!dbc->auc_async.pool)
+		return;
+
+	auc_pool_free(dbc->auc_async.pool);
+	dbc->auc_async.pool = NULL;
+
+	while ((req = llist_first_entry_or_null(&dbc->auc_async.busy, struct db_auc_req, list)))
+		auc_req_finish(req, -ECANCELED, NULL);
+	while ((req = llist_first_entry_or_null(&dbc->auc_async.waiting, struct db_auc_req, list)))
+		auc_req_finish(req, -ECANCELED, NULL);
+
+	talloc_free(dbc->auc_async.buckets);
+	dbc->auc_async.buckets = NULL;
+}
@@ -17,17 +17,13 @@
  *
  */
 
-#define _POSIX_C_SOURCE 200809L /* for strptime(3) */
-/* These are needed as well due to the above _POSIX_C_SOURCE definition: */
-#define _DEFAULT_SOURCE		/* for struct timezone */
-#define _XOPEN_SOURCE		/* for clockid_t */
-
 #include <string.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <time.h>
 
 #include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
 #include <osmocom/crypt/auth.h>
 #include <osmocom/gsm/gsm23003.h>
 
@@ -36,11 +32,47 @@
 #include "logging.h"
 #include "hlr.h"
 #include "db.h"
+#include "db_sqlite.h"
 #include "gsup_server.h"
 #include "luop.h"
+#include "imsi_filter.h"
 
 #define LOGHLR(imsi, level, fmt, args ...)	LOGP(DAUC, level, "IMSI='%s': " fmt, imsi, ## args)
 
+/* Step a DB_STMT_EXISTS_BY_* statement with its parameter bound. */
+static int db_sqlite_exists(struct db_context *dbc, sqlite3_stmt *stmt)
+{
+	int rc = sqlite3_step(stmt);
+	db_remove_reset(stmt);
+	switch (rc) {
+	case SQLITE_ROW:
+		return 0;
+	case SQLITE_DONE:
+		return -ENOENT;
+	default:
+		LOGP(DAUC, LOGL_ERROR, "Cannot look up subscriber: SQL error: (%d) %s\n", rc, sqlite3_errmsg(dbc->db));
+		return -EIO;
+	}
+}
+
+/* For a conditional UPDATE that modified no rows: return 0 if the subscriber exists, i.e. the write was
+ * suppressed because it would not have changed anything, or -ENOENT if there is no such subscriber. */
+static int db_sqlite_exists_by_id(struct db_context *dbc, int64_t subscr_id)
+{
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_EXISTS_BY_ID];
+	if (!db_bind_int64(stmt, NULL, subscr_id))
+		return -EIO;
+	return db_sqlite_exists(dbc, stmt);
+}
+
+static int db_sqlite_exists_by_imsi(struct db_context *dbc, const char *imsi)
+{
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_EXISTS_BY_IMSI];
+	if (!db_bind_digits(stmt, NULL, imsi))
+		return -EIO;
+	return db_sqlite_exists(dbc, stmt);
+}
+
 /*! Add new subscriber record to the HLR database.
  * \param[in,out] dbc  database context.
  * \param[in] imsi  ASCII string of IMSI digits, is validated.
@@ -48,7 +80,6 @@
  */
 int db_subscr_create(struct db_context *dbc, const char *imsi)
 {
-	sqlite3_stmt *stmt;
 	int rc;
 
 	if (!osmo_imsi_str_valid(imsi)) {
@@ -57,10 +88,21 @@ int db_subscr_create(struct db_context *dbc, const char *imsi)
 		return -EINVAL;
 	}
 
-	stmt = dbc->stmt[DB_STMT_SUBSCR_CREATE];
+	rc = dbc->ops->subscr_create(dbc, imsi);
+	if (!rc && dbc->imsi_filter)
+		imsi_filter_add(dbc->imsi_filter, imsi);
+	return rc;
+}
+
+int db_sqlite_subscr_create(struct db_context *dbc, const char *imsi)
+{
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_SUBSCR_CREATE];
+	int rc;
 
 	if (!db_bind_text(stmt, "$imsi", imsi))
 		return -EIO;
+	if (!db_bind_digits(stmt, "$imsi_int", imsi))
+		return -EIO;
 
 	/* execute the statement */
 	rc = sqlite3_step(stmt);
@@ -84,6 +126,11 @@ int db_subscr_create(struct db_context *dbc, const char *imsi)
  *          -ENOENT if no such subscriber data exists.
  */
 int db_subscr_delete_by_id(struct db_context *dbc, int64_t subscr_id)
+{
+	return dbc->ops->subscr_delete_by_id(dbc, subscr_id);
+}
+
+int db_sqlite_subscr_delete_by_id(struct db_context *dbc, int64_t subscr_id)
 {
 	int rc;
 	struct sub_auth_data_str aud;
@@ -124,7 +171,7 @@ int db_subscr_delete_by_id(struct db_context *dbc, int64_t subscr_id)
 		.type = OSMO_AUTH_TYPE_GSM,
 		.algo = OSMO_AUTH_ALG_NONE,
 	};
-	rc = db_subscr_update_aud_by_id(dbc, subscr_id, &aud);
+	rc = db_sqlite_subscr_update_aud_by_id(dbc, subscr_id, &aud);
 	if (ret == -ENOENT && !rc)
 		ret = 0;
 
@@ -132,7 +179,7 @@ int db_subscr_delete_by_id(struct db_context *dbc, int64_t subscr_id)
 		.type = OSMO_AUTH_TYPE_UMTS,
 		.algo = OSMO_AUTH_ALG_NONE,
 	};
-	rc = db_subscr_update_aud_by_id(dbc, subscr_id, &aud);
+	rc = db_sqlite_subscr_update_aud_by_id(dbc, subscr_id, &aud);
 	if (ret == -ENOENT && !rc)
 		ret = 0;
 
@@ -149,9 +196,6 @@ int db_subscr_delete_by_id(struct db_context *dbc, int64_t subscr_id)
 int db_subscr_update_msisdn_by_imsi(struct db_context *dbc, const char *imsi,
 				    const char *msisdn)
 {
-	int rc;
-	int ret = 0;
-
 	if (msisdn && !osmo_msisdn_str_valid(msisdn)) {
 		LOGHLR(imsi, LOGL_ERROR,
 		       "Cannot update subscriber: invalid MSISDN: '%s'\n",
@@ -159,14 +203,25 @@ int db_subscr_update_msisdn_by_imsi(struct db_context *dbc, const char *imsi,
 		return -EINVAL;
 	}
 
+	return dbc->ops->subscr_update_msisdn_by_imsi(dbc, imsi, msisdn);
+}
+
+int db_sqlite_subscr_update_msisdn_by_imsi(struct db_context *dbc, const char *imsi,
+					   const char *msisdn)
+{
+	int rc;
+	int ret = 0;
+
 	sqlite3_stmt *stmt = dbc->stmt[
 		msisdn ? DB_STMT_SET_MSISDN_BY_IMSI : DB_STMT_DELETE_MSISDN_BY_IMSI];
 
-	if (!db_bind_text(stmt, "$imsi", imsi))
+	if (!db_bind_digits(stmt, "$imsi", imsi))
 		return -EIO;
 	if (msisdn) {
 		if (!db_bind_text(stmt, "$msisdn", msisdn))
 			return -EIO;
+		if (!db_bind_digits(stmt, "$msisdn_int", msisdn))
+			return -EIO;
 	}
 
 	/* execute the statement */
@@ -212,19 +267,8 @@ out:
 int db_subscr_update_aud_by_id(struct db_context *dbc, int64_t subscr_id,
 			       const struct sub_auth_data_str *aud)
 {
-	sqlite3_stmt *stmt_del;
-	sqlite3_stmt *stmt_ins;
-	sqlite3_stmt *stmt;
-	const char *label;
-	int rc;
-	int ret = 0;
-
 	switch (aud->type) {
 	case OSMO_AUTH_TYPE_GSM:
-		label = "auc_2g";
-		stmt_del = dbc->stmt[DB_STMT_AUC_2G_DELETE];
-		stmt_ins = dbc->stmt[DB_STMT_AUC_2G_INSERT];
-
 		switch (aud->algo) {
 		case OSMO_AUTH_ALG_NONE:
 		case OSMO_AUTH_ALG_COMP128v1:
@@ -253,9 +297,6 @@ int db_subscr_update_aud_by_id(struct db_context *dbc, int64_t subscr_id,
 		break;
 
 	case OSMO_AUTH_TYPE_UMTS:
-		label = "auc_3g";
-		stmt_del = dbc->stmt[DB_STMT_AUC_3G_DELETE];
-		stmt_ins = dbc->stmt[DB_STMT_AUC_3G_INSERT];
 		switch (aud->algo) {
 		case OSMO_AUTH_ALG_NONE:
 		case OSMO_AUTH_ALG_MILENAGE:
@@ -298,6 +339,29 @@ int db_subscr_update_aud_by_id(struct db_context *dbc, int64_t subscr_id,
 		return -EINVAL;
 	}
 
+	return dbc->ops->subscr_update_aud_by_id(dbc, subscr_id, aud);
+}
+
+int db_sqlite_subscr_update_aud_by_id(struct db_context *dbc, int64_t subscr_id,
+				      const struct sub_auth_data_str *aud)
+{
+	sqlite3_stmt *stmt_del;
+	sqlite3_stmt *stmt_ins;
+	sqlite3_stmt *stmt;
+	const char *label;
+	int rc;
+	int ret = 0;
+
+	if (aud->type == OSMO_AUTH_TYPE_GSM) {
+		label = "auc_2g";
+		stmt_del = dbc->stmt[DB_STMT_AUC_2G_DELETE];
+		stmt_ins = dbc->stmt[DB_STMT_AUC_2G_INSERT];
+	} else {
+		label = "auc_3g";
+		stmt_del = dbc->stmt[DB_STMT_AUC_3G_DELETE];
+		stmt_ins = dbc->stmt[DB_STMT_AUC_3G_INSERT];
+	}
+
 	stmt = stmt_del;
 
 	if (!db_bind_int64(stmt, "$subscriber_id", subscr_id))
@@ -395,15 +459,20 @@ out:
  */
 int db_subscr_update_imei_by_imsi(struct db_context *dbc, const char* imsi, const char *imei)
 {
-	int rc, ret = 0;
-	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_UPD_IMEI_BY_IMSI];
-
 	if (imei && !osmo_imei_str_valid(imei, false)) {
 		LOGP(DAUC, LOGL_ERROR, "Cannot update subscriber IMSI='%s': invalid IMEI: '%s'\n", imsi, imei);
 		return -EINVAL;
 	}
 
-	if (!db_bind_text(stmt, "$imsi", imsi))
+	return dbc->ops->subscr_update_imei_by_imsi(dbc, imsi, imei);
+}
+
+int db_sqlite_subscr_update_imei_by_imsi(struct db_context *dbc, const char* imsi, const char *imei)
+{
+	int rc, ret = 0;
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_UPD_IMEI_BY_IMSI];
+
+	if (!db_bind_digits(stmt, "$imsi", imsi))
 		return -EIO;
 	if (imei && !db_bind_text(stmt, "$imei", imei))
 		return -EIO;
@@ -420,8 +489,12 @@ int db_subscr_update_imei_by_imsi(struct db_context *dbc, const char* imsi, cons
 	/* verify execution result */
 	rc = sqlite3_changes(dbc->db);
 	if (!rc) {
-		LOGP(DAUC, LOGL_ERROR, "Cannot update IMEI for subscriber IMSI='%s': no such subscriber\n", imsi);
-		ret = -ENOENT;
+		ret = db_sqlite_exists_by_imsi(dbc, imsi);
+		if (!ret)
+			db_ctr_inc(dbc, DB_CTR_IMEI_SUPPRESSED);
+		else if (ret == -ENOENT)
+			LOGP(DAUC, LOGL_ERROR, "Cannot update IMEI for subscriber IMSI='%s': no such subscriber\n",
+			     imsi);
 	} else if (rc != 1) {
 		LOGP(DAUC, LOGL_ERROR, "Update IMEI for subscriber IMSI='%s': SQL modified %d rows (expected 1)\n",
 		     imsi, rc);
@@ -439,8 +512,6 @@ static int db_sel(struct db_context *dbc, sqlite3_stmt *stmt, struct hlr_subscri
 {
 	int rc;
 	int ret = 0;
-	const char *last_lu_seen_str;
-	struct tm tm;
 
 	/* execute the statement */
 	rc = sqlite3_step(stmt);
@@ -474,20 +545,8 @@ static int db_sel(struct db_context *dbc, sqlite3_stmt *stmt, struct hlr_subscri
 	subscr->lmsi = sqlite3_column_int(stmt, 11);
 	subscr->ms_purged_cs = sqlite3_column_int(stmt, 12);
 	subscr->ms_purged_ps = sqlite3_column_int(stmt, 13);
-	last_lu_seen_str = (const char *)sqlite3_column_text(stmt, 14);
-	if (last_lu_seen_str && last_lu_seen_str[0] != '\0') {
-		if (strptime(last_lu_seen_str, DB_LAST_LU_SEEN_FMT, &tm) == NULL) {
-			LOGP(DAUC, LOGL_ERROR, "Cannot parse last LU timestamp '%s' of subscriber with IMSI='%s': %s\n",
-			     last_lu_seen_str, subscr->imsi, strerror(errno));
-		} else {
-			subscr->last_lu_seen = mktime(&tm);
-			if (subscr->last_lu_seen == -1) {
-				LOGP(DAUC, LOGL_ERROR, "Cannot convert LU timestamp '%s' to time_t: %s\n",
-				     last_lu_seen_str, strerror(errno));
-				subscr->last_lu_seen = 0;
-			}
-		}
-	}
+	/* seconds since the epoch, NULL reads as 0 */
+	subscr->last_lu_seen = sqlite3_column_int64(stmt, 14);
 
 out:
 	db_remove_reset(stmt);
@@ -515,12 +574,27 @@ out:
  */
 int db_subscr_get_by_imsi(struct db_context *dbc, const char *imsi,
 			  struct hlr_subscriber *subscr)
+{
+	int rc;
+
+	if (dbc->imsi_filter && !imsi_filter_check(dbc->imsi_filter, imsi)) {
+		LOGHLR(imsi, LOGL_DEBUG, "Unknown according to IMSI filter\n");
+		return -ENOENT;
+	}
+
+	rc = dbc->ops->subscr_get_by_imsi(dbc, imsi, subscr);
+	if (rc == -ENOENT && dbc->imsi_filter)
+		imsi_filter_unknown_add(dbc->imsi_filter, imsi);
+	return rc;
+}
+
+int db_sqlite_subscr_get_by_imsi(struct db_context *dbc, const char *imsi, struct hlr_subscriber *subscr)
 {
 	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_SEL_BY_IMSI];
 	const char *err;
 	int rc;
 
-	if (!db_bind_text(stmt, NULL, imsi))
+	if (!db_bind_digits(stmt, NULL, imsi))
 		return -EIO;
 
 	rc = db_sel(dbc, stmt, subscr, &err);
@@ -540,12 +614,26 @@ int db_subscr_get_by_imsi(struct db_context *dbc, const char *imsi,
 int db_subscr_get_by_msisdn(struct db_context *dbc, const char *msisdn,
 			    struct hlr_subscriber *subscr)
 {
-	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_SEL_BY_MSISDN];
+	return dbc->ops->subscr_get_by_msisdn(dbc, msisdn, subscr);
+}
+
+int db_sqlite_subscr_get_by_msisdn(struct db_context *dbc, const char *msisdn, struct hlr_subscriber *subscr)
+{
+	sqlite3_stmt *stmt;
 	const char *err;
+	int64_t msisdn_int;
 	int rc;
 
-	if (!db_bind_text(stmt, NULL, msisdn))
-		return -EIO;
+	if (db_digits_to_int(msisdn, &msisdn_int)) {
+		stmt = dbc->stmt[DB_STMT_SEL_BY_MSISDN];
+		if (!db_bind_int64(stmt, NULL, msisdn_int))
+			return -EIO;
+	} else {
+		/* not all digits or too long for msisdn_int, compare the text */
+		stmt = dbc->stmt[DB_STMT_SEL_BY_MSISDN_TEXT];
+		if (!db_bind_text(stmt, NULL, msisdn))
+			return -EIO;
+	}
 
 	rc = db_sel(dbc, stmt, subscr, &err);
 	if (rc)
@@ -563,6 +651,11 @@ int db_subscr_get_by_msisdn(struct db_context *dbc, const char *msisdn,
  */
 int db_subscr_get_by_id(struct db_context *dbc, int64_t id,
 			struct hlr_subscriber *subscr)
+{
+	return dbc->ops->subscr_get_by_id(dbc, id, subscr);
+}
+
+int db_sqlite_subscr_get_by_id(struct db_context *dbc, int64_t id, struct hlr_subscriber *subscr)
 {
 	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_SEL_BY_ID];
 	const char *err;
@@ -586,6 +679,11 @@ int db_subscr_get_by_id(struct db_context *dbc, int64_t id,
  *          database error.
  */
 int db_subscr_get_by_imei(struct db_context *dbc, const char *imei, struct hlr_subscriber *subscr)
+{
+	return dbc->ops->subscr_get_by_imei(dbc, imei, subscr);
+}
+
+int db_sqlite_subscr_get_by_imei(struct db_context *dbc, const char *imei, struct hlr_subscriber *subscr)
 {
 	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_SEL_BY_IMEI];
 	const char *err;
@@ -610,6 +708,11 @@ int db_subscr_get_by_imei(struct db_context *dbc, const char *imei, struct hlr_s
  *          database errors.
  */
 int db_subscr_nam(struct db_context *dbc, const char *imsi, bool nam_val, bool is_ps)
+{
+	return dbc->ops->subscr_nam(dbc, imsi, nam_val, is_ps);
+}
+
+int db_sqlite_subscr_nam(struct db_context *dbc, const char *imsi, bool nam_val, bool is_ps)
 {
 	sqlite3_stmt *stmt;
 	int rc;
@@ -618,7 +721,7 @@ int db_subscr_nam(struct db_context *dbc, const char *imsi, bool nam_val, bool i
 	stmt = dbc->stmt[is_ps ? DB_STMT_UPD_NAM_PS_BY_IMSI
 			       : DB_STMT_UPD_NAM_CS_BY_IMSI];
 
-	if (!db_bind_text(stmt, "$imsi", imsi))
+	if (!db_bind_digits(stmt, "$imsi", imsi))
 		return -EIO;
 	if (!db_bind_int(stmt, "$val", nam_val ? 1 : 0))
 		return -EIO;
@@ -637,11 +740,14 @@ int db_subscr_nam(struct db_context *dbc, const char *imsi, bool nam_val, bool i
 	/* verify execution result */
 	rc = sqlite3_changes(dbc->db);
 	if (!rc) {
-		LOGP(DAUC, LOGL_ERROR, "Cannot %s %s: no such subscriber: IMSI='%s'\n",
-		     nam_val ? "enable" : "disable",
-		     is_ps ? "PS" : "CS",
-		     imsi);
-		ret = -ENOENT;
+		ret = db_sqlite_exists_by_imsi(dbc, imsi);
+		if (!ret)
+			db_ctr_inc(dbc, DB_CTR_NAM_SUPPRESSED);
+		else if (ret == -ENOENT)
+			LOGP(DAUC, LOGL_ERROR, "Cannot %s %s: no such subscriber: IMSI='%s'\n",
+			     nam_val ? "enable" : "disable",
+			     is_ps ? "PS" : "CS",
+			     imsi);
 		goto out;
 	} else if (rc != 1) {
 		LOGHLR(imsi, LOGL_ERROR, "%s %s: SQL modified %d rows (expected 1)\n",
@@ -666,11 +772,22 @@ out:
  */
 int db_subscr_lu(struct db_context *dbc, int64_t subscr_id,
 		 const char *vlr_or_sgsn_number, bool is_ps)
+{
+	return dbc->ops->subscr_lu(dbc, subscr_id, vlr_or_sgsn_number, is_ps);
+}
+
+int db_sqlite_subscr_lu(struct db_context *dbc, int64_t subscr_id,
+			const char *vlr_or_sgsn_number, bool is_ps)
 {
 	sqlite3_stmt *stmt;
 	int rc, ret = 0;
 	struct timespec localtime;
 
+	if (osmo_clock_gettime(CLOCK_REALTIME, &localtime) != 0) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot get the current time: (%d) %s\n", errno, strerror(errno));
+		return -errno;
+	}
+
 	stmt = dbc->stmt[is_ps ? DB_STMT_UPD_SGSN_BY_ID
 			       : DB_STMT_UPD_VLR_BY_ID];
 
@@ -680,6 +797,13 @@ int db_subscr_lu(struct db_context *dbc, int64_t subscr_id,
 	if (!db_bind_text(stmt, "$number", vlr_or_sgsn_number))
 		return -EIO;
 
+	/* Stored as seconds since the epoch, which is UTC by definition. */
+	if (!db_bind_int64(stmt, "$now", (int64_t)localtime.tv_sec))
+		return -EIO;
+
+	if (!db_bind_int64(stmt, "$granularity", dbc->last_lu_seen_granularity))
+		return -EIO;
+
 	/* execute the statement */
 	rc = sqlite3_step(stmt);
 	if (rc != SQLITE_DONE) {
@@ -692,58 +816,20 @@ int db_subscr_lu(struct db_context *dbc, int64_t subscr_id,
 	/* verify execution result */
 	rc = sqlite3_changes(dbc->db);
 	if (!rc) {
-		LOGP(DAUC, LOGL_ERROR, "Cannot update %s number for subscriber ID=%" PRId64
-		     ": no such subscriber\n",
-		     is_ps? "SGSN" : "VLR", subscr_id);
-		ret = -ENOENT;
-		goto out;
+		ret = db_sqlite_exists_by_id(dbc, subscr_id);
+		if (!ret)
+			db_ctr_inc(dbc, DB_CTR_LU_SUPPRESSED);
+		else if (ret == -ENOENT)
+			LOGP(DAUC, LOGL_ERROR, "Cannot update %s number for subscriber ID=%" PRId64
+			     ": no such subscriber\n",
+			     is_ps? "SGSN" : "VLR", subscr_id);
 	} else if (rc != 1) {
 		LOGP(DAUC, LOGL_ERROR, "Update %s number for subscriber ID=%" PRId64
 		       ": SQL modified %d rows (expected 1)\n",
 		       is_ps? "SGSN" : "VLR", subscr_id, rc);
 		ret = -EIO;
-		goto out;
-	}
-
-	db_remove_reset(stmt);
-
-	if (osmo_clock_gettime(CLOCK_REALTIME, &localtime) != 0) {
-		LOGP(DAUC, LOGL_ERROR, "Cannot get the current time: (%d) %s\n", errno, strerror(errno));
-		ret = -errno;
-		goto out;
-	}
-
-	stmt = dbc->stmt[DB_STMT_SET_LAST_LU_SEEN];
-
-	if (!db_bind_int64(stmt, "$subscriber_id", subscr_id))
-		return -EIO;
-	/* The timestamp will be converted to UTC by SQLite. */
-	if (!db_bind_int64(stmt, "$val", (int64_t)localtime.tv_sec)) {
-		ret = -EIO;
-		goto out;
 	}
 
-	rc = sqlite3_step(stmt);
-	if (rc != SQLITE_DONE) {
-		LOGP(DAUC, LOGL_ERROR,
-		       "Cannot update LU timestamp for subscriber ID=%" PRId64 ": SQL error: (%d) %s\n",
-		       subscr_id, rc, sqlite3_errmsg(dbc->db));
-		ret = -EIO;
-		goto out;
-	}
-
-	/* verify execution result */
-	rc = sqlite3_changes(dbc->db);
-	if (!rc) {
-		LOGP(DAUC, LOGL_ERROR, "Cannot update LU timestamp for subscriber ID=%" PRId64
-		     ": no such subscriber\n", subscr_id);
-		ret = -ENOENT;
-		goto out;
-	} else if (rc != 1) {
-		LOGP(DAUC, LOGL_ERROR, "Update LU timestamp for subscriber ID=%" PRId64
-		     ": SQL modified %d rows (expected 1)\n", subscr_id, rc);
-		ret = -EIO;
-	}
 out:
 	db_remove_reset(stmt);
 	return ret;
@@ -759,6 +845,12 @@ out:
  */
 int db_subscr_purge(struct db_context *dbc, const char *by_imsi,
 		    bool purge_val, bool is_ps)
+{
+	return dbc->ops->subscr_purge(dbc, by_imsi, purge_val, is_ps);
+}
+
+int db_sqlite_subscr_purge(struct db_context *dbc, const char *by_imsi,
+			   bool purge_val, bool is_ps)
 {
 	sqlite3_stmt *stmt;
 	int rc, ret = 0;
@@ -766,7 +858,7 @@ int db_subscr_purge(struct db_context *dbc, const char *by_imsi,
 	stmt = dbc->stmt[is_ps ? DB_STMT_UPD_PURGE_PS_BY_IMSI
 			       : DB_STMT_UPD_PURGE_CS_BY_IMSI];
 
-	if (!db_bind_text(stmt, "$imsi", by_imsi))
+	if (!db_bind_digits(stmt, "$imsi", by_imsi))
 		return -EIO;
 	if (!db_bind_int(stmt, "$val", purge_val ? 1 : 0))
 		return -EIO;
@@ -805,6 +897,214 @@ out:
 	return ret;
 }
 
+/*! Return the sequence number of the newest subscriber change log entry.
+ * \param[in,out] dbc  database context.
+ * \param[out] seq  newest seq, 0 if the log is empty.
+ * \returns 0 on success, -ENOTSUP if the storage backend keeps no change log, -EIO on database error.
+ */
+int db_change_last_seq(struct db_context *dbc, int64_t *seq)
+{
+	if (!dbc->ops->change_last_seq)
+		return -ENOTSUP;
+	return dbc->ops->change_last_seq(dbc, seq);
+}
+
+int db_sqlite_change_last_seq(struct db_context *dbc, int64_t *seq)
+{
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_CHANGE_LAST_SEQ];
+	int rc;
+	int ret = 0;
+
+	rc = sqlite3_step(stmt);
+	if (rc == SQLITE_ROW)
+		*seq = sqlite3_column_int64(stmt, 0);
+	else {
+		LOGP(DDB, LOGL_ERROR, "Cannot read change log: SQL error: (%d) %s\n", rc, sqlite3_errmsg(dbc->db));
+		ret = -EIO;
+	}
+
+	db_remove_reset(stmt);
+	return ret;
+}
+
+/*! Iterate the subscriber change log entries after a given sequence number, oldest first.
+ * \param[in,out] dbc  database context.
+ * \param[in] seq  last seq the caller has seen already, 0 for all.
+ * \param[in] max  stop after this many entries.
+ * \param[in] cb  called for each entry; a nonzero return value stops the iteration.
+ * \param[in] data  passed on to cb.
+ * \returns the number of entries passed to cb, -ENOTSUP if the storage backend keeps no change log, -EIO
+ *          on database error.
+ */
+int db_change_since(struct db_context *dbc, int64_t seq, unsigned int max, db_change_cb_t cb, void *data)
+{
+	if (!dbc->ops->change_since)
+		return -ENOTSUP;
+	return dbc->ops->change_since(dbc, seq, max, cb, data);
+}
+
+int db_sqlite_change_since(struct db_context *dbc, int64_t seq, unsigned int max, db_change_cb_t cb, void *data)
+{
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_CHANGE_SINCE];
+	struct db_change change;
+	int n = 0;
+	int rc;
+
+	if (!db_bind_int64(stmt, "$seq", seq))
+		return -EIO;
+	if (!db_bind_int64(stmt, "$max", max))
+		return -EIO;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		change = (struct db_change){
+			.seq = sqlite3_column_int64(stmt, 0),
+			.ts = sqlite3_column_int64(stmt, 1),
+			.subscr_id = sqlite3_column_int64(stmt, 2),
+		};
+		copy_sqlite3_text_to_buf(change.imsi, stmt, 3);
+		copy_sqlite3_text_to_buf(change.change, stmt, 4);
+		copy_sqlite3_text_to_buf(change.value, stmt, 5);
+		n++;
+		if (cb(&change, data)) {
+			rc = SQLITE_DONE;
+			break;
+		}
+	}
+
+	if (rc != SQLITE_DONE) {
+		LOGP(DDB, LOGL_ERROR, "Cannot read change log: SQL error: (%d) %s\n", rc, sqlite3_errmsg(dbc->db));
+		n = -EIO;
+	}
+
+	db_remove_reset(stmt);
+	return n;
+}
+
+/*! Remove subscriber change log entries.
+ * \param[in,out] dbc  database context.
+ * \param[in] seq  remove all entries up to and including this seq.
+ * \returns 0 on success, -ENOTSUP if the storage backend keeps no change log, -EIO on database error.
+ */
+int db_change_trim(struct db_context *dbc, int64_t seq)
+{
+	if (!dbc->ops->change_trim)
+		return -ENOTSUP;
+	return dbc->ops->change_trim(dbc, seq);
+}
+
+int db_sqlite_change_trim(struct db_context *dbc, int64_t seq)
+{
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_CHANGE_TRIM];
+	int rc;
+	int ret = 0;
+
+	if (!db_bind_int64(stmt, "$seq", seq))
+		return -EIO;
+
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_DONE) {
+		LOGP(DDB, LOGL_ERROR, "Cannot trim change log: SQL error: (%d) %s\n", rc, sqlite3_errmsg(dbc->db));
+		ret = -EIO;
+	}
+
+	db_remove_reset(stmt);
+	return ret;
+}
+
+/*! Iterate the IMSIs of all subscribers, in no particular order.
+ * \param[in,out] dbc  database context.
+ * \param[in] cb  called for each IMSI; a nonzero return value stops the iteration.
+ * \param[in] data  passed on to cb.
+ * \returns the number of IMSIs passed to cb, -ENOTSUP if the storage backend cannot iterate subscribers,
+ *          -EIO on database error.
+ */
+int db_subscr_imsi_iter(struct db_context *dbc, db_imsi_cb_t cb, void *data)
+{
+	if (!dbc->ops->subscr_imsi_iter)
+		return -ENOTSUP;
+	return dbc->ops->subscr_imsi_iter(dbc, cb, data);
+}
+
+int db_sqlite_subscr_imsi_iter(struct db_context *dbc, db_imsi_cb_t cb, void *data)
+{
+	sqlite3_stmt *stmt = dbc->stmt[DB_STMT_SEL_ALL_IMSI];
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	int n = 0;
+	int rc;
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		copy_sqlite3_text_to_buf(imsi, stmt, 0);
+		n++;
+		if (cb(imsi, data)) {
+			rc = SQLITE_DONE;
+			break;
+		}
+	}
+
+	if (rc != SQLITE_DONE) {
+		LOGP(DDB, LOGL_ERROR, "Cannot read IMSIs: SQL error: (%d) %s\n", rc, sqlite3_errmsg(dbc->db));
+		n = -EIO;
+	}
+
+	db_remove_reset(stmt);
+	return n;
+}
+
+static int imsi_count_cb(const char *imsi, void *data)
+{
+	(*(unsigned int *)data)++;
+	return 0;
+}
+
+static int imsi_filter_add_cb(const char *imsi, void *data)
+{
+	imsi_filter_add(data, imsi);
+	return 0;
+}
+
+/*! Build a filter of all provisioned IMSIs, or rebuild it, to reject unknown IMSIs without a lookup.
+ * The filter learns about subscribers created with db_subscr_create() on this db_context only: a subscriber
+ * that another process adds to the database stays unknown until the filter is rebuilt. Hence it is not
+ * available on a read-only database.
+ * \param[in,out] dbc  database context.
+ * \param[in] unknown_ttl  seconds to remember IMSIs that passed the filter but were not found.
+ * \returns 0 on success, -EROFS if dbc is read-only, -ENOTSUP if the storage backend cannot iterate
+ *          subscribers, -EIO on database error.
+ */
+int db_imsi_filter_enable(struct db_context *dbc, unsigned int unknown_ttl)
+{
+	struct imsi_filter *f;
+	unsigned int count = 0;
+	int rc;
+
+	if (dbc->readonly)
+		return -EROFS;
+
+	rc = db_subscr_imsi_iter(dbc, imsi_count_cb, &count);
+	if (rc < 0)
+		return rc;
+
+	/* Leave room for as many new subscribers as there are now */
+	f = imsi_filter_alloc(dbc, count * 2, unknown_ttl);
+	rc = db_subscr_imsi_iter(dbc, imsi_filter_add_cb, f);
+	if (rc < 0) {
+		talloc_free(f);
+		return rc;
+	}
+
+	db_imsi_filter_disable(dbc);
+	dbc->imsi_filter = f;
+	LOGP(DDB, LOGL_NOTICE, "IMSI filter: %u subscribers, %" PRIu64 " bits\n", f->num_imsis, f->num_bits);
+	return 0;
+}
+
+/*! Drop the IMSI filter, so that all IMSIs are looked up in the database again. */
+void db_imsi_filter_disable(struct db_context *dbc)
+{
+	talloc_free(dbc->imsi_filter);
+	dbc->imsi_filter = NULL;
+}
+
 /*! Update nam_cs/nam_ps in the db and trigger notifications to GSUP clients.
  * \param[in,out] hlr  Global hlr context.
  * \param[in] subscr   Subscriber from a fresh db_subscr_get_by_*() call.
@@ -0,0 +1,883 @@
+/* LMDB storage backend for the HLR database */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Layout: one LMDB environment file with these named databases:
+ *
+ *   subscr   8 byte big-endian subscriber id -> struct lmdb_subscr
+ *   imsi     IMSI digits -> subscriber id
+ *   msisdn   MSISDN digits -> subscriber id
+ *   imei     IMEI digits -> subscriber id (DUPSORT, an IMEI is not unique)
+ *   auc_2g   subscriber id -> struct lmdb_auc_2g
+ *   auc_3g   subscriber id -> struct lmdb_auc_3g
+ *   meta     "version"
+ *
+ * Keys are stored in binary, so reads need no parsing. Every db_ops call is one
+ * LMDB transaction; read-only calls reuse a single reset/renewed read txn. */
+
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <lmdb.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/bit64gen.h>
+#include <osmocom/crypt/auth.h>
+
+#include "logging.h"
+#include "db.h"
+
+#define LOGHLR(imsi, level, fmt, args ...)	LOGP(DAUC, level, "IMSI='%s': " fmt, imsi, ## args)
+
+#define LMDB_SCHEMA_VERSION	1
+#define LMDB_DEFAULT_MAPSIZE	(1024ULL * 1024 * 1024)
+
+enum lmdb_dbi {
+	LMDB_DBI_SUBSCR,
+	LMDB_DBI_IMSI,
+	LMDB_DBI_MSISDN,
+	LMDB_DBI_IMEI,
+	LMDB_DBI_AUC_2G,
+	LMDB_DBI_AUC_3G,
+	LMDB_DBI_META,
+	_NUM_LMDB_DBI
+};
+
+static const struct {
+	const char *name;
+	unsigned int flags;
+} lmdb_dbi_def[] = {
+	[LMDB_DBI_SUBSCR] = { "subscr", 0 },
+	[LMDB_DBI_IMSI] = { "imsi", 0 },
+	[LMDB_DBI_MSISDN] = { "msisdn", 0 },
+	[LMDB_DBI_IMEI] = { "imei", MDB_DUPSORT },
+	[LMDB_DBI_AUC_2G] = { "auc_2g", 0 },
+	[LMDB_DBI_AUC_3G] = { "auc_3g", 0 },
+	[LMDB_DBI_META] = { "meta", 0 },
+};
+
+struct lmdb_subscr {
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	char msisdn[GT_MAX_DIGITS+1];
+	char imei[GSM23003_IMEI_NUM_DIGITS+1];
+	char vlr_number[32];
+	char sgsn_number[32];
+	char sgsn_address[GT_MAX_DIGITS+1];
+	uint32_t periodic_lu_timer;
+	uint32_t periodic_rau_tau_timer;
+	uint32_t lmsi;
+	uint8_t nam_cs;
+	uint8_t nam_ps;
+	uint8_t ms_purged_cs;
+	uint8_t ms_purged_ps;
+	int64_t last_lu_seen;
+};
+
+struct lmdb_auc_2g {
+	int32_t algo;
+	uint8_t ki[16];
+};
+
+struct lmdb_auc_3g {
+	int32_t algo;
+	uint8_t k[16];
+	uint8_t opc[16];
+	uint8_t opc_is_op;
+	uint8_t ind_bitlen;
+	uint64_t sqn;
+};
+
+struct lmdb_priv {
+	MDB_env *env;
+	MDB_dbi dbi[_NUM_LMDB_DBI];
+	MDB_txn *rd_txn;
+};
+
+#define PRIV(dbc) ((struct lmdb_priv *)(dbc)->priv)
+
+/* Subscriber ids are big-endian keys, so that the subscr db iterates in id order. */
+struct lmdb_id_key {
+	uint8_t be[8];
+};
+
+static MDB_val id_key(struct lmdb_id_key *k, int64_t id)
+{
+	osmo_store64be(id, k->be);
+	return (MDB_val){ .mv_size = sizeof(k->be), .mv_data = k->be };
+}
+
+static int64_t id_from_val(const MDB_val *v)
+{
+	if (v->mv_size != 8)
+		return -1;
+	return osmo_load64be(v->mv_data);
+}
+
+static MDB_val str_key(const char *str)
+{
+	return (MDB_val){ .mv_size = strlen(str), .mv_data = (void *)str };
+}
+
+static int lmdb_rd_begin(struct db_context *dbc, MDB_txn **txn)
+{
+	struct lmdb_priv *priv = PRIV(dbc);
+	int rc;
+
+	if (priv->rd_txn)
+		rc = mdb_txn_renew(priv->rd_txn);
+	else
+		rc = mdb_txn_begin(priv->env, NULL, MDB_RDONLY, &priv->rd_txn);
+	if (rc) {
+		LOGP(DDB, LOGL_ERROR, "Cannot begin LMDB read transaction: %s\n", mdb_strerror(rc));
+		return -EIO;
+	}
+	*txn = priv->rd_txn;
+	return 0;
+}
+
+static void lmdb_rd_end(struct db_context *dbc)
+{
+	mdb_txn_reset(PRIV(dbc)->rd_txn);
+}
+
+static int lmdb_wr_begin(struct db_context *dbc, MDB_txn **txn)
+{
+	int rc = mdb_txn_begin(PRIV(dbc)->env, NULL, 0, txn);
+	if (rc) {
+		LOGP(DDB, LOGL_ERROR, "Cannot begin LMDB write transaction: %s\n", mdb_strerror(rc));
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Commit if ret == 0, abort otherwise. Return ret, or -EIO if the commit failed. */
+static int lmdb_wr_end(MDB_txn *txn, int ret)
+{
+	int rc;
+	if (ret) {
+		mdb_txn_abort(txn);
+		return ret;
+	}
+	rc = mdb_txn_commit(txn);
+	if (rc) {
+		LOGP(DDB, LOGL_ERROR, "Cannot commit LMDB transaction: %s\n", mdb_strerror(rc));
+		return -EIO;
+	}
+	return 0;
+}
+
+/* Look up an id in one of the index dbs. */
+static int lmdb_lookup_id(struct db_context *dbc, MDB_txn *txn, enum lmdb_dbi dbi, const char *key,
+			  int64_t *id)
+{
+	MDB_val k = str_key(key);
+	MDB_val v;
+	int rc;
+
+	rc = mdb_get(txn, PRIV(dbc)->dbi[dbi], &k, &v);
+	if (rc == MDB_NOTFOUND)
+		return -ENOENT;
+	if (rc) {
+		LOGP(DDB, LOGL_ERROR, "LMDB %s lookup failed: %s\n", lmdb_dbi_def[dbi].name, mdb_strerror(rc));
+		return -EIO;
+	}
+	*id = id_from_val(&v);
+	return *id < 0 ? -EIO : 0;
+}
+
+static int lmdb_get_subscr(struct db_context *dbc, MDB_txn *txn, int64_t id, struct lmdb_subscr *rec)
+{
+	struct lmdb_id_key kbuf;
+	MDB_val k = id_key(&kbuf, id);
+	MDB_val v;
+	int rc;
+
+	rc = mdb_get(txn, PRIV(dbc)->dbi[LMDB_DBI_SUBSCR], &k, &v);
+	if (rc == MDB_NOTFOUND)
+		return -ENOENT;
+	if (rc || v.mv_size != sizeof(*rec)) {
+		LOGP(DDB, LOGL_ERROR, "LMDB subscriber ID=%" PRId64 " lookup failed: %s\n", id,
+		     rc ? mdb_strerror(rc) : "record size mismatch");
+		return -EIO;
+	}
+	memcpy(rec, v.mv_data, sizeof(*rec));
+	return 0;
+}
+
+/* Subscriber ids are big-endian keys, so the largest id is the last key of the subscr db; 0 if it is empty. */
+static int lmdb_last_subscr_id(struct db_context *dbc, MDB_txn *txn, int64_t *id)
+{
+	MDB_cursor *cur;
+	MDB_val k, v;
+	int rc;
+
+	rc = mdb_cursor_open(txn, PRIV(dbc)->dbi[LMDB_DBI_SUBSCR], &cur);
+	if (rc)
+		return -EIO;
+	rc = mdb_cursor_get(cur, &k, &v, MDB_LAST);
+	mdb_cursor_close(cur);
+	if (rc == MDB_NOTFOUND) {
+		*id = 0;
+		return 0;
+	}
+	if (rc)
+		return -EIO;
+	*id = id_from_val(&k);
+	return *id < 0 ? -EIO : 0;
+}
+
+static int lmdb_put_subscr(struct db_context *dbc, MDB_txn *txn, int64_t id, const struct lmdb_subscr *rec)
+{
+	struct lmdb_id_key kbuf;
+	MDB_val k = id_key(&kbuf, id);
+	MDB_val v = { .mv_size = sizeof(*rec), .mv_data = (void *)rec };
+	int rc;
+
+	rc = mdb_put(txn, PRIV(dbc)->dbi[LMDB_DBI_SUBSCR], &k, &v, 0);
+	if (rc) {
+		LOGP(DDB, LOGL_ERROR, "Cannot store subscriber ID=%" PRId64 ": %s\n", id, mdb_strerror(rc));
+		return -EIO;
+	}
+	return 0;
+}
+
+static int lmdb_put_index(struct db_context *dbc, MDB_txn *txn, enum lmdb_dbi dbi, const char *key, int64_t id,
+			  unsigned int flags)
+{
+	struct lmdb_id_key kbuf;
+	MDB_val k = str_key(key);
+	MDB_val v = id_key(&kbuf, id);
+	int rc;
+
+	rc = mdb_put(txn, PRIV(dbc)->dbi[dbi], &k, &v, flags);
+	if (rc) {
+		LOGP(DDB, LOGL_ERROR, "Cannot store %s '%s' for subscriber ID=%" PRId64 ": %s\n",
+		     lmdb_dbi_def[dbi].name, key, id, mdb_strerror(rc));
+		return -EIO;
+	}
+	return 0;
+}
+
+static void lmdb_del_index(struct db_context *dbc, MDB_txn *txn, enum lmdb_dbi dbi, const char *key, int64_t id)
+{
+	struct lmdb_id_key kbuf;
+	MDB_val k = str_key(key);
+	MDB_val v = id_key(&kbuf, id);
+
+	if (!key[0])
+		return;
+	/* the data selects the duplicate to remove in DUPSORT dbs, and is ignored otherwise */
+	mdb_del(txn, PRIV(dbc)->dbi[dbi], &k, &v);
+}
+
+static void lmdb_subscr_to_hlr(int64_t id, const struct lmdb_subscr *rec, struct hlr_subscriber *subscr)
+{
+	*subscr = (struct hlr_subscriber){
+		.id = id,
+		.periodic_lu_timer = rec->periodic_lu_timer,
+		.periodic_rau_tau_timer = rec->periodic_rau_tau_timer,
+		.nam_cs = rec->nam_cs,
+		.nam_ps = rec->nam_ps,
+		.lmsi = rec->lmsi,
+		.ms_purged_cs = rec->ms_purged_cs,
+		.ms_purged_ps = rec->ms_purged_ps,
+		.last_lu_seen = rec->last_lu_seen,
+	};
+	OSMO_STRLCPY_ARRAY(subscr->imsi, rec->imsi);
+	OSMO_STRLCPY_ARRAY(subscr->msisdn, rec->msisdn);
+	OSMO_STRLCPY_ARRAY(subscr->imei, rec->imei);
+	OSMO_STRLCPY_ARRAY(subscr->vlr_number, rec->vlr_number);
+	OSMO_STRLCPY_ARRAY(subscr->sgsn_number, rec->sgsn_number);
+	OSMO_STRLCPY_ARRAY(subscr->sgsn_address, rec->sgsn_address);
+}
+
+static int lmdb_meta_get_u64(struct db_context *dbc, MDB_txn *txn, const char *name, uint64_t *val)
+{
+	MDB_val k = str_key(name);
+	MDB_val v;
+	int rc;
+
+	rc = mdb_get(txn, PRIV(dbc)->dbi[LMDB_DBI_META], &k, &v);
+	if (rc == MDB_NOTFOUND)
+		return -ENOENT;
+	if (rc || v.mv_size != sizeof(*val))
+		return -EIO;
+	memcpy(val, v.mv_data, sizeof(*val));
+	return 0;
+}
+
+static int lmdb_meta_put_u64(struct db_context *dbc, MDB_txn *txn, const char *name, uint64_t val)
+{
+	MDB_val k = str_key(name);
+	MDB_val v = { .mv_size = sizeof(val), .mv_data = &val };
+	return mdb_put(txn, PRIV(dbc)->dbi[LMDB_DBI_META], &k, &v, 0) ? -EIO : 0;
+}
+
+static void db_lmdb_close(struct db_context *dbc)
+{
+	struct lmdb_priv *priv = PRIV(dbc);
+	if (!priv)
+		return;
+	if (priv->rd_txn)
+		mdb_txn_abort(priv->rd_txn);
+	if (priv->env)
+		mdb_env_close(priv->env);
+	talloc_free(priv);
+	dbc->priv = NULL;
+}
+
+static int db_lmdb_open(struct db_context *dbc, bool enable_logging, bool allow_upgrade)
+{
+	struct lmdb_priv *priv;
+	MDB_txn *txn;
+	uint64_t version;
+	int i;
+	int rc;
+
+	LOGP(DDB, LOGL_NOTICE, "using LMDB database: %s\n", dbc->fname);
+	LOGP(DDB, LOGL_INFO, "Running with %s\n", mdb_version(NULL, NULL, NULL));
+
+	priv = talloc_zero(dbc, struct lmdb_priv);
+	OSMO_ASSERT(priv);
+	dbc->priv = priv;
+
+	if ((rc = mdb_env_create(&priv->env))
+	    || (rc = mdb_env_set_maxdbs(priv->env, _NUM_LMDB_DBI))
+	    || (rc = mdb_env_set_mapsize(priv->env, LMDB_DEFAULT_MAPSIZE))
+	    || (rc = mdb_env_open(priv->env, dbc->fname, MDB_NOSUBDIR | (dbc->readonly ? MDB_RDONLY : 0), 0600))) {
+		LOGP(DDB, LOGL_ERROR, "Unable to open LMDB '%s': %s\n", dbc->fname, mdb_strerror(rc));
+		goto out_free;
+	}
+
+	/* LMDB readers in other processes always see the last committed write txn, nothing else to do for a
+	 * read replica than to not write. */
+	if (dbc->readonly) {
+		rc = mdb_txn_begin(priv->env, NULL, MDB_RDONLY, &txn);
+		if (rc) {
+			LOGP(DDB, LOGL_ERROR, "Cannot begin LMDB read transaction: %s\n", mdb_strerror(rc));
+			goto out_free;
+		}
+	} else if (lmdb_wr_begin(dbc, &txn))
+		goto out_free;
+	for (i = 0; i < _NUM_LMDB_DBI; i++) {
+		rc = mdb_dbi_open(txn, lmdb_dbi_def[i].name, lmdb_dbi_def[i].flags | (dbc->readonly ? 0 : MDB_CREATE),
+				  &priv->dbi[i]);
+		if (rc) {
+			LOGP(DDB, LOGL_ERROR, "Unable to open LMDB database '%s': %s\n", lmdb_dbi_def[i].name,
+			     mdb_strerror(rc));
+			mdb_txn_abort(txn);
+			goto out_free;
+		}
+	}
+
+	rc = lmdb_meta_get_u64(dbc, txn, "version", &version);
+	if (rc == -ENOENT && !dbc->readonly) {
+		LOGP(DDB, LOGL_NOTICE, "Bootstrapping LMDB database '%s'\n", dbc->fname);
+		version = LMDB_SCHEMA_VERSION;
+		rc = lmdb_meta_put_u64(dbc, txn, "version", version);
+	}
+	if (lmdb_wr_end(txn, rc)) {
+		LOGP(DDB, LOGL_ERROR, "Unable to read LMDB schema version from '%s'\n", dbc->fname);
+		goto out_free;
+	}
+
+	LOGP(DDB, LOGL_NOTICE, "Database '%s' has HLR LMDB schema version %" PRIu64 "\n", dbc->fname, version);
+	if (version != LMDB_SCHEMA_VERSION) {
+		LOGP(DDB, LOGL_ERROR, "HLR LMDB schema version %" PRIu64 " is unknown\n", version);
+		goto out_free;
+	}
+	return 0;
+
+out_free:
+	db_lmdb_close(dbc);
+	return -EIO;
+}
+
+static int db_lmdb_subscr_create(struct db_context *dbc, const char *imsi)
+{
+	struct lmdb_subscr rec = {
+		.nam_cs = 1,
+		.nam_ps = 1,
+	};
+	int64_t next_id;
+	MDB_txn *txn;
+	int rc;
+
+	if (lmdb_wr_begin(dbc, &txn))
+		return -EIO;
+
+	/* like SQLite's INTEGER PRIMARY KEY, use one more than the largest id in use */
+	rc = lmdb_last_subscr_id(dbc, txn, &next_id);
+	if (rc) {
+		LOGHLR(imsi, LOGL_ERROR, "Cannot create subscriber: cannot read next subscriber ID\n");
+		return lmdb_wr_end(txn, -EIO);
+	}
+
+	OSMO_STRLCPY_ARRAY(rec.imsi, imsi);
+	/* like the UNIQUE constraint on subscriber.imsi */
+	next_id++;
+	rc = lmdb_put_index(dbc, txn, LMDB_DBI_IMSI, imsi, next_id, MDB_NOOVERWRITE);
+	if (!rc)
+		rc = lmdb_put_subscr(dbc, txn, next_id, &rec);
+	if (rc)
+		LOGHLR(imsi, LOGL_ERROR, "Cannot create subscriber\n");
+	return lmdb_wr_end(txn, rc);
+}
+
+static int db_lmdb_subscr_delete_by_id(struct db_context *dbc, int64_t subscr_id)
+{
+	struct lmdb_subscr rec;
+	struct lmdb_id_key kbuf;
+	MDB_val k = id_key(&kbuf, subscr_id);
+	struct lmdb_priv *priv = PRIV(dbc);
+	bool had_auc;
+	MDB_txn *txn;
+	int rc;
+
+	if (lmdb_wr_begin(dbc, &txn))
+		return -EIO;
+
+	/* remove auth data even if the subscriber row is gone, like the SQLite backend */
+	had_auc = !mdb_del(txn, priv->dbi[LMDB_DBI_AUC_2G], &k, NULL);
+	had_auc = !mdb_del(txn, priv->dbi[LMDB_DBI_AUC_3G], &k, NULL) || had_auc;
+
+	rc = lmdb_get_subscr(dbc, txn, subscr_id, &rec);
+	if (rc == -ENOENT) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot delete: no such subscriber: ID=%" PRId64 "\n", subscr_id);
+		return lmdb_wr_end(txn, had_auc ? 0 : -ENOENT);
+	}
+	if (rc)
+		return lmdb_wr_end(txn, rc);
+
+	lmdb_del_index(dbc, txn, LMDB_DBI_IMSI, rec.imsi, subscr_id);
+	lmdb_del_index(dbc, txn, LMDB_DBI_MSISDN, rec.msisdn, subscr_id);
+	lmdb_del_index(dbc, txn, LMDB_DBI_IMEI, rec.imei, subscr_id);
+	rc = mdb_del(txn, priv->dbi[LMDB_DBI_SUBSCR], &k, NULL);
+	if (rc) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot delete subscriber ID=%" PRId64 ": %s\n", subscr_id, mdb_strerror(rc));
+		return lmdb_wr_end(txn, -EIO);
+	}
+	return lmdb_wr_end(txn, 0);
+}
+
+/* Read-modify-write of the subscriber record found by IMSI. */
+static int lmdb_modify_by_imsi(struct db_context *dbc, const char *imsi, MDB_txn **txn,
+			       int64_t *id, struct lmdb_subscr *rec)
+{
+	int rc;
+
+	if (lmdb_wr_begin(dbc, txn))
+		return -EIO;
+	rc = lmdb_lookup_id(dbc, *txn, LMDB_DBI_IMSI, imsi, id);
+	if (!rc)
+		rc = lmdb_get_subscr(dbc, *txn, *id, rec);
+	if (rc) {
+		mdb_txn_abort(*txn);
+		return rc;
+	}
+	return 0;
+}
+
+static int db_lmdb_subscr_update_msisdn_by_imsi(struct db_context *dbc, const char *imsi,
+						const char *msisdn)
+{
+	struct lmdb_subscr rec;
+	MDB_txn *txn;
+	int64_t id;
+	int rc;
+
+	rc = lmdb_modify_by_imsi(dbc, imsi, &txn, &id, &rec);
+	if (rc == -ENOENT)
+		LOGP(DAUC, LOGL_ERROR, "Cannot update MSISDN: no such subscriber: IMSI='%s'\n", imsi);
+	if (rc)
+		return rc;
+
+	lmdb_del_index(dbc, txn, LMDB_DBI_MSISDN, rec.msisdn, id);
+	if (msisdn) {
+		/* like the UNIQUE constraint on subscriber.msisdn */
+		rc = lmdb_put_index(dbc, txn, LMDB_DBI_MSISDN, msisdn, id, MDB_NOOVERWRITE);
+		if (rc) {
+			LOGHLR(imsi, LOGL_ERROR, "Cannot update subscriber's MSISDN\n");
+			return lmdb_wr_end(txn, rc);
+		}
+		OSMO_STRLCPY_ARRAY(rec.msisdn, msisdn);
+	} else
+		rec.msisdn[0] = '\0';
+
+	return lmdb_wr_end(txn, lmdb_put_subscr(dbc, txn, id, &rec));
+}
+
+static int db_lmdb_subscr_update_aud_by_id(struct db_context *dbc, int64_t subscr_id,
+					   const struct sub_auth_data_str *aud)
+{
+	bool is_2g = (aud->type == OSMO_AUTH_TYPE_GSM);
+	MDB_dbi dbi = PRIV(dbc)->dbi[is_2g ? LMDB_DBI_AUC_2G : LMDB_DBI_AUC_3G];
+	struct lmdb_id_key kbuf;
+	MDB_val k = id_key(&kbuf, subscr_id);
+	struct lmdb_auc_2g a2 = {};
+	struct lmdb_auc_3g a3 = {};
+	struct lmdb_subscr rec;
+	MDB_val v;
+	MDB_txn *txn;
+	int ret = 0;
+	int rc;
+
+	if (lmdb_wr_begin(dbc, &txn))
+		return -EIO;
+
+	rc = mdb_del(txn, dbi, &k, NULL);
+	if (rc == MDB_NOTFOUND)
+		ret = -ENOENT;
+	else if (rc) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot delete %s entry: %s\n", is_2g ? "auc_2g" : "auc_3g",
+		     mdb_strerror(rc));
+		return lmdb_wr_end(txn, -EIO);
+	}
+
+	/* Just delete requested? */
+	if (aud->algo == OSMO_AUTH_ALG_NONE) {
+		rc = lmdb_wr_end(txn, 0);
+		return rc ? rc : ret;
+	}
+
+	rc = lmdb_get_subscr(dbc, txn, subscr_id, &rec);
+	if (rc) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot update auth tokens: no such subscriber: ID=%" PRId64 "\n",
+		     subscr_id);
+		return lmdb_wr_end(txn, rc);
+	}
+
+	if (is_2g) {
+		a2.algo = aud->algo;
+		osmo_hexparse(aud->u.gsm.ki, a2.ki, sizeof(a2.ki));
+		v = (MDB_val){ .mv_size = sizeof(a2), .mv_data = &a2 };
+	} else {
+		a3.algo = aud->algo;
+		osmo_hexparse(aud->u.umts.k, a3.k, sizeof(a3.k));
+		osmo_hexparse(aud->u.umts.opc, a3.opc, sizeof(a3.opc));
+		a3.opc_is_op = aud->u.umts.opc_is_op ? 1 : 0;
+		a3.ind_bitlen = aud->u.umts.ind_bitlen;
+		/* like the auc_3g.sqn column default */
+		a3.sqn = 0;
+		v = (MDB_val){ .mv_size = sizeof(a3), .mv_data = &a3 };
+	}
+
+	rc = mdb_put(txn, dbi, &k, &v, 0);
+	if (rc) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot insert %s entry: %s\n", is_2g ? "auc_2g" : "auc_3g",
+		     mdb_strerror(rc));
+		return lmdb_wr_end(txn, -EIO);
+	}
+	return lmdb_wr_end(txn, 0);
+}
+
+static int db_lmdb_subscr_update_imei_by_imsi(struct db_context *dbc, const char *imsi, const char *imei)
+{
+	struct lmdb_subscr rec;
+	MDB_txn *txn;
+	int64_t id;
+	int rc;
+
+	rc = lmdb_modify_by_imsi(dbc, imsi, &txn, &id, &rec);
+	if (rc == -ENOENT)
+		LOGP(DAUC, LOGL_ERROR, "Cannot update IMEI for subscriber IMSI='%s': no such subscriber\n", imsi);
+	if (rc)
+		return rc;
+
+	if (!strcmp(rec.imei, imei ? : "")) {
+		mdb_txn_abort(txn);
+		db_ctr_inc(dbc, DB_CTR_IMEI_SUPPRESSED);
+		return 0;
+	}
+
+	lmdb_del_index(dbc, txn, LMDB_DBI_IMEI, rec.imei, id);
+	if (imei) {
+		rc = lmdb_put_index(dbc, txn, LMDB_DBI_IMEI, imei, id, 0);
+		if (rc)
+			return lmdb_wr_end(txn, rc);
+		OSMO_STRLCPY_ARRAY(rec.imei, imei);
+	} else
+		rec.imei[0] = '\0';
+
+	return lmdb_wr_end(txn, lmdb_put_subscr(dbc, txn, id, &rec));
+}
+
+static int lmdb_get_by_index(struct db_context *dbc, enum lmdb_dbi dbi, const char *label, const char *key,
+			     struct hlr_subscriber *subscr)
+{
+	struct lmdb_subscr rec;
+	MDB_txn *txn;
+	int64_t id;
+	int rc;
+
+	if (lmdb_rd_begin(dbc, &txn))
+		return -EIO;
+	rc = lmdb_lookup_id(dbc, txn, dbi, key, &id);
+	if (!rc)
+		rc = lmdb_get_subscr(dbc, txn, id, &rec);
+	lmdb_rd_end(dbc);
+
+	if (rc) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot read subscriber from db: %s='%s': %s\n", label, key,
+		     rc == -ENOENT ? "No such subscriber" : "LMDB error");
+		return rc;
+	}
+	if (subscr)
+		lmdb_subscr_to_hlr(id, &rec, subscr);
+	return 0;
+}
+
+static int db_lmdb_subscr_get_by_imsi(struct db_context *dbc, const char *imsi, struct hlr_subscriber *subscr)
+{
+	return lmdb_get_by_index(dbc, LMDB_DBI_IMSI, "IMSI", imsi, subscr);
+}
+
+static int db_lmdb_subscr_get_by_msisdn(struct db_context *dbc, const char *msisdn, struct hlr_subscriber *subscr)
+{
+	return lmdb_get_by_index(dbc, LMDB_DBI_MSISDN, "MSISDN", msisdn, subscr);
+}
+
+static int db_lmdb_subscr_get_by_imei(struct db_context *dbc, const char *imei, struct hlr_subscriber *subscr)
+{
+	return lmdb_get_by_index(dbc, LMDB_DBI_IMEI, "IMEI", imei, subscr);
+}
+
+static int db_lmdb_subscr_get_by_id(struct db_context *dbc, int64_t id, struct hlr_subscriber *subscr)
+{
+	struct lmdb_subscr rec;
+	MDB_txn *txn;
+	int rc;
+
+	if (lmdb_rd_begin(dbc, &txn))
+		return -EIO;
+	rc = lmdb_get_subscr(dbc, txn, id, &rec);
+	lmdb_rd_end(dbc);
+
+	if (rc) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot read subscriber from db: ID=%" PRId64 ": %s\n", id,
+		     rc == -ENOENT ? "No such subscriber" : "LMDB error");
+		return rc;
+	}
+	if (subscr)
+		lmdb_subscr_to_hlr(id, &rec, subscr);
+	return 0;
+}
+
+static int db_lmdb_subscr_nam(struct db_context *dbc, const char *imsi, bool nam_val, bool is_ps)
+{
+	struct lmdb_subscr rec;
+	MDB_txn *txn;
+	int64_t id;
+	int rc;
+
+	rc = lmdb_modify_by_imsi(dbc, imsi, &txn, &id, &rec);
+	if (rc == -ENOENT)
+		LOGP(DAUC, LOGL_ERROR, "Cannot %s %s: no such subscriber: IMSI='%s'\n",
+		     nam_val ? "enable" : "disable", is_ps ? "PS" : "CS", imsi);
+	if (rc)
+		return rc;
+
+	if ((is_ps ? rec.nam_ps : rec.nam_cs) == nam_val) {
+		mdb_txn_abort(txn);
+		db_ctr_inc(dbc, DB_CTR_NAM_SUPPRESSED);
+		return 0;
+	}
+
+	if (is_ps)
+		rec.nam_ps = nam_val;
+	else
+		rec.nam_cs = nam_val;
+	return lmdb_wr_end(txn, lmdb_put_subscr(dbc, txn, id, &rec));
+}
+
+static int db_lmdb_subscr_lu(struct db_context *dbc, int64_t subscr_id,
+			     const char *vlr_or_sgsn_number, bool is_ps)
+{
+	struct lmdb_subscr rec;
+	struct timespec localtime;
+	MDB_txn *txn;
+	char *number;
+	int rc;
+
+	if (osmo_clock_gettime(CLOCK_REALTIME, &localtime) != 0) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot get the current time: (%d) %s\n", errno, strerror(errno));
+		return -errno;
+	}
+
+	if (lmdb_wr_begin(dbc, &txn))
+		return -EIO;
+	rc = lmdb_get_subscr(dbc, txn, subscr_id, &rec);
+	if (rc) {
+		if (rc == -ENOENT)
+			LOGP(DAUC, LOGL_ERROR, "Cannot update %s number for subscriber ID=%" PRId64
+			     ": no such subscriber\n", is_ps ? "SGSN" : "VLR", subscr_id);
+		return lmdb_wr_end(txn, rc);
+	}
+
+	number = is_ps ? rec.sgsn_number : rec.vlr_number;
+	if (!strcmp(number, vlr_or_sgsn_number ? : "")
+	    && rec.last_lu_seen && rec.last_lu_seen > localtime.tv_sec - dbc->last_lu_seen_granularity) {
+		mdb_txn_abort(txn);
+		db_ctr_inc(dbc, DB_CTR_LU_SUPPRESSED);
+		return 0;
+	}
+
+	osmo_strlcpy(number, vlr_or_sgsn_number, sizeof(rec.vlr_number));
+	rec.last_lu_seen = localtime.tv_sec;
+
+	return lmdb_wr_end(txn, lmdb_put_subscr(dbc, txn, subscr_id, &rec));
+}
+
+static int db_lmdb_subscr_purge(struct db_context *dbc, const char *by_imsi, bool purge_val, bool is_ps)
+{
+	struct lmdb_subscr rec;
+	MDB_txn *txn;
+	int64_t id;
+	int rc;
+
+	rc = lmdb_modify_by_imsi(dbc, by_imsi, &txn, &id, &rec);
+	if (rc == -ENOENT)
+		LOGP(DAUC, LOGL_ERROR, "Cannot %s %s: no such subscriber: IMSI='%s'\n",
+		     purge_val ? "purge" : "un-purge", is_ps ? "PS" : "CS", by_imsi);
+	if (rc)
+		return rc;
+
+	if (is_ps)
+		rec.ms_purged_ps = purge_val;
+	else
+		rec.ms_purged_cs = purge_val;
+	return lmdb_wr_end(txn, lmdb_put_subscr(dbc, txn, id, &rec));
+}
+
+static int db_lmdb_get_auth_data(struct db_context *dbc, const char *imsi,
+				 struct osmo_sub_auth_data *aud2g,
+				 struct osmo_sub_auth_data *aud3g,
+				 int64_t *subscr_id)
+{
+	struct lmdb_priv *priv = PRIV(dbc);
+	struct lmdb_id_key kbuf;
+	struct lmdb_auc_2g a2;
+	struct lmdb_auc_3g a3;
+	MDB_val k, v;
+	MDB_txn *txn;
+	int64_t id;
+	int ret = 0;
+	int rc;
+
+	memset(aud2g, 0, sizeof(*aud2g));
+	memset(aud3g, 0, sizeof(*aud3g));
+
+	if (lmdb_rd_begin(dbc, &txn))
+		return -EIO;
+
+	rc = lmdb_lookup_id(dbc, txn, LMDB_DBI_IMSI, imsi, &id);
+	if (rc) {
+		if (rc == -ENOENT)
+			LOGHLR(imsi, LOGL_INFO, "No such subscriber\n");
+		ret = rc;
+		goto out;
+	}
+	if (subscr_id)
+		*subscr_id = id;
+	k = id_key(&kbuf, id);
+
+	rc = mdb_get(txn, priv->dbi[LMDB_DBI_AUC_2G], &k, &v);
+	if (!rc && v.mv_size == sizeof(a2)) {
+		memcpy(&a2, v.mv_data, sizeof(a2));
+		aud2g->algo = a2.algo;
+		memcpy(aud2g->u.gsm.ki, a2.ki, sizeof(aud2g->u.gsm.ki));
+		aud2g->type = OSMO_AUTH_TYPE_GSM;
+	} else
+		LOGHLR(imsi, LOGL_DEBUG, "No 2G Auth Data\n");
+
+	rc = mdb_get(txn, priv->dbi[LMDB_DBI_AUC_3G], &k, &v);
+	if (!rc && v.mv_size == sizeof(a3)) {
+		memcpy(&a3, v.mv_data, sizeof(a3));
+		aud3g->algo = a3.algo;
+		memcpy(aud3g->u.umts.k, a3.k, sizeof(aud3g->u.umts.k));
+		memcpy(aud3g->u.umts.opc, a3.opc, sizeof(aud3g->u.umts.opc));
+		aud3g->u.umts.opc_is_op = a3.opc_is_op;
+		aud3g->u.umts.sqn = a3.sqn;
+		aud3g->u.umts.ind_bitlen = a3.ind_bitlen;
+		aud3g->type = OSMO_AUTH_TYPE_UMTS;
+	} else
+		LOGHLR(imsi, LOGL_DEBUG, "No 3G Auth Data\n");
+
+	if (aud2g->type == 0 && aud3g->type == 0)
+		ret = -ENOKEY;
+out:
+	lmdb_rd_end(dbc);
+	return ret;
+}
+
+static int db_lmdb_update_sqn(struct db_context *dbc, int64_t subscr_id, uint64_t new_sqn)
+{
+	MDB_dbi dbi = PRIV(dbc)->dbi[LMDB_DBI_AUC_3G];
+	struct lmdb_id_key kbuf;
+	MDB_val k = id_key(&kbuf, subscr_id);
+	struct lmdb_auc_3g a3;
+	MDB_val v;
+	MDB_txn *txn;
+	int rc;
+
+	if (lmdb_wr_begin(dbc, &txn))
+		return -EIO;
+
+	rc = mdb_get(txn, dbi, &k, &v);
+	if (rc || v.mv_size != sizeof(a3)) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot update SQN for subscriber ID=%" PRId64
+		     ": no auc_3g entry for such subscriber\n", subscr_id);
+		return lmdb_wr_end(txn, -ENOENT);
+	}
+	memcpy(&a3, v.mv_data, sizeof(a3));
+	a3.sqn = new_sqn;
+	v = (MDB_val){ .mv_size = sizeof(a3), .mv_data = &a3 };
+	rc = mdb_put(txn, dbi, &k, &v, 0);
+	if (rc) {
+		LOGP(DAUC, LOGL_ERROR, "Cannot update SQN for subscriber ID=%" PRId64 ": %s\n",
+		     subscr_id, mdb_strerror(rc));
+		return lmdb_wr_end(txn, -EIO);
+	}
+	return lmdb_wr_end(txn, 0);
+}
+
+const struct db_ops db_lmdb_ops = {
+	.name = "LMDB",
+	.open = db_lmdb_open,
+	.close = db_lmdb_close,
+	.subscr_create = db_lmdb_subscr_create,
+	.subscr_delete_by_id = db_lmdb_subscr_delete_by_id,
+	.subscr_update_msisdn_by_imsi = db_lmdb_subscr_update_msisdn_by_imsi,
+	.subscr_update_aud_by_id = db_lmdb_subscr_update_aud_by_id,
+	.subscr_update_imei_by_imsi = db_lmdb_subscr_update_imei_by_imsi,
+	.subscr_get_by_imsi = db_lmdb_subscr_get_by_imsi,
+	.subscr_get_by_msisdn = db_lmdb_subscr_get_by_msisdn,
+	.subscr_get_by_id = db_lmdb_subscr_get_by_id,
+	.subscr_get_by_imei = db_lmdb_subscr_get_by_imei,
+	.subscr_nam = db_lmdb_subscr_nam,
+	.subscr_lu = db_lmdb_subscr_lu,
+	.subscr_purge = db_lmdb_subscr_purge,
+	.get_auth_data = db_lmdb_get_auth_data,
+	.update_sqn = db_lmdb_update_sqn,
+};
@@ -0,0 +1,55 @@
+/* SQLite storage backend, see struct db_ops */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "db.h"
+
+int db_sqlite_subscr_create(struct db_context *dbc, const char *imsi);
+int db_sqlite_subscr_delete_by_id(struct db_context *dbc, int64_t subscr_id);
+int db_sqlite_subscr_update_msisdn_by_imsi(struct db_context *dbc, const char *imsi,
+					   const char *msisdn);
+int db_sqlite_subscr_update_aud_by_id(struct db_context *dbc, int64_t subscr_id,
+				      const struct sub_auth_data_str *aud);
+int db_sqlite_subscr_update_imei_by_imsi(struct db_context *dbc, const char* imsi, const char *imei);
+
+int db_sqlite_subscr_get_by_imsi(struct db_context *dbc, const char *imsi, struct hlr_subscriber *subscr);
+int db_sqlite_subscr_get_by_msisdn(struct db_context *dbc, const char *msisdn, struct hlr_subscriber *subscr);
+int db_sqlite_subscr_get_by_id(struct db_context *dbc, int64_t id, struct hlr_subscriber *subscr);
+int db_sqlite_subscr_get_by_imei(struct db_context *dbc, const char *imei, struct hlr_subscriber *subscr);
+
+int db_sqlite_subscr_nam(struct db_context *dbc, const char *imsi, bool nam_val, bool is_ps);
+int db_sqlite_subscr_lu(struct db_context *dbc, int64_t subscr_id,
+			const char *vlr_or_sgsn_number, bool is_ps);
+int db_sqlite_subscr_purge(struct db_context *dbc, const char *by_imsi,
+			   bool purge_val, bool is_ps);
+
+int db_sqlite_get_auth_data(struct db_context *dbc, const char *imsi,
+			    struct osmo_sub_auth_data *aud2g,
+			    struct osmo_sub_auth_data *aud3g,
+			    int64_t *subscr_id);
+int db_sqlite_update_sqn(struct db_context *dbc, int64_t subscr_id, uint64_t new_sqn);
+
+int db_sqlite_change_last_seq(struct db_context *dbc, int64_t *seq);
+int db_sqlite_change_since(struct db_context *dbc, int64_t seq, unsigned int max, db_change_cb_t cb, void *data);
+int db_sqlite_change_trim(struct db_context *dbc, int64_t seq);
+
+int db_sqlite_subscr_imsi_iter(struct db_context *dbc, db_imsi_cb_t cb, void *data);
@@ -0,0 +1,123 @@
+/* Recording of GSUP traffic for replay */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/bits.h>
+#include <osmocom/abis/ipa.h>
+#include <osmocom/gsm/gsup.h>
+
+#include "gsup_server.h"
+#include "gsup_record.h"
+
+/*! Create a capture file and start recording to it.
+ * \param[in] ctx  talloc context.
+ * \param[in] path  File to create, an existing file is truncated.
+ * \returns new recording, or NULL (with errno set) if the file cannot be created.
+ */
+struct gsup_record *gsup_record_start(void *ctx, const char *path)
+{
+	struct gsup_record *rec;
+	FILE *f;
+
+	f = fopen(path, "w");
+	if (!f)
+		return NULL;
+	if (fwrite(GSUP_RECORD_MAGIC, strlen(GSUP_RECORD_MAGIC), 1, f) != 1) {
+		int err = errno;
+		fclose(f);
+		errno = err;
+		return NULL;
+	}
+
+	rec = talloc_zero(ctx, struct gsup_record);
+	OSMO_ASSERT(rec);
+	rec->path = talloc_strdup(rec, path);
+	rec->f = f;
+	LOGP(DLGSUP, LOGL_NOTICE, "Recording GSUP traffic to %s\n", path);
+	return rec;
+}
+
+/*! Flush and close the capture file, and free rec. */
+void gsup_record_stop(struct gsup_record *rec)
+{
+	if (fclose(rec->f))
+		LOGP(DLGSUP, LOGL_ERROR, "Writing %s failed: %s\n", rec->path, strerror(errno));
+	LOGP(DLGSUP, LOGL_NOTICE, "Recorded %lu GSUP messages (%lu bytes) to %s\n", rec->msgs, rec->bytes, rec->path);
+	talloc_free(rec);
+}
+
+/*! Append a GSUP message received from or sent to conn.
+ * \param[in] rec  Recording.
+ * \param[in] conn  Peer.
+ * \param[in] tx  True for a message sent by the HLR, which is cut after the IMSI IE.
+ * \param[in] data  GSUP message, starting with the message type.
+ * \param[in] len  Length of data.
+ */
+void gsup_record_msg(struct gsup_record *rec, struct osmo_gsup_conn *conn, bool tx, const uint8_t *data, size_t len)
+{
+	uint8_t hdr[12];
+	struct timeval tv;
+	char *name = NULL;
+	int name_len;
+
+	name_len = osmo_gsup_conn_ccm_get(conn, (uint8_t **) &name, IPAC_IDTAG_SERNR);
+	/* not identified yet, the replay could not impersonate it */
+	if (name_len <= 0 || !len)
+		return;
+	/* ccm_get() counts the terminating nul */
+	name_len = strnlen(name, name_len);
+	if (name_len > 255 || len > 0xffff) {
+		rec->errors++;
+		return;
+	}
+
+	if (tx) {
+		if (len >= 3 && data[1] == OSMO_GSUP_IMSI_IE && len >= 3 + data[2])
+			len = 3 + data[2];
+		else
+			len = 1;
+	}
+
+	osmo_gettimeofday(&tv, NULL);
+	osmo_store32be(tv.tv_sec, &hdr[0]);
+	osmo_store32be(tv.tv_usec, &hdr[4]);
+	hdr[8] = tx ? GSUP_RECORD_F_TX : 0;
+	hdr[9] = name_len;
+	osmo_store16be(len, &hdr[10]);
+
+	if (fwrite(hdr, sizeof(hdr), 1, rec->f) != 1
+	    || fwrite(name, name_len, 1, rec->f) != 1
+	    || fwrite(data, len, 1, rec->f) != 1) {
+		if (!rec->errors)
+			LOGP(DLGSUP, LOGL_ERROR, "Writing %s failed: %s\n", rec->path, strerror(errno));
+		rec->errors++;
+		return;
+	}
+	rec->msgs++;
+	rec->bytes += sizeof(hdr) + name_len + len;
+}
@@ -0,0 +1,54 @@
+/* Recording of GSUP traffic for replay, see contrib/gsup-replay.py */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct osmo_gsup_conn;
+
+/* Capture file format, all numbers big endian:
+ *
+ * "GSUPREC1"                                   file header
+ * u32 sec, u32 usec, u8 flags, u8 name_len, u16 len, name, data    per message
+ *
+ * sec and usec are the wall clock time the message was received or queued, name is the IPA name of the peer,
+ * data the GSUP message (without IPA header). flags has GSUP_RECORD_F_TX set for messages sent by the HLR.
+ * These are only recorded up to and including the IMSI IE, enough to match them to the requests they answer,
+ * and not to put auth vectors or subscriber data into the capture file. */
+#define GSUP_RECORD_MAGIC	"GSUPREC1"
+#define GSUP_RECORD_F_TX	0x01
+
+struct gsup_record {
+	char *path;
+	FILE *f;
+	unsigned long msgs;
+	unsigned long bytes;
+	/* messages not recorded because writing failed */
+	unsigned long errors;
+};
+
+struct gsup_record *gsup_record_start(void *ctx, const char *path);
+void gsup_record_stop(struct gsup_record *rec);
+void gsup_record_msg(struct gsup_record *rec, struct osmo_gsup_conn *conn, bool tx, const uint8_t *data, size_t len);
@@ -0,0 +1,104 @@
+/* Scanning the routing IEs of GSUP messages, without decoding them completely */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/tlv.h>
+#include <osmocom/gsm/gsm48_ie.h>
+#include <osmocom/gsm/gsup.h>
+
+#include "gsup_scan.h"
+
+/*! Extract what is needed to route a GSUP message from it, like osmo_gsup_decode() but without decoding auth
+ * tuples, PDP infos, SS payloads etc. Only message_type, imsi, message_class, source_name, destination_name,
+ * session_id, session_state, auts and rand are set in gsup, all other members are zero. Messages forwarded to
+ * other GSUP clients or cluster nodes are sent unchanged and need no more than that; messages the HLR handles
+ * itself still need to be decoded with osmo_gsup_decode().
+ * \param[in] data  GSUP message.
+ * \param[in] data_len  Length of data.
+ * \param[out] gsup  Scanned message, pointing into data.
+ * \returns 0 on success, negative GMM cause on malformed TLVs.
+ */
+int gsup_scan(const uint8_t *data, size_t data_len, struct osmo_gsup_message *gsup)
+{
+	uint8_t tag;
+	const uint8_t *value;
+	size_t value_len;
+	int rc;
+
+	memset(gsup, 0, sizeof(*gsup));
+
+	if (data_len < 1)
+		return -GMM_CAUSE_INV_MAND_INFO;
+	gsup->message_type = data[0];
+	data++;
+	data_len--;
+
+	while (data_len > 0) {
+		rc = osmo_shift_tlv(&data, &data_len, &tag, &value, &value_len);
+		if (rc < 0)
+			return -GMM_CAUSE_PROTO_ERR_UNSPEC;
+
+		switch (tag) {
+		case OSMO_GSUP_IMSI_IE:
+			/* value - 1 is the length octet, as in osmo_gsup_decode() */
+			gsm48_decode_bcd_number(gsup->imsi, sizeof(gsup->imsi), value - 1, 0);
+			break;
+		case OSMO_GSUP_MESSAGE_CLASS_IE:
+			if (value_len < 1)
+				return -GMM_CAUSE_INV_MAND_INFO;
+			gsup->message_class = value[0];
+			break;
+		case OSMO_GSUP_SOURCE_NAME_IE:
+			gsup->source_name = value;
+			gsup->source_name_len = value_len;
+			break;
+		case OSMO_GSUP_DESTINATION_NAME_IE:
+			gsup->destination_name = value;
+			gsup->destination_name_len = value_len;
+			break;
+		case OSMO_GSUP_SESSION_ID_IE:
+			gsup->session_id = osmo_decode_big_endian(value, value_len);
+			break;
+		case OSMO_GSUP_SESSION_STATE_IE:
+			if (value_len < 1)
+				return -GMM_CAUSE_INV_MAND_INFO;
+			gsup->session_state = value[0];
+			break;
+		case OSMO_GSUP_AUTS_IE:
+			if (value_len != 14)
+				return -GMM_CAUSE_INV_MAND_INFO;
+			gsup->auts = value;
+			break;
+		case OSMO_GSUP_RAND_IE:
+			if (value_len != 16)
+				return -GMM_CAUSE_INV_MAND_INFO;
+			gsup->rand = value;
+			break;
+		default:
+			/* decoded by osmo_gsup_decode() if needed */
+			break;
+		}
+	}
+
+	return 0;
+}
@@ -18,6 +18,13 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/logging.h>
@@ -26,18 +33,282 @@
 #include <osmocom/abis/ipaccess.h>
 #include <osmocom/gsm/gsm48_ie.h>
 #include <osmocom/gsm/apn.h>
+#include <osmocom/gsm/ipa.h>
 
 #include "gsup_server.h"
 #include "gsup_router.h"
+#include "probes.h"
+#include "logring.h"
+
+/* Write as many queued messages as the socket takes, in batches of up to this many */
+#define GSUP_TX_IOV_MAX	64
+
+#ifdef HAVE_SYS_EPOLL_H
+/* Dispatch at most this many fd events per main loop iteration; more stay pending in the epoll instance, which
+ * then remains readable. */
+#define GSUP_EPOLL_MAX_EVENTS	256
+
+static uint32_t gsup_epoll_events(unsigned int when)
+{
+	uint32_t events = 0;
+
+	if (when & BSC_FD_READ)
+		events |= EPOLLIN;
+	if (when & BSC_FD_WRITE)
+		events |= EPOLLOUT;
+	return events;
+}
+
+/* The epoll instance is readable: call the fd callbacks of the sockets that are ready, in constant time
+ * regardless of how many are idle. */
+static int gsup_epoll_cb(struct osmo_fd *epoll_ofd, unsigned int what)
+{
+	struct osmo_gsup_server *gs = epoll_ofd->data;
+	struct epoll_event ev[GSUP_EPOLL_MAX_EVENTS];
+	int i, n;
+
+	n = epoll_wait(epoll_ofd->fd, ev, ARRAY_SIZE(ev), 0);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+	gs->epoll.wakeups++;
+	gs->epoll.events += n;
+
+	for (i = 0; i < n; i++) {
+		struct osmo_fd *ofd = ev[i].data.ptr;
+		unsigned int flags = 0;
+		unsigned long closed = gs->epoll.closed;
+
+		/* Let the read path see the error or EOF and close the connection */
+		if (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+			flags |= BSC_FD_READ;
+		if (ev[i].events & EPOLLOUT)
+			flags |= BSC_FD_WRITE;
+		flags &= ofd->when;
+		if (!flags)
+			continue;
+		ofd->cb(ofd, flags);
+		/* Like libosmocore's unregistered_count: a connection closed by the callback may come later in ev[],
+		 * with its ofd freed. Leave the rest of ev[] pending, the epoll instance stays readable. */
+		if (gs->epoll.closed != closed)
+			break;
+	}
+	return 0;
+}
 
-static void osmo_gsup_server_send(struct osmo_gsup_conn *conn,
+/* Move ofd from the main loop's select() set to the epoll instance. libosmo-abis still owns ofd and will
+ * osmo_fd_unregister() it before closing the socket, which removes it from the epoll instance; re-init its
+ * list head so that unregistering is harmless. */
+static int gsup_epoll_add(struct osmo_gsup_server *gs, struct osmo_fd *ofd)
+{
+	struct epoll_event ev = {
+		.events = gsup_epoll_events(ofd->when),
+		.data.ptr = ofd,
+	};
+
+	if (epoll_ctl(gs->epoll.ofd.fd, EPOLL_CTL_ADD, ofd->fd, &ev) < 0)
+		return -errno;
+	osmo_fd_unregister(ofd);
+	INIT_LLIST_HEAD(&ofd->list);
+	return 0;
+}
+
+/* Create the epoll instance and register it with the main loop */
+static int gsup_epoll_open(struct osmo_gsup_server *gs)
+{
+	int fd;
+
+	fd = epoll_create1(EPOLL_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	gs->epoll.ofd.fd = fd;
+	gs->epoll.ofd.when = BSC_FD_READ;
+	gs->epoll.ofd.cb = gsup_epoll_cb;
+	gs->epoll.ofd.data = gs;
+	if (osmo_fd_register(&gs->epoll.ofd)) {
+		close(fd);
+		gs->epoll.ofd.fd = -1;
+		return -EIO;
+	}
+	return 0;
+}
+#endif
+
+/* Apply changes of ofd->when of a socket watched by the epoll instance */
+static void gsup_fd_update(struct osmo_gsup_server *gs, struct osmo_fd *ofd)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event ev = {
+		.events = gsup_epoll_events(ofd->when),
+		.data.ptr = ofd,
+	};
+
+	if (gs->epoll.ofd.fd < 0)
+		return;
+	if (epoll_ctl(gs->epoll.ofd.fd, EPOLL_CTL_MOD, ofd->fd, &ev) < 0)
+		LOGP(DLGSUP, LOGL_ERROR, "epoll_ctl(fd %d) failed: %s\n", ofd->fd, strerror(errno));
+#endif
+}
+
+static void gsup_conn_tx_throttle(struct osmo_gsup_conn *conn, bool throttle)
+{
+	struct osmo_fd *ofd = &conn->conn->ofd;
+
+	if (conn->tx.throttled == throttle)
+		return;
+	conn->tx.throttled = throttle;
+	if (throttle) {
+		LOGP(DLGSUP, LOGL_NOTICE, "GSUP client %s:%u: %u messages queued, not reading until it catches up\n",
+		     conn->conn->addr, conn->conn->port, conn->tx.len);
+		conn->tx.stats.throttled++;
+		ofd->when &= ~BSC_FD_READ;
+	} else {
+		LOGP(DLGSUP, LOGL_NOTICE, "GSUP client %s:%u: caught up, reading again\n",
+		     conn->conn->addr, conn->conn->port);
+		ofd->when |= BSC_FD_READ;
+	}
+	gsup_fd_update(conn->server, ofd);
+}
+
+/* Write the queued messages; return negative if the connection failed */
+static int gsup_conn_tx_flush(struct osmo_gsup_conn *conn)
+{
+	struct osmo_fd *ofd = &conn->conn->ofd;
+	struct iovec iov[GSUP_TX_IOV_MAX];
+	struct msgb *msg, *msg2;
+	unsigned int n;
+	ssize_t rc;
+
+	while (!llist_empty(&conn->tx.queue)) {
+		n = 0;
+		llist_for_each_entry(msg, &conn->tx.queue, list) {
+			if (n == ARRAY_SIZE(iov))
+				break;
+			iov[n++] = (struct iovec){ .iov_base = msg->data, .iov_len = msg->len };
+		}
+
+		rc = writev(ofd->fd, iov, n);
+		if (rc < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				break;
+			LOGP(DLGSUP, LOGL_ERROR, "GSUP client %s:%u: write failed: %s\n",
+			     conn->conn->addr, conn->conn->port, strerror(errno));
+			return -errno;
+		}
+		conn->tx.stats.writev++;
+
+		llist_for_each_entry_safe(msg, msg2, &conn->tx.queue, list) {
+			if (rc < msg->len) {
+				msgb_pull(msg, rc);
+				break;
+			}
+			rc -= msg->len;
+			llist_del(&msg->list);
+			msgb_free(msg);
+			conn->tx.len--;
+			conn->tx.stats.msgs++;
+		}
+		/* short write: the socket buffer is full */
+		if (!llist_empty(&conn->tx.queue) && n < ARRAY_SIZE(iov))
+			break;
+	}
+
+	if (llist_empty(&conn->tx.queue)) {
+		ofd->when &= ~BSC_FD_WRITE;
+		gsup_fd_update(conn->server, ofd);
+	}
+	if (conn->tx.throttled && conn->tx.len <= conn->server->tx_queue.low)
+		gsup_conn_tx_throttle(conn, false);
+	return 0;
+}
+
+static void gsup_conn_tx_drop(struct osmo_gsup_conn *conn)
+{
+	struct msgb *msg, *msg2;
+
+	llist_for_each_entry_safe(msg, msg2, &conn->tx.queue, list) {
+		llist_del(&msg->list);
+		msgb_free(msg);
+	}
+	conn->tx.len = 0;
+}
+
+/* Replaces the ipa_server_conn's fd callback: writes are batched by gsup_conn_tx_flush(), reads still go to
+ * libosmo-abis. Keep this function non-static to allow linking in a unit test. */
+int osmo_gsup_conn_fd_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	struct ipa_server_conn *isc = ofd->data;
+	struct osmo_gsup_conn *conn = isc->data;
+
+	if ((what & BSC_FD_WRITE) && gsup_conn_tx_flush(conn) < 0) {
+		/* frees conn via osmo_gsup_server_closed_cb() */
+		ipa_server_conn_destroy(isc);
+		return -EBADF;
+	}
+	if (what & BSC_FD_READ)
+		return conn->tx.ipa_fd_cb(ofd, BSC_FD_READ);
+	return 0;
+}
+
+/* Queue msg, with IPA header, to be written once the main loop sees the socket writable */
+static void gsup_conn_tx_enqueue(struct osmo_gsup_conn *conn, struct msgb *msg)
+{
+	struct osmo_gsup_server *gs = conn->server;
+
+	msgb_enqueue(&conn->tx.queue, msg);
+	conn->tx.len++;
+	if (conn->tx.len > conn->tx.stats.peak)
+		conn->tx.stats.peak = conn->tx.len;
+	if (!(conn->conn->ofd.when & BSC_FD_WRITE)) {
+		conn->conn->ofd.when |= BSC_FD_WRITE;
+		gsup_fd_update(gs, &conn->conn->ofd);
+	}
+
+	if (conn->tx.len > gs->tx_queue.high)
+		gsup_conn_tx_throttle(conn, true);
+}
+
+/* Queue an IPA CCM message without payload. It must not be written to the socket directly, where it could end
+ * up in the middle of a partly written message of the tx queue. */
+static void gsup_conn_tx_ccm(struct osmo_gsup_conn *conn, uint8_t msg_type)
+{
+	struct msgb *msg = msgb_alloc_headroom(16, 8, "IPA CCM");
+
+	OSMO_ASSERT(msg);
+	*msgb_put(msg, 1) = msg_type;
+	ipa_msg_push_header(msg, IPAC_PROTO_IPACCESS);
+	gsup_conn_tx_enqueue(conn, msg);
+}
+
+static int osmo_gsup_server_send(struct osmo_gsup_conn *conn,
 			     int proto_ext, struct msgb *msg_tx)
 {
+	struct osmo_gsup_server *gs = conn->server;
+
+	if (conn->tx.len >= gs->tx_queue.limit) {
+		if (!conn->tx.stats.dropped)
+			LOGP(DLGSUP, LOGL_ERROR, "GSUP client %s:%u: %u messages queued, dropping messages\n",
+			     conn->conn->addr, conn->conn->port, conn->tx.len);
+		conn->tx.stats.dropped++;
+		msgb_free(msg_tx);
+		return -ENOBUFS;
+	}
+
+	if (proto_ext == IPAC_PROTO_EXT_GSUP) {
+		HLR_PROBE3(gsup_tx, conn->auc_3g_ind, msgb_length(msg_tx) ? msg_tx->data[0] : 0, msgb_length(msg_tx));
+		gsup_stats_tx(conn, msgb_data(msg_tx), msgb_length(msg_tx));
+		if (gs->record)
+			gsup_record_msg(gs->record, conn, true, msgb_data(msg_tx), msgb_length(msg_tx));
+	}
 	ipa_prepend_header_ext(msg_tx, proto_ext);
 	ipa_msg_push_header(msg_tx, IPAC_PROTO_OSMO);
-	ipa_server_conn_send(conn->conn, msg_tx);
+	gsup_conn_tx_enqueue(conn, msg_tx);
+	return 0;
 }
 
+/*! Queue a GSUP message to a client, to be written in the next main loop iteration.
+ * \returns 0 on success, -ENOTCONN without conn, -ENOBUFS if the client's tx queue is full. msg is freed in
+ *          any case.
+ */
 int osmo_gsup_conn_send(struct osmo_gsup_conn *conn, struct msgb *msg)
 {
 	if (!conn) {
@@ -45,9 +316,7 @@ int osmo_gsup_conn_send(struct osmo_gsup_conn *conn, struct msgb *msg)
 		return -ENOTCONN;
 	}
 
-	osmo_gsup_server_send(conn, IPAC_PROTO_EXT_GSUP, msg);
-
-	return 0;
+	return osmo_gsup_server_send(conn, IPAC_PROTO_EXT_GSUP, msg);
 }
 
 static int osmo_gsup_conn_oap_handle(struct osmo_gsup_conn *conn,
@@ -67,8 +336,11 @@ static int osmo_gsup_conn_oap_handle(struct osmo_gsup_conn *conn,
 	return 0;
 }
 
-/* Data from a given client has arrived over the socket */
-static int osmo_gsup_server_read_cb(struct ipa_server_conn *conn,
+static int osmo_gsup_conn_rx_ccm(struct osmo_gsup_conn *clnt, struct msgb *msg);
+
+/* Data from a given client has arrived over the socket. Keep this function non-static to allow linking in a
+ * unit test. */
+int osmo_gsup_server_read_cb(struct ipa_server_conn *conn,
 			       struct msgb *msg)
 {
 	struct ipaccess_head *hh = (struct ipaccess_head *) msg->data;
@@ -79,12 +351,13 @@ static int osmo_gsup_server_read_cb(struct ipa_server_conn *conn,
 	msg->l2h = &hh->data[0];
 
 	if (hh->proto == IPAC_PROTO_IPACCESS) {
-		rc = ipa_server_conn_ccm(conn, msg);
+		rc = osmo_gsup_conn_rx_ccm(clnt, msg);
+		msgb_free(msg);
 		if (rc < 0) {
-			/* conn is already invalid here! */
+			/* frees clnt via osmo_gsup_server_closed_cb() */
+			ipa_server_conn_destroy(conn);
 			return -1;
 		}
-		msgb_free(msg);
 		return 0;
 	}
 
@@ -102,6 +375,10 @@ static int osmo_gsup_server_read_cb(struct ipa_server_conn *conn,
 	msg->l2h = &he->data[0];
 
 	if (he->proto == IPAC_PROTO_EXT_GSUP) {
+		HLR_PROBE3(gsup_rx, clnt->auc_3g_ind, msgb_l2len(msg) ? msg->l2h[0] : 0, msgb_l2len(msg));
+		gsup_stats_rx(clnt, msgb_l2(msg), msgb_l2len(msg));
+		if (clnt->server->record)
+			gsup_record_msg(clnt->server->record, clnt, false, msgb_l2(msg), msgb_l2len(msg));
 		OSMO_ASSERT(clnt->server->read_cb != NULL);
 		clnt->server->read_cb(clnt, msg);
 		/* expecting read_cb() to free msg */
@@ -117,9 +394,10 @@ static int osmo_gsup_server_read_cb(struct ipa_server_conn *conn,
 	return 0;
 
 invalid:
-	LOGP(DLGSUP, LOGL_NOTICE,
-	     "GSUP received an invalid IPA message from %s:%d: %s\n",
-	     conn->addr, conn->port, osmo_hexdump(msgb_l2(msg), msgb_l2len(msg)));
+	gsup_stats_inc(clnt, GSUP_CONN_CTR_RX_INVALID);
+	LOGPR(DLGSUP, LOGL_NOTICE,
+	      "GSUP received an invalid IPA message from %s:%d: %s\n",
+	      conn->addr, conn->port, LOGRING_HEXDUMP(msgb_l2(msg), msgb_l2len(msg)));
 	msgb_free(msg);
 	return -1;
 
@@ -195,10 +473,80 @@ static int osmo_gsup_server_ccm_cb(struct ipa_server_conn *conn,
 		return -EINVAL;
 	}
 
-	gsup_route_add(clnt, addr, addr_len);
+	/* Several processes may connect with the same name, e.g. the members of
+	 * an EUSE pool. Only one of them is reachable by that name at a time:
+	 * the first one, and the next one takes over once it disconnects, see
+	 * gsup_route_hand_over(). */
+	if (gsup_route_add(clnt, addr, addr_len) == -EEXIST)
+		LOGP(DLGSUP, LOGL_NOTICE, "GSUP client %s:%u: another client is"
+		     " already routed by the name %s, this one is not\n",
+		     conn->addr, conn->port, addr);
+	if (clnt->server->conn_up_cb)
+		clnt->server->conn_up_cb(clnt);
 	return 0;
 }
 
+/* Route the name of a closing client to another client of the same name */
+static void gsup_route_hand_over(struct osmo_gsup_conn *clnt)
+{
+	struct osmo_gsup_conn *c;
+	uint8_t *addr, *c_addr;
+	int addr_len;
+
+	addr_len = osmo_gsup_conn_ccm_get(clnt, &addr, IPAC_IDTAG_SERNR);
+	if (addr_len <= 0)
+		return;
+
+	llist_for_each_entry(c, &clnt->server->clients, list) {
+		if (c == clnt)
+			continue;
+		if (osmo_gsup_conn_ccm_get(c, &c_addr, IPAC_IDTAG_SERNR) != addr_len
+		    || memcmp(addr, c_addr, addr_len))
+			continue;
+		if (gsup_route_add(c, addr, addr_len) == 0)
+			return;
+	}
+}
+
+/* Instead of ipa_server_conn_ccm(), which writes its answers straight to the socket, handle CCM messages like it
+ * does, but queue the answers behind the GSUP messages. Return negative to close the connection. */
+static int osmo_gsup_conn_rx_ccm(struct osmo_gsup_conn *clnt, struct msgb *msg)
+{
+	struct tlv_parsed tlvp;
+	uint8_t msg_type;
+	int rc;
+
+	if (msgb_l2len(msg) < 1) {
+		LOGP(DLGSUP, LOGL_NOTICE, "GSUP client %s:%u: short IPA CCM message\n",
+		     clnt->conn->addr, clnt->conn->port);
+		return -EINVAL;
+	}
+	msg_type = msg->l2h[0];
+
+	switch (msg_type) {
+	case IPAC_MSGT_PING:
+		gsup_conn_tx_ccm(clnt, IPAC_MSGT_PONG);
+		return 0;
+	case IPAC_MSGT_PONG:
+		return 0;
+	case IPAC_MSGT_ID_ACK:
+		gsup_conn_tx_ccm(clnt, IPAC_MSGT_ID_ACK);
+		return 0;
+	case IPAC_MSGT_ID_RESP:
+		rc = ipa_ccm_id_resp_parse(&tlvp, msg->l2h + 1, msgb_l2len(msg) - 1);
+		if (rc < 0) {
+			LOGP(DLGSUP, LOGL_ERROR, "GSUP client %s:%u: cannot parse IPA ID response\n",
+			     clnt->conn->addr, clnt->conn->port);
+			return rc;
+		}
+		return osmo_gsup_server_ccm_cb(clnt->conn, msg, &tlvp, NULL);
+	default:
+		LOGP(DLGSUP, LOGL_NOTICE, "GSUP client %s:%u: unknown IPA CCM message type 0x%02x\n",
+		     clnt->conn->addr, clnt->conn->port, msg_type);
+		return 0;
+	}
+}
+
 static int osmo_gsup_server_closed_cb(struct ipa_server_conn *conn)
 {
 	struct osmo_gsup_conn *clnt = (struct osmo_gsup_conn *)conn->data;
@@ -206,8 +554,14 @@ static int osmo_gsup_server_closed_cb(struct ipa_server_conn *conn)
 	LOGP(DLGSUP, LOGL_INFO, "Lost GSUP client %s:%d\n",
 		conn->addr, conn->port);
 
-	gsup_route_del_conn(clnt);
+	if (clnt->server->conn_down_cb)
+		clnt->server->conn_down_cb(clnt);
+	if (gsup_route_del_conn(clnt))
+		gsup_route_hand_over(clnt);
+	gsup_conn_tx_drop(clnt);
+	gsup_stats_free(clnt);
 	llist_del(&clnt->list);
+	clnt->server->epoll.closed++;
 	talloc_free(clnt);
 
 	return 0;
@@ -258,23 +612,52 @@ static int osmo_gsup_server_accept_cb(struct ipa_server_link *link, int fd)
 		(struct osmo_gsup_server *) link->data;
 	int rc;
 
+	/* ipa_server_conn_create() registers fd with the main loop's select(), even if it is moved to the epoll
+	 * instance right after, and select() cannot take an fd beyond FD_SETSIZE. */
+	if (fd >= FD_SETSIZE) {
+		LOGP(DLGSUP, LOGL_ERROR, "Rejecting GSUP client on fd %d, at most %d open files are supported\n",
+		     fd, FD_SETSIZE);
+		close(fd);
+		return -EMFILE;
+	}
+
 	conn = talloc_zero(gsups, struct osmo_gsup_conn);
 	OSMO_ASSERT(conn);
 
 	conn->conn = ipa_server_conn_create(gsups, link, fd,
 					   osmo_gsup_server_read_cb,
 					   osmo_gsup_server_closed_cb, conn);
-	OSMO_ASSERT(conn->conn);
-	conn->conn->ccm_cb = osmo_gsup_server_ccm_cb;
+	if (!conn->conn) {
+		LOGP(DLGSUP, LOGL_ERROR, "Cannot set up GSUP client connection on fd %d\n", fd);
+		close(fd);
+		talloc_free(conn);
+		return -ENOMEM;
+	}
+
+	INIT_LLIST_HEAD(&conn->tx.queue);
+	conn->tx.ipa_fd_cb = conn->conn->ofd.cb;
+	conn->conn->ofd.cb = osmo_gsup_conn_fd_cb;
+	/* gsup_conn_tx_flush() writes as much as the socket takes */
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef HAVE_SYS_EPOLL_H
+	if (gsups->epoll.ofd.fd >= 0) {
+		rc = gsup_epoll_add(gsups, &conn->conn->ofd);
+		if (rc < 0)
+			LOGP(DLGSUP, LOGL_ERROR, "Cannot add GSUP client fd %d to epoll, using select(): %s\n",
+			     fd, strerror(-rc));
+	}
+#endif
 
 	/* link data structure with server structure */
 	conn->server = gsups;
 	osmo_gsup_server_add_conn(&gsups->clients, conn);
+	/* per IND, so after osmo_gsup_server_add_conn() */
+	gsup_stats_init(conn);
 
 	LOGP(DLGSUP, LOGL_INFO, "New GSUP client %s:%d (IND=%u)\n",
 	     conn->conn->addr, conn->conn->port, conn->auc_3g_ind);
 
-	/* request the identity of the client */
+	/* request the identity of the client; written directly, as nothing can be queued yet */
 	rc = ipa_ccm_send_id_req(fd);
 	if (rc < 0)
 		goto failed;
@@ -302,6 +685,10 @@ osmo_gsup_server_create(void *ctx, const char *ip_addr, uint16_t tcp_port,
 
 	INIT_LLIST_HEAD(&gsups->clients);
 	INIT_LLIST_HEAD(&gsups->routes);
+	gsups->epoll.ofd.fd = -1;
+	gsups->tx_queue.limit = OSMO_GSUP_TX_QUEUE_LIMIT_DEFAULT;
+	gsups->tx_queue.high = OSMO_GSUP_TX_QUEUE_HIGH_DEFAULT;
+	gsups->tx_queue.low = OSMO_GSUP_TX_QUEUE_LOW_DEFAULT;
 
 	gsups->link = ipa_server_link_create(gsups,
 					/* no e1inp */ NULL,
@@ -318,6 +705,14 @@ osmo_gsup_server_create(void *ctx, const char *ip_addr, uint16_t tcp_port,
 	if (rc < 0)
 		goto failed;
 
+#ifdef HAVE_SYS_EPOLL_H
+	rc = gsup_epoll_open(gsups);
+	if (rc == 0)
+		rc = gsup_epoll_add(gsups, &gsups->link->ofd);
+	if (rc < 0)
+		LOGP(DLGSUP, LOGL_ERROR, "Cannot use epoll for GSUP, falling back to select(): %s\n", strerror(-rc));
+#endif
+
 	gsups->luop = lu_op_lst;
 
 	return gsups;
@@ -329,11 +724,20 @@ failed:
 
 void osmo_gsup_server_destroy(struct osmo_gsup_server *gsups)
 {
+	if (gsups->record) {
+		gsup_record_stop(gsups->record);
+		gsups->record = NULL;
+	}
 	if (gsups->link) {
 		ipa_server_link_close(gsups->link);
 		ipa_server_link_destroy(gsups->link);
 		gsups->link = NULL;
 	}
+	if (gsups->epoll.ofd.fd >= 0) {
+		osmo_fd_unregister(&gsups->epoll.ofd);
+		close(gsups->epoll.ofd.fd);
+		gsups->epoll.ofd.fd = -1;
+	}
 	talloc_free(gsups);
 }
 
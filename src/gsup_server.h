@@ -2,14 +2,24 @@
 
 #include <osmocom/core/linuxlist.h>
 #include <osmocom/core/msgb.h>
+#include <osmocom/core/select.h>
 #include <osmocom/abis/ipa.h>
 #include <osmocom/abis/ipaccess.h>
 #include <osmocom/gsm/gsup.h>
 
+#include "gsup_stats.h"
+#include "gsup_record.h"
+#include "isd_cache.h"
+
 #ifndef OSMO_GSUP_MAX_CALLED_PARTY_BCD_LEN
 #define OSMO_GSUP_MAX_CALLED_PARTY_BCD_LEN	43 /* TS 24.008 10.5.4.7 */
 #endif
 
+/* Default bounds of each osmo_gsup_conn's tx queue, in messages, see osmo_gsup_server.tx_queue */
+#define OSMO_GSUP_TX_QUEUE_LIMIT_DEFAULT	10000
+#define OSMO_GSUP_TX_QUEUE_HIGH_DEFAULT		1000
+#define OSMO_GSUP_TX_QUEUE_LOW_DEFAULT		100
+
 struct osmo_gsup_conn;
 
 /* Expects message in msg->l2h */
@@ -28,6 +38,39 @@ struct osmo_gsup_server {
 	struct ipa_server_link *link;
 	osmo_gsup_read_cb_t read_cb;
 	struct llist_head routes;
+
+	/* if not NULL, called when a client has sent its IPA ID, and when a client connection is closed */
+	void (*conn_up_cb)(struct osmo_gsup_conn *conn);
+	void (*conn_down_cb)(struct osmo_gsup_conn *conn);
+
+	/* With epoll, the listening socket and all client sockets are watched by one epoll instance, which is
+	 * the only fd registered with the main loop; ofd.fd is -1 without epoll. */
+	struct {
+		struct osmo_fd ofd;
+		/* epoll_wait() calls, and fd events returned by them */
+		unsigned long wakeups;
+		unsigned long events;
+		/* client connections freed so far, see gsup_epoll_cb() */
+		unsigned long closed;
+	} epoll;
+
+	/* if not NULL, GSUP messages are recorded to a capture file, see gsup_record.h */
+	struct gsup_record *record;
+
+	/* Match requests to replies for each client's latency histograms, see gsup_stats_latency_enable() */
+	bool latency_stats;
+
+	/* if not NULL, Insert Subscriber Data requests are cached, see isd_cache.h */
+	struct isd_cache *isd_cache;
+
+	/* Messages to each client are queued and written in one writev() per main loop iteration. When more than
+	 * 'high' are queued, stop reading from the client until no more than 'low' are left, so that a slow
+	 * client slows down its own requests. Messages beyond 'limit' are dropped. */
+	struct {
+		unsigned int limit;
+		unsigned int high;
+		unsigned int low;
+	} tx_queue;
 };
 
 
@@ -45,6 +88,29 @@ struct osmo_gsup_conn {
 	/* Set when Location Update is received: */
 	bool supports_cs; /* client supports OSMO_GSUP_CN_DOMAIN_CS */
 	bool supports_ps; /* client supports OSMO_GSUP_CN_DOMAIN_PS */
+
+	/* see osmo_gsup_server.tx_queue */
+	struct {
+		/* msgb with IPA header, the first one possibly partly written */
+		struct llist_head queue;
+		unsigned int len;
+		/* Not reading from the client because len went above the high watermark */
+		bool throttled;
+		/* the ipa_server_conn's fd callback, for reading */
+		int (*ipa_fd_cb)(struct osmo_fd *ofd, unsigned int what);
+
+		struct {
+			unsigned long msgs;
+			unsigned long writev;
+			unsigned long dropped;
+			unsigned long throttled;
+			/* largest len so far */
+			unsigned int peak;
+		} stats;
+	} tx;
+
+	/* see gsup_stats.c */
+	struct gsup_conn_stats traffic;
 };
 
 
@@ -0,0 +1,341 @@
+/* Per GSUP client traffic statistics */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+#include <stdbool.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/bits.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/rate_ctr.h>
+#include <osmocom/core/stats.h>
+#include <osmocom/gsm/gsup.h>
+
+#include "gsup_server.h"
+#include "gsup_stats.h"
+
+static const struct rate_ctr_desc gsup_conn_ctr_desc[] = {
+	[GSUP_CONN_CTR_RX_MSGS] = { "rx:msgs", "GSUP messages received" },
+	[GSUP_CONN_CTR_RX_BYTES] = { "rx:bytes", "GSUP bytes received" },
+	[GSUP_CONN_CTR_RX_ERRORS] = { "rx:errors", "GSUP error messages received" },
+	[GSUP_CONN_CTR_RX_INVALID] = { "rx:invalid", "Messages received that could not be decoded" },
+	[GSUP_CONN_CTR_RX_SAI] = { "rx:send_auth_info", "Send Auth Info requests received" },
+	[GSUP_CONN_CTR_RX_UL] = { "rx:update_location", "Update Location requests received" },
+	[GSUP_CONN_CTR_RX_PURGE_MS] = { "rx:purge_ms", "Purge MS requests received" },
+	[GSUP_CONN_CTR_RX_CHECK_IMEI] = { "rx:check_imei", "Check IMEI requests received" },
+	[GSUP_CONN_CTR_RX_PROC_SS] = { "rx:proc_ss", "Process SS requests received" },
+	[GSUP_CONN_CTR_RX_OTHER] = { "rx:other", "Other GSUP messages received" },
+	[GSUP_CONN_CTR_TX_MSGS] = { "tx:msgs", "GSUP messages sent" },
+	[GSUP_CONN_CTR_TX_BYTES] = { "tx:bytes", "GSUP bytes sent" },
+	[GSUP_CONN_CTR_TX_ERRORS] = { "tx:errors", "GSUP error messages sent" },
+	[GSUP_CONN_CTR_TX_ISD] = { "tx:insert_data", "Insert Subscriber Data requests sent" },
+	[GSUP_CONN_CTR_TX_DSD] = { "tx:delete_data", "Delete Subscriber Data requests sent" },
+	[GSUP_CONN_CTR_TX_CANCEL] = { "tx:location_cancel", "Location Cancel requests sent" },
+	[GSUP_CONN_CTR_TX_PROC_SS] = { "tx:proc_ss", "Process SS requests sent" },
+	[GSUP_CONN_CTR_TX_OTHER] = { "tx:other", "Other GSUP messages sent" },
+};
+
+static const struct rate_ctr_group_desc gsup_conn_ctrg_desc = {
+	.group_name_prefix = "gsup_conn",
+	.group_description = "GSUP client connection, by 3G IND",
+	.class_id = OSMO_STATS_CLASS_PEER,
+	.num_ctr = ARRAY_SIZE(gsup_conn_ctr_desc),
+	.ctr_desc = gsup_conn_ctr_desc,
+};
+
+/* Identify a GSUP message by its message type, and the IMSI and Session ID IEs as encoded; walks the IEs without
+ * decoding them. Return false if the message is too short. */
+static bool gsup_peek(const uint8_t *data, size_t len, struct gsup_pending *key)
+{
+	size_t pos;
+
+	if (len < 1)
+		return false;
+	*key = (struct gsup_pending){
+		.msg_type = data[0],
+	};
+	for (pos = 1; pos + 2 <= len && pos + 2 + data[pos + 1] <= len; pos += 2 + data[pos + 1]) {
+		const uint8_t *val = &data[pos + 2];
+		uint8_t val_len = data[pos + 1];
+
+		switch (data[pos]) {
+		case OSMO_GSUP_IMSI_IE:
+			if (val_len > sizeof(key->imsi))
+				break;
+			key->imsi_len = val_len;
+			memcpy(key->imsi, val, val_len);
+			break;
+		case OSMO_GSUP_SESSION_ID_IE:
+			if (val_len == 4)
+				key->session_id = osmo_load32be(val);
+			break;
+		}
+	}
+	return true;
+}
+
+/* FNV-1a over the fields that match a request to its reply */
+static uint32_t pending_hash(const struct gsup_pending *key)
+{
+	uint32_t h = 2166136261U;
+	unsigned int i;
+
+#define HASH_BYTE(b) do { h ^= (uint8_t)(b); h *= 16777619U; } while (0)
+	HASH_BYTE(key->rx);
+	HASH_BYTE(key->msg_type);
+	for (i = 0; i < key->imsi_len; i++)
+		HASH_BYTE(key->imsi[i]);
+	for (i = 0; i < 4; i++)
+		HASH_BYTE(key->session_id >> (i * 8));
+#undef HASH_BYTE
+	return h;
+}
+
+static bool pending_expired(const struct gsup_pending *p, const struct timespec *now)
+{
+	return now->tv_sec - p->since.tv_sec >= GSUP_STATS_PENDING_TIMEOUT;
+}
+
+static void latency_add(struct gsup_latency *l, const struct timespec *since, const struct timespec *now)
+{
+	struct timespec d;
+	uint64_t us;
+	unsigned int i;
+
+	timespecsub(now, since, &d);
+	us = (uint64_t)d.tv_sec * 1000000 + d.tv_nsec / 1000;
+	for (i = 0; i < GSUP_LATENCY_BUCKETS - 1; i++) {
+		if (us < (1ULL << (i + GSUP_LATENCY_MIN_SHIFT)))
+			break;
+	}
+	l->buckets[i]++;
+	l->count++;
+}
+
+/*! Return the upper bound of the bucket holding the given percentile, in microseconds; 0 without samples.
+ * Latencies above all buckets count as twice the largest bucket bound. */
+unsigned int gsup_latency_percentile_us(const struct gsup_latency *l, unsigned int percent)
+{
+	unsigned long want;
+	unsigned long sum = 0;
+	unsigned int i;
+
+	if (!l->count)
+		return 0;
+	want = (l->count * percent + 99) / 100;
+	for (i = 0; i < GSUP_LATENCY_BUCKETS; i++) {
+		sum += l->buckets[i];
+		if (sum >= want)
+			break;
+	}
+	return 1U << (OSMO_MIN(i, GSUP_LATENCY_BUCKETS - 1) + GSUP_LATENCY_MIN_SHIFT);
+}
+
+#define PENDING_SLOT(s, h, i) (&(s)->pending[((h) + (i)) & (GSUP_STATS_PENDING_SLOTS - 1)])
+
+/* A request or a reply, received from the peer (rx == true) or sent to it */
+static void track(struct osmo_gsup_conn *conn, bool rx, const uint8_t *data, size_t len)
+{
+	struct gsup_conn_stats *s = &conn->traffic;
+	struct gsup_pending key, *p, *found = NULL;
+	struct timespec now;
+	uint32_t h;
+	unsigned int i;
+
+	if (!conn->server || !conn->server->latency_stats)
+		return;
+	if (!gsup_peek(data, len, &key))
+		return;
+	if (!s->pending) {
+		s->pending = talloc_zero_array(conn, struct gsup_pending, GSUP_STATS_PENDING_SLOTS);
+		OSMO_ASSERT(s->pending);
+	}
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (OSMO_GSUP_IS_MSGT_REQUEST(key.msg_type)) {
+		key.rx = rx;
+		key.since = now;
+		h = pending_hash(&key);
+		/* a free or timed out slot, else the oldest request */
+		for (i = 0; i < GSUP_STATS_PENDING_PROBE; i++) {
+			p = PENDING_SLOT(s, h, i);
+			if (!p->msg_type || pending_expired(p, &now)) {
+				found = p;
+				break;
+			}
+			if (!found || timespeccmp(&p->since, &found->since, <))
+				found = p;
+		}
+		*found = key;
+		return;
+	}
+
+	/* A result or error answers the oldest request of the same type, IMSI and session in the other direction */
+	if (!OSMO_GSUP_IS_MSGT_ERROR(key.msg_type) && !OSMO_GSUP_IS_MSGT_RESULT(key.msg_type))
+		return;
+	key.rx = !rx;
+	key.msg_type &= ~3;
+	h = pending_hash(&key);
+	for (i = 0; i < GSUP_STATS_PENDING_PROBE; i++) {
+		p = PENDING_SLOT(s, h, i);
+		if (p->msg_type != key.msg_type || p->rx != key.rx || p->session_id != key.session_id
+		    || p->imsi_len != key.imsi_len || memcmp(p->imsi, key.imsi, key.imsi_len))
+			continue;
+		if (pending_expired(p, &now)) {
+			p->msg_type = 0;
+			continue;
+		}
+		if (!found || timespeccmp(&p->since, &found->since, <))
+			found = p;
+	}
+	if (!found)
+		return;
+	/* a reply we send answers the peer's request */
+	latency_add(rx ? &s->peer_latency : &s->hlr_latency, &found->since, &now);
+	found->msg_type = 0;
+}
+
+/*! Count the requests from the peer not answered yet (rx), and our requests the peer has not answered yet (tx).
+ * Requests forgotten for lack of slots are not counted. */
+void gsup_stats_pending_count(const struct gsup_conn_stats *s, unsigned int *rx, unsigned int *tx)
+{
+	struct timespec now;
+	unsigned int i;
+
+	*rx = *tx = 0;
+	if (!s->pending)
+		return;
+	osmo_clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < GSUP_STATS_PENDING_SLOTS; i++) {
+		const struct gsup_pending *p = &s->pending[i];
+		if (!p->msg_type || pending_expired(p, &now))
+			continue;
+		if (p->rx)
+			(*rx)++;
+		else
+			(*tx)++;
+	}
+}
+
+/*! Start or stop matching requests to replies on all connections of gs, for the latency histograms. */
+void gsup_stats_latency_enable(struct osmo_gsup_server *gs, bool enable)
+{
+	struct osmo_gsup_conn *conn;
+
+	gs->latency_stats = enable;
+	if (enable)
+		return;
+	llist_for_each_entry(conn, &gs->clients, list) {
+		talloc_free(conn->traffic.pending);
+		conn->traffic.pending = NULL;
+	}
+}
+
+void gsup_stats_init(struct osmo_gsup_conn *conn)
+{
+	conn->traffic.ctrs = rate_ctr_group_alloc(conn, &gsup_conn_ctrg_desc, conn->auc_3g_ind);
+}
+
+void gsup_stats_free(struct osmo_gsup_conn *conn)
+{
+	talloc_free(conn->traffic.pending);
+	conn->traffic.pending = NULL;
+	if (conn->traffic.ctrs)
+		rate_ctr_group_free(conn->traffic.ctrs);
+	conn->traffic.ctrs = NULL;
+}
+
+void gsup_stats_inc(struct osmo_gsup_conn *conn, enum gsup_conn_ctr ctr)
+{
+	if (conn->traffic.ctrs)
+		rate_ctr_inc(&conn->traffic.ctrs->ctr[ctr]);
+}
+
+/*! Count a GSUP message received from conn, data pointing at the GSUP message type. */
+void gsup_stats_rx(struct osmo_gsup_conn *conn, const uint8_t *data, size_t len)
+{
+	enum gsup_conn_ctr ctr;
+
+	gsup_stats_inc(conn, GSUP_CONN_CTR_RX_MSGS);
+	if (conn->traffic.ctrs)
+		rate_ctr_add(&conn->traffic.ctrs->ctr[GSUP_CONN_CTR_RX_BYTES], len);
+	if (len < 1) {
+		gsup_stats_inc(conn, GSUP_CONN_CTR_RX_INVALID);
+		return;
+	}
+
+	switch (data[0]) {
+	case OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST:
+		ctr = GSUP_CONN_CTR_RX_SAI;
+		break;
+	case OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST:
+		ctr = GSUP_CONN_CTR_RX_UL;
+		break;
+	case OSMO_GSUP_MSGT_PURGE_MS_REQUEST:
+		ctr = GSUP_CONN_CTR_RX_PURGE_MS;
+		break;
+	case OSMO_GSUP_MSGT_CHECK_IMEI_REQUEST:
+		ctr = GSUP_CONN_CTR_RX_CHECK_IMEI;
+		break;
+	case OSMO_GSUP_MSGT_PROC_SS_REQUEST:
+		ctr = GSUP_CONN_CTR_RX_PROC_SS;
+		break;
+	default:
+		ctr = OSMO_GSUP_IS_MSGT_ERROR(data[0]) ? GSUP_CONN_CTR_RX_ERRORS : GSUP_CONN_CTR_RX_OTHER;
+		break;
+	}
+	gsup_stats_inc(conn, ctr);
+	track(conn, true, data, len);
+}
+
+/*! Count a GSUP message sent to conn, data pointing at the GSUP message type. */
+void gsup_stats_tx(struct osmo_gsup_conn *conn, const uint8_t *data, size_t len)
+{
+	enum gsup_conn_ctr ctr;
+
+	gsup_stats_inc(conn, GSUP_CONN_CTR_TX_MSGS);
+	if (conn->traffic.ctrs)
+		rate_ctr_add(&conn->traffic.ctrs->ctr[GSUP_CONN_CTR_TX_BYTES], len);
+	if (len < 1)
+		return;
+
+	switch (data[0]) {
+	case OSMO_GSUP_MSGT_INSERT_DATA_REQUEST:
+		ctr = GSUP_CONN_CTR_TX_ISD;
+		break;
+	case OSMO_GSUP_MSGT_DELETE_DATA_REQUEST:
+		ctr = GSUP_CONN_CTR_TX_DSD;
+		break;
+	case OSMO_GSUP_MSGT_LOCATION_CANCEL_REQUEST:
+		ctr = GSUP_CONN_CTR_TX_CANCEL;
+		break;
+	case OSMO_GSUP_MSGT_PROC_SS_REQUEST:
+		ctr = GSUP_CONN_CTR_TX_PROC_SS;
+		break;
+	default:
+		ctr = OSMO_GSUP_IS_MSGT_ERROR(data[0]) ? GSUP_CONN_CTR_TX_ERRORS : GSUP_CONN_CTR_TX_OTHER;
+		break;
+	}
+	gsup_stats_inc(conn, ctr);
+	track(conn, false, data, len);
+}
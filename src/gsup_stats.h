@@ -0,0 +1,102 @@
+/* Per GSUP client traffic statistics */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+
+struct osmo_gsup_conn;
+struct osmo_gsup_server;
+struct rate_ctr_group;
+
+/* Requests not answered within this many seconds are no longer waited for */
+#define GSUP_STATS_PENDING_TIMEOUT	30
+/* Slots of the table of unanswered requests per connection, a power of two. A request goes into one of
+ * GSUP_STATS_PENDING_PROBE slots following its hash, replacing the oldest one there if all are taken. */
+#define GSUP_STATS_PENDING_SLOTS	256
+#define GSUP_STATS_PENDING_PROBE	8
+
+/* Indexes of osmo_gsup_conn.stats.ctrs */
+enum gsup_conn_ctr {
+	GSUP_CONN_CTR_RX_MSGS,
+	GSUP_CONN_CTR_RX_BYTES,
+	GSUP_CONN_CTR_RX_ERRORS,
+	GSUP_CONN_CTR_RX_INVALID,
+	GSUP_CONN_CTR_RX_SAI,
+	GSUP_CONN_CTR_RX_UL,
+	GSUP_CONN_CTR_RX_PURGE_MS,
+	GSUP_CONN_CTR_RX_CHECK_IMEI,
+	GSUP_CONN_CTR_RX_PROC_SS,
+	GSUP_CONN_CTR_RX_OTHER,
+	GSUP_CONN_CTR_TX_MSGS,
+	GSUP_CONN_CTR_TX_BYTES,
+	GSUP_CONN_CTR_TX_ERRORS,
+	GSUP_CONN_CTR_TX_ISD,
+	GSUP_CONN_CTR_TX_DSD,
+	GSUP_CONN_CTR_TX_CANCEL,
+	GSUP_CONN_CTR_TX_PROC_SS,
+	GSUP_CONN_CTR_TX_OTHER,
+};
+
+/* Histogram of request-to-reply latencies: bucket i counts latencies below 2^(i + GSUP_LATENCY_MIN_SHIFT) us,
+ * the last bucket everything above. */
+#define GSUP_LATENCY_MIN_SHIFT	6
+#define GSUP_LATENCY_BUCKETS	18
+struct gsup_latency {
+	unsigned long buckets[GSUP_LATENCY_BUCKETS];
+	unsigned long count;
+};
+
+/* An unanswered request, matched to its reply by message type, IMSI and session ID */
+struct gsup_pending {
+	/* request message type, 0 for a free slot */
+	uint8_t msg_type;
+	/* received from the peer, or sent to it */
+	bool rx;
+	/* IMSI IE value as encoded, compared without decoding */
+	uint8_t imsi_len;
+	uint8_t imsi[8];
+	/* Session ID IE, 0 without */
+	uint32_t session_id;
+	struct timespec since;
+};
+
+struct gsup_conn_stats {
+	/* enum gsup_conn_ctr */
+	struct rate_ctr_group *ctrs;
+	/* GSUP_STATS_PENDING_SLOTS, NULL while not tracking requests, see osmo_gsup_server.latency_stats */
+	struct gsup_pending *pending;
+	/* how long we take to answer the peer's requests, and how long the peer takes to answer ours */
+	struct gsup_latency hlr_latency;
+	struct gsup_latency peer_latency;
+};
+
+void gsup_stats_init(struct osmo_gsup_conn *conn);
+void gsup_stats_free(struct osmo_gsup_conn *conn);
+void gsup_stats_inc(struct osmo_gsup_conn *conn, enum gsup_conn_ctr ctr);
+void gsup_stats_rx(struct osmo_gsup_conn *conn, const uint8_t *data, size_t len);
+void gsup_stats_tx(struct osmo_gsup_conn *conn, const uint8_t *data, size_t len);
+void gsup_stats_latency_enable(struct osmo_gsup_server *gs, bool enable);
+void gsup_stats_pending_count(const struct gsup_conn_stats *s, unsigned int *rx, unsigned int *tx);
+unsigned int gsup_latency_percentile_us(const struct gsup_latency *l, unsigned int percent);
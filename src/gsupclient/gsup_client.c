@@ -23,16 +23,39 @@
 
 #include <osmocom/gsupclient/gsup_client.h>
 
+#include "gsup_client_internal.h"
+
 #include <osmocom/abis/ipa.h>
 #include <osmocom/gsm/oap_client.h>
 #include <osmocom/gsm/protocol/ipaccess.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/logging.h>
 
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/protocol/gsm_23_003.h>
+
 #include <errno.h>
+#include <stdbool.h>
 #include <string.h>
 
+/* A request sent with osmo_gsup_client_request(), waiting for its response */
+struct osmo_gsup_client_trans {
+	struct llist_head entry;
+	struct osmo_gsup_client *gsupc;
+	struct osmo_timer_list timer;
+
+	/* Responses match by IMSI, message type (without the request/error/result bits) and session id */
+	char imsi[GSM23003_IMSI_MAX_DIGITS + 1];
+	uint8_t message_type;
+	uint32_t session_id;
+
+	osmo_gsup_client_resp_cb_t resp_cb;
+	void *data;
+};
+
 static void start_test_procedure(struct osmo_gsup_client *gsupc);
+static void gsup_client_trans_fail_all(struct osmo_gsup_client *gsupc, int rc);
+static bool gsup_client_trans_rx(struct osmo_gsup_client *gsupc, struct msgb *msg);
 
 static void gsup_client_send_ping(struct osmo_gsup_client *gsupc)
 {
@@ -144,6 +167,8 @@ static void gsup_client_updown_cb(struct ipa_client_conn *link, int up)
 
 		osmo_timer_schedule(&gsupc->connect_timer,
 				    OSMO_GSUP_CLIENT_RECONNECT_INTERVAL, 0);
+
+		gsup_client_trans_fail_all(gsupc, -ENOTCONN);
 	}
 }
 
@@ -184,6 +209,7 @@ static int gsup_client_read_cb(struct ipa_client_conn *link, struct msgb *msg)
 		/* Link has been closed */
 		gsupc->is_connected = 0;
 		msgb_free(msg);
+		gsup_client_trans_fail_all(gsupc, -ENOTCONN);
 		return -1;
 	}
 
@@ -208,9 +234,9 @@ static int gsup_client_read_cb(struct ipa_client_conn *link, struct msgb *msg)
 	msg->l2h = &he->data[0];
 
 	if (he->proto == IPAC_PROTO_EXT_GSUP) {
-		OSMO_ASSERT(gsupc->read_cb != NULL);
-		gsupc->read_cb(gsupc, msg);
-		/* expecting read_cb() to free msg */
+		if (gsupc->av_cache && gsup_client_av_cache_rx(gsupc->av_cache, msg))
+			return 0;
+		gsup_client_rx_gsup(gsupc, msg);
 	} else if (he->proto == IPAC_PROTO_EXT_OAP) {
 		return gsup_client_oap_handle(gsupc, msg);
 		/* gsup_client_oap_handle frees msg */
@@ -228,6 +254,21 @@ invalid:
 	return -1;
 }
 
+/* Pass a received GSUP message at msg->l2h to the request it answers or to read_cb, which free msg */
+void gsup_client_rx_gsup(struct osmo_gsup_client *gsupc, struct msgb *msg)
+{
+	if (gsupc->num_trans && gsup_client_trans_rx(gsupc, msg))
+		return;
+	if (!gsupc->read_cb) {
+		LOGP(DLGSUP, LOGL_NOTICE, "GSUP message from %s:%d matches no request, dropping\n",
+		     gsupc->link->addr, gsupc->link->port);
+		msgb_free(msg);
+		return;
+	}
+	gsupc->read_cb(gsupc, msg);
+	/* expecting read_cb() to free msg */
+}
+
 static void ping_timer_cb(void *gsupc_)
 {
 	struct osmo_gsup_client *gsupc = gsupc_;
@@ -244,6 +285,7 @@ static void ping_timer_cb(void *gsupc_)
 	LOGP(DLGSUP, LOGL_NOTICE, "GSUP ping timed out, reconnecting\n");
 	ipa_client_conn_close(gsupc->link);
 	gsupc->is_connected = 0;
+	gsup_client_trans_fail_all(gsupc, -ENOTCONN);
 
 	gsup_client_connect(gsupc);
 }
@@ -267,7 +309,8 @@ static void start_test_procedure(struct osmo_gsup_client *gsupc)
  *                    in talloc_ctx as well to ensure it lives throughout the lifetime of the connection.
  * \param[in] ip_addr GSUP server IP address.
  * \param[in] tcp_port GSUP server TCP port.
- * \param[in] read_cb callback for reading from the GSUP connection.
+ * \param[in] read_cb callback for reading from the GSUP connection; may be NULL if the client only receives
+ *                    responses to osmo_gsup_client_request().
  * \param[in] oapc_config OPA client configuration.
  *  \returns a GSUP client connection or NULL on failure.
  */
@@ -336,9 +379,21 @@ struct osmo_gsup_client *osmo_gsup_client_create(void *talloc_ctx,
 
 void osmo_gsup_client_destroy(struct osmo_gsup_client *gsupc)
 {
+	unsigned int i;
+	struct osmo_gsup_client_trans *trans, *next;
+
 	osmo_timer_del(&gsupc->connect_timer);
 	osmo_timer_del(&gsupc->ping_timer);
 
+	if (gsupc->av_cache)
+		gsup_client_av_cache_free(gsupc->av_cache);
+
+	/* Pending requests are dropped without calling back; the caller is going away as well */
+	for (i = 0; gsupc->trans_buckets && i < OSMO_GSUP_CLIENT_TRANS_BUCKETS; i++) {
+		llist_for_each_entry_safe(trans, next, &gsupc->trans_buckets[i], entry)
+			osmo_gsup_client_trans_cancel(trans);
+	}
+
 	if (gsupc->link) {
 		ipa_client_conn_close(gsupc->link);
 		ipa_client_conn_destroy(gsupc->link);
@@ -348,6 +403,17 @@ void osmo_gsup_client_destroy(struct osmo_gsup_client *gsupc)
 }
 
 int osmo_gsup_client_send(struct osmo_gsup_client *gsupc, struct msgb *msg)
+{
+	/* Send Auth Info requests may be answered from the cache instead */
+	if (gsupc && gsupc->av_cache && msgb_length(msg)
+	    && msgb_data(msg)[0] == OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST)
+		return gsup_client_av_cache_tx(gsupc->av_cache, msg);
+
+	return gsup_client_send_gsup(gsupc, msg);
+}
+
+/* Send a GSUP message to the server, bypassing the auth vector cache */
+int gsup_client_send_gsup(struct osmo_gsup_client *gsupc, struct msgb *msg)
 {
 	if (!gsupc || !gsupc->is_connected) {
 		LOGP(DLGSUP, LOGL_ERROR, "GSUP not connected, unable to send %s\n", msgb_hexdump(msg));
@@ -400,3 +466,177 @@ struct msgb *osmo_gsup_client_msgb_alloc(void)
 {
 	return msgb_alloc_headroom(4000, 64, __func__);
 }
+
+static unsigned int trans_hash(const char *imsi, uint8_t message_type, uint32_t session_id)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 16777619u;
+	}
+	h ^= message_type;
+	h *= 16777619u;
+	h ^= session_id;
+	h *= 16777619u;
+	return h % OSMO_GSUP_CLIENT_TRANS_BUCKETS;
+}
+
+/* Requests, errors and results of the same procedure differ only in the two lowest bits */
+static uint8_t trans_msgt(enum osmo_gsup_message_type message_type)
+{
+	return message_type & ~0x03;
+}
+
+/* Remove trans and report rc and resp to its owner */
+static void gsup_client_trans_complete(struct osmo_gsup_client_trans *trans, int rc,
+				       const struct osmo_gsup_message *resp)
+{
+	struct osmo_gsup_client *gsupc = trans->gsupc;
+	osmo_gsup_client_resp_cb_t resp_cb = trans->resp_cb;
+	void *data = trans->data;
+
+	/* Free first, the callback may well send the next request or cancel others */
+	osmo_gsup_client_trans_cancel(trans);
+	resp_cb(gsupc, rc, resp, data);
+}
+
+static void gsup_client_trans_timer_cb(void *data)
+{
+	struct osmo_gsup_client_trans *trans = data;
+
+	LOGP(DLGSUP, LOGL_NOTICE, "IMSI='%s': GSUP %s timed out\n", trans->imsi,
+	     osmo_gsup_message_type_name(trans->message_type));
+	gsup_client_trans_complete(trans, -ETIMEDOUT, NULL);
+}
+
+static void gsup_client_trans_fail_all(struct osmo_gsup_client *gsupc, int rc)
+{
+	unsigned int i;
+
+	if (!gsupc->num_trans)
+		return;
+
+	LOGP(DLGSUP, LOGL_NOTICE, "GSUP link lost, failing %u pending requests\n", gsupc->num_trans);
+	/* No new requests are added while not connected, but callbacks may cancel any other request */
+	for (i = 0; i < OSMO_GSUP_CLIENT_TRANS_BUCKETS; i++) {
+		while (!llist_empty(&gsupc->trans_buckets[i]))
+			gsup_client_trans_complete(llist_first_entry(&gsupc->trans_buckets[i],
+								     struct osmo_gsup_client_trans, entry),
+						   rc, NULL);
+	}
+}
+
+/* Complete the oldest request that msg is the response for and free msg, if there is one. */
+static bool gsup_client_trans_rx(struct osmo_gsup_client *gsupc, struct msgb *msg)
+{
+	struct osmo_gsup_message resp;
+	struct osmo_gsup_client_trans *trans;
+	struct llist_head *bucket;
+	uint8_t message_type;
+
+	if (!msgb_l2len(msg) || OSMO_GSUP_IS_MSGT_REQUEST(msg->l2h[0]))
+		return false;
+	if (osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &resp) < 0)
+		return false;
+
+	message_type = trans_msgt(resp.message_type);
+	bucket = &gsupc->trans_buckets[trans_hash(resp.imsi, message_type, resp.session_id)];
+	llist_for_each_entry(trans, bucket, entry) {
+		if (trans->message_type != message_type
+		    || trans->session_id != resp.session_id
+		    || strcmp(trans->imsi, resp.imsi))
+			continue;
+		gsup_client_trans_complete(trans, 0, &resp);
+		msgb_free(msg);
+		return true;
+	}
+	return false;
+}
+
+/*! Encode and send a GSUP request, and call back with its response.
+ * The response is matched by IMSI, message type and session id, so that any number of requests may be in
+ * flight, also several ones of the same type for the same IMSI: these are answered in the order they were sent.
+ * Responses that match no request are passed to the read_cb of the client as usual.
+ * \param[in] gsupc  GSUP client.
+ * \param[in] gsup_msg  GSUP request to be sent.
+ * \param[in] timeout_ms  Call back with -ETIMEDOUT if no response arrived after this time, 0 to wait as long
+ *                        as the link is up.
+ * \param[in] resp_cb  Called exactly once with the response, on timeout or when the link is lost; not
+ *                     called if sending fails right away, or for osmo_gsup_client_trans_cancel().
+ * \param[in] data  Passed to resp_cb.
+ * \returns the pending request, to cancel it; NULL if it could not be sent.
+ */
+struct osmo_gsup_client_trans *osmo_gsup_client_request(struct osmo_gsup_client *gsupc,
+							 const struct osmo_gsup_message *gsup_msg,
+							 unsigned int timeout_ms,
+							 osmo_gsup_client_resp_cb_t resp_cb, void *data)
+{
+	struct msgb *msg;
+
+	OSMO_ASSERT(OSMO_GSUP_IS_MSGT_REQUEST(gsup_msg->message_type));
+
+	msg = osmo_gsup_client_msgb_alloc();
+	if (osmo_gsup_encode(msg, gsup_msg)) {
+		LOGP(DLGSUP, LOGL_ERROR, "Couldn't encode GSUP message\n");
+		msgb_free(msg);
+		return NULL;
+	}
+
+	return gsup_client_trans_send(gsupc, msg, gsup_msg->imsi, gsup_msg->message_type, gsup_msg->session_id,
+				      timeout_ms, resp_cb, data);
+}
+
+/* Send the encoded request msg and add it to the pending requests, see osmo_gsup_client_request(). imsi,
+ * message_type and session_id must be those encoded in msg. msg is always consumed. */
+struct osmo_gsup_client_trans *gsup_client_trans_send(struct osmo_gsup_client *gsupc, struct msgb *msg,
+						      const char *imsi, enum osmo_gsup_message_type message_type,
+						      uint32_t session_id, unsigned int timeout_ms,
+						      osmo_gsup_client_resp_cb_t resp_cb, void *data)
+{
+	struct osmo_gsup_client_trans *trans;
+	unsigned int i;
+
+	OSMO_ASSERT(resp_cb);
+
+	if (osmo_gsup_client_send(gsupc, msg))
+		return NULL;
+
+	if (!gsupc->trans_buckets) {
+		gsupc->trans_buckets = talloc_array(gsupc, struct llist_head, OSMO_GSUP_CLIENT_TRANS_BUCKETS);
+		OSMO_ASSERT(gsupc->trans_buckets);
+		for (i = 0; i < OSMO_GSUP_CLIENT_TRANS_BUCKETS; i++)
+			INIT_LLIST_HEAD(&gsupc->trans_buckets[i]);
+	}
+
+	trans = talloc_zero(gsupc, struct osmo_gsup_client_trans);
+	OSMO_ASSERT(trans);
+	*trans = (struct osmo_gsup_client_trans){
+		.gsupc = gsupc,
+		.message_type = trans_msgt(message_type),
+		.session_id = session_id,
+		.resp_cb = resp_cb,
+		.data = data,
+	};
+	OSMO_STRLCPY_ARRAY(trans->imsi, imsi);
+	osmo_timer_setup(&trans->timer, gsup_client_trans_timer_cb, trans);
+	if (timeout_ms)
+		osmo_timer_schedule(&trans->timer, timeout_ms / 1000, (timeout_ms % 1000) * 1000);
+
+	/* At the tail, to match the oldest request first */
+	llist_add_tail(&trans->entry,
+		       &gsupc->trans_buckets[trans_hash(trans->imsi, trans->message_type, trans->session_id)]);
+	gsupc->num_trans++;
+	return trans;
+}
+
+/*! Forget about a request sent with osmo_gsup_client_request(), without calling back. A response arriving
+ * later is passed to the read_cb of the client.
+ * \param[in] trans  Pending request, as returned by osmo_gsup_client_request(). */
+void osmo_gsup_client_trans_cancel(struct osmo_gsup_client_trans *trans)
+{
+	osmo_timer_del(&trans->timer);
+	llist_del(&trans->entry);
+	trans->gsupc->num_trans--;
+	talloc_free(trans);
+}
@@ -0,0 +1,301 @@
+/* Cache of auth vectors from earlier Send Auth Info results, for GSUP clients */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/protocol/gsm_23_003.h>
+
+#include <osmocom/gsupclient/gsup_client.h>
+
+#include "gsup_client_internal.h"
+
+/* Give up waiting for the result of a fetch after this many seconds and let the next request fetch again */
+#define AV_CACHE_FETCH_TIMEOUT 10
+
+/* Unused vectors left when the next ones arrive are kept in front of them */
+#define AV_CACHE_MAX_VECTORS (2 * OSMO_GSUP_MAX_NUM_AUTH_INFO)
+
+struct osmo_gsup_client_av_cache_entry {
+	char imsi[GSM23003_IMSI_MAX_DIGITS + 1];
+	/* unused vectors are vec[next] to vec[num - 1], oldest first */
+	struct osmo_auth_vector vec[AV_CACHE_MAX_VECTORS];
+	unsigned int num;
+	unsigned int next;
+	time_t fetched;
+
+	/* a Send Auth Info request for this IMSI was sent to the server, and its result will go to the cache */
+	bool fetching;
+	time_t fetch_started;
+	/* requests of the application waiting for that result */
+	unsigned int waiting;
+};
+
+static time_t now(void)
+{
+	struct timespec ts;
+	osmo_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static unsigned int imsi_hash(const char *imsi)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void av_cache_deliver_timer_cb(void *data)
+{
+	struct osmo_gsup_client_av_cache *c = data;
+	struct msgb *msg;
+
+	while ((msg = msgb_dequeue(&c->deliver_queue)))
+		gsup_client_rx_gsup(c->gsupc, msg);
+}
+
+/*! Answer Send Auth Info requests sent on a GSUP client from auth vectors received earlier, where possible.
+ * The HLR returns several vectors per Send Auth Info result, while a client uses only one per authentication.
+ * With the cache enabled, the client library keeps the other vectors, and hands them out one per Send Auth Info
+ * request sent with osmo_gsup_client_send() and friends later: the application gets a Send Auth Info result
+ * with a single vector from the main loop, like from the server, but without a round trip. When only low_water
+ * unused vectors are left for an IMSI, the request also goes to the server to fetch the next ones. Requests
+ * with AUTS (re-synchronisation) always go to the server and discard the unused vectors of the IMSI.
+ * \param[in] gsupc  GSUP client.
+ * \param[in] num_slots  Number of IMSIs to keep vectors for at most.
+ * \param[in] ttl  Seconds after which unused vectors are discarded.
+ * \param[in] low_water  Fetch the next vectors when no more than this many are left.
+ * \returns the cache, also at gsupc->av_cache.
+ */
+struct osmo_gsup_client_av_cache *osmo_gsup_client_av_cache_enable(struct osmo_gsup_client *gsupc,
+								    unsigned int num_slots, unsigned int ttl,
+								    unsigned int low_water)
+{
+	struct osmo_gsup_client_av_cache *c;
+
+	OSMO_ASSERT(num_slots);
+	if (gsupc->av_cache)
+		gsup_client_av_cache_free(gsupc->av_cache);
+
+	c = talloc_zero(gsupc, struct osmo_gsup_client_av_cache);
+	OSMO_ASSERT(c);
+	c->gsupc = gsupc;
+	c->num_slots = num_slots;
+	c->ttl = ttl;
+	c->low_water = low_water;
+	c->slots = talloc_zero_array(c, struct osmo_gsup_client_av_cache_entry, num_slots);
+	OSMO_ASSERT(c->slots);
+	INIT_LLIST_HEAD(&c->deliver_queue);
+	osmo_timer_setup(&c->deliver_timer, av_cache_deliver_timer_cb, c);
+
+	gsupc->av_cache = c;
+	return c;
+}
+
+void gsup_client_av_cache_free(struct osmo_gsup_client_av_cache *c)
+{
+	struct msgb *msg;
+
+	osmo_timer_del(&c->deliver_timer);
+	while ((msg = msgb_dequeue(&c->deliver_queue)))
+		msgb_free(msg);
+	c->gsupc->av_cache = NULL;
+	/* don't leave keys lying around in freed memory */
+	memset(c->slots, 0, c->num_slots * sizeof(*c->slots));
+	talloc_free(c);
+}
+
+static void av_cache_flush(struct osmo_gsup_client_av_cache_entry *e)
+{
+	memset(e->vec, 0, sizeof(e->vec));
+	e->num = e->next = 0;
+}
+
+/* The slot for imsi, taken over from another IMSI if necessary; NULL if it is busy with another IMSI */
+static struct osmo_gsup_client_av_cache_entry *av_cache_entry(struct osmo_gsup_client_av_cache *c,
+							      const char *imsi, bool create)
+{
+	struct osmo_gsup_client_av_cache_entry *e = &c->slots[imsi_hash(imsi) % c->num_slots];
+	time_t t = now();
+
+	if (e->fetching && t - e->fetch_started > AV_CACHE_FETCH_TIMEOUT) {
+		LOGP(DLGSUP, LOGL_NOTICE, "IMSI='%s': GSUP auth vector cache: no Send Auth Info result from server,"
+		     " %u requests waited for it\n", e->imsi, e->waiting);
+		e->fetching = false;
+		e->waiting = 0;
+	}
+
+	if (strcmp(e->imsi, imsi)) {
+		if (!create || e->fetching)
+			return NULL;
+		av_cache_flush(e);
+		OSMO_STRLCPY_ARRAY(e->imsi, imsi);
+	}
+
+	if (e->next < e->num && t - e->fetched >= c->ttl)
+		av_cache_flush(e);
+	return e;
+}
+
+/* Answer a Send Auth Info request with the next unused vector of e, or with an error if there is none */
+static void av_cache_deliver(struct osmo_gsup_client_av_cache *c, struct osmo_gsup_client_av_cache_entry *e,
+			     bool from_main_loop)
+{
+	struct osmo_gsup_message resp = {
+		.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT,
+	};
+	struct msgb *msg = osmo_gsup_client_msgb_alloc();
+
+	OSMO_STRLCPY_ARRAY(resp.imsi, e->imsi);
+	if (e->next < e->num) {
+		resp.auth_vectors[0] = e->vec[e->next];
+		resp.num_auth_vectors = 1;
+		memset(&e->vec[e->next], 0, sizeof(e->vec[e->next]));
+		e->next++;
+	} else {
+		resp.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR;
+		resp.cause = GMM_CAUSE_NET_FAIL;
+	}
+
+	msg->l2h = msg->data;
+	osmo_gsup_encode(msg, &resp);
+	memset(&resp, 0, sizeof(resp));
+
+	if (from_main_loop) {
+		msgb_enqueue(&c->deliver_queue, msg);
+		osmo_timer_schedule(&c->deliver_timer, 0, 0);
+	} else
+		gsup_client_rx_gsup(c->gsupc, msg);
+}
+
+/* Send a Send Auth Info request msg for the application, or answer it from the cache. msg is always consumed.
+ * Returns 0 on success, negative on error like osmo_gsup_client_send(). */
+int gsup_client_av_cache_tx(struct osmo_gsup_client_av_cache *c, struct msgb *msg)
+{
+	struct osmo_gsup_message req;
+	struct osmo_gsup_client_av_cache_entry *e;
+	int rc;
+
+	if (osmo_gsup_decode(msgb_data(msg), msgb_length(msg), &req) < 0 || !req.imsi[0])
+		return gsup_client_send_gsup(c->gsupc, msg);
+
+	e = av_cache_entry(c, req.imsi, true);
+	if (!e)
+		return gsup_client_send_gsup(c->gsupc, msg);
+
+	/* Re-synchronisation: the SQN of the unused vectors is out of range for the SIM as well */
+	if (req.auts || req.rand) {
+		av_cache_flush(e);
+		return gsup_client_send_gsup(c->gsupc, msg);
+	}
+
+	if (e->next < e->num) {
+		c->stats.hits++;
+		av_cache_deliver(c, e, true);
+		if (e->num - e->next > c->low_water || e->fetching) {
+			msgb_free(msg);
+			return 0;
+		}
+		/* Running low, fetch the next vectors with this request. Should that fail, the application still
+		 * got its vector. */
+		c->stats.prefetches++;
+		if (gsup_client_send_gsup(c->gsupc, msg) == 0) {
+			e->fetching = true;
+			e->fetch_started = now();
+		}
+		return 0;
+	}
+
+	c->stats.misses++;
+	if (e->fetching) {
+		e->waiting++;
+		msgb_free(msg);
+		return 0;
+	}
+	rc = gsup_client_send_gsup(c->gsupc, msg);
+	if (rc == 0) {
+		e->fetching = true;
+		e->fetch_started = now();
+		e->waiting++;
+	}
+	return rc;
+}
+
+/* Put the vectors of a Send Auth Info result at msg->l2h into the cache, if it answers a fetch of the cache,
+ * and answer the requests waiting for it. Returns true if msg was consumed. */
+bool gsup_client_av_cache_rx(struct osmo_gsup_client_av_cache *c, struct msgb *msg)
+{
+	struct osmo_gsup_message resp;
+	struct osmo_gsup_client_av_cache_entry *e;
+	unsigned int waiting, keep, i;
+
+	if (!msgb_l2len(msg) || (msg->l2h[0] != OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT
+				 && msg->l2h[0] != OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR))
+		return false;
+	if (osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &resp) < 0)
+		return false;
+
+	e = av_cache_entry(c, resp.imsi, false);
+	if (!e || !e->fetching)
+		return false;
+	e->fetching = false;
+	waiting = e->waiting;
+	e->waiting = 0;
+
+	if (resp.message_type == OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR) {
+		/* Each waiting request gets the error */
+		for (; waiting > 1; waiting--)
+			gsup_client_rx_gsup(c->gsupc, msgb_copy(msg, __func__));
+		if (waiting)
+			gsup_client_rx_gsup(c->gsupc, msg);
+		else
+			msgb_free(msg);
+		return true;
+	}
+
+	/* Keep the unused vectors (the oldest SQNs) in front of the new ones, as many as fit */
+	keep = OSMO_MIN(e->num - e->next, AV_CACHE_MAX_VECTORS - resp.num_auth_vectors);
+	memmove(&e->vec[0], &e->vec[e->num - keep], keep * sizeof(e->vec[0]));
+	memset(&e->vec[keep], 0, sizeof(e->vec) - keep * sizeof(e->vec[0]));
+	for (i = 0; i < resp.num_auth_vectors; i++)
+		e->vec[keep + i] = resp.auth_vectors[i];
+	e->next = 0;
+	e->num = keep + resp.num_auth_vectors;
+	e->fetched = now();
+	memset(&resp, 0, sizeof(resp));
+	msgb_free(msg);
+
+	LOGP(DLGSUP, LOGL_DEBUG, "IMSI='%s': GSUP auth vector cache: %u vectors, %u requests waiting\n",
+	     e->imsi, e->num, waiting);
+	/* An error for waiting requests the server sent no vectors for */
+	for (; waiting; waiting--)
+		av_cache_deliver(c, e, false);
+	return true;
+}
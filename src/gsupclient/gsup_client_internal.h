@@ -0,0 +1,37 @@
+/* Internal interfaces between the parts of libosmo-gsup-client */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include <osmocom/gsupclient/gsup_client.h>
+
+struct osmo_gsup_client_trans *gsup_client_trans_send(struct osmo_gsup_client *gsupc, struct msgb *msg,
+						      const char *imsi, enum osmo_gsup_message_type message_type,
+						      uint32_t session_id, unsigned int timeout_ms,
+						      osmo_gsup_client_resp_cb_t resp_cb, void *data);
+
+int gsup_client_send_gsup(struct osmo_gsup_client *gsupc, struct msgb *msg);
+void gsup_client_rx_gsup(struct osmo_gsup_client *gsupc, struct msgb *msg);
+
+int gsup_client_av_cache_tx(struct osmo_gsup_client_av_cache *c, struct msgb *msg);
+bool gsup_client_av_cache_rx(struct osmo_gsup_client_av_cache *c, struct msgb *msg);
+void gsup_client_av_cache_free(struct osmo_gsup_client_av_cache *c);
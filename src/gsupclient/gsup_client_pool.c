@@ -0,0 +1,271 @@
+/* GSUP client connections to several servers, with failover and load balancing */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/protocol/gsm_23_003.h>
+#include <osmocom/abis/ipa.h>
+
+#include <osmocom/gsupclient/gsup_client.h>
+
+#include "gsup_client_internal.h"
+
+const struct value_string osmo_gsup_client_pool_policy_names[] = {
+	{ OSMO_GSUP_CLIENT_POOL_ACTIVE_STANDBY, "active-standby" },
+	{ OSMO_GSUP_CLIENT_POOL_ROUND_ROBIN, "round-robin" },
+	{ OSMO_GSUP_CLIENT_POOL_IMSI_HASH, "imsi-hash" },
+	{ 0, NULL }
+};
+
+/* A request sent with osmo_gsup_client_pool_request(); moves to another server when the link to the server it
+ * was sent to is lost before the response arrived. */
+struct osmo_gsup_client_pool_trans {
+	struct osmo_gsup_client_pool *pool;
+	/* pending request on the current server */
+	struct osmo_gsup_client_trans *trans;
+
+	/* encoded request, to send it again */
+	struct msgb *msg;
+	char imsi[GSM23003_IMSI_MAX_DIGITS + 1];
+	enum osmo_gsup_message_type message_type;
+	uint32_t session_id;
+	unsigned int timeout_ms;
+	/* sent to this many servers so far */
+	unsigned int attempts;
+
+	osmo_gsup_client_resp_cb_t resp_cb;
+	void *data;
+};
+
+/*! Create GSUP client connections to several servers.
+ * \param[in] talloc_ctx  talloc context.
+ * \param[in] ipa_dev  IPA identification sent to all servers, see osmo_gsup_client_create2().
+ * \param[in] servers  Addresses of the servers; for OSMO_GSUP_CLIENT_POOL_ACTIVE_STANDBY in order of preference.
+ * \param[in] num_servers  Number of servers.
+ * \param[in] policy  Which server to send each message to.
+ * \param[in] read_cb  Callback for messages received from any server, except for responses to
+ *                     osmo_gsup_client_pool_request(); gsupc->data points to the pool.
+ * \returns the pool, or NULL if a client could not be created.
+ */
+struct osmo_gsup_client_pool *osmo_gsup_client_pool_create(void *talloc_ctx,
+							   struct ipaccess_unit *ipa_dev,
+							   const struct osmo_gsup_client_pool_server *servers,
+							   unsigned int num_servers,
+							   enum osmo_gsup_client_pool_policy policy,
+							   osmo_gsup_client_read_cb_t read_cb)
+{
+	struct osmo_gsup_client_pool *pool;
+	unsigned int i;
+
+	OSMO_ASSERT(num_servers);
+
+	pool = talloc_zero(talloc_ctx, struct osmo_gsup_client_pool);
+	OSMO_ASSERT(pool);
+	pool->policy = policy;
+	pool->clients = talloc_zero_array(pool, struct osmo_gsup_client *, num_servers);
+	OSMO_ASSERT(pool->clients);
+
+	for (; pool->num_clients < num_servers; pool->num_clients++) {
+		struct osmo_gsup_client *gsupc;
+
+		i = pool->num_clients;
+		gsupc = osmo_gsup_client_create2(pool, ipa_dev, servers[i].ip_addr, servers[i].tcp_port, read_cb,
+						 NULL);
+		if (!gsupc) {
+			LOGP(DLGSUP, LOGL_ERROR, "GSUP pool: cannot create client for %s:%u\n",
+			     servers[i].ip_addr, servers[i].tcp_port);
+			osmo_gsup_client_pool_destroy(pool);
+			return NULL;
+		}
+		gsupc->data = pool;
+		pool->clients[i] = gsupc;
+	}
+
+	return pool;
+}
+
+void osmo_gsup_client_pool_destroy(struct osmo_gsup_client_pool *pool)
+{
+	unsigned int i;
+
+	/* Pending requests are dropped without calling back, like in osmo_gsup_client_destroy(). Their
+	 * osmo_gsup_client_pool_trans are talloc children of the pool. */
+	for (i = 0; i < pool->num_clients; i++)
+		osmo_gsup_client_destroy(pool->clients[i]);
+	talloc_free(pool);
+}
+
+static unsigned int imsi_hash(const char *imsi)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*! Pick the connected server to send a message for an IMSI to, according to the policy of the pool.
+ * \param[in] pool  Client pool.
+ * \param[in] imsi  IMSI the message is about, for OSMO_GSUP_CLIENT_POOL_IMSI_HASH; NULL or empty to use
+ *                  round-robin instead.
+ * \returns a connected client, or NULL if no server is connected.
+ */
+struct osmo_gsup_client *osmo_gsup_client_pool_pick(struct osmo_gsup_client_pool *pool, const char *imsi)
+{
+	unsigned int first, i;
+
+	switch (pool->policy) {
+	case OSMO_GSUP_CLIENT_POOL_ACTIVE_STANDBY:
+		first = 0;
+		break;
+	case OSMO_GSUP_CLIENT_POOL_IMSI_HASH:
+		if (imsi && *imsi) {
+			/* When the server of the IMSI is down, the next one in the list takes over */
+			first = imsi_hash(imsi) % pool->num_clients;
+			break;
+		}
+		/* fall through */
+	case OSMO_GSUP_CLIENT_POOL_ROUND_ROBIN:
+	default:
+		first = pool->next++ % pool->num_clients;
+		break;
+	}
+
+	for (i = 0; i < pool->num_clients; i++) {
+		struct osmo_gsup_client *gsupc = pool->clients[(first + i) % pool->num_clients];
+		if (gsupc->is_connected)
+			return gsupc;
+	}
+	return NULL;
+}
+
+/*! Encode and send a GSUP message to a server picked by osmo_gsup_client_pool_pick().
+ * \returns 0 in case of success, negative on error. */
+int osmo_gsup_client_pool_enc_send(struct osmo_gsup_client_pool *pool,
+				   const struct osmo_gsup_message *gsup_msg)
+{
+	struct osmo_gsup_client *gsupc = osmo_gsup_client_pool_pick(pool, gsup_msg->imsi);
+
+	if (!gsupc) {
+		LOGP(DLGSUP, LOGL_ERROR, "GSUP pool: no server connected, unable to send %s\n",
+		     osmo_gsup_message_type_name(gsup_msg->message_type));
+		return -ENOTCONN;
+	}
+	return osmo_gsup_client_enc_send(gsupc, gsup_msg);
+}
+
+static void pool_trans_resp_cb(struct osmo_gsup_client *gsupc, int rc, const struct osmo_gsup_message *resp,
+			       void *data);
+
+/* Send ptrans->msg to the next connected server, if any is left to try */
+static bool pool_trans_send(struct osmo_gsup_client_pool_trans *ptrans)
+{
+	struct osmo_gsup_client *gsupc;
+
+	if (ptrans->attempts >= ptrans->pool->num_clients)
+		return false;
+	gsupc = osmo_gsup_client_pool_pick(ptrans->pool, ptrans->imsi);
+	if (!gsupc)
+		return false;
+
+	ptrans->attempts++;
+	ptrans->trans = gsup_client_trans_send(gsupc, msgb_copy(ptrans->msg, __func__), ptrans->imsi,
+					       ptrans->message_type, ptrans->session_id, ptrans->timeout_ms,
+					       pool_trans_resp_cb, ptrans);
+	return ptrans->trans != NULL;
+}
+
+static void pool_trans_resp_cb(struct osmo_gsup_client *gsupc, int rc, const struct osmo_gsup_message *resp,
+			       void *data)
+{
+	struct osmo_gsup_client_pool_trans *ptrans = data;
+	osmo_gsup_client_resp_cb_t resp_cb = ptrans->resp_cb;
+	void *resp_data = ptrans->data;
+
+	ptrans->trans = NULL;
+	if (rc == -ENOTCONN) {
+		LOGP(DLGSUP, LOGL_INFO, "IMSI='%s': GSUP pool: link to %s:%d lost, sending %s to the next server\n",
+		     ptrans->imsi, gsupc->link->addr, gsupc->link->port,
+		     osmo_gsup_message_type_name(ptrans->message_type));
+		if (pool_trans_send(ptrans))
+			return;
+	}
+
+	talloc_free(ptrans);
+	resp_cb(gsupc, rc, resp, resp_data);
+}
+
+/*! Like osmo_gsup_client_request(), sending to a server picked by osmo_gsup_client_pool_pick(). When the link
+ * to that server is lost before the response arrived, the request is sent again to the next connected server,
+ * up to once per server; only then is resp_cb called with -ENOTCONN. Each server gets the full timeout_ms.
+ * \returns the pending request, to cancel it; NULL if it could not be sent to any server.
+ */
+struct osmo_gsup_client_pool_trans *osmo_gsup_client_pool_request(struct osmo_gsup_client_pool *pool,
+								   const struct osmo_gsup_message *gsup_msg,
+								   unsigned int timeout_ms,
+								   osmo_gsup_client_resp_cb_t resp_cb, void *data)
+{
+	struct osmo_gsup_client_pool_trans *ptrans;
+
+	OSMO_ASSERT(resp_cb);
+	OSMO_ASSERT(OSMO_GSUP_IS_MSGT_REQUEST(gsup_msg->message_type));
+
+	ptrans = talloc_zero(pool, struct osmo_gsup_client_pool_trans);
+	OSMO_ASSERT(ptrans);
+	ptrans->msg = osmo_gsup_client_msgb_alloc();
+	talloc_steal(ptrans, ptrans->msg);
+	if (osmo_gsup_encode(ptrans->msg, gsup_msg)) {
+		LOGP(DLGSUP, LOGL_ERROR, "Couldn't encode GSUP message\n");
+		talloc_free(ptrans);
+		return NULL;
+	}
+
+	ptrans->pool = pool;
+	OSMO_STRLCPY_ARRAY(ptrans->imsi, gsup_msg->imsi);
+	ptrans->message_type = gsup_msg->message_type;
+	ptrans->session_id = gsup_msg->session_id;
+	ptrans->timeout_ms = timeout_ms;
+	ptrans->resp_cb = resp_cb;
+	ptrans->data = data;
+
+	if (!pool_trans_send(ptrans)) {
+		LOGP(DLGSUP, LOGL_ERROR, "IMSI='%s': GSUP pool: no server connected, unable to send %s\n",
+		     ptrans->imsi, osmo_gsup_message_type_name(ptrans->message_type));
+		talloc_free(ptrans);
+		return NULL;
+	}
+	return ptrans;
+}
+
+/*! Forget about a request sent with osmo_gsup_client_pool_request(), without calling back.
+ * \param[in] ptrans  Pending request, as returned by osmo_gsup_client_pool_request(). */
+void osmo_gsup_client_pool_trans_cancel(struct osmo_gsup_client_pool_trans *ptrans)
+{
+	if (ptrans->trans)
+		osmo_gsup_client_trans_cancel(ptrans->trans);
+	talloc_free(ptrans);
+}
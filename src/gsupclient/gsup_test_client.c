@@ -3,7 +3,6 @@
 #include <errno.h>
 #include <signal.h>
 
-#include <osmocom/core/linuxlist.h>
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/select.h>
 #include <osmocom/core/application.h>
@@ -19,7 +18,9 @@ static struct osmo_gsup_client *g_gc;
 /***********************************************************************
  * IMSI Operation
  ***********************************************************************/
-static LLIST_HEAD(g_imsi_ops);
+
+/* Give up waiting for a response after this time */
+#define IMSI_OP_TIMEOUT_MS 10000
 
 struct imsi_op_stats {
 	uint32_t num_alloc;
@@ -45,127 +46,69 @@ static const struct value_string imsi_op_names[] = {
 
 static struct imsi_op_stats imsi_op_stats[_NUM_IMSI_OP];
 
+/* A request sent by us; the GSUP client library matches the response to it */
 struct imsi_op {
-	struct llist_head list;
 	char imsi[17];
 	enum imsi_op_type type;
-	struct osmo_timer_list timer;
 };
 
-static struct imsi_op *imsi_op_find(const char *imsi,
-			     enum imsi_op_type type)
-{
-	struct imsi_op *io;
+static void imsi_op_resp_cb(struct osmo_gsup_client *gsupc, int rc, const struct osmo_gsup_message *resp,
+			    void *data);
 
-	llist_for_each_entry(io, &g_imsi_ops, list) {
-		if (!strcmp(io->imsi, imsi) && io->type == type)
-			return io;
-	}
-	return NULL;
-}
-
-static void imsi_op_timer_cb(void *data);
-
-static struct imsi_op *imsi_op_alloc(void *ctx, const char *imsi,
-				enum imsi_op_type type)
+/* allocate + generate + send a request */
+static int imsi_op_req(const char *imsi, enum imsi_op_type type, enum osmo_gsup_message_type msg_type)
 {
-	struct imsi_op *io;
-
-	if (imsi_op_find(imsi, type))
-		return NULL;
+	struct imsi_op *io = talloc_zero(g_gc, struct imsi_op);
+	struct osmo_gsup_message gsup = {0};
 
-	io = talloc_zero(ctx, struct imsi_op);
 	OSMO_STRLCPY_ARRAY(io->imsi, imsi);
 	io->type = type;
-	osmo_timer_setup(&io->timer, imsi_op_timer_cb, io);
-	llist_add(&io->list, &g_imsi_ops);
-	imsi_op_stats[type].num_alloc++;
 
-	return io;
+	OSMO_STRLCPY_ARRAY(gsup.imsi, io->imsi);
+	gsup.message_type = msg_type;
+
+	if (!osmo_gsup_client_request(g_gc, &gsup, IMSI_OP_TIMEOUT_MS, imsi_op_resp_cb, io)) {
+		printf("%s: sending failure\n", imsi);
+		talloc_free(io);
+		return -EIO;
+	}
+	imsi_op_stats[type].num_alloc++;
+	return 0;
 }
 
 static void imsi_op_release(struct imsi_op *io)
 {
-	osmo_timer_del(&io->timer);
-	llist_del(&io->list);
 	imsi_op_stats[io->type].num_released++;
 	talloc_free(io);
 }
 
-static void imsi_op_timer_cb(void *data)
-{
-	struct imsi_op *io = data;
-	printf("%s: Timer expiration\n", io->imsi);
-	imsi_op_stats[io->type].num_timeout++;
-	imsi_op_release(io);
-}
-
 /* allocate + generate + send Send-Auth-Info */
 static int req_auth_info(const char *imsi)
 {
-	struct imsi_op *io = imsi_op_alloc(g_gc, imsi, IMSI_OP_SAI);
-	struct osmo_gsup_message gsup = {0};
-	struct msgb *msg = msgb_alloc_headroom(1200, 200, __func__);
-	int rc;
-
-	OSMO_STRLCPY_ARRAY(gsup.imsi, io->imsi);
-	gsup.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST;
-
-	rc = osmo_gsup_encode(msg, &gsup);
-	if (rc < 0) {
-		printf("%s: encoding failure (%s)\n", imsi, strerror(-rc));
-		return rc;
-	}
-
-	return osmo_gsup_client_send(g_gc, msg);
+	return imsi_op_req(imsi, IMSI_OP_SAI, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST);
 }
 
-/* allocate + generate + send Send-Auth-Info */
+/* allocate + generate + send Update-Location */
 static int req_loc_upd(const char *imsi)
 {
-	struct imsi_op *io = imsi_op_alloc(g_gc, imsi, IMSI_OP_LU);
-	struct osmo_gsup_message gsup = {0};
-	struct msgb *msg = msgb_alloc_headroom(1200, 200, __func__);
-	int rc;
-
-	OSMO_STRLCPY_ARRAY(gsup.imsi, io->imsi);
-	gsup.message_type = OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST;
-
-	rc = osmo_gsup_encode(msg, &gsup);
-	if (rc < 0) {
-		printf("%s: encoding failure (%s)\n", imsi, strerror(-rc));
-		return rc;
-	}
-
-	return osmo_gsup_client_send(g_gc, msg);
+	return imsi_op_req(imsi, IMSI_OP_LU, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST);
 }
 
-static int resp_isd(struct imsi_op *io)
+/* receive the response to a request */
+static void imsi_op_resp_cb(struct osmo_gsup_client *gsupc, int rc, const struct osmo_gsup_message *resp,
+			    void *data)
 {
-	struct osmo_gsup_message gsup = {0};
-	struct msgb *msg = msgb_alloc_headroom(1200, 200, __func__);
-	int rc;
-
-	OSMO_STRLCPY_ARRAY(gsup.imsi, io->imsi);
-	gsup.message_type = OSMO_GSUP_MSGT_INSERT_DATA_RESULT;
+	struct imsi_op *io = data;
+	int is_error = 0;
 
-	rc = osmo_gsup_encode(msg, &gsup);
 	if (rc < 0) {
-		printf("%s: encoding failure (%s)\n", io->imsi, strerror(-rc));
-		return rc;
+		printf("%s: %s\n", io->imsi, rc == -ETIMEDOUT ? "Timer expiration" : "Link lost");
+		imsi_op_stats[io->type].num_timeout++;
+		imsi_op_release(io);
+		return;
 	}
 
-	imsi_op_release(io);
-
-	return osmo_gsup_client_send(g_gc, msg);
-}
-
-/* receive an incoming GSUP message */
-static void imsi_op_rx_gsup(struct imsi_op *io, const struct osmo_gsup_message *gsup)
-{
-	int is_error = 0, rc;
-
-	if (OSMO_GSUP_IS_MSGT_ERROR(gsup->message_type)) {
+	if (OSMO_GSUP_IS_MSGT_ERROR(resp->message_type)) {
 		imsi_op_stats[io->type].num_rx_error++;
 		is_error = 1;
 	} else
@@ -178,78 +121,71 @@ static void imsi_op_rx_gsup(struct imsi_op *io, const struct osmo_gsup_message *
 		rc = req_loc_upd(io->imsi);
 		if (rc < 0)
 			printf("Failed to request Location Update for %s\n", io->imsi);
-		imsi_op_release(io);
 		break;
 	case IMSI_OP_LU:
 		printf("%s; LU Response%s\n", io->imsi, is_error ? ": ERROR" : "");
-		imsi_op_release(io);
-		break;
-	case IMSI_OP_ISD:
-		printf("%s; ISD Request%s\n", io->imsi, is_error ? ": ERROR" : "");
-		rc = resp_isd(io);
-		if (rc < 0)
-			printf("Failed to insert subscriber data for %s\n", io->imsi);
 		break;
 	default:
 		printf("%s: Unknown\n", io->imsi);
-		imsi_op_release(io);
 		break;
 	}
+	imsi_op_release(io);
 }
 
-static int op_type_by_gsup_msgt(enum osmo_gsup_message_type msg_type)
+/* ISD is an inbound transaction, answer it right away */
+static int resp_isd(const char *imsi)
 {
-	switch (msg_type) {
-	case OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT:
-	case OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR:
-		return IMSI_OP_SAI;
-	case OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT:
-	case OSMO_GSUP_MSGT_UPDATE_LOCATION_ERROR:
-		return IMSI_OP_LU;
-	case OSMO_GSUP_MSGT_INSERT_DATA_REQUEST:
-		return IMSI_OP_ISD;
-	default:
-		printf("Unknown GSUP msg_type %u\n", msg_type);
-		return -1;
+	struct osmo_gsup_message gsup = {0};
+	struct msgb *msg = msgb_alloc_headroom(1200, 200, __func__);
+	int rc;
+
+	printf("%s; ISD Request\n", imsi);
+	imsi_op_stats[IMSI_OP_ISD].num_alloc++;
+	imsi_op_stats[IMSI_OP_ISD].num_rx_success++;
+
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	gsup.message_type = OSMO_GSUP_MSGT_INSERT_DATA_RESULT;
+
+	rc = osmo_gsup_encode(msg, &gsup);
+	imsi_op_stats[IMSI_OP_ISD].num_released++;
+	if (rc < 0) {
+		printf("%s: encoding failure (%s)\n", imsi, strerror(-rc));
+		msgb_free(msg);
+		return rc;
 	}
+
+	return osmo_gsup_client_send(g_gc, msg);
 }
 
+/* receive an incoming GSUP message that is not a response to our requests */
 static int gsupc_read_cb(struct osmo_gsup_client *gsupc, struct msgb *msg)
 {
 	struct osmo_gsup_message gsup_msg = {0};
-	struct imsi_op *io = NULL;
 	int rc;
 
 	DEBUGP(DLGSUP, "Rx GSUP %s\n", msgb_hexdump(msg));
 
 	rc = osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup_msg);
-	if (rc < 0)
-		return rc;
-
-	if (!gsup_msg.imsi[0])
+	if (rc < 0 || !gsup_msg.imsi[0]) {
+		msgb_free(msg);
 		return -1;
+	}
 
-	rc = op_type_by_gsup_msgt(gsup_msg.message_type);
-	if (rc < 0)
-		return rc;
-
-	switch (rc) {
-	case IMSI_OP_SAI:
-	case IMSI_OP_LU:
-		io = imsi_op_find(gsup_msg.imsi, rc);
+	switch (gsup_msg.message_type) {
+	case OSMO_GSUP_MSGT_INSERT_DATA_REQUEST:
+		rc = resp_isd(gsup_msg.imsi);
+		if (rc < 0)
+			printf("Failed to insert subscriber data for %s\n", gsup_msg.imsi);
 		break;
-	case IMSI_OP_ISD:
-		/* ISD is an inbound transaction */
-		io = imsi_op_alloc(g_gc, gsup_msg.imsi, IMSI_OP_ISD);
+	default:
+		/* also responses arriving after their request timed out */
+		printf("%s: Unexpected GSUP msg_type %u\n", gsup_msg.imsi, gsup_msg.message_type);
+		rc = -1;
 		break;
 	}
-	if (!io)
-		return -1;
 
-	imsi_op_rx_gsup(io, &gsup_msg);
 	msgb_free(msg);
-
-	return 0;
+	return rc;
 }
 
 static void print_report(void)
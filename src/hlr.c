@@ -21,6 +21,7 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <string.h>
 
 #include <osmocom/core/msgb.h>
 #include <osmocom/core/stats.h>
@@ -32,10 +33,10 @@
 #include <osmocom/vty/telnet_interface.h>
 #include <osmocom/vty/ports.h>
 #include <osmocom/ctrl/control_vty.h>
-#include <osmocom/gsm/apn.h>
 #include <osmocom/gsm/gsm48_ie.h>
 
 #include "db.h"
+#include "auc_image.h"
 #include "hlr.h"
 #include "ctrl.h"
 #include "logging.h"
@@ -45,6 +46,11 @@
 #include "luop.h"
 #include "hlr_vty.h"
 #include "hlr_ussd.h"
+#include "hlr_cluster.h"
+#include "imsi_filter.h"
+#include "probes.h"
+#include "logring.h"
+#include "gsup_scan.h"
 
 struct hlr *g_hlr;
 static void *hlr_ctx = NULL;
@@ -68,9 +74,6 @@ osmo_hlr_subscriber_update_notify(struct hlr_subscriber *subscr)
 	}
 
 	llist_for_each_entry(co, &g_hlr->gs->clients, list) {
-		struct osmo_gsup_message gsup = { };
-		uint8_t msisdn_enc[OSMO_GSUP_MAX_CALLED_PARTY_BCD_LEN];
-		uint8_t apn[APN_MAXLEN];
 		struct msgb *msg_out;
 		uint8_t *peer;
 		int peer_len;
@@ -115,8 +118,8 @@ osmo_hlr_subscriber_update_notify(struct hlr_subscriber *subscr)
 		     subscr->imsi, cn_domain == OSMO_GSUP_CN_DOMAIN_PS ? "PS" : "CS",
 		     osmo_quote_str(peer_compare, -1));
 
-		if (osmo_gsup_create_insert_subscriber_data_msg(&gsup, subscr->imsi, subscr->msisdn, msisdn_enc,
-								sizeof(msisdn_enc), apn, sizeof(apn), cn_domain) != 0) {
+		msg_out = isd_cache_msgb(g_hlr->gs->isd_cache, subscr->imsi, subscr->msisdn, cn_domain);
+		if (!msg_out) {
 			LOGP(DLGSUP, LOGL_ERROR,
 			       "IMSI='%s': Cannot notify GSUP client; could not create gsup message "
 			       "for %s:%u\n", subscr->imsi,
@@ -126,16 +129,6 @@ osmo_hlr_subscriber_update_notify(struct hlr_subscriber *subscr)
 		}
 
 		/* Send ISD to MSC/SGSN */
-		msg_out = msgb_alloc_headroom(1024+16, 16, "GSUP ISD UPDATE");
-		if (msg_out == NULL) {
-			LOGP(DLGSUP, LOGL_ERROR,
-			       "IMSI='%s': Cannot notify GSUP client; could not allocate msg buffer "
-			       "for %s:%u\n", subscr->imsi,
-			       co && co->conn && co->conn->server? co->conn->server->addr : "unset",
-			       co && co->conn && co->conn->server? co->conn->server->port : 0);
-			continue;
-		}
-		osmo_gsup_encode(msg_out, &gsup);
 
 		if (osmo_gsup_addr_send(g_hlr->gs, peer, peer_len, msg_out) < 0) {
 			LOGP(DMAIN, LOGL_ERROR,
@@ -152,25 +145,11 @@ osmo_hlr_subscriber_update_notify(struct hlr_subscriber *subscr)
  * Send Auth Info handling
  ***********************************************************************/
 
-/* process an incoming SAI request */
-static int rx_send_auth_info(struct osmo_gsup_conn *conn,
-			     const struct osmo_gsup_message *gsup,
-			     struct db_context *dbc)
+/* Fill in the SAI response for the return value of db_get_auc() */
+static void sai_response_set(struct osmo_gsup_message *gsup_out, const char *imsi, int rc)
 {
-	struct osmo_gsup_message gsup_out;
-	struct msgb *msg_out;
-	int rc;
-
-	/* initialize return message structure */
-	memset(&gsup_out, 0, sizeof(gsup_out));
-	memcpy(&gsup_out.imsi, &gsup->imsi, sizeof(gsup_out.imsi));
-
-	rc = db_get_auc(dbc, gsup->imsi, conn->auc_3g_ind,
-			gsup_out.auth_vectors,
-			ARRAY_SIZE(gsup_out.auth_vectors),
-			gsup->rand, gsup->auts);
 	if (rc <= 0) {
-		gsup_out.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR;
+		gsup_out->message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR;
 		switch (rc) {
 		case 0:
 			/* 0 means "0 tuples generated", which shouldn't happen.
@@ -178,23 +157,121 @@ static int rx_send_auth_info(struct osmo_gsup_conn *conn,
 		case -ENOKEY:
 			LOGP(DAUC, LOGL_NOTICE, "%s: IMSI known, but has no auth data;"
 			     " Returning slightly inaccurate cause 'IMSI Unknown' via GSUP\n",
-			     gsup->imsi);
-			gsup_out.cause = GMM_CAUSE_IMSI_UNKNOWN;
+			     imsi);
+			gsup_out->cause = GMM_CAUSE_IMSI_UNKNOWN;
 			break;
 		case -ENOENT:
-			LOGP(DAUC, LOGL_NOTICE, "%s: IMSI not known\n", gsup->imsi);
-			gsup_out.cause = GMM_CAUSE_IMSI_UNKNOWN;
+			LOGP(DAUC, LOGL_NOTICE, "%s: IMSI not known\n", imsi);
+			gsup_out->cause = GMM_CAUSE_IMSI_UNKNOWN;
 			break;
 		default:
-			LOGP(DAUC, LOGL_ERROR, "%s: failure to look up IMSI in db\n", gsup->imsi);
-			gsup_out.cause = GMM_CAUSE_NET_FAIL;
+			LOGP(DAUC, LOGL_ERROR, "%s: failure to look up IMSI in db\n", imsi);
+			gsup_out->cause = GMM_CAUSE_NET_FAIL;
 			break;
 		}
 	} else {
-		gsup_out.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT;
-		gsup_out.num_auth_vectors = rc;
+		gsup_out->message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT;
+		gsup_out->num_auth_vectors = rc;
+	}
+}
+
+/* IPA name of the VLR/SGSN waiting for db_get_auc_async() */
+struct sai_async {
+	uint8_t *peer;
+	size_t peer_len;
+	/* On a read replica, a copy of the request to pass on to the primary if db_get_auc() returns -EROFS */
+	struct msgb *req;
+};
+
+static void sai_async_cb(struct db_context *dbc, const char *imsi, int rc, const struct osmo_auth_vector *vec,
+			 void *data)
+{
+	struct sai_async *sa = data;
+	struct osmo_gsup_message gsup_out;
+	struct msgb *msg_out;
+
+	/* Workers stopped on shutdown, the GSUP server may be gone already */
+	if (rc == -ECANCELED) {
+		if (sa->req)
+			msgb_free(sa->req);
+		talloc_free(sa);
+		return;
+	}
+
+	if (rc == -EROFS && sa->req) {
+		rc = cluster_forward_to_primary(g_hlr, sa->peer, sa->peer_len, sa->req, imsi,
+						OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST);
+		sa->req = NULL;
+		if (!rc) {
+			talloc_free(sa);
+			return;
+		}
+	}
+	if (sa->req)
+		msgb_free(sa->req);
+
+	memset(&gsup_out, 0, sizeof(gsup_out));
+	OSMO_STRLCPY_ARRAY(gsup_out.imsi, imsi);
+	if (rc > 0)
+		memcpy(gsup_out.auth_vectors, vec, rc * sizeof(*vec));
+	sai_response_set(&gsup_out, imsi, rc);
+
+	msg_out = msgb_alloc_headroom(1024+16, 16, "GSUP AUC response");
+	osmo_gsup_encode(msg_out, &gsup_out);
+	/* The VLR/SGSN may have disconnected meanwhile, then this drops the response */
+	if (osmo_gsup_addr_send(g_hlr->gs, sa->peer, sa->peer_len, msg_out) < 0)
+		LOGP(DAUC, LOGL_NOTICE, "%s: Cannot send auth vectors, GSUP client gone\n", imsi);
+	talloc_free(sa);
+}
+
+/* process an incoming SAI request */
+static int rx_send_auth_info(struct osmo_gsup_conn *conn, struct msgb *msg,
+			     const struct osmo_gsup_message *gsup,
+			     struct db_context *dbc)
+{
+	struct osmo_gsup_message gsup_out;
+	struct msgb *msg_out;
+	struct sai_async *sa;
+	uint8_t *peer;
+	int peer_len;
+	int rc;
+
+	/* With worker threads, reply once the vectors are computed. The conn may be gone by then, so remember
+	 * its name to look it up again. */
+	peer_len = dbc->auc_async.pool ? osmo_gsup_conn_ccm_get(conn, &peer, IPAC_IDTAG_SERNR) : -1;
+	if (peer_len > 0) {
+		sa = talloc_zero(g_hlr, struct sai_async);
+		OSMO_ASSERT(sa);
+		sa->peer = talloc_memdup(sa, peer, peer_len);
+		sa->peer_len = peer_len;
+		if (dbc->readonly)
+			sa->req = msgb_copy(msg, __func__);
+		rc = db_get_auc_async(dbc, gsup->imsi, conn->auc_3g_ind, ARRAY_SIZE(gsup_out.auth_vectors),
+				      gsup->rand, gsup->auts, sai_async_cb, sa);
+		if (!rc)
+			return 0;
+		if (sa->req)
+			msgb_free(sa->req);
+		talloc_free(sa);
 	}
 
+	/* initialize return message structure */
+	memset(&gsup_out, 0, sizeof(gsup_out));
+	memcpy(&gsup_out.imsi, &gsup->imsi, sizeof(gsup_out.imsi));
+
+	rc = db_get_auc(dbc, gsup->imsi, conn->auc_3g_ind,
+			gsup_out.auth_vectors,
+			ARRAY_SIZE(gsup_out.auth_vectors),
+			gsup->rand, gsup->auts);
+
+	/* A read replica cannot store the new SQN, the primary has to answer */
+	if (rc == -EROFS && (peer_len = osmo_gsup_conn_ccm_get(conn, &peer, IPAC_IDTAG_SERNR)) > 0
+	    && !cluster_forward_to_primary(g_hlr, peer, peer_len, msgb_copy(msg, __func__), gsup->imsi,
+					   gsup->message_type))
+		return 0;
+
+	sai_response_set(&gsup_out, gsup->imsi, rc);
+
 	msg_out = msgb_alloc_headroom(1024+16, 16, "GSUP AUC response");
 	osmo_gsup_encode(msg_out, &gsup_out);
 	return osmo_gsup_conn_send(conn, msg_out);
@@ -441,15 +518,14 @@ static int rx_check_imei_req(struct osmo_gsup_conn *conn, const struct osmo_gsup
 	return osmo_gsup_conn_send(conn, msg_out);
 }
 
-static char namebuf[255];
 #define LOGP_GSUP_FWD(gsup, level, fmt, args ...) \
-	LOGP(DMAIN, level, "Forward %s (class=%s, IMSI=%s, %s->%s): " fmt, \
-	     osmo_gsup_message_type_name(gsup->message_type), \
-	     osmo_gsup_message_class_name(gsup->message_class), \
-	     gsup->imsi, \
-	     osmo_quote_str((const char *)gsup->source_name, gsup->source_name_len), \
-	     osmo_quote_str_buf2(namebuf, sizeof(namebuf), (const char *)gsup->destination_name, gsup->destination_name_len), \
-	     ## args)
+	LOGPR(DMAIN, level, "Forward %s (class=%s, IMSI=%s, %s->%s): " fmt, \
+	      osmo_gsup_message_type_name(gsup->message_type), \
+	      osmo_gsup_message_class_name(gsup->message_class), \
+	      gsup->imsi, \
+	      LOGRING_QUOTE(gsup->source_name, gsup->source_name_len), \
+	      LOGRING_QUOTE(gsup->destination_name, gsup->destination_name_len), \
+	      ## args)
 
 static int read_cb_forward(struct osmo_gsup_conn *conn, struct msgb *msg, const struct osmo_gsup_message *gsup)
 {
@@ -525,12 +601,10 @@ static int read_cb(struct osmo_gsup_conn *conn, struct msgb *msg)
 		return -EINVAL;
 	}
 
-	rc = osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup);
-	if (rc < 0) {
-		LOGP(DMAIN, LOGL_ERROR, "error in GSUP decode: %d\n", rc);
-		msgb_free(msg);
-		return rc;
-	}
+	/* Messages to forward only need their routing IEs, decode them completely once they stay here */
+	rc = gsup_scan(msgb_l2(msg), msgb_l2len(msg), &gsup);
+	if (rc < 0)
+		goto decode_error;
 
 	/* 3GPP TS 23.003 Section 2.2 clearly states that an IMSI with less than 5
 	 * digits is impossible.  Even 5 digits is a highly theoretical case */
@@ -544,10 +618,19 @@ static int read_cb(struct osmo_gsup_conn *conn, struct msgb *msg)
 	if (gsup.destination_name_len)
 		return read_cb_forward(conn, msg, &gsup);
 
+	/* IMSI served by another node of the cluster */
+	if (cluster_forward_from_conn(conn, msg, &gsup))
+		return 0;
+
+	rc = osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup);
+	if (rc < 0)
+		goto decode_error;
+
+	HLR_PROBE3(gsup_dispatch, conn->auc_3g_ind, gsup.message_type, (const char *)gsup.imsi);
 	switch (gsup.message_type) {
 	/* requests sent to us */
 	case OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST:
-		rx_send_auth_info(conn, &gsup, g_hlr->dbc);
+		rx_send_auth_info(conn, msg, &gsup, g_hlr->dbc);
 		break;
 	case OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST:
 		rx_upd_loc_req(conn, &gsup);
@@ -596,8 +679,15 @@ static int read_cb(struct osmo_gsup_conn *conn, struct msgb *msg)
 		     osmo_gsup_message_type_name(gsup.message_type));
 		break;
 	}
+	HLR_PROBE2(gsup_dispatch_done, conn->auc_3g_ind, gsup.message_type);
 	msgb_free(msg);
 	return 0;
+
+decode_error:
+	LOGP(DMAIN, LOGL_ERROR, "error in GSUP decode: %d\n", rc);
+	gsup_stats_inc(conn, GSUP_CONN_CTR_RX_INVALID);
+	msgb_free(msg);
+	return rc;
 }
 
 static void print_usage()
@@ -741,10 +831,18 @@ int main(int argc, char **argv)
 	INIT_LLIST_HEAD(&g_hlr->iuse_list);
 	INIT_LLIST_HEAD(&g_hlr->ss_sessions);
 	INIT_LLIST_HEAD(&g_hlr->ussd_routes);
+	INIT_LLIST_HEAD(&g_hlr->cluster.peers);
+	INIT_LLIST_HEAD(&g_hlr->cluster.ranges);
 	g_hlr->db_file_path = talloc_strdup(g_hlr, HLR_DEFAULT_DB_FILE_PATH);
 
 	/* Init default (call independent) SS session guard timeout value */
 	g_hlr->ncss_guard_timeout = NCSS_GUARD_TIMEOUT_DEFAULT;
+	g_hlr->change_log_keep = DB_CHANGE_LOG_KEEP_DEFAULT;
+	g_hlr->imsi_filter.unknown_ttl = IMSI_FILTER_UNKNOWN_TTL_DEFAULT;
+	g_hlr->gsup_tx_queue.limit = OSMO_GSUP_TX_QUEUE_LIMIT_DEFAULT;
+	g_hlr->gsup_latency_stats = true;
+	g_hlr->gsup_tx_queue.high = OSMO_GSUP_TX_QUEUE_HIGH_DEFAULT;
+	g_hlr->gsup_tx_queue.low = OSMO_GSUP_TX_QUEUE_LOW_DEFAULT;
 
 	rc = osmo_init_logging2(hlr_ctx, &hlr_log_info);
 	if (rc < 0) {
@@ -783,18 +881,68 @@ int main(int argc, char **argv)
 	if (cmdline_opts.db_file)
 		osmo_talloc_replace_string(g_hlr, &g_hlr->db_file_path, cmdline_opts.db_file);
 
-	g_hlr->dbc = db_open(hlr_ctx, g_hlr->db_file_path, true, cmdline_opts.db_upgrade);
+	/* A read replica reads the database its primary writes */
+	g_hlr->dbc = db_open2(hlr_ctx, g_hlr->db_file_path, true, cmdline_opts.db_upgrade, !!g_hlr->cluster.primary);
 	if (!g_hlr->dbc) {
 		LOGP(DMAIN, LOGL_FATAL, "Error opening database %s\n", osmo_quote_str(g_hlr->db_file_path, -1));
 		exit(1);
 	}
 
+	g_hlr->dbc->last_lu_seen_granularity = g_hlr->last_lu_seen_granularity;
+	g_hlr->dbc->change_log.keep = g_hlr->change_log_keep;
+	db_sai_coalesce_window_set(g_hlr->dbc, g_hlr->sai_coalesce_window_ms);
+	if (g_hlr->db_stmt_stats)
+		db_stmt_stats_enable(g_hlr->dbc, true);
+
+	if (g_hlr->imsi_filter.enable) {
+		rc = db_imsi_filter_enable(g_hlr->dbc, g_hlr->imsi_filter.unknown_ttl);
+		if (rc)
+			LOGP(DMAIN, LOGL_ERROR, "Cannot set up the IMSI filter, looking up all IMSIs: %s\n",
+			     strerror(-rc));
+	}
+
+	if (g_hlr->auc_workers && db_auc_workers_start(g_hlr->dbc, g_hlr->auc_workers))
+		LOGP(DMAIN, LOGL_ERROR, "Cannot start auth vector worker threads, computing on the main thread\n");
+
+	if (g_hlr->cluster.num_nodes > 1 || g_hlr->cluster.node_id) {
+		if (db_ind_partition_set(g_hlr->dbc, g_hlr->cluster.node_id, g_hlr->cluster.num_nodes)) {
+			LOGP(DMAIN, LOGL_FATAL, "cluster node-id %u must be smaller than num-nodes %u\n",
+			     g_hlr->cluster.node_id, g_hlr->cluster.num_nodes);
+			exit(1);
+		}
+		LOGP(DMAIN, LOGL_NOTICE, "Cluster node %u of %u: using every %u. UMTS SQN IND value from %u\n",
+		     g_hlr->cluster.node_id, g_hlr->cluster.num_nodes, g_hlr->cluster.num_nodes,
+		     g_hlr->cluster.node_id);
+	}
+
+	if (g_hlr->auc_image_path) {
+		g_hlr->dbc->auc_image = auc_image_open(g_hlr->dbc, g_hlr->auc_image_path, NULL);
+		if (!g_hlr->dbc->auc_image) {
+			LOGP(DMAIN, LOGL_FATAL, "Error opening AUC image %s\n",
+			     osmo_quote_str(g_hlr->auc_image_path, -1));
+			exit(1);
+		}
+	}
+
 	g_hlr->gs = osmo_gsup_server_create(hlr_ctx, g_hlr->gsup_bind_addr, OSMO_GSUP_PORT,
 					    read_cb, &g_lu_ops, g_hlr);
 	if (!g_hlr->gs) {
 		LOGP(DMAIN, LOGL_FATAL, "Error starting GSUP server\n");
 		exit(1);
 	}
+	g_hlr->gs->tx_queue.limit = g_hlr->gsup_tx_queue.limit;
+	g_hlr->gs->tx_queue.high = g_hlr->gsup_tx_queue.high;
+	g_hlr->gs->tx_queue.low = g_hlr->gsup_tx_queue.low;
+	if (g_hlr->gsup_isd_cache_slots)
+		g_hlr->gs->isd_cache = isd_cache_alloc(g_hlr->gs, g_hlr->gsup_isd_cache_slots);
+	g_hlr->gs->latency_stats = g_hlr->gsup_latency_stats;
+	g_hlr->gs->conn_up_cb = euse_conn_up;
+	g_hlr->gs->conn_down_cb = euse_conn_down;
+
+	if (hlr_cluster_start(g_hlr)) {
+		LOGP(DMAIN, LOGL_FATAL, "Error connecting to cluster peers\n");
+		exit(1);
+	}
 
 	g_hlr->ctrl_bind_addr = ctrl_vty_get_bind_addr();
 	g_hlr->ctrl = hlr_controlif_setup(g_hlr);
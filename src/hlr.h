@@ -28,6 +28,7 @@
 #define HLR_DEFAULT_DB_FILE_PATH "hlr.db"
 
 struct hlr_euse;
+struct hlr_cluster_peer;
 
 struct hlr {
 	/* GSUP server pointer */
@@ -36,6 +37,8 @@ struct hlr {
 	/* DB context */
 	char *db_file_path;
 	struct db_context *dbc;
+	/* Read-only AUC image to serve auth data from, see auc_image.h */
+	char *auc_image_path;
 
 	/* Control Interface */
 	struct ctrl_handle *ctrl;
@@ -43,6 +46,17 @@ struct hlr {
 
 	/* Local bind addr */
 	char *gsup_bind_addr;
+	/* see osmo_gsup_server.tx_queue */
+	struct {
+		unsigned int limit;
+		unsigned int high;
+		unsigned int low;
+	} gsup_tx_queue;
+	/* Subscribers to cache Insert Subscriber Data requests for, 0 to encode them each time; see
+	 * osmo_gsup_server.isd_cache */
+	unsigned int gsup_isd_cache_slots;
+	/* see osmo_gsup_server.latency_stats */
+	bool gsup_latency_stats;
 
 	struct llist_head euse_list;
 	struct hlr_euse *euse_default;
@@ -56,6 +70,40 @@ struct hlr {
 	struct llist_head ss_sessions;
 
 	bool store_imei;
+
+	/* see db_context.last_lu_seen_granularity */
+	unsigned int last_lu_seen_granularity;
+
+	/* see db_context.change_log.keep */
+	unsigned int change_log_keep;
+
+	/* see db_context.sai_coalesce.window_ms */
+	unsigned int sai_coalesce_window_ms;
+
+	/* see db_imsi_filter_enable() */
+	struct {
+		bool enable;
+		unsigned int unknown_ttl;
+	} imsi_filter;
+
+	/* see db_stmt_stats_enable() */
+	bool db_stmt_stats;
+
+	/* Number of threads computing auth vectors, 0 to compute them on the main thread */
+	unsigned int auc_workers;
+
+	/* Several HLR nodes serving the same subscribers, see db_context.ind_part, and/or each serving some
+	 * IMSI ranges, see hlr_cluster.h */
+	struct {
+		unsigned int node_id;
+		unsigned int num_nodes;
+		/* IPA name towards peers, see cluster_name() */
+		char *name;
+		struct llist_head peers;
+		struct llist_head ranges;
+		/* If set, this node is a read replica of that node, see cluster_primary_set() */
+		struct hlr_cluster_peer *primary;
+	} cluster;
 };
 
 extern struct hlr *g_hlr;
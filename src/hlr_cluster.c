@@ -0,0 +1,591 @@
+/* OsmoHLR: IMSI ranges partitioned between several HLR nodes */
+
+/* (C) 2019 sysmocom s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Each node serves the subscribers in its own database. A VLR or SGSN may connect to any node: requests for
+ * IMSIs owned by another node are passed on unchanged over a GSUP client connection to that node, which sees
+ * this node like one of its VLRs. Everything the owner sends back for that IMSI (results, Insert Subscriber
+ * Data, ...) is relayed to the VLR/SGSN the request came from, and the VLR's answers go back to the owner.
+ *
+ * A read replica opens the database of its primary read-only and passes all requests that would write to it
+ * on to the primary the same way. */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/gsup.h>
+#include <osmocom/gsupclient/gsup_client.h>
+
+#include "hlr.h"
+#include "hlr_cluster.h"
+#include "gsup_server.h"
+#include "gsup_router.h"
+#include "logging.h"
+#include "db.h"
+#include "gsup_scan.h"
+
+/* A VLR/SGSN waiting for messages from the node owning an IMSI. The MSC and the SGSN of a subscriber each have
+ * their own. */
+struct cluster_proxy {
+	/* cluster_proxies */
+	struct llist_head list;
+	/* cluster_proxy_bucket(imsi), the VLR/SGSN that sent the latest request last */
+	struct llist_head bucket_list;
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	/* IPA name of the VLR/SGSN, to find its conn with osmo_gsup_addr_send() */
+	uint8_t *origin;
+	size_t origin_len;
+	struct hlr_cluster_peer *peer;
+	/* Requests forwarded to the peer and not answered yet, per message type >> 2 */
+	uint8_t pending[64];
+	/* Session of the last message with a session id (USSD, SMS), if has_session */
+	bool has_session;
+	uint32_t session_id;
+	struct osmo_timer_list timer;
+};
+
+static LLIST_HEAD(cluster_proxies);
+
+/* Number of hash buckets for the cluster_proxies by IMSI, a power of two */
+#define CLUSTER_PROXY_BUCKETS 1024
+
+/***********************************************************************
+ * core data structures expressing config from VTY
+ ***********************************************************************/
+
+struct hlr_cluster_peer *cluster_peer_find(struct hlr *hlr, const char *name)
+{
+	struct hlr_cluster_peer *peer;
+
+	llist_for_each_entry(peer, &hlr->cluster.peers, list) {
+		if (!strcmp(peer->name, name))
+			return peer;
+	}
+	return NULL;
+}
+
+static struct hlr_cluster_peer *cluster_peer_find_by_addr(struct hlr *hlr, const uint8_t *addr, size_t addrlen)
+{
+	struct hlr_cluster_peer *peer;
+
+	/* IPA names from osmo_gsup_conn_ccm_get() include the terminating nul */
+	addrlen = strnlen((const char *)addr, addrlen);
+	llist_for_each_entry(peer, &hlr->cluster.peers, list) {
+		if (strlen(peer->name) == addrlen && !memcmp(peer->name, addr, addrlen))
+			return peer;
+	}
+	return NULL;
+}
+
+struct hlr_cluster_peer *cluster_peer_alloc(struct hlr *hlr, const char *name, const char *addr, uint16_t port)
+{
+	struct hlr_cluster_peer *peer = cluster_peer_find(hlr, name);
+	if (peer)
+		return NULL;
+
+	peer = talloc_zero(hlr, struct hlr_cluster_peer);
+	peer->name = talloc_strdup(peer, name);
+	peer->addr = talloc_strdup(peer, addr);
+	peer->port = port;
+	peer->hlr = hlr;
+	llist_add_tail(&peer->list, &hlr->cluster.peers);
+
+	return peer;
+}
+
+static void cluster_proxy_del(struct cluster_proxy *proxy)
+{
+	osmo_timer_del(&proxy->timer);
+	llist_del(&proxy->list);
+	llist_del(&proxy->bucket_list);
+	talloc_free(proxy);
+}
+
+void cluster_peer_del(struct hlr_cluster_peer *peer)
+{
+	struct cluster_proxy *proxy, *proxy_tmp;
+
+	llist_for_each_entry_safe(proxy, proxy_tmp, &cluster_proxies, list) {
+		if (proxy->peer == peer)
+			cluster_proxy_del(proxy);
+	}
+	if (peer->client)
+		osmo_gsup_client_destroy(peer->client);
+	llist_del(&peer->list);
+	talloc_free(peer);
+}
+
+/*! Return whether addr is an IPv4 address of this host, which it is if a socket can be bound to it. */
+bool cluster_addr_is_local(const char *addr)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+	};
+	bool local;
+	int fd;
+
+	if (inet_pton(AF_INET, addr, &sin.sin_addr) != 1)
+		return false;
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		return false;
+	local = bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == 0;
+	close(fd);
+	return local;
+}
+
+/*! Make this node a read replica of the osmo-hlr at addr:port.
+ * \param[in] hlr  Global hlr context.
+ * \param[in] addr  IP address of the primary's GSUP server.
+ * \param[in] port  TCP port of the primary's GSUP server.
+ * \returns 0 on success, negative if connecting to the primary failed.
+ */
+int cluster_primary_set(struct hlr *hlr, const char *addr, uint16_t port)
+{
+	struct hlr_cluster_peer *primary;
+
+	cluster_primary_del(hlr);
+
+	/* The read replica opens the primary's database file, so both normally run on the same host. A primary
+	 * in another container or network namespace sharing the file is fine, so only warn. */
+	if (!cluster_addr_is_local(addr))
+		LOGP(DMAIN, LOGL_NOTICE, "cluster: primary %s is not an address of this host, make sure that"
+		     " 'database' is the file the primary writes\n", addr);
+
+	/* Not in hlr->cluster.peers: it has no IMSI ranges and is not written as 'peer' */
+	primary = talloc_zero(hlr, struct hlr_cluster_peer);
+	INIT_LLIST_HEAD(&primary->list);
+	primary->name = talloc_strdup(primary, "primary");
+	primary->addr = talloc_strdup(primary, addr);
+	primary->port = port;
+	primary->hlr = hlr;
+	hlr->cluster.primary = primary;
+
+	if (hlr->gs)
+		return cluster_peer_connect(primary);
+	return 0;
+}
+
+void cluster_primary_del(struct hlr *hlr)
+{
+	if (!hlr->cluster.primary)
+		return;
+	cluster_peer_del(hlr->cluster.primary);
+	hlr->cluster.primary = NULL;
+}
+
+struct hlr_cluster_range *cluster_range_find(struct hlr *hlr, const char *first, const char *last)
+{
+	struct hlr_cluster_range *range;
+
+	llist_for_each_entry(range, &hlr->cluster.ranges, list) {
+		if (!strcmp(range->first, first) && !strcmp(range->last, last))
+			return range;
+	}
+	return NULL;
+}
+
+struct hlr_cluster_range *cluster_range_alloc(struct hlr *hlr, const char *first, const char *last,
+					      struct hlr_cluster_peer *peer)
+{
+	struct hlr_cluster_range *range;
+
+	if (strlen(first) != strlen(last) || strcmp(first, last) > 0)
+		return NULL;
+	if (cluster_range_find(hlr, first, last))
+		return NULL;
+
+	range = talloc_zero(hlr, struct hlr_cluster_range);
+	range->first = talloc_strdup(range, first);
+	range->last = talloc_strdup(range, last);
+	range->peer = peer;
+	llist_add_tail(&range->list, &hlr->cluster.ranges);
+
+	return range;
+}
+
+void cluster_range_del(struct hlr_cluster_range *range)
+{
+	llist_del(&range->list);
+	talloc_free(range);
+}
+
+/*! Find the first configured IMSI range containing an IMSI.
+ * \param[in] hlr  Global hlr context.
+ * \param[in] imsi  IMSI digits.
+ * \returns the range, or NULL if no range contains the IMSI (i.e. it is served by this node).
+ */
+struct hlr_cluster_range *cluster_range_by_imsi(struct hlr *hlr, const char *imsi)
+{
+	struct hlr_cluster_range *range;
+	size_t len = strlen(imsi);
+
+	/* Digit strings of the same length compare like the numbers they spell */
+	llist_for_each_entry(range, &hlr->cluster.ranges, list) {
+		if (strlen(range->first) == len && strcmp(imsi, range->first) >= 0 && strcmp(imsi, range->last) <= 0)
+			return range;
+	}
+	return NULL;
+}
+
+/*! Return the IPA name this node uses towards its peers, "HLR-<node-id>" unless configured. */
+const char *cluster_name(const struct hlr *hlr)
+{
+	static char buf[32];
+
+	if (hlr->cluster.name)
+		return hlr->cluster.name;
+	snprintf(buf, sizeof(buf), "HLR-%u", hlr->cluster.node_id);
+	return buf;
+}
+
+unsigned int cluster_proxy_count(void)
+{
+	return llist_count(&cluster_proxies);
+}
+
+/***********************************************************************
+ * forwarding between VLRs/SGSNs and peers
+ ***********************************************************************/
+
+/* FNV-1a, 32 bit, of the IMSI */
+static struct llist_head *cluster_proxy_bucket(const char *imsi)
+{
+	static struct llist_head buckets[CLUSTER_PROXY_BUCKETS];
+	uint32_t h = 0x811c9dc5;
+	unsigned int i;
+
+	if (!buckets[0].next) {
+		for (i = 0; i < ARRAY_SIZE(buckets); i++)
+			INIT_LLIST_HEAD(&buckets[i]);
+	}
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 0x01000193;
+	}
+	return &buckets[h & (CLUSTER_PROXY_BUCKETS - 1)];
+}
+
+static struct cluster_proxy *cluster_proxy_find(const char *imsi, const uint8_t *origin, size_t origin_len)
+{
+	struct cluster_proxy *proxy;
+
+	llist_for_each_entry(proxy, cluster_proxy_bucket(imsi), bucket_list) {
+		if (!strcmp(proxy->imsi, imsi) && proxy->origin_len == origin_len
+		    && !memcmp(proxy->origin, origin, origin_len))
+			return proxy;
+	}
+	return NULL;
+}
+
+/* Find the VLR/SGSN a message from the owner of an IMSI goes to: the one in the same session; for a result or
+ * error, the first one waiting for it; for a request of the owner, like Insert Subscriber Data, the one with a
+ * pending Update Location, or else the one that sent the latest request. */
+static struct cluster_proxy *cluster_proxy_find_for_peer(const struct hlr_cluster_peer *peer,
+							 const struct osmo_gsup_message *gsup)
+{
+	struct cluster_proxy *proxy;
+	struct cluster_proxy *waiting = NULL;
+	struct cluster_proxy *updating = NULL;
+	struct cluster_proxy *latest = NULL;
+
+	llist_for_each_entry(proxy, cluster_proxy_bucket(gsup->imsi), bucket_list) {
+		if (proxy->peer != peer || strcmp(proxy->imsi, gsup->imsi))
+			continue;
+		if (gsup->session_state != OSMO_GSUP_SESSION_STATE_NONE && proxy->has_session
+		    && proxy->session_id == gsup->session_id)
+			return proxy;
+		if (!waiting && proxy->pending[gsup->message_type >> 2])
+			waiting = proxy;
+		if (!updating && proxy->pending[OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST >> 2])
+			updating = proxy;
+		latest = proxy;
+	}
+	if (OSMO_GSUP_IS_MSGT_REQUEST(gsup->message_type))
+		return updating ? : latest;
+	return waiting ? : latest;
+}
+
+static void cluster_proxy_timer_cb(void *data)
+{
+	struct cluster_proxy *proxy = data;
+
+	LOGP(DMAIN, LOGL_DEBUG, "IMSI='%s': cluster: forgetting VLR/SGSN %s\n", proxy->imsi,
+	     osmo_quote_str((const char *)proxy->origin, proxy->origin_len));
+	cluster_proxy_del(proxy);
+}
+
+/* Remember that msg from origin went to peer, to pass the answers back */
+static struct cluster_proxy *cluster_proxy_update(const uint8_t *origin, size_t origin_len,
+						   struct hlr_cluster_peer *peer, const struct osmo_gsup_message *gsup)
+{
+	struct cluster_proxy *proxy = cluster_proxy_find(gsup->imsi, origin, origin_len);
+	uint8_t *pending;
+
+	if (!proxy) {
+		proxy = talloc_zero(peer->hlr, struct cluster_proxy);
+		OSMO_STRLCPY_ARRAY(proxy->imsi, gsup->imsi);
+		proxy->origin = talloc_memdup(proxy, origin, origin_len);
+		proxy->origin_len = origin_len;
+		osmo_timer_setup(&proxy->timer, cluster_proxy_timer_cb, proxy);
+		llist_add_tail(&proxy->list, &cluster_proxies);
+		llist_add_tail(&proxy->bucket_list, cluster_proxy_bucket(gsup->imsi));
+	}
+
+	/* The IMSI range may have moved to another node */
+	if (proxy->peer != peer) {
+		memset(proxy->pending, 0, sizeof(proxy->pending));
+		proxy->peer = peer;
+	}
+
+	if (OSMO_GSUP_IS_MSGT_REQUEST(gsup->message_type)) {
+		pending = &proxy->pending[gsup->message_type >> 2];
+		if (*pending < UINT8_MAX)
+			(*pending)++;
+		llist_move_tail(&proxy->bucket_list, cluster_proxy_bucket(gsup->imsi));
+	}
+	if (gsup->session_state != OSMO_GSUP_SESSION_STATE_NONE) {
+		proxy->has_session = gsup->session_state != OSMO_GSUP_SESSION_STATE_END;
+		proxy->session_id = gsup->session_id;
+	}
+
+	osmo_timer_schedule(&proxy->timer, HLR_CLUSTER_PROXY_TIMEOUT, 0);
+	return proxy;
+}
+
+static int cluster_send_err_reply(struct osmo_gsup_conn *conn, const struct osmo_gsup_message *gsup)
+{
+	struct osmo_gsup_message gsup_reply = {0};
+	struct msgb *msg_out;
+
+	OSMO_STRLCPY_ARRAY(gsup_reply.imsi, gsup->imsi);
+	gsup_reply.message_type = OSMO_GSUP_TO_MSGT_ERROR(gsup->message_type);
+	gsup_reply.message_class = gsup->message_class;
+	gsup_reply.cause = GMM_CAUSE_NET_FAIL;
+	gsup_reply.session_state = gsup->session_state;
+	gsup_reply.session_id = gsup->session_id;
+	msg_out = msgb_alloc_headroom(1024+16, 16, "GSUP cluster ERR response");
+	OSMO_ASSERT(msg_out);
+	osmo_gsup_encode(msg_out, &gsup_reply);
+	return osmo_gsup_conn_send(conn, msg_out);
+}
+
+/* Whether a read replica can answer a request from its read-only database */
+static bool cluster_is_local_read(struct hlr *hlr, const struct osmo_gsup_message *gsup)
+{
+	switch (gsup->message_type) {
+	case OSMO_GSUP_MSGT_CHECK_IMEI_REQUEST:
+		return !hlr->store_imei;
+	case OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST:
+		/* A resync always stores a new SQN. Otherwise only UMTS AKA does, which db_get_auc() tells from
+		 * the auth data it reads anyway: it returns -EROFS, and rx_send_auth_info() passes the request
+		 * on with cluster_forward_to_primary(). */
+		return !gsup->auts;
+	default:
+		return false;
+	}
+}
+
+/* Forward msg to peer and remember where the answers go; consumes msg.
+ * Return 0 on success, -ENOTCONN if the peer is not connected. */
+static int cluster_peer_forward(struct hlr_cluster_peer *peer, const uint8_t *origin, size_t origin_len,
+				struct msgb *msg, const struct osmo_gsup_message *gsup)
+{
+	if (!peer->client || !peer->client->is_connected) {
+		LOGP(DMAIN, LOGL_ERROR, "IMSI='%s': cluster: cannot forward %s, peer %s not connected\n",
+		     gsup->imsi, osmo_gsup_message_type_name(gsup->message_type), peer->name);
+		peer->stats.tx_failed++;
+		msgb_free(msg);
+		return -ENOTCONN;
+	}
+
+	LOGP(DMAIN, LOGL_DEBUG, "IMSI='%s': cluster: forwarding %s from %s to %s\n", gsup->imsi,
+	     osmo_gsup_message_type_name(gsup->message_type), osmo_quote_str((const char *)origin, origin_len),
+	     peer->name);
+	cluster_proxy_update(origin, origin_len, peer, gsup);
+	peer->stats.tx++;
+
+	/* Forward message without re-encoding (so we don't remove unknown IEs) */
+	msgb_pull_to_l2(msg);
+	osmo_gsup_client_send(peer->client, msg);
+	return 0;
+}
+
+/*! Forward a message from a VLR/SGSN to the node owning its IMSI, if that is not this node.
+ * \param[in] conn  GSUP connection the message was received on.
+ * \param[in] msg  Received message, with the GSUP data at msgb_l2().
+ * \param[in] gsup  msg as scanned by gsup_scan().
+ * \returns true if msg was consumed (forwarded, or answered with an error), false to handle it locally.
+ */
+bool cluster_forward_from_conn(struct osmo_gsup_conn *conn, struct msgb *msg, const struct osmo_gsup_message *gsup)
+{
+	struct hlr *hlr = g_hlr;
+	struct hlr_cluster_range *range;
+	struct hlr_cluster_peer *peer;
+	struct cluster_proxy *proxy;
+	uint8_t *origin;
+	int origin_len;
+
+	if (llist_empty(&hlr->cluster.peers) && !hlr->cluster.primary)
+		return false;
+
+	origin_len = osmo_gsup_conn_ccm_get(conn, &origin, IPAC_IDTAG_SERNR);
+	if (origin_len <= 0)
+		return false;
+
+	/* Serve whatever another node forwards to us, even if our IMSI ranges disagree (e.g. while the cluster
+	 * is being reconfigured). Passing it on could make it go around in circles. */
+	if (cluster_peer_find_by_addr(hlr, origin, origin_len))
+		return false;
+
+	if (OSMO_GSUP_IS_MSGT_REQUEST(gsup->message_type) && hlr->cluster.primary) {
+		if (cluster_is_local_read(hlr, gsup))
+			return false;
+		peer = hlr->cluster.primary;
+	} else if (OSMO_GSUP_IS_MSGT_REQUEST(gsup->message_type)) {
+		range = cluster_range_by_imsi(hlr, gsup->imsi);
+		if (!range || !range->peer) {
+			proxy = cluster_proxy_find(gsup->imsi, origin, origin_len);
+			if (proxy)
+				cluster_proxy_del(proxy);
+			return false;
+		}
+		peer = range->peer;
+	} else {
+		/* A response to a request from the owner, like Insert Subscriber Data */
+		proxy = cluster_proxy_find(gsup->imsi, origin, origin_len);
+		if (!proxy)
+			return false;
+		peer = proxy->peer;
+	}
+
+	if (cluster_peer_forward(peer, origin, origin_len, msg, gsup)
+	    && OSMO_GSUP_IS_MSGT_REQUEST(gsup->message_type))
+		cluster_send_err_reply(conn, gsup);
+	return true;
+}
+
+/*! Pass a request on to the primary, after this read replica found that answering it needs a write.
+ * \param[in] hlr  Global hlr context.
+ * \param[in] origin  IPA name of the VLR/SGSN that sent the request.
+ * \param[in] origin_len  Length of origin.
+ * \param[in] msg  The request, with the GSUP data at msgb_l2(); consumed.
+ * \param[in] imsi  IMSI of the request.
+ * \param[in] message_type  GSUP message type of the request.
+ * \returns 0 on success, -ENOTCONN if this node is no read replica or the primary is not connected.
+ */
+int cluster_forward_to_primary(struct hlr *hlr, const uint8_t *origin, size_t origin_len, struct msgb *msg,
+			       const char *imsi, enum osmo_gsup_message_type message_type)
+{
+	struct osmo_gsup_message gsup = {
+		.message_type = message_type,
+	};
+
+	if (!hlr->cluster.primary) {
+		msgb_free(msg);
+		return -ENOTCONN;
+	}
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	return cluster_peer_forward(hlr->cluster.primary, origin, origin_len, msg, &gsup);
+}
+
+static int cluster_peer_read_cb(struct osmo_gsup_client *gsupc, struct msgb *msg)
+{
+	struct hlr_cluster_peer *peer = gsupc->data;
+	struct osmo_gsup_message gsup;
+	struct cluster_proxy *proxy;
+	int rc;
+
+	/* Relayed unchanged, only the IMSI is needed */
+	rc = gsup_scan(msgb_l2(msg), msgb_l2len(msg), &gsup);
+	if (rc < 0) {
+		LOGP(DMAIN, LOGL_ERROR, "cluster: error in GSUP decode from peer %s: %d\n", peer->name, rc);
+		msgb_free(msg);
+		return rc;
+	}
+
+	proxy = cluster_proxy_find_for_peer(peer, &gsup);
+	if (!proxy) {
+		LOGP(DMAIN, LOGL_NOTICE, "IMSI='%s': cluster: no VLR/SGSN known for %s from peer %s, dropping\n",
+		     gsup.imsi, osmo_gsup_message_type_name(gsup.message_type), peer->name);
+		msgb_free(msg);
+		return -ENOENT;
+	}
+
+	LOGP(DMAIN, LOGL_DEBUG, "IMSI='%s': cluster: relaying %s from %s to %s\n", gsup.imsi,
+	     osmo_gsup_message_type_name(gsup.message_type), peer->name,
+	     osmo_quote_str((const char *)proxy->origin, proxy->origin_len));
+	if (!OSMO_GSUP_IS_MSGT_REQUEST(gsup.message_type) && proxy->pending[gsup.message_type >> 2])
+		proxy->pending[gsup.message_type >> 2]--;
+	if (gsup.session_state == OSMO_GSUP_SESSION_STATE_END && proxy->session_id == gsup.session_id)
+		proxy->has_session = false;
+	osmo_timer_schedule(&proxy->timer, HLR_CLUSTER_PROXY_TIMEOUT, 0);
+	peer->stats.rx++;
+
+	/* Remove incoming IPA header to be able to prepend an outgoing IPA header */
+	msgb_pull_to_l2(msg);
+	rc = osmo_gsup_addr_send(peer->hlr->gs, proxy->origin, proxy->origin_len, msg);
+	if (rc == -ENODEV)
+		LOGP(DMAIN, LOGL_ERROR, "IMSI='%s': cluster: VLR/SGSN %s not connected\n", proxy->imsi,
+		     osmo_quote_str((const char *)proxy->origin, proxy->origin_len));
+	return rc;
+}
+
+/*! Open the GSUP client connection to a peer, if not open yet. */
+int cluster_peer_connect(struct hlr_cluster_peer *peer)
+{
+	if (peer->client)
+		return 0;
+
+	peer->client = osmo_gsup_client_create(peer, cluster_name(peer->hlr), peer->addr, peer->port,
+					       cluster_peer_read_cb, NULL);
+	if (!peer->client) {
+		LOGP(DMAIN, LOGL_ERROR, "cluster: cannot connect to peer %s at %s:%u\n",
+		     peer->name, peer->addr, peer->port);
+		return -EIO;
+	}
+	peer->client->data = peer;
+	return 0;
+}
+
+/*! Connect to all configured peers, once the GSUP server is up. */
+int hlr_cluster_start(struct hlr *hlr)
+{
+	struct hlr_cluster_peer *peer;
+	int rc;
+
+	llist_for_each_entry(peer, &hlr->cluster.peers, list) {
+		rc = cluster_peer_connect(peer);
+		if (rc)
+			return rc;
+	}
+	if (hlr->cluster.primary)
+		return cluster_peer_connect(hlr->cluster.primary);
+	return 0;
+}
@@ -0,0 +1,93 @@
+/* OsmoHLR: IMSI ranges partitioned between several HLR nodes */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <osmocom/core/linuxlist.h>
+#include <osmocom/gsm/gsup.h>
+
+#include "gsup_server.h"
+
+/* How long to remember which VLR/SGSN a forwarded request came from, refreshed on each message */
+#define HLR_CLUSTER_PROXY_TIMEOUT 60
+
+struct hlr;
+struct msgb;
+struct osmo_gsup_client;
+
+/* Another osmo-hlr owning some of the IMSI ranges, or the primary of a read replica */
+struct hlr_cluster_peer {
+	/* g_hlr->cluster.peers */
+	struct llist_head list;
+	struct hlr *hlr;
+	/* name (must match the peer's 'cluster' / 'name', which it uses as IPA ID tag) */
+	const char *name;
+	const char *addr;
+	uint16_t port;
+
+	/* GSUP client connection to the peer's GSUP server, NULL until hlr_cluster_start() */
+	struct osmo_gsup_client *client;
+
+	struct {
+		/* messages from our VLRs/SGSNs forwarded to the peer */
+		unsigned long tx;
+		/* messages from the peer relayed to our VLRs/SGSNs */
+		unsigned long rx;
+		/* messages not forwarded because the peer was not connected */
+		unsigned long tx_failed;
+	} stats;
+};
+
+/* A range of IMSIs of the same length, served either by this node or by a peer */
+struct hlr_cluster_range {
+	/* g_hlr->cluster.ranges */
+	struct llist_head list;
+	const char *first;
+	const char *last;
+	/* owner of the range, NULL for this node */
+	struct hlr_cluster_peer *peer;
+};
+
+struct hlr_cluster_peer *cluster_peer_find(struct hlr *hlr, const char *name);
+struct hlr_cluster_peer *cluster_peer_alloc(struct hlr *hlr, const char *name, const char *addr, uint16_t port);
+void cluster_peer_del(struct hlr_cluster_peer *peer);
+int cluster_peer_connect(struct hlr_cluster_peer *peer);
+
+bool cluster_addr_is_local(const char *addr);
+int cluster_primary_set(struct hlr *hlr, const char *addr, uint16_t port);
+void cluster_primary_del(struct hlr *hlr);
+
+struct hlr_cluster_range *cluster_range_find(struct hlr *hlr, const char *first, const char *last);
+struct hlr_cluster_range *cluster_range_alloc(struct hlr *hlr, const char *first, const char *last,
+					      struct hlr_cluster_peer *peer);
+void cluster_range_del(struct hlr_cluster_range *range);
+struct hlr_cluster_range *cluster_range_by_imsi(struct hlr *hlr, const char *imsi);
+
+const char *cluster_name(const struct hlr *hlr);
+unsigned int cluster_proxy_count(void);
+
+int hlr_cluster_start(struct hlr *hlr);
+bool cluster_forward_from_conn(struct osmo_gsup_conn *conn, struct msgb *msg, const struct osmo_gsup_message *gsup);
+int cluster_forward_to_primary(struct hlr *hlr, const uint8_t *origin, size_t origin_len, struct msgb *msg,
+			       const char *imsi, enum osmo_gsup_message_type message_type);
@@ -32,6 +32,7 @@
 #include "logging.h"
 #include "db.h"
 #include "rand.h"
+#include "auc_image.h"
 
 struct hlr_db_tool_ctx {
 	/* DB context */
@@ -44,6 +45,7 @@ static struct {
 	const char *db_file;
 	bool bootstrap;
 	const char *import_nitb_db;
+	const char *export_auc_image;
 	bool db_upgrade;
 } cmdline_opts = {
 	.db_file = "hlr.db",
@@ -53,7 +55,7 @@ static struct {
 static void print_help()
 {
 	printf("\n");
-	printf("Usage: osmo-hlr-db-tool [-l <hlr.db>] [create|import-nitb-db <nitb.db>]\n");
+	printf("Usage: osmo-hlr-db-tool [-l <hlr.db>] [create|import-nitb-db <nitb.db>|export-auc-image <auc.img>]\n");
 	printf("  -l --database db-name      The OsmoHLR database to use, default '%s'.\n",
 	       cmdline_opts.db_file);
 	printf("  -h --help                  This text.\n");
@@ -72,6 +74,10 @@ static void print_help()
 	printf("  import-nitb-db <nitb.db>   Add OsmoNITB db's subscribers to OsmoHLR db.\n");
 	printf("                             Be aware that the import is lossy, only the\n");
 	printf("                             IMSI, MSISDN, nam_cs/ps and 2G auth data are set.\n");
+	printf("\n");
+	printf("  export-auc-image <auc.img> Write all subscribers' auth data to a read-only image,\n");
+	printf("                             for osmo-hlr's 'auc-image' config. osmo-hlr then\n");
+	printf("                             re-initializes '<auc.img>.sqn' from the exported SQNs.\n");
 }
 
 static void print_version(int print_copyright)
@@ -161,6 +167,13 @@ static void handle_options(int argc, char **argv)
 			exit(EXIT_FAILURE);
 		}
 		cmdline_opts.import_nitb_db = argv[optind++];
+	} else if (!strcmp(cmd, "export-auc-image")) {
+		if (argc - optind < 1) {
+			fprintf(stderr, "You must specify an output image file\n");
+			print_help();
+			exit(EXIT_FAILURE);
+		}
+		cmdline_opts.export_auc_image = argv[optind++];
 	} else {
 		fprintf(stderr, "Error: Unknown command `%s'\n", cmd);
 		print_help();
@@ -383,6 +396,85 @@ out_free:
 	return ret;
 }
 
+static const char export_auc_image_sql[] =
+	"SELECT id, imsi, algo_id_2g, ki, algo_id_3g, k, op, opc, sqn, ind_bitlen"
+	" FROM subscriber"
+	" LEFT JOIN auc_2g ON auc_2g.subscriber_id = subscriber.id"
+	" LEFT JOIN auc_3g ON auc_3g.subscriber_id = subscriber.id"
+	" ORDER BY imsi";
+
+static void export_auc_image_rec(sqlite3_stmt *stmt, struct auc_image_rec *rec)
+{
+	const char *op;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->subscr_id = sqlite3_column_int64(stmt, 0);
+	copy_sqlite3_text_to_buf(rec->imsi, stmt, 1);
+
+	if (sqlite3_column_type(stmt, 2) == SQLITE_INTEGER) {
+		rec->flags |= AUC_IMAGE_F_2G;
+		rec->algo_2g = sqlite3_column_int(stmt, 2);
+		osmo_hexparse((const char *)sqlite3_column_text(stmt, 3), rec->ki, sizeof(rec->ki));
+	}
+
+	if (sqlite3_column_type(stmt, 4) == SQLITE_INTEGER) {
+		rec->flags |= AUC_IMAGE_F_3G;
+		rec->algo_3g = sqlite3_column_int(stmt, 4);
+		osmo_hexparse((const char *)sqlite3_column_text(stmt, 5), rec->k, sizeof(rec->k));
+		op = (const char *)sqlite3_column_text(stmt, 6);
+		if (op) {
+			osmo_hexparse(op, rec->opc, sizeof(rec->opc));
+			rec->opc_is_op = 1;
+		} else
+			osmo_hexparse((const char *)sqlite3_column_text(stmt, 7), rec->opc, sizeof(rec->opc));
+		rec->sqn = sqlite3_column_int64(stmt, 8);
+		rec->ind_bitlen = sqlite3_column_int(stmt, 9);
+	}
+}
+
+int export_auc_image(void)
+{
+	struct db_context *dbc = g_hlr_db_tool_ctx->dbc;
+	struct auc_image_rec *recs = NULL;
+	uint32_t num_recs = 0;
+	uint32_t alloc_recs = 0;
+	sqlite3_stmt *stmt;
+	int rc;
+
+	if (dbc->ops != &db_sqlite_ops) {
+		LOGP(DDB, LOGL_ERROR, "export-auc-image is only supported for SQLite databases, not %s\n",
+		     dbc->ops->name);
+		return -1;
+	}
+
+	rc = sqlite3_prepare_v2(dbc->db, export_auc_image_sql, -1, &stmt, NULL);
+	if (rc != SQLITE_OK) {
+		LOGP(DDB, LOGL_ERROR, "Unable to prepare SQL statement '%s'\n", export_auc_image_sql);
+		return -1;
+	}
+
+	while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+		if (num_recs == alloc_recs) {
+			alloc_recs = alloc_recs ? alloc_recs * 2 : 1024;
+			recs = talloc_realloc(g_hlr_db_tool_ctx, recs, struct auc_image_rec, alloc_recs);
+			OSMO_ASSERT(recs);
+		}
+		export_auc_image_rec(stmt, &recs[num_recs++]);
+	}
+	if (rc != SQLITE_DONE) {
+		LOGP(DDB, LOGL_ERROR, "%s: SQL error: (%d) %s, during stmt '%s'\n",
+		     dbc->fname, rc, sqlite3_errmsg(dbc->db), export_auc_image_sql);
+		sqlite3_finalize(stmt);
+		talloc_free(recs);
+		return -1;
+	}
+	sqlite3_finalize(stmt);
+
+	rc = auc_image_write(g_hlr_db_tool_ctx, cmdline_opts.export_auc_image, recs, num_recs);
+	talloc_free(recs);
+	return rc;
+}
+
 int main(int argc, char **argv)
 {
 	int rc;
@@ -406,6 +498,11 @@ int main(int argc, char **argv)
 			goto too_many_actions;
 		main_action = import_nitb_db;
 	}
+	if (cmdline_opts.export_auc_image) {
+		if (main_action)
+			goto too_many_actions;
+		main_action = export_auc_image;
+	}
 	/* Future: add more main_actions, besides import-nitb-db, here.
 	 * For command 'create', no action is required. */
 
@@ -35,6 +35,7 @@
 #include "gsup_router.h"
 #include "logging.h"
 #include "db.h"
+#include "probes.h"
 
 /***********************************************************************
  * core data structures expressing config from VTY
@@ -53,6 +54,7 @@ struct hlr_euse *euse_find(struct hlr *hlr, const char *name)
 
 struct hlr_euse *euse_alloc(struct hlr *hlr, const char *name)
 {
+	struct osmo_gsup_conn *conn;
 	struct hlr_euse *euse = euse_find(hlr, name);
 	if (euse)
 		return NULL;
@@ -60,13 +62,24 @@ struct hlr_euse *euse_alloc(struct hlr *hlr, const char *name)
 	euse = talloc_zero(hlr, struct hlr_euse);
 	euse->name = talloc_strdup(euse, name);
 	euse->hlr = hlr;
+	INIT_LLIST_HEAD(&euse->members);
 	llist_add_tail(&euse->list, &hlr->euse_list);
 
+	/* EUSE processes that connected before it was configured */
+	if (hlr->gs) {
+		llist_for_each_entry(conn, &hlr->gs->clients, list)
+			euse_conn_up(conn);
+	}
+
 	return euse;
 }
 
+static void ss_sessions_forget_euse(struct hlr *hlr, const struct hlr_euse *euse,
+				    const struct hlr_euse_member *member);
+
 void euse_del(struct hlr_euse *euse)
 {
+	ss_sessions_forget_euse(euse->hlr, euse, NULL);
 	llist_del(&euse->list);
 	talloc_free(euse);
 }
@@ -176,6 +189,9 @@ struct ss_session {
 	/* we don't keep a pointer to the osmo_gsup_{route,conn} towards the MSC/VLR here,
 	 * as this might change during inter-VLR hand-over, and we simply look-up the serving MSC/VLR
 	 * every time we receive an USSD component from the EUSE */
+
+	/* EUSE connection serving this session, for its whole lifetime; NULL if it was lost */
+	struct hlr_euse_member *euse_member;
 };
 
 struct ss_session *ss_session_find(struct hlr *hlr, const char *imsi, uint32_t session_id)
@@ -190,6 +206,9 @@ struct ss_session *ss_session_find(struct hlr *hlr, const char *imsi, uint32_t s
 
 void ss_session_free(struct ss_session *ss)
 {
+	HLR_PROBE2(ss_session_end, (const char *)ss->imsi, ss->session_id);
+	if (ss->euse_member)
+		ss->euse_member->sessions--;
 	osmo_timer_del(&ss->timeout);
 	llist_del(&ss->list);
 	talloc_free(ss);
@@ -222,6 +241,7 @@ struct ss_session *ss_session_alloc(struct hlr *hlr, const char *imsi, uint32_t
 		osmo_timer_schedule(&ss->timeout, g_hlr->ncss_guard_timeout, 0);
 
 	llist_add_tail(&ss->list, &hlr->ss_sessions);
+	HLR_PROBE2(ss_session_start, (const char *)ss->imsi, ss->session_id);
 	return ss;
 }
 
@@ -427,6 +447,126 @@ static struct hlr_euse *euse_by_conn(struct osmo_gsup_conn *conn)
 	return euse_find(hlr, addr+5);
 }
 
+/***********************************************************************
+ * EUSE connections
+ ***********************************************************************/
+
+const struct value_string euse_balance_names[] = {
+	{ EUSE_BALANCE_LEAST_SESSIONS, "least-sessions" },
+	{ EUSE_BALANCE_ROUND_ROBIN, "round-robin" },
+	{ 0, NULL }
+};
+
+static struct hlr_euse_member *euse_member_by_conn(struct osmo_gsup_conn *conn)
+{
+	struct hlr_euse *euse = euse_by_conn(conn);
+	struct hlr_euse_member *m;
+
+	if (!euse)
+		return NULL;
+	llist_for_each_entry(m, &euse->members, list) {
+		if (m->conn == conn)
+			return m;
+	}
+	return NULL;
+}
+
+/* Pick the connection of euse to assign a new session to */
+static struct hlr_euse_member *euse_member_pick(struct hlr_euse *euse)
+{
+	struct hlr_euse_member *m, *best = NULL;
+
+	if (llist_empty(&euse->members))
+		return NULL;
+
+	switch (euse->balance) {
+	case EUSE_BALANCE_ROUND_ROBIN:
+		best = llist_first_entry(&euse->members, struct hlr_euse_member, list);
+		/* the next session goes to the next one */
+		llist_move_tail(&best->list, &euse->members);
+		return best;
+	case EUSE_BALANCE_LEAST_SESSIONS:
+	default:
+		llist_for_each_entry(m, &euse->members, list) {
+			if (!best || m->sessions < best->sessions)
+				best = m;
+		}
+		return best;
+	}
+}
+
+static void ss_session_pin(struct ss_session *ss, struct hlr_euse_member *m)
+{
+	ss->euse_member = m;
+	if (!m)
+		return;
+	m->sessions++;
+	m->sessions_total++;
+}
+
+/* Sessions pinned to member lose their EUSE connection; if member is NULL, all sessions of euse lose the EUSE */
+static void ss_sessions_forget_euse(struct hlr *hlr, const struct hlr_euse *euse,
+				    const struct hlr_euse_member *member)
+{
+	struct ss_session *ss;
+
+	llist_for_each_entry(ss, &hlr->ss_sessions, list) {
+		if (member) {
+			if (ss->euse_member == member)
+				ss->euse_member = NULL;
+			continue;
+		}
+		/* the EUSE itself is going away */
+		if (ss->u.euse != euse)
+			continue;
+		ss->u.euse = NULL;
+		ss->euse_member = NULL;
+	}
+}
+
+/*! Add a GSUP client that identified itself as an EUSE to the connections of that EUSE.
+ * \param[in] conn  GSUP connection, after its IPA ID was received. */
+void euse_conn_up(struct osmo_gsup_conn *conn)
+{
+	struct hlr_euse *euse;
+	struct hlr_euse_member *m;
+
+	if (!conn_is_euse(conn))
+		return;
+	euse = euse_by_conn(conn);
+	if (!euse) {
+		LOGP(DSS, LOGL_NOTICE, "EUSE connection from %s:%u for unknown EUSE\n",
+		     conn->conn->addr, conn->conn->port);
+		return;
+	}
+	if (euse_member_by_conn(conn))
+		return;
+
+	m = talloc_zero(euse, struct hlr_euse_member);
+	OSMO_ASSERT(m);
+	m->euse = euse;
+	m->conn = conn;
+	llist_add_tail(&m->list, &euse->members);
+	LOGP(DSS, LOGL_INFO, "EUSE %s: connection from %s:%u, %u connections\n", euse->name,
+	     conn->conn->addr, conn->conn->port, llist_count(&euse->members));
+}
+
+/*! Remove a GSUP client from the connections of its EUSE, if it is one. Its sessions are not moved to another
+ * connection, the USSD dialogue state lives in the EUSE process.
+ * \param[in] conn  GSUP connection that is about to be closed. */
+void euse_conn_down(struct osmo_gsup_conn *conn)
+{
+	struct hlr_euse_member *m = euse_member_by_conn(conn);
+
+	if (!m)
+		return;
+	LOGP(DSS, LOGL_NOTICE, "EUSE %s: lost connection from %s:%u with %u sessions\n", m->euse->name,
+	     conn->conn->addr, conn->conn->port, m->sessions);
+	ss_sessions_forget_euse(m->euse->hlr, m->euse, m);
+	llist_del(&m->list);
+	talloc_free(m);
+}
+
 static int handle_ss(struct ss_session *ss, const struct osmo_gsup_message *gsup,
 			const struct ss_request *req)
 {
@@ -472,19 +612,16 @@ static int handle_ussd(struct osmo_gsup_conn *conn, struct ss_session *ss,
 	} else {
 		/* Received from VLR (MS) */
 		if (ss->is_external) {
-			/* Forward to EUSE */
-			char addr[128];
-			strcpy(addr, "EUSE-");
-			osmo_strlcpy(addr+5, ss->u.euse->name, sizeof(addr)-5);
-			conn = gsup_route_find(conn->server, (uint8_t *)addr, strlen(addr)+1);
-			if (!conn) {
-				LOGPSS(ss, LOGL_ERROR, "Cannot find conn for EUSE %s\n", addr);
+			/* Forward to the EUSE connection serving this session */
+			if (!ss->euse_member) {
+				LOGPSS(ss, LOGL_ERROR, "No connection to EUSE %s for this session\n",
+				       ss->u.euse->name);
 				ss_tx_error(ss, req->invoke_id, GSM0480_ERR_CODE_SYSTEM_FAILURE);
 			} else {
 				msg_out = msgb_alloc_headroom(1024+16, 16, "GSUP USSD FW");
 				OSMO_ASSERT(msg_out);
 				osmo_gsup_encode(msg_out, gsup);
-				osmo_gsup_conn_send(conn, msg_out);
+				osmo_gsup_conn_send(ss->euse_member->conn, msg_out);
 			}
 		} else {
 			/* Handle internally */
@@ -553,6 +690,7 @@ int rx_proc_ss_req(struct osmo_gsup_conn *conn, const struct osmo_gsup_message *
 			if (conn_is_euse(conn)) {
 				/* EUSE->VLR: MT USSD. EUSE is known ('conn'), VLR is to be resolved */
 				ss->u.euse = euse_by_conn(conn);
+				ss_session_pin(ss, euse_member_by_conn(conn));
 			} else {
 				/* VLR->EUSE: MO USSD. VLR is known ('conn'), EUSE is to be resolved */
 				struct hlr_ussd_route *rt;
@@ -571,6 +709,8 @@ int rx_proc_ss_req(struct osmo_gsup_conn *conn, const struct osmo_gsup_message *
 						ss->u.euse = hlr->euse_default;
 					}
 				}
+				if (ss->is_external)
+					ss_session_pin(ss, euse_member_pick(ss->u.euse));
 			}
 			/* dispatch unstructured SS to routing */
 			handle_ussd(conn, ss, gsup, &req);
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 
 #include <osmocom/core/linuxlist.h>
+#include <osmocom/core/utils.h>
 #include <osmocom/gsm/gsup.h>
 
 #include "gsup_server.h"
@@ -20,6 +21,28 @@ struct hlr_ussd_route {
 	} u;
 };
 
+/* How new sessions are assigned to the connections of an EUSE */
+enum hlr_euse_balance {
+	/* the connection with the fewest sessions */
+	EUSE_BALANCE_LEAST_SESSIONS,
+	/* each connection in turn */
+	EUSE_BALANCE_ROUND_ROBIN,
+};
+
+extern const struct value_string euse_balance_names[];
+
+/* A GSUP connection to an EUSE. Several processes may connect with the same EUSE name, to share its load. */
+struct hlr_euse_member {
+	/* list in hlr_euse.members */
+	struct llist_head list;
+	struct hlr_euse *euse;
+	struct osmo_gsup_conn *conn;
+
+	/* sessions pinned to this member, now and since it connected */
+	unsigned int sessions;
+	unsigned long sessions_total;
+};
+
 struct hlr_euse {
 	/* list in the per-hlr list of EUSEs */
 	struct llist_head list;
@@ -29,14 +52,18 @@ struct hlr_euse {
 	/* human-readable description */
 	const char *description;
 
-	/* GSUP connection to the EUSE, if any */
-	struct osmo_gsup_conn *conn;
+	/* GSUP connections to the EUSE; each session stays with the one it was assigned to */
+	struct llist_head members;
+	enum hlr_euse_balance balance;
 };
 
 struct hlr_euse *euse_find(struct hlr *hlr, const char *name);
 struct hlr_euse *euse_alloc(struct hlr *hlr, const char *name);
 void euse_del(struct hlr_euse *euse);
 
+void euse_conn_up(struct osmo_gsup_conn *conn);
+void euse_conn_down(struct osmo_gsup_conn *conn);
+
 const struct hlr_iuse *iuse_find(const char *name);
 
 struct hlr_ussd_route *ussd_route_find_prefix(struct hlr *hlr, const char *prefix);
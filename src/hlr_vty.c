@@ -25,19 +25,41 @@
  *
  */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
 #include <osmocom/core/talloc.h>
+#include <osmocom/core/rate_ctr.h>
 #include <osmocom/vty/vty.h>
 #include <osmocom/vty/stats.h>
 #include <osmocom/vty/command.h>
 #include <osmocom/vty/logging.h>
 #include <osmocom/vty/misc.h>
 #include <osmocom/abis/ipa.h>
+#include <osmocom/gsupclient/gsup_client.h>
 
 #include "hlr.h"
+#include "db.h"
 #include "hlr_vty.h"
 #include "hlr_vty_subscr.h"
 #include "hlr_ussd.h"
+#include "hlr_cluster.h"
+#include "imsi_filter.h"
+#include "auc_pool.h"
 #include "gsup_server.h"
+#include "logring.h"
+
+static const struct value_string log_ring_level_names[] = {
+	{ LOGL_DEBUG, "debug" },
+	{ LOGL_INFO, "info" },
+	{ LOGL_NOTICE, "notice" },
+	{ LOGL_ERROR, "error" },
+	{ 0, NULL }
+};
 
 struct cmd_node hlr_node = {
 	HLR_NODE,
@@ -76,6 +98,57 @@ static int config_write_hlr(struct vty *vty)
 		vty_out(vty, " store-imei%s", VTY_NEWLINE);
 	if (g_hlr->db_file_path && strcmp(g_hlr->db_file_path, HLR_DEFAULT_DB_FILE_PATH))
 		vty_out(vty, " database %s%s", g_hlr->db_file_path, VTY_NEWLINE);
+	if (g_hlr->auc_image_path)
+		vty_out(vty, " auc-image %s%s", g_hlr->auc_image_path, VTY_NEWLINE);
+	if (g_hlr->last_lu_seen_granularity)
+		vty_out(vty, " last-lu-seen-granularity %u%s", g_hlr->last_lu_seen_granularity, VTY_NEWLINE);
+	if (g_hlr->change_log_keep != DB_CHANGE_LOG_KEEP_DEFAULT)
+		vty_out(vty, " subscriber-change-log keep %u%s", g_hlr->change_log_keep, VTY_NEWLINE);
+	if (g_hlr->sai_coalesce_window_ms)
+		vty_out(vty, " sai-coalesce-window %u%s", g_hlr->sai_coalesce_window_ms, VTY_NEWLINE);
+	if (g_hlr->db_stmt_stats)
+		vty_out(vty, " database-statement-stats%s", VTY_NEWLINE);
+	if (g_hlr->auc_workers)
+		vty_out(vty, " auc-workers %u%s", g_hlr->auc_workers, VTY_NEWLINE);
+	if (g_hlr->imsi_filter.enable)
+		vty_out(vty, " imsi-filter%s", VTY_NEWLINE);
+	if (g_hlr->imsi_filter.unknown_ttl != IMSI_FILTER_UNKNOWN_TTL_DEFAULT)
+		vty_out(vty, " imsi-filter unknown-ttl %u%s", g_hlr->imsi_filter.unknown_ttl, VTY_NEWLINE);
+	if (logring_entries != LOGRING_DEFAULT_ENTRIES)
+		vty_out(vty, " log-ring entries %u%s", logring_entries, VTY_NEWLINE);
+	if (logring_level != LOGRING_OFF)
+		vty_out(vty, " log-ring %s%s", get_value_string(log_ring_level_names, logring_level), VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+static int config_write_hlr_cluster(struct vty *vty)
+{
+	struct hlr_cluster_peer *peer;
+	struct hlr_cluster_range *range;
+	bool ind_part = g_hlr->cluster.num_nodes > 1 || g_hlr->cluster.node_id;
+
+	if (!ind_part && !g_hlr->cluster.name && !g_hlr->cluster.primary
+	    && llist_empty(&g_hlr->cluster.peers) && llist_empty(&g_hlr->cluster.ranges))
+		return CMD_SUCCESS;
+	vty_out(vty, " cluster%s", VTY_NEWLINE);
+	if (ind_part) {
+		vty_out(vty, "  node-id %u%s", g_hlr->cluster.node_id, VTY_NEWLINE);
+		vty_out(vty, "  num-nodes %u%s", g_hlr->cluster.num_nodes, VTY_NEWLINE);
+	}
+	if (g_hlr->cluster.name)
+		vty_out(vty, "  name %s%s", g_hlr->cluster.name, VTY_NEWLINE);
+	if (g_hlr->cluster.primary)
+		vty_out(vty, "  primary %s %u%s", g_hlr->cluster.primary->addr, g_hlr->cluster.primary->port,
+			VTY_NEWLINE);
+	llist_for_each_entry(peer, &g_hlr->cluster.peers, list)
+		vty_out(vty, "  peer %s %s %u%s", peer->name, peer->addr, peer->port, VTY_NEWLINE);
+	llist_for_each_entry(range, &g_hlr->cluster.ranges, list) {
+		if (range->peer)
+			vty_out(vty, "  imsi-range %s %s peer %s%s", range->first, range->last, range->peer->name,
+				VTY_NEWLINE);
+		else
+			vty_out(vty, "  imsi-range %s %s local%s", range->first, range->last, VTY_NEWLINE);
+	}
 	return CMD_SUCCESS;
 }
 
@@ -84,9 +157,49 @@ static int config_write_hlr_gsup(struct vty *vty)
 	vty_out(vty, " gsup%s", VTY_NEWLINE);
 	if (g_hlr->gsup_bind_addr)
 		vty_out(vty, "  bind ip %s%s", g_hlr->gsup_bind_addr, VTY_NEWLINE);
+	if (g_hlr->gsup_tx_queue.limit != OSMO_GSUP_TX_QUEUE_LIMIT_DEFAULT)
+		vty_out(vty, "  tx-queue limit %u%s", g_hlr->gsup_tx_queue.limit, VTY_NEWLINE);
+	if (g_hlr->gsup_tx_queue.high != OSMO_GSUP_TX_QUEUE_HIGH_DEFAULT
+	    || g_hlr->gsup_tx_queue.low != OSMO_GSUP_TX_QUEUE_LOW_DEFAULT)
+		vty_out(vty, "  tx-queue watermarks %u %u%s", g_hlr->gsup_tx_queue.high, g_hlr->gsup_tx_queue.low,
+			VTY_NEWLINE);
+	if (g_hlr->gsup_isd_cache_slots)
+		vty_out(vty, "  isd-cache %u%s", g_hlr->gsup_isd_cache_slots, VTY_NEWLINE);
+	if (!g_hlr->gsup_latency_stats)
+		vty_out(vty, "  no latency-stats%s", VTY_NEWLINE);
 	return CMD_SUCCESS;
 }
 
+static void show_latency(struct vty *vty, const char *what, const struct gsup_latency *l)
+{
+	vty_out(vty, "  %s: %lu replies, p50 < %u us, p90 < %u us, p99 < %u us%s", what, l->count,
+		gsup_latency_percentile_us(l, 50), gsup_latency_percentile_us(l, 90),
+		gsup_latency_percentile_us(l, 99), VTY_NEWLINE);
+}
+
+static void show_conn_traffic(struct vty *vty, const struct osmo_gsup_conn *conn)
+{
+	const struct gsup_conn_stats *s = &conn->traffic;
+	unsigned int pending_rx, pending_tx;
+
+	if (s->ctrs) {
+		const struct rate_ctr *c = s->ctrs->ctr;
+		vty_out(vty, "  rx: %"PRIu64" messages, %"PRIu64" bytes, %"PRIu64" errors, %"PRIu64" invalid%s",
+			c[GSUP_CONN_CTR_RX_MSGS].current, c[GSUP_CONN_CTR_RX_BYTES].current,
+			c[GSUP_CONN_CTR_RX_ERRORS].current, c[GSUP_CONN_CTR_RX_INVALID].current, VTY_NEWLINE);
+		vty_out(vty, "  tx: %"PRIu64" messages, %"PRIu64" bytes, %"PRIu64" errors%s",
+			c[GSUP_CONN_CTR_TX_MSGS].current, c[GSUP_CONN_CTR_TX_BYTES].current,
+			c[GSUP_CONN_CTR_TX_ERRORS].current, VTY_NEWLINE);
+	}
+	if (!conn->server->latency_stats)
+		return;
+	gsup_stats_pending_count(s, &pending_rx, &pending_tx);
+	vty_out(vty, "  in flight: %u requests from the client, %u requests to the client%s",
+		pending_rx, pending_tx, VTY_NEWLINE);
+	show_latency(vty, "HLR latency", &s->hlr_latency);
+	show_latency(vty, "client latency", &s->peer_latency);
+}
+
 static void show_one_conn(struct vty *vty, const struct osmo_gsup_conn *conn)
 {
 	const struct ipa_server_conn *isc = conn->conn;
@@ -99,6 +212,11 @@ static void show_one_conn(struct vty *vty, const struct osmo_gsup_conn *conn)
 	vty_out(vty, " '%s' from %s:%5u, CS=%u, PS=%u, 3G_IND=%u%s",
 		name, isc->addr, isc->port, conn->supports_cs, conn->supports_ps, conn->auc_3g_ind,
 		VTY_NEWLINE);
+	vty_out(vty, "  tx queue: %u (peak %u)%s, %lu messages in %lu writes, %lu dropped, throttled %lu times%s",
+		conn->tx.len, conn->tx.stats.peak, conn->tx.throttled ? ", not reading" : "",
+		conn->tx.stats.msgs, conn->tx.stats.writev, conn->tx.stats.dropped, conn->tx.stats.throttled,
+		VTY_NEWLINE);
+	show_conn_traffic(vty, conn);
 }
 
 DEFUN(show_gsup_conn, show_gsup_conn_cmd,
@@ -128,6 +246,108 @@ DEFUN(cfg_hlr_gsup_bind_ip,
 	return CMD_SUCCESS;
 }
 
+static void gsup_tx_queue_apply(void)
+{
+	if (!g_hlr->gs)
+		return;
+	g_hlr->gs->tx_queue.limit = g_hlr->gsup_tx_queue.limit;
+	g_hlr->gs->tx_queue.high = g_hlr->gsup_tx_queue.high;
+	g_hlr->gs->tx_queue.low = g_hlr->gsup_tx_queue.low;
+}
+
+#define TX_QUEUE_STR "Queue of messages to each GSUP client, written once per main loop iteration\n"
+
+DEFUN(cfg_hlr_gsup_tx_queue_limit,
+      cfg_hlr_gsup_tx_queue_limit_cmd,
+      "tx-queue limit <1-1000000>",
+      TX_QUEUE_STR
+      "Drop messages to a client that has this many messages queued already\n"
+      "Number of messages (default: 10000)\n")
+{
+	g_hlr->gsup_tx_queue.limit = atoi(argv[0]);
+	gsup_tx_queue_apply();
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_hlr_gsup_tx_queue_watermarks,
+      cfg_hlr_gsup_tx_queue_watermarks_cmd,
+      "tx-queue watermarks <1-1000000> <0-1000000>",
+      TX_QUEUE_STR
+      "Stop reading from a client with too many messages queued, until it catches up\n"
+      "High watermark: stop reading above this many queued messages (default: 1000)\n"
+      "Low watermark: read again at this many queued messages (default: 100)\n")
+{
+	unsigned int high = atoi(argv[0]);
+	unsigned int low = atoi(argv[1]);
+
+	if (low >= high) {
+		vty_out(vty, "%% The low watermark must be below the high watermark%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	g_hlr->gsup_tx_queue.high = high;
+	g_hlr->gsup_tx_queue.low = low;
+	gsup_tx_queue_apply();
+	return CMD_SUCCESS;
+}
+
+#define ISD_CACHE_STR "Cache the Insert Subscriber Data request encoded for each subscriber's last Location Update\n"
+
+DEFUN(cfg_hlr_gsup_isd_cache,
+      cfg_hlr_gsup_isd_cache_cmd,
+      "isd-cache <0-1048576>",
+      ISD_CACHE_STR
+      "Number of subscribers to cache, about 160 bytes each; 0 to encode each request (default)\n")
+{
+	g_hlr->gsup_isd_cache_slots = atoi(argv[0]);
+	if (!g_hlr->gs)
+		return CMD_SUCCESS;
+	talloc_free(g_hlr->gs->isd_cache);
+	g_hlr->gs->isd_cache = NULL;
+	if (g_hlr->gsup_isd_cache_slots)
+		g_hlr->gs->isd_cache = isd_cache_alloc(g_hlr->gs, g_hlr->gsup_isd_cache_slots);
+	return CMD_SUCCESS;
+}
+
+#define LATENCY_STATS_STR "Match requests to replies for the latency and in flight requests shown for each client" \
+	" by 'show gsup-connections'\n"
+
+DEFUN(cfg_hlr_gsup_latency_stats,
+      cfg_hlr_gsup_latency_stats_cmd,
+      "latency-stats",
+      LATENCY_STATS_STR)
+{
+	g_hlr->gsup_latency_stats = true;
+	if (g_hlr->gs)
+		gsup_stats_latency_enable(g_hlr->gs, true);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_hlr_gsup_no_latency_stats,
+      cfg_hlr_gsup_no_latency_stats_cmd,
+      "no latency-stats",
+      NO_STR LATENCY_STATS_STR)
+{
+	g_hlr->gsup_latency_stats = false;
+	if (g_hlr->gs)
+		gsup_stats_latency_enable(g_hlr->gs, false);
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_isd_cache, show_isd_cache_cmd,
+	"show isd-cache",
+	SHOW_STR "Cache of encoded Insert Subscriber Data requests ('isd-cache')\n")
+{
+	const struct isd_cache *c = g_hlr->gs ? g_hlr->gs->isd_cache : NULL;
+
+	if (!c) {
+		vty_out(vty, "Insert Subscriber Data requests are encoded each time%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+	vty_out(vty, "Insert Subscriber Data cache for %u subscribers: %lu hits, %lu misses%s",
+		c->num_slots, c->stats.hits, c->stats.misses, VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
 /***********************************************************************
  * USSD Entity
  ***********************************************************************/
@@ -229,12 +449,32 @@ DEFUN(cfg_ussd_no_defaultroute, cfg_ussd_no_defaultroute_cmd,
 DEFUN(cfg_database, cfg_database_cmd,
 	"database PATH",
 	"Set the path to the HLR database file\n"
-	"Relative or absolute file system path to the database file (default is '" HLR_DEFAULT_DB_FILE_PATH "')\n")
+	"Relative or absolute file system path to the database file (default is '" HLR_DEFAULT_DB_FILE_PATH "');"
+	" prefix with 'lmdb:' to use the LMDB backend, if built with --enable-lmdb\n")
 {
 	osmo_talloc_replace_string(g_hlr, &g_hlr->db_file_path, argv[0]);
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_auc_image, cfg_auc_image_cmd,
+	"auc-image PATH",
+	"Serve authentication data from a read-only AUC image instead of the database's auc tables."
+	" The image is created by 'osmo-hlr-db-tool export-auc-image'; SQNs are kept in '<PATH>.sqn'\n"
+	"Relative or absolute file system path to the AUC image file\n")
+{
+	osmo_talloc_replace_string(g_hlr, &g_hlr->auc_image_path, argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_auc_image, cfg_no_auc_image_cmd,
+	"no auc-image",
+	NO_STR "Serve authentication data from the database (default)\n")
+{
+	talloc_free(g_hlr->auc_image_path);
+	g_hlr->auc_image_path = NULL;
+	return CMD_SUCCESS;
+}
+
 struct cmd_node euse_node = {
 	EUSE_NODE,
 	"%s(config-hlr-euse)# ",
@@ -280,9 +520,40 @@ DEFUN(cfg_no_euse, cfg_no_euse_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_euse_balance, cfg_euse_balance_cmd,
+	"balance (least-sessions|round-robin)",
+	"Assign new sessions to the connections of this EUSE by\n"
+	"The number of sessions each connection has (default)\n"
+	"Turns\n")
+{
+	struct hlr_euse *euse = vty->index;
+
+	euse->balance = get_string_value(euse_balance_names, argv[0]);
+	return CMD_SUCCESS;
+}
+
 static void dump_one_euse(struct vty *vty, struct hlr_euse *euse)
 {
 	vty_out(vty, " euse %s%s", euse->name, VTY_NEWLINE);
+	if (euse->balance != EUSE_BALANCE_LEAST_SESSIONS)
+		vty_out(vty, "  balance %s%s", get_value_string(euse_balance_names, euse->balance), VTY_NEWLINE);
+}
+
+DEFUN(show_euse, show_euse_cmd,
+	"show euse",
+	SHOW_STR "External USSD Entities and their connections\n")
+{
+	struct hlr_euse *euse;
+	struct hlr_euse_member *m;
+
+	llist_for_each_entry(euse, &g_hlr->euse_list, list) {
+		vty_out(vty, "EUSE %s: %u connections, balance %s%s", euse->name, llist_count(&euse->members),
+			get_value_string(euse_balance_names, euse->balance), VTY_NEWLINE);
+		llist_for_each_entry(m, &euse->members, list)
+			vty_out(vty, " %s:%u: %u sessions, %lu total%s", m->conn->conn->addr, m->conn->conn->port,
+				m->sessions, m->sessions_total, VTY_NEWLINE);
+	}
+	return CMD_SUCCESS;
 }
 
 static int config_write_euse(struct vty *vty)
@@ -336,6 +607,562 @@ DEFUN(cfg_no_store_imei, cfg_no_store_imei_cmd,
 	return CMD_SUCCESS;
 }
 
+DEFUN(cfg_last_lu_seen_granularity, cfg_last_lu_seen_granularity_cmd,
+	"last-lu-seen-granularity <0-86400>",
+	"Write a subscriber's last LU seen timestamp to the database only when it is older than this,"
+	" unless the VLR or SGSN changed. Saves a database write for most periodic Location Updates.\n"
+	"Granularity in seconds, 0 to write on every Location Update (default)\n")
+{
+	g_hlr->last_lu_seen_granularity = atoi(argv[0]);
+	if (g_hlr->dbc)
+		g_hlr->dbc->last_lu_seen_granularity = g_hlr->last_lu_seen_granularity;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_subscriber_change_log_keep, cfg_subscriber_change_log_keep_cmd,
+	"subscriber-change-log keep <0-100000000>",
+	"Configure the log of subscriber changes that CTRL clients can follow ('subscriber-changes')\n"
+	"Remove all but the newest entries once per main loop iteration with new changes\n"
+	"Number of entries to keep (default: 100000), 0 to keep all\n")
+{
+	g_hlr->change_log_keep = atoi(argv[0]);
+	if (g_hlr->dbc)
+		g_hlr->dbc->change_log.keep = g_hlr->change_log_keep;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_sai_coalesce_window, cfg_sai_coalesce_window_cmd,
+	"sai-coalesce-window <0-10000>",
+	"Answer a Send Auth Info request for the same IMSI and IND as a recent one with the same vectors,"
+	" instead of generating new ones. Saves the computation and SQN space for retransmissions and for"
+	" simultaneous attaches.\n"
+	"Window in milliseconds, 0 to always generate new vectors (default)\n")
+{
+	g_hlr->sai_coalesce_window_ms = atoi(argv[0]);
+	if (g_hlr->dbc)
+		db_sai_coalesce_window_set(g_hlr->dbc, g_hlr->sai_coalesce_window_ms);
+	return CMD_SUCCESS;
+}
+
+#define DB_STMT_STATS_STR "Account the time spent in each SQL statement of the database, for" \
+	" 'show database statement-stats' and the db_stmt_start/db_stmt_done static tracepoints\n"
+
+DEFUN(cfg_db_stmt_stats, cfg_db_stmt_stats_cmd,
+	"database-statement-stats",
+	DB_STMT_STATS_STR)
+{
+	g_hlr->db_stmt_stats = true;
+	if (g_hlr->dbc && db_stmt_stats_enable(g_hlr->dbc, true) == -EIO) {
+		vty_out(vty, "%% Cannot set up statement stats%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_db_stmt_stats, cfg_no_db_stmt_stats_cmd,
+	"no database-statement-stats",
+	NO_STR DB_STMT_STATS_STR)
+{
+	g_hlr->db_stmt_stats = false;
+	if (g_hlr->dbc)
+		db_stmt_stats_enable(g_hlr->dbc, false);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_auc_workers, cfg_auc_workers_cmd,
+	"auc-workers <0-64>",
+	"Compute auth vectors on worker threads, so that bursts of Send Auth Info requests do not delay other"
+	" GSUP messages. Takes effect on restart.\n"
+	"Number of threads, 0 to compute on the main thread (default)\n")
+{
+	g_hlr->auc_workers = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+#define IMSI_FILTER_STR "Reject unknown IMSIs without a database lookup, using an in-memory filter of all subscribers\n"
+
+DEFUN(cfg_imsi_filter, cfg_imsi_filter_cmd,
+	"imsi-filter",
+	IMSI_FILTER_STR)
+{
+	int rc;
+
+	g_hlr->imsi_filter.enable = true;
+	if (!g_hlr->dbc || g_hlr->dbc->imsi_filter)
+		return CMD_SUCCESS;
+	rc = db_imsi_filter_enable(g_hlr->dbc, g_hlr->imsi_filter.unknown_ttl);
+	if (rc) {
+		vty_out(vty, "%% Cannot set up the IMSI filter: %s%s", strerror(-rc), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_imsi_filter, cfg_no_imsi_filter_cmd,
+	"no imsi-filter",
+	NO_STR IMSI_FILTER_STR)
+{
+	g_hlr->imsi_filter.enable = false;
+	if (g_hlr->dbc)
+		db_imsi_filter_disable(g_hlr->dbc);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_imsi_filter_unknown_ttl, cfg_imsi_filter_unknown_ttl_cmd,
+	"imsi-filter unknown-ttl <0-3600>",
+	IMSI_FILTER_STR
+	"Also remember IMSIs that passed the filter but were not found in the database\n"
+	"Seconds to remember an unknown IMSI (default: 30), 0 to not remember them\n")
+{
+	g_hlr->imsi_filter.unknown_ttl = atoi(argv[0]);
+	if (g_hlr->dbc && g_hlr->dbc->imsi_filter)
+		g_hlr->dbc->imsi_filter->unknown_ttl = g_hlr->imsi_filter.unknown_ttl;
+	return CMD_SUCCESS;
+}
+
+struct cmd_node cluster_node = {
+	CLUSTER_NODE,
+	"%s(config-hlr-cluster)# ",
+	1,
+};
+
+DEFUN(cfg_cluster, cfg_cluster_cmd,
+	"cluster",
+	"Configure this HLR as one of several nodes serving the same subscribers")
+{
+	vty->node = CLUSTER_NODE;
+	return CMD_SUCCESS;
+}
+
+#define CLUSTER_TAKES_EFFECT " Takes effect on the next program start."
+
+DEFUN(cfg_cluster_node_id, cfg_cluster_node_id_cmd,
+	"node-id <0-31>",
+	"Set this node's index in the cluster. It selects the UMTS SQN IND values this node uses, and which"
+	" of the per-node SQNs it keeps in the database." CLUSTER_TAKES_EFFECT "\n"
+	"Node index, must be smaller than num-nodes and unique in the cluster\n")
+{
+	g_hlr->cluster.node_id = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cluster_num_nodes, cfg_cluster_num_nodes_cmd,
+	"num-nodes <1-32>",
+	"Set the number of nodes generating auth vectors for the same subscribers. The UMTS SQN IND space"
+	" is divided evenly between them, so each node needs an IND bitlen of at least log2(num-nodes)."
+	CLUSTER_TAKES_EFFECT "\n"
+	"Number of nodes, 1 to not partition the IND space (default)\n")
+{
+	g_hlr->cluster.num_nodes = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cluster_name, cfg_cluster_name_cmd,
+	"name NAME",
+	"Set the IPA name this node uses when connecting to its peers (default: HLR-<node-id>)."
+	CLUSTER_TAKES_EFFECT "\n"
+	"Name, must match what the peers configure as 'peer NAME'\n")
+{
+	osmo_talloc_replace_string(g_hlr, &g_hlr->cluster.name, argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cluster_peer, cfg_cluster_peer_cmd,
+	"peer NAME A.B.C.D [<1-65535>]",
+	"Configure another HLR node serving some of the IMSI ranges\n"
+	"The peer's name, as set by 'name' in its 'cluster' config\n"
+	"IP address of the peer's GSUP server\n"
+	"TCP port of the peer's GSUP server (default: 4222)\n")
+{
+	struct hlr_cluster_peer *peer = cluster_peer_find(g_hlr, argv[0]);
+
+	if (peer) {
+		vty_out(vty, "%% Peer '%s' already exists%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	peer = cluster_peer_alloc(g_hlr, argv[0], argv[1], argc > 2 ? atoi(argv[2]) : OSMO_GSUP_PORT);
+	/* At program start, hlr_cluster_start() connects once the GSUP server is up */
+	if (g_hlr->gs && cluster_peer_connect(peer)) {
+		vty_out(vty, "%% Cannot connect to peer '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cluster_no_peer, cfg_cluster_no_peer_cmd,
+	"no peer NAME",
+	NO_STR "Remove an HLR node from the cluster\n"
+	"The peer's name\n")
+{
+	struct hlr_cluster_peer *peer = cluster_peer_find(g_hlr, argv[0]);
+	struct hlr_cluster_range *range;
+
+	if (!peer) {
+		vty_out(vty, "%% Cannot find peer '%s'%s", argv[0], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	llist_for_each_entry(range, &g_hlr->cluster.ranges, list) {
+		if (range->peer == peer) {
+			vty_out(vty, "%% Cannot remove peer '%s', it is used by imsi-range %s %s%s",
+				peer->name, range->first, range->last, VTY_NEWLINE);
+			return CMD_WARNING;
+		}
+	}
+
+	cluster_peer_del(peer);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cluster_primary, cfg_cluster_primary_cmd,
+	"primary A.B.C.D [<1-65535>]",
+	"Run as read replica of another osmo-hlr on this host: open the same database read-only, answer what"
+	" needs no writing (Check IMEI without store-imei, auth info without UMTS AKA) and forward all other"
+	" requests to the primary." CLUSTER_TAKES_EFFECT "\n"
+	"IP address of the primary's GSUP server\n"
+	"TCP port of the primary's GSUP server (default: 4222)\n")
+{
+	if (!cluster_addr_is_local(argv[0]))
+		vty_out(vty, "%% Warning: %s is not an address of this host, the primary must write the file"
+			" configured as 'database' here%s", argv[0], VTY_NEWLINE);
+	if (cluster_primary_set(g_hlr, argv[0], argc > 1 ? atoi(argv[1]) : OSMO_GSUP_PORT)) {
+		vty_out(vty, "%% Cannot connect to primary%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cluster_no_primary, cfg_cluster_no_primary_cmd,
+	"no primary",
+	NO_STR "Do not run as read replica." CLUSTER_TAKES_EFFECT "\n")
+{
+	cluster_primary_del(g_hlr);
+	return CMD_SUCCESS;
+}
+
+#define IMSI_RANGE_STR \
+	"Configure which node serves a range of IMSIs. IMSIs outside all ranges are served locally, the first" \
+	" matching range counts.\n" \
+	"First IMSI of the range\n" \
+	"Last IMSI of the range, with as many digits as the first\n"
+
+static int cluster_range_add(struct vty *vty, const char *first, const char *last,
+			     struct hlr_cluster_peer *peer)
+{
+	if (!osmo_imsi_str_valid(first) || !osmo_imsi_str_valid(last)) {
+		vty_out(vty, "%% Invalid IMSI%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	if (cluster_range_find(g_hlr, first, last)) {
+		vty_out(vty, "%% IMSI range %s %s already exists%s", first, last, VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	if (!cluster_range_alloc(g_hlr, first, last, peer)) {
+		vty_out(vty, "%% Invalid IMSI range: first and last need the same length, first <= last%s",
+			VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_cluster_range_local, cfg_cluster_range_local_cmd,
+	"imsi-range IMSI IMSI local",
+	IMSI_RANGE_STR
+	"Served by this node\n")
+{
+	return cluster_range_add(vty, argv[0], argv[1], NULL);
+}
+
+DEFUN(cfg_cluster_range_peer, cfg_cluster_range_peer_cmd,
+	"imsi-range IMSI IMSI peer NAME",
+	IMSI_RANGE_STR
+	"Served by a peer, requests from our VLRs/SGSNs are forwarded to it\n"
+	"The peer's name\n")
+{
+	struct hlr_cluster_peer *peer = cluster_peer_find(g_hlr, argv[2]);
+
+	if (!peer) {
+		vty_out(vty, "%% Cannot find peer '%s'%s", argv[2], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	return cluster_range_add(vty, argv[0], argv[1], peer);
+}
+
+DEFUN(cfg_cluster_no_range, cfg_cluster_no_range_cmd,
+	"no imsi-range IMSI IMSI",
+	NO_STR "Remove a range of IMSIs, they are served by this node unless another range matches\n"
+	"First IMSI of the range\n"
+	"Last IMSI of the range\n")
+{
+	struct hlr_cluster_range *range = cluster_range_find(g_hlr, argv[0], argv[1]);
+
+	if (!range) {
+		vty_out(vty, "%% Cannot find IMSI range %s %s%s", argv[0], argv[1], VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	cluster_range_del(range);
+	return CMD_SUCCESS;
+}
+
+static void show_one_cluster_peer(struct vty *vty, const struct hlr_cluster_peer *peer)
+{
+	const char *state = "not started";
+
+	if (peer->client)
+		state = !peer->client->is_connected ? "disconnected"
+			: peer->client->got_ipa_pong ? "connected" : "connected, no IPA pong yet";
+	vty_out(vty, " %s '%s' at %s:%u: %s, tx=%lu rx=%lu tx-failed=%lu%s",
+		peer == g_hlr->cluster.primary ? "primary" : "peer", peer->name, peer->addr, peer->port, state,
+		peer->stats.tx, peer->stats.rx, peer->stats.tx_failed, VTY_NEWLINE);
+}
+
+DEFUN(show_cluster, show_cluster_cmd,
+	"show cluster",
+	SHOW_STR "IMSI ranges served by this node and its peers, and the state of the peer connections\n")
+{
+	struct hlr_cluster_peer *peer;
+	struct hlr_cluster_range *range;
+
+	vty_out(vty, "Cluster node '%s'%s%s", cluster_name(g_hlr),
+		g_hlr->cluster.primary ? ", read replica" : "", VTY_NEWLINE);
+	if (g_hlr->cluster.primary)
+		show_one_cluster_peer(vty, g_hlr->cluster.primary);
+	llist_for_each_entry(peer, &g_hlr->cluster.peers, list)
+		show_one_cluster_peer(vty, peer);
+	llist_for_each_entry(range, &g_hlr->cluster.ranges, list)
+		vty_out(vty, " imsi-range %s..%s: %s%s", range->first, range->last,
+			range->peer ? range->peer->name : "local", VTY_NEWLINE);
+	vty_out(vty, " IMSIs outside these ranges: local%s", VTY_NEWLINE);
+	vty_out(vty, " Subscribers with forwarded requests pending: %u%s", cluster_proxy_count(), VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_imsi_filter, show_imsi_filter_cmd,
+	"show imsi-filter",
+	SHOW_STR "Filter of provisioned IMSIs and cache of unknown IMSIs ('imsi-filter')\n")
+{
+	const struct imsi_filter *f = g_hlr->dbc ? g_hlr->dbc->imsi_filter : NULL;
+
+	if (!f) {
+		vty_out(vty, "IMSI filter: off%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+	vty_out(vty, "IMSI filter: %u IMSIs in %u layers of %" PRIu64 " bits (sized for %u),"
+		" unknown IMSIs remembered for %u s%s",
+		f->num_imsis, f->num_layers, f->num_bits, f->capacity, f->unknown_ttl, VTY_NEWLINE);
+	vty_out(vty, " lookups: %lu%s", f->stats.lookups, VTY_NEWLINE);
+	vty_out(vty, " rejected by filter: %lu%s", f->stats.rejected_by_filter, VTY_NEWLINE);
+	vty_out(vty, " rejected by unknown IMSI cache: %lu%s", f->stats.rejected_by_cache, VTY_NEWLINE);
+	vty_out(vty, " passed, but not found in the database: %lu%s", f->stats.false_positives, VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_auc_workers, show_auc_workers_cmd,
+	"show auc-workers",
+	SHOW_STR "Threads computing auth vectors ('auc-workers')\n")
+{
+	const struct auc_pool *pool = g_hlr->dbc ? g_hlr->dbc->auc_async.pool : NULL;
+
+	if (!pool) {
+		vty_out(vty, "Auth vectors are computed on the main thread%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+	vty_out(vty, "%u auth vector worker threads: %u requests computing, %lu completed%s",
+		auc_pool_workers(pool), auc_pool_in_flight(pool), auc_pool_completed(pool), VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+static int stmt_stats_cmp(const void *a, const void *b)
+{
+	const struct db_stmt_stats *sa = *(const struct db_stmt_stats **)a;
+	const struct db_stmt_stats *sb = *(const struct db_stmt_stats **)b;
+
+	/* most total time first */
+	if (sa->total_us != sb->total_us)
+		return sa->total_us < sb->total_us ? 1 : -1;
+	return sa < sb ? -1 : 1;
+}
+
+#define STMT_STATS_STR "Time spent in each SQL statement of the database\n"
+
+DEFUN(show_database_stmt_stats, show_database_stmt_stats_cmd,
+	"show database statement-stats",
+	SHOW_STR "HLR database\n" STMT_STATS_STR)
+{
+	struct db_context *dbc = g_hlr->dbc;
+	const struct db_stmt_stats *sorted[_NUM_DB_STMT];
+	unsigned int i;
+
+	if (!dbc || !dbc->db) {
+		vty_out(vty, "%% No statement stats for this database backend%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	if (!dbc->stmt_stats.enabled)
+		vty_out(vty, "%% Statement stats are off, see 'database-statement-stats'%s", VTY_NEWLINE);
+
+	for (i = 0; i < _NUM_DB_STMT; i++)
+		sorted[i] = &dbc->stmt_stats.s[i];
+	qsort(sorted, _NUM_DB_STMT, sizeof(sorted[0]), stmt_stats_cmp);
+
+	vty_out(vty, "%-22s %10s %10s %8s %8s %10s %8s %8s%s", "statement", "count", "total ms", "avg us", "max us",
+		"changes", "busy", "failed", VTY_NEWLINE);
+	for (i = 0; i < _NUM_DB_STMT; i++) {
+		const struct db_stmt_stats *st = sorted[i];
+		if (!st->count)
+			continue;
+		vty_out(vty, "%-22s %10lu %10"PRIu64" %8"PRIu64" %8"PRIu64" %10"PRIu64" %8lu %8lu%s",
+			db_stmt_name(st - dbc->stmt_stats.s), st->count, st->total_us / 1000,
+			st->total_us / st->count, st->max_us, st->changes, st->busy_retries, st->busy_failed,
+			VTY_NEWLINE);
+	}
+	return CMD_SUCCESS;
+}
+
+DEFUN(database_stmt_stats_reset, database_stmt_stats_reset_cmd,
+	"database statement-stats reset",
+	"HLR database\n" STMT_STATS_STR "Zero all statement stats\n")
+{
+	if (!g_hlr->dbc || !g_hlr->dbc->db) {
+		vty_out(vty, "%% No statement stats for this database backend%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	db_stmt_stats_reset(g_hlr->dbc);
+	return CMD_SUCCESS;
+}
+
+#define GSUP_RECORD_STR "Record GSUP traffic for contrib/gsup-replay.py\n"
+
+DEFUN(gsup_rec_start, gsup_rec_start_cmd,
+	"gsup-record start FILE",
+	GSUP_RECORD_STR "Start recording, replacing a running recording\n"
+	"Capture file to create\n")
+{
+	struct osmo_gsup_server *gs = g_hlr->gs;
+	struct gsup_record *rec;
+
+	if (!gs) {
+		vty_out(vty, "%% GSUP server not running%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+
+	rec = gsup_record_start(gs, argv[0]);
+	if (!rec) {
+		vty_out(vty, "%% Cannot create %s: %s%s", argv[0], strerror(errno), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	if (gs->record)
+		gsup_record_stop(gs->record);
+	gs->record = rec;
+	return CMD_SUCCESS;
+}
+
+DEFUN(gsup_rec_stop, gsup_rec_stop_cmd,
+	"gsup-record stop",
+	GSUP_RECORD_STR "Stop recording and close the capture file\n")
+{
+	struct osmo_gsup_server *gs = g_hlr->gs;
+
+	if (!gs || !gs->record) {
+		vty_out(vty, "%% Not recording%s", VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	gsup_record_stop(gs->record);
+	gs->record = NULL;
+	return CMD_SUCCESS;
+}
+
+DEFUN(show_gsup_record, show_gsup_record_cmd,
+	"show gsup-record",
+	SHOW_STR "Recording of GSUP traffic ('gsup-record')\n")
+{
+	const struct gsup_record *rec = g_hlr->gs ? g_hlr->gs->record : NULL;
+
+	if (!rec) {
+		vty_out(vty, "Not recording GSUP traffic%s", VTY_NEWLINE);
+		return CMD_SUCCESS;
+	}
+	vty_out(vty, "Recording GSUP traffic to %s: %lu messages, %lu bytes, %lu failed%s",
+		rec->path, rec->msgs, rec->bytes, rec->errors, VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+#define LOG_RING_STR "Binary log ring: record hot path log lines unformatted, per thread ('log-ring')\n"
+
+DEFUN(cfg_log_ring, cfg_log_ring_cmd,
+	"log-ring (debug|info|notice|error)",
+	LOG_RING_STR
+	"Record debug and above\n" "Record info and above\n" "Record notice and above\n" "Record error and above\n")
+{
+	logring_level = get_string_value(log_ring_level_names, argv[0]);
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_no_log_ring, cfg_no_log_ring_cmd,
+	"no log-ring",
+	NO_STR LOG_RING_STR)
+{
+	logring_level = LOGRING_OFF;
+	return CMD_SUCCESS;
+}
+
+DEFUN(cfg_log_ring_entries, cfg_log_ring_entries_cmd,
+	"log-ring entries <1024-1048576>",
+	LOG_RING_STR "Size of each thread's ring, for threads that did not log to a ring yet\n"
+	"Number of records, rounded up to a power of two (default 16384)\n")
+{
+	logring_entries = atoi(argv[0]);
+	return CMD_SUCCESS;
+}
+
+static void log_ring_vty_line(const char *line, void *data)
+{
+	struct vty *vty = data;
+	vty_out(vty, "%s%s", line, VTY_NEWLINE);
+}
+
+DEFUN(show_log_ring, show_log_ring_cmd,
+	"show log-ring [<1-10000>]",
+	SHOW_STR LOG_RING_STR "Number of latest records to show (default 50)\n")
+{
+	unsigned int max = argc ? atoi(argv[0]) : 50;
+
+	if (!logring_print(g_hlr, max, log_ring_vty_line, vty))
+		vty_out(vty, "No records in the log ring%s%s",
+			logring_level == LOGRING_OFF ? ", it is off" : "", VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
+static void log_ring_file_line(const char *line, void *data)
+{
+	fprintf(data, "%s\n", line);
+}
+
+DEFUN(log_ring_dump, log_ring_dump_cmd,
+	"log-ring dump FILE",
+	LOG_RING_STR "Write all records of all threads to a file, oldest first\n"
+	"File to create\n")
+{
+	unsigned int n;
+	FILE *f = fopen(argv[0], "w");
+
+	if (!f) {
+		vty_out(vty, "%% Cannot create %s: %s%s", argv[0], strerror(errno), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	n = logring_print(g_hlr, UINT_MAX, log_ring_file_line, f);
+	if (fclose(f)) {
+		vty_out(vty, "%% Cannot write %s: %s%s", argv[0], strerror(errno), VTY_NEWLINE);
+		return CMD_WARNING;
+	}
+	vty_out(vty, "%u records written to %s%s", n, argv[0], VTY_NEWLINE);
+	return CMD_SUCCESS;
+}
+
 /***********************************************************************
  * Common Code
  ***********************************************************************/
@@ -345,6 +1172,7 @@ int hlr_vty_go_parent(struct vty *vty)
 	switch (vty->node) {
 	case GSUP_NODE:
 	case EUSE_NODE:
+	case CLUSTER_NODE:
 		vty->node = HLR_NODE;
 		vty->index = NULL;
 		vty->index_sub = NULL;
@@ -382,6 +1210,18 @@ void hlr_vty_init(const struct log_info *cat)
 	osmo_stats_vty_add_cmds();
 
 	install_element_ve(&show_gsup_conn_cmd);
+	install_element_ve(&show_cluster_cmd);
+	install_element_ve(&show_imsi_filter_cmd);
+	install_element_ve(&show_auc_workers_cmd);
+	install_element_ve(&show_gsup_record_cmd);
+	install_element_ve(&show_database_stmt_stats_cmd);
+	install_element_ve(&show_log_ring_cmd);
+	install_element_ve(&show_isd_cache_cmd);
+	install_element_ve(&show_euse_cmd);
+	install_element(ENABLE_NODE, &gsup_rec_start_cmd);
+	install_element(ENABLE_NODE, &gsup_rec_stop_cmd);
+	install_element(ENABLE_NODE, &database_stmt_stats_reset_cmd);
+	install_element(ENABLE_NODE, &log_ring_dump_cmd);
 
 	install_element(CONFIG_NODE, &cfg_hlr_cmd);
 	install_node(&hlr_node, config_write_hlr);
@@ -390,12 +1230,33 @@ void hlr_vty_init(const struct log_info *cat)
 	install_node(&gsup_node, config_write_hlr_gsup);
 
 	install_element(GSUP_NODE, &cfg_hlr_gsup_bind_ip_cmd);
+	install_element(GSUP_NODE, &cfg_hlr_gsup_tx_queue_limit_cmd);
+	install_element(GSUP_NODE, &cfg_hlr_gsup_tx_queue_watermarks_cmd);
+	install_element(GSUP_NODE, &cfg_hlr_gsup_isd_cache_cmd);
+	install_element(GSUP_NODE, &cfg_hlr_gsup_latency_stats_cmd);
+	install_element(GSUP_NODE, &cfg_hlr_gsup_no_latency_stats_cmd);
+
+	install_element(HLR_NODE, &cfg_cluster_cmd);
+	install_node(&cluster_node, config_write_hlr_cluster);
+	install_element(CLUSTER_NODE, &cfg_cluster_node_id_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_num_nodes_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_name_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_peer_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_no_peer_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_primary_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_no_primary_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_range_local_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_range_peer_cmd);
+	install_element(CLUSTER_NODE, &cfg_cluster_no_range_cmd);
 
 	install_element(HLR_NODE, &cfg_database_cmd);
+	install_element(HLR_NODE, &cfg_auc_image_cmd);
+	install_element(HLR_NODE, &cfg_no_auc_image_cmd);
 
 	install_element(HLR_NODE, &cfg_euse_cmd);
 	install_element(HLR_NODE, &cfg_no_euse_cmd);
 	install_node(&euse_node, config_write_euse);
+	install_element(EUSE_NODE, &cfg_euse_balance_cmd);
 	install_element(HLR_NODE, &cfg_ussd_route_pfx_int_cmd);
 	install_element(HLR_NODE, &cfg_ussd_route_pfx_ext_cmd);
 	install_element(HLR_NODE, &cfg_ussd_no_route_pfx_cmd);
@@ -404,6 +1265,18 @@ void hlr_vty_init(const struct log_info *cat)
 	install_element(HLR_NODE, &cfg_ncss_guard_timeout_cmd);
 	install_element(HLR_NODE, &cfg_store_imei_cmd);
 	install_element(HLR_NODE, &cfg_no_store_imei_cmd);
+	install_element(HLR_NODE, &cfg_last_lu_seen_granularity_cmd);
+	install_element(HLR_NODE, &cfg_subscriber_change_log_keep_cmd);
+	install_element(HLR_NODE, &cfg_sai_coalesce_window_cmd);
+	install_element(HLR_NODE, &cfg_db_stmt_stats_cmd);
+	install_element(HLR_NODE, &cfg_no_db_stmt_stats_cmd);
+	install_element(HLR_NODE, &cfg_auc_workers_cmd);
+	install_element(HLR_NODE, &cfg_imsi_filter_cmd);
+	install_element(HLR_NODE, &cfg_no_imsi_filter_cmd);
+	install_element(HLR_NODE, &cfg_imsi_filter_unknown_ttl_cmd);
+	install_element(HLR_NODE, &cfg_log_ring_cmd);
+	install_element(HLR_NODE, &cfg_no_log_ring_cmd);
+	install_element(HLR_NODE, &cfg_log_ring_entries_cmd);
 
 	hlr_vty_subscriber_init();
 }
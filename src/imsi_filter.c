@@ -0,0 +1,168 @@
+/* Bloom filter of provisioned IMSIs and cache of unknown IMSIs */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <string.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+
+#include "imsi_filter.h"
+
+/* FNV-1a, 64 bit */
+static uint64_t imsi_hash(const char *imsi)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Double hashing: the i-th bit of an IMSI is h1 + i * h2, with both halves taken from one 64 bit hash */
+#define FOREACH_BIT(l, hash, i, bit) \
+	for (i = 0, bit = (uint32_t)(hash) & ((l)->num_bits - 1); i < IMSI_FILTER_NUM_HASHES; \
+	     i++, bit = ((uint32_t)(hash) + i * ((uint32_t)((hash) >> 32) | 1)) & ((l)->num_bits - 1))
+
+static void layer_add(struct imsi_filter *f, uint64_t want)
+{
+	struct imsi_filter_layer *l;
+
+	f->layers = talloc_realloc(f, f->layers, struct imsi_filter_layer, f->num_layers + 1);
+	OSMO_ASSERT(f->layers);
+	l = &f->layers[f->num_layers++];
+	*l = (struct imsi_filter_layer){};
+
+	l->num_bits = IMSI_FILTER_MIN_BITS;
+	while (l->num_bits < want && l->num_bits < IMSI_FILTER_MAX_BITS)
+		l->num_bits <<= 1;
+	l->capacity = l->num_bits / IMSI_FILTER_BITS_PER_IMSI;
+	l->bits = talloc_zero_array(f, uint64_t, l->num_bits / 64);
+	OSMO_ASSERT(l->bits);
+
+	f->num_bits += l->num_bits;
+	f->capacity += l->capacity;
+}
+
+/*! Allocate an empty filter.
+ * \param[in] ctx  talloc context.
+ * \param[in] capacity  Number of IMSIs to size the first layer of the Bloom filter for.
+ * \param[in] unknown_ttl  Seconds to remember an IMSI passed to imsi_filter_unknown_add().
+ * \returns new filter.
+ */
+struct imsi_filter *imsi_filter_alloc(void *ctx, unsigned int capacity, unsigned int unknown_ttl)
+{
+	struct imsi_filter *f = talloc_zero(ctx, struct imsi_filter);
+	OSMO_ASSERT(f);
+
+	layer_add(f, (uint64_t)capacity * IMSI_FILTER_BITS_PER_IMSI);
+
+	f->unknown_ttl = unknown_ttl;
+	f->unknown = talloc_zero_array(f, struct imsi_filter_unknown, IMSI_FILTER_UNKNOWN_SLOTS);
+	OSMO_ASSERT(f->unknown);
+	return f;
+}
+
+/*! Add a provisioned IMSI, and forget it as unknown. Start a new layer with twice the bits of the newest one
+ * if that is full. */
+void imsi_filter_add(struct imsi_filter *f, const char *imsi)
+{
+	uint64_t hash = imsi_hash(imsi);
+	struct imsi_filter_unknown *u = &f->unknown[hash % IMSI_FILTER_UNKNOWN_SLOTS];
+	struct imsi_filter_layer *l = &f->layers[f->num_layers - 1];
+	uint32_t bit;
+	unsigned int i;
+
+	if (l->num_imsis >= l->capacity) {
+		/* Each layer adds its own false positives; doubling keeps the number of layers small */
+		layer_add(f, (uint64_t)l->num_bits * 2);
+		l = &f->layers[f->num_layers - 1];
+	}
+
+	FOREACH_BIT(l, hash, i, bit)
+		l->bits[bit / 64] |= 1ULL << (bit % 64);
+	l->num_imsis++;
+	f->num_imsis++;
+
+	if (u->hash == hash)
+		memset(u, 0, sizeof(*u));
+}
+
+static bool layer_check(const struct imsi_filter_layer *l, uint64_t hash)
+{
+	uint32_t bit;
+	unsigned int i;
+
+	FOREACH_BIT(l, hash, i, bit) {
+		if (!(l->bits[bit / 64] & (1ULL << (bit % 64))))
+			return false;
+	}
+	return true;
+}
+
+/*! Return whether an IMSI may be provisioned and needs to be looked up in the database.
+ * \returns false if the IMSI is certainly not provisioned or was recently found to be unknown.
+ */
+bool imsi_filter_check(struct imsi_filter *f, const char *imsi)
+{
+	uint64_t hash = imsi_hash(imsi);
+	struct imsi_filter_unknown *u = &f->unknown[hash % IMSI_FILTER_UNKNOWN_SLOTS];
+	struct timespec now;
+	unsigned int i;
+
+	f->stats.lookups++;
+
+	for (i = 0; i < f->num_layers; i++) {
+		if (layer_check(&f->layers[i], hash))
+			break;
+	}
+	if (i == f->num_layers) {
+		f->stats.rejected_by_filter++;
+		return false;
+	}
+
+	if (u->hash == hash) {
+		osmo_clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespeccmp(&now, &u->expires, <)) {
+			f->stats.rejected_by_cache++;
+			return false;
+		}
+		memset(u, 0, sizeof(*u));
+	}
+	return true;
+}
+
+/*! Remember an IMSI that passed imsi_filter_check() but was not found in the database. */
+void imsi_filter_unknown_add(struct imsi_filter *f, const char *imsi)
+{
+	uint64_t hash = imsi_hash(imsi);
+	struct imsi_filter_unknown *u = &f->unknown[hash % IMSI_FILTER_UNKNOWN_SLOTS];
+
+	f->stats.false_positives++;
+	if (!f->unknown_ttl)
+		return;
+
+	osmo_clock_gettime(CLOCK_MONOTONIC, &u->expires);
+	u->expires.tv_sec += f->unknown_ttl;
+	u->hash = hash;
+}
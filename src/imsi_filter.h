@@ -0,0 +1,82 @@
+/* Bloom filter of provisioned IMSIs and cache of unknown IMSIs */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Bits per IMSI the Bloom filter is sized for, and number of bits set per IMSI: about 1% false positives. */
+#define IMSI_FILTER_BITS_PER_IMSI 10
+#define IMSI_FILTER_NUM_HASHES 7
+/* Smallest filter, in bits */
+#define IMSI_FILTER_MIN_BITS (1 << 16)
+/* Largest layer, in bits; further layers for more IMSIs are this large, too */
+#define IMSI_FILTER_MAX_BITS (1U << 31)
+/* Slots of the unknown IMSI cache; a new entry replaces whichever IMSI hashed to the same slot before. */
+#define IMSI_FILTER_UNKNOWN_SLOTS 4096
+#define IMSI_FILTER_UNKNOWN_TTL_DEFAULT 30
+
+/* Answers "is this IMSI certainly not provisioned?" without a database lookup.
+ * The Bloom filter holds every IMSI added with imsi_filter_add(). It never forgets an IMSI (deleting a
+ * subscriber just leaves a false positive behind) and can only miss an IMSI that was not added, i.e. that
+ * another process wrote to the database. When the newest layer is full, imsi_filter_add() starts another one
+ * with twice the bits, so the filter grows without reading all IMSIs again; a lookup checks every layer.
+ * IMSIs that passed the filter but were not found in the database are remembered in a small cache for
+ * unknown_ttl seconds. */
+struct imsi_filter {
+	struct imsi_filter_layer {
+		uint64_t *bits;
+		/* power of two */
+		uint32_t num_bits;
+		unsigned int num_imsis;
+		unsigned int capacity;
+	} *layers;
+	unsigned int num_layers;
+	/* Sums over all layers */
+	uint64_t num_bits;
+	unsigned int num_imsis;
+	unsigned int capacity;
+
+	/* Seconds to remember an unknown IMSI, 0 to not cache unknown IMSIs */
+	unsigned int unknown_ttl;
+	struct imsi_filter_unknown {
+		uint64_t hash;
+		struct timespec expires;
+	} *unknown;
+
+	struct {
+		/* imsi_filter_check() calls */
+		unsigned long lookups;
+		/* IMSIs not in the Bloom filter */
+		unsigned long rejected_by_filter;
+		/* IMSIs in the unknown IMSI cache */
+		unsigned long rejected_by_cache;
+		/* IMSIs passed by the Bloom filter but not found in the database, see imsi_filter_unknown_add() */
+		unsigned long false_positives;
+	} stats;
+};
+
+struct imsi_filter *imsi_filter_alloc(void *ctx, unsigned int capacity, unsigned int unknown_ttl);
+void imsi_filter_add(struct imsi_filter *f, const char *imsi);
+bool imsi_filter_check(struct imsi_filter *f, const char *imsi);
+void imsi_filter_unknown_add(struct imsi_filter *f, const char *imsi);
@@ -0,0 +1,116 @@
+/* Cache of encoded Insert Subscriber Data requests */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <osmocom/core/utils.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/gsm/apn.h>
+#include <osmocom/gsm/gsup.h>
+
+#include "gsup_server.h"
+#include "isd_cache.h"
+
+/* Headroom for the IPA headers prepended by osmo_gsup_addr_send() */
+#define ISD_MSGB_HEADROOM 16
+
+/*! Allocate an empty cache.
+ * \param[in] ctx  talloc context.
+ * \param[in] num_slots  Number of subscribers to keep at most.
+ * \returns new cache. */
+struct isd_cache *isd_cache_alloc(void *ctx, unsigned int num_slots)
+{
+	struct isd_cache *c = talloc_zero(ctx, struct isd_cache);
+	OSMO_ASSERT(c);
+	c->num_slots = num_slots;
+	c->slots = talloc_zero_array(c, struct isd_cache_entry, num_slots);
+	OSMO_ASSERT(c->slots);
+	return c;
+}
+
+static uint32_t imsi_hash(const char *imsi)
+{
+	uint32_t h = 2166136261u;
+
+	for (; *imsi; imsi++) {
+		h ^= (uint8_t)*imsi;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct msgb *isd_msgb(const uint8_t *pdu, size_t len)
+{
+	struct msgb *msg = msgb_alloc_headroom(ISD_MSGB_HEADROOM + len, ISD_MSGB_HEADROOM, "GSUP ISD");
+	OSMO_ASSERT(msg);
+	memcpy(msgb_put(msg, len), pdu, len);
+	return msg;
+}
+
+/*! Return an Insert Subscriber Data request for a subscriber, copied from the cache or encoded and added to it.
+ * \param[in] c  Cache, or NULL to always encode the message.
+ * \param[in] imsi  The subscriber's IMSI.
+ * \param[in] msisdn  The subscriber's MSISDN.
+ * \param[in] cn_domain  The CN domain of the GSUP client to send the message to.
+ * \returns GSUP message, without IPA header; NULL if the MSISDN cannot be encoded. */
+struct msgb *isd_cache_msgb(struct isd_cache *c, const char *imsi, const char *msisdn,
+			    enum osmo_gsup_cn_domain cn_domain)
+{
+	struct osmo_gsup_message gsup = { };
+	uint8_t msisdn_enc[OSMO_GSUP_MAX_CALLED_PARTY_BCD_LEN];
+	uint8_t apn[APN_MAXLEN];
+	struct isd_cache_entry *e = NULL;
+	int d = cn_domain == OSMO_GSUP_CN_DOMAIN_PS;
+	struct msgb *msg;
+
+	if (c && c->num_slots) {
+		e = &c->slots[imsi_hash(imsi) % c->num_slots];
+		if (!strcmp(e->imsi, imsi) && !strcmp(e->msisdn, msisdn) && e->dom[d].len) {
+			c->stats.hits++;
+			return isd_msgb(e->dom[d].pdu, e->dom[d].len);
+		}
+		c->stats.misses++;
+	}
+
+	if (osmo_gsup_create_insert_subscriber_data_msg(&gsup, imsi, msisdn, msisdn_enc, sizeof(msisdn_enc),
+							apn, sizeof(apn), cn_domain) != 0)
+		return NULL;
+	msg = msgb_alloc_headroom(1024+16, 16, "GSUP ISD");
+	OSMO_ASSERT(msg);
+	osmo_gsup_encode(msg, &gsup);
+
+	if (!e || msgb_length(msg) > ISD_CACHE_PDU_MAX
+	    || strlen(imsi) >= sizeof(e->imsi) || strlen(msisdn) >= sizeof(e->msisdn))
+		return msg;
+
+	/* A different subscriber or MSISDN in this slot: drop the other domain's message too */
+	if (strcmp(e->imsi, imsi) || strcmp(e->msisdn, msisdn)) {
+		memset(e, 0, sizeof(*e));
+		OSMO_STRLCPY_ARRAY(e->imsi, imsi);
+		OSMO_STRLCPY_ARRAY(e->msisdn, msisdn);
+	}
+	e->dom[d].len = msgb_length(msg);
+	memcpy(e->dom[d].pdu, msgb_data(msg), msgb_length(msg));
+	return msg;
+}
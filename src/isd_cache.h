@@ -0,0 +1,59 @@
+/* Cache of encoded Insert Subscriber Data requests */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <osmocom/gsm/gsup.h>
+
+struct msgb;
+
+/* Longest encoded Insert Subscriber Data request kept; with an IMSI, an MSISDN of up to 15 digits and the
+ * wildcard APN PDP info it is about 45 bytes. */
+#define ISD_CACHE_PDU_MAX 64
+
+/* Insert Subscriber Data requests encoded for earlier Location Updates, per subscriber and CN domain, so that
+ * the next Location Update of the subscriber just copies the message. The request only depends on the IMSI,
+ * the MSISDN and the CN domain (the APN is always the wildcard APN), so an entry is valid as long as the
+ * subscriber still has the MSISDN it was encoded with; a changed MSISDN simply misses. Like the unknown IMSI
+ * cache of imsi_filter.h, each IMSI hashes to one slot and replaces whatever IMSI was there before. */
+struct isd_cache {
+	struct isd_cache_entry {
+		char imsi[GSM23003_IMSI_MAX_DIGITS + 1];
+		char msisdn[GSM23003_MSISDN_MAX_DIGITS + 1];
+		/* [0] CS, [1] PS; len 0 if not encoded yet */
+		struct {
+			uint8_t len;
+			uint8_t pdu[ISD_CACHE_PDU_MAX];
+		} dom[2];
+	} *slots;
+	unsigned int num_slots;
+
+	struct {
+		unsigned long hits;
+		unsigned long misses;
+	} stats;
+};
+
+struct isd_cache *isd_cache_alloc(void *ctx, unsigned int num_slots);
+struct msgb *isd_cache_msgb(struct isd_cache *c, const char *imsi, const char *msisdn,
+			    enum osmo_gsup_cn_domain cn_domain);
@@ -0,0 +1,482 @@
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/logging.h>
+
+#include "logring.h"
+
+/* Bytes per record for copies of string and buffer arguments; longer ones are cut and printed with "..." */
+#define LOGRING_DATA_LEN 128
+
+struct logring_entry {
+	/* Position of the record in the ring plus one, 0 while it is written. Readers copy the record and
+	 * check that seq did not change meanwhile, like a seqlock. */
+	_Atomic uint64_t seq;
+	struct timespec ts;
+	const struct logring_site *site;
+	uint8_t nargs;
+	uint8_t type[LOGRING_MAX_ARGS];
+	union {
+		int64_t i;
+		double d;
+		const void *p;
+		struct {
+			uint8_t off;
+			uint8_t len;
+			uint32_t orig_len;
+		} buf;
+	} arg[LOGRING_MAX_ARGS];
+	char data[LOGRING_DATA_LEN];
+};
+
+struct logring {
+	struct logring *next;
+	/* Threads are numbered in the order they first logged to the ring */
+	unsigned int thread;
+	uint64_t mask;
+	/* Position of the next record, only ever written by the owning thread */
+	_Atomic uint64_t head;
+	struct logring_entry entries[];
+};
+
+int logring_level = LOGRING_OFF;
+unsigned int logring_entries = LOGRING_DEFAULT_ENTRIES;
+
+/* All rings ever created. They are not freed when their thread ends, so that its last records can still be
+ * read; threads are only created at startup anyway. */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct logring *rings;
+static unsigned int rings_count;
+
+static __thread struct logring *thread_ring;
+
+/* Not talloc: it is not thread safe */
+static struct logring *logring_thread_init(void)
+{
+	struct logring *r;
+	uint64_t n = 1024;
+
+	while (n < logring_entries)
+		n <<= 1;
+	r = calloc(1, sizeof(*r) + n * sizeof(r->entries[0]));
+	if (!r)
+		return NULL;
+	r->mask = n - 1;
+
+	pthread_mutex_lock(&rings_lock);
+	r->thread = rings_count++;
+	r->next = rings;
+	rings = r;
+	pthread_mutex_unlock(&rings_lock);
+
+	thread_ring = r;
+	return r;
+}
+
+/*! Record a log line to the calling thread's ring, to be formatted later. Use LOGPR() instead.
+ * \param[in] site  LOGPR() call site; must stay valid, as it is referenced by the record.
+ * \param[in] nargs  Number of arguments, the rest is dropped above LOGRING_MAX_ARGS.
+ * \param[in] args  Arguments; strings and buffers are copied. */
+void logring_add(const struct logring_site *site, unsigned int nargs, const struct logring_arg *args)
+{
+	struct logring *r = thread_ring ? : logring_thread_init();
+	struct logring_entry *e;
+	uint64_t pos;
+	unsigned int i;
+	size_t off = 0;
+
+	if (!r)
+		return;
+
+	pos = atomic_load_explicit(&r->head, memory_order_relaxed);
+	e = &r->entries[pos & r->mask];
+	atomic_store_explicit(&e->seq, 0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	clock_gettime(CLOCK_REALTIME, &e->ts);
+	e->site = site;
+	e->nargs = OSMO_MIN(nargs, LOGRING_MAX_ARGS);
+	for (i = 0; i < e->nargs; i++) {
+		const struct logring_arg *a = &args[i];
+		const void *src;
+		size_t len, copy;
+
+		e->type[i] = a->type;
+		switch (a->type) {
+		case LOGRING_ARG_INT:
+			e->arg[i].i = a->i;
+			continue;
+		case LOGRING_ARG_DOUBLE:
+			e->arg[i].d = a->d;
+			continue;
+		case LOGRING_ARG_PTR:
+			e->arg[i].p = a->p;
+			continue;
+		case LOGRING_ARG_STR:
+			src = a->p ? : "(null)";
+			len = strlen(src);
+			/* keep the copy nul terminated */
+			copy = OSMO_MIN(len, sizeof(e->data) - off - 1);
+			e->data[off + copy] = '\0';
+			break;
+		default:
+			src = a->p;
+			len = a->p ? a->len : 0;
+			copy = OSMO_MIN(len, sizeof(e->data) - off);
+			break;
+		}
+		memcpy(e->data + off, src, copy);
+		e->arg[i].buf.off = off;
+		e->arg[i].buf.len = copy;
+		e->arg[i].buf.orig_len = OSMO_MIN(len, UINT32_MAX);
+		off += copy + (a->type == LOGRING_ARG_STR);
+		if (off >= sizeof(e->data))
+			off = sizeof(e->data) - 1;
+	}
+
+	atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+	atomic_store_explicit(&r->head, pos + 1, memory_order_release);
+}
+
+static void append(char *buf, size_t size, size_t *pos, const char *fmt, ...)
+{
+	va_list ap;
+	int rc;
+
+	if (*pos >= size - 1)
+		return;
+	va_start(ap, fmt);
+	rc = vsnprintf(buf + *pos, size - *pos, fmt, ap);
+	va_end(ap);
+	if (rc > 0)
+		*pos = OSMO_MIN(*pos + rc, size - 1);
+}
+
+/* A %s argument as text. The osmo_hexdump() and osmo_quote_str() static buffers are fine, formatting is only
+ * done on the main thread. */
+static const char *arg_str(const struct logring_arg *a)
+{
+	switch (a->type) {
+	case LOGRING_ARG_STR:
+		return a->p;
+	case LOGRING_ARG_QUOTE:
+		return osmo_quote_str(a->p, a->len);
+	case LOGRING_ARG_HEXDUMP:
+		return osmo_hexdump(a->p, a->len);
+	case LOGRING_ARG_HEXDUMP_NOSPC:
+		return osmo_hexdump_nospc(a->p, a->len);
+	default:
+		return NULL;
+	}
+}
+
+/* Like snprintf(buf, size, fmt, args...), with the arguments taken from args. Length modifiers in fmt are
+ * ignored, all integers are 64 bit here. truncated[i] tells whether a string or buffer argument was cut. */
+static void logring_format(char *buf, size_t size, const char *fmt,
+			   unsigned int nargs, const struct logring_arg *args, const bool *truncated)
+{
+	size_t pos = 0;
+	unsigned int argi = 0;
+	const char *p = fmt;
+
+	buf[0] = '\0';
+	while (*p) {
+		char spec[32];
+		size_t n = 0;
+		const char *q;
+		const struct logring_arg *a;
+		const char *str;
+
+		if (*p != '%' || p[1] == '%') {
+			q = *p == '%' ? p + 1 : p;
+			n = strcspn(q + 1, "%") + 1;
+			append(buf, size, &pos, "%.*s", (int)n, q);
+			p = q + n;
+			continue;
+		}
+
+		/* Keep flags, width and precision, drop the length modifier */
+		spec[n++] = '%';
+		for (q = p + 1; *q && strchr("-+ #0123456789.", *q); q++) {
+			if (n < sizeof(spec) - 4)
+				spec[n++] = *q;
+		}
+		while (*q && strchr("hlLqjzt", *q))
+			q++;
+		if (!*q || argi >= nargs) {
+			append(buf, size, &pos, "%s", "<?>");
+			p = *q ? q + 1 : q;
+			continue;
+		}
+		a = &args[argi++];
+		str = arg_str(a);
+
+		switch (*q) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		case 'c':
+			if (str)
+				break;
+			if (*q != 'c') {
+				spec[n++] = 'l';
+				spec[n++] = 'l';
+			}
+			spec[n++] = *q;
+			spec[n] = '\0';
+			if (*q == 'd' || *q == 'i')
+				append(buf, size, &pos, spec, (long long)a->i);
+			else if (*q == 'c')
+				append(buf, size, &pos, spec, (int)a->i);
+			else
+				append(buf, size, &pos, spec, (unsigned long long)a->i);
+			p = q + 1;
+			continue;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			if (str)
+				break;
+			spec[n++] = *q;
+			spec[n] = '\0';
+			append(buf, size, &pos, spec, a->type == LOGRING_ARG_DOUBLE ? a->d : (double)a->i);
+			p = q + 1;
+			continue;
+		case 'p':
+			if (str)
+				break;
+			spec[n++] = 'p';
+			spec[n] = '\0';
+			append(buf, size, &pos, spec, a->type == LOGRING_ARG_PTR ? a->p : (const void *)(intptr_t)a->i);
+			p = q + 1;
+			continue;
+		case 's':
+			if (str)
+				break;
+			append(buf, size, &pos, a->type == LOGRING_ARG_DOUBLE ? "%g" : "%lld",
+			       a->type == LOGRING_ARG_DOUBLE ? a->d : (long long)a->i);
+			p = q + 1;
+			continue;
+		default:
+			append(buf, size, &pos, "%.*s", (int)(q + 1 - p), p);
+			p = q + 1;
+			continue;
+		}
+
+		/* a string or buffer, whatever the conversion says */
+		spec[n++] = 's';
+		spec[n] = '\0';
+		append(buf, size, &pos, spec, str);
+		if (truncated && truncated[argi - 1])
+			append(buf, size, &pos, "%s", "...");
+		p = q + 1;
+	}
+}
+
+/*! A LOGRING_QUOTE() or LOGRING_HEXDUMP() argument as text, for LOGP(). Use LOGPR() instead.
+ * \param[out] str  Buffer for the text, cut to fit.
+ * \param[in] str_size  Size of str.
+ * \param[in] b  The argument.
+ * \returns str. */
+const char *logring_buf_str(char *str, size_t str_size, struct logring_buf b)
+{
+	switch (b.type) {
+	case LOGRING_ARG_QUOTE:
+		return osmo_quote_str_buf2(str, str_size, b.buf, b.len);
+	case LOGRING_ARG_HEXDUMP:
+		return osmo_hexdump_buf(str, str_size, b.buf, b.len, " ", true);
+	case LOGRING_ARG_HEXDUMP_NOSPC:
+		return osmo_hexdump_buf(str, str_size, b.buf, b.len, "", true);
+	default:
+		osmo_strlcpy(str, "<?>", str_size);
+		return str;
+	}
+}
+
+struct logring_copy {
+	struct logring_entry e;
+	unsigned int thread;
+};
+
+/* Copy the record at pos, if it was not overwritten yet */
+static bool logring_read(const struct logring *r, uint64_t pos, struct logring_copy *out)
+{
+	const struct logring_entry *e = &r->entries[pos & r->mask];
+
+	if (atomic_load_explicit(&e->seq, memory_order_acquire) != pos + 1)
+		return false;
+	memcpy(&out->e, e, sizeof(out->e));
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&e->seq, memory_order_relaxed) != pos + 1)
+		return false;
+	out->thread = r->thread;
+	return true;
+}
+
+static int logring_copy_cmp(const void *a, const void *b)
+{
+	const struct logring_copy *ca = a;
+	const struct logring_copy *cb = b;
+
+	if (ca->e.ts.tv_sec != cb->e.ts.tv_sec)
+		return ca->e.ts.tv_sec < cb->e.ts.tv_sec ? -1 : 1;
+	if (ca->e.ts.tv_nsec != cb->e.ts.tv_nsec)
+		return ca->e.ts.tv_nsec < cb->e.ts.tv_nsec ? -1 : 1;
+	return ca->thread < cb->thread ? -1 : (ca->thread > cb->thread);
+}
+
+/* Library categories come after the application's, see map_subsys() in libosmocore; -1 if out of range */
+static int map_subsys(int subsys)
+{
+	if (subsys < 0)
+		subsys = osmo_log_info->num_cat_user - subsys - 1;
+	if (subsys < 0 || subsys >= osmo_log_info->num_cat)
+		return -1;
+	return subsys;
+}
+
+static const char *subsys_name(int subsys)
+{
+	subsys = map_subsys(subsys);
+	return subsys < 0 ? "?" : osmo_log_info->cat[subsys].name;
+}
+
+/*! Whether LOGPR() records lines of a category to the ring: only if it is enabled on a log target, see
+ * log_set_category_filter(). Threads other than the main thread must not walk the log targets, they go by the
+ * category's default in the log_info instead.
+ * \param[in] subsys  Logging category.
+ * \param[in] main_thread  Whether called on the main thread. */
+bool logring_category_enabled(int subsys, bool main_thread)
+{
+	struct log_target *tar;
+
+	subsys = map_subsys(subsys);
+	if (subsys < 0)
+		return false;
+	if (!main_thread)
+		return osmo_log_info->cat[subsys].enabled;
+	llist_for_each_entry(tar, &osmo_log_target_list, entry) {
+		if (tar->categories[subsys].enabled)
+			return true;
+	}
+	return false;
+}
+
+static void logring_print_one(const struct logring_copy *c, void (*print_cb)(const char *line, void *data),
+			      void *data)
+{
+	const struct logring_entry *e = &c->e;
+	struct logring_arg args[LOGRING_MAX_ARGS];
+	bool truncated[LOGRING_MAX_ARGS] = {};
+	char msg[1024];
+	char line[1200];
+	char tbuf[32];
+	struct tm tm;
+	size_t len;
+	unsigned int i;
+
+	for (i = 0; i < e->nargs; i++) {
+		args[i] = (struct logring_arg){ .type = e->type[i] };
+		switch (e->type[i]) {
+		case LOGRING_ARG_INT:
+			args[i].i = e->arg[i].i;
+			break;
+		case LOGRING_ARG_DOUBLE:
+			args[i].d = e->arg[i].d;
+			break;
+		case LOGRING_ARG_PTR:
+			args[i].p = e->arg[i].p;
+			break;
+		default:
+			args[i].p = e->data + e->arg[i].buf.off;
+			args[i].len = e->arg[i].buf.len;
+			truncated[i] = e->arg[i].buf.len < e->arg[i].buf.orig_len;
+			break;
+		}
+	}
+	logring_format(msg, sizeof(msg), e->site->fmt, e->nargs, args, truncated);
+	len = strlen(msg);
+	if (len && msg[len - 1] == '\n')
+		msg[len - 1] = '\0';
+
+	localtime_r(&e->ts.tv_sec, &tm);
+	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm);
+	snprintf(line, sizeof(line), "%s.%06ld [%u] %s %s %s:%d %s", tbuf, e->ts.tv_nsec / 1000, c->thread,
+		 subsys_name(e->site->subsys), log_level_str(e->site->level), e->site->file, e->site->line,
+		 msg);
+	print_cb(line, data);
+}
+
+/*! Format the latest records of all threads' rings, oldest first.
+ * \param[in] ctx  talloc context for a temporary copy of the records.
+ * \param[in] max  Number of records to print at most.
+ * \param[in] print_cb  Called with each line, without a trailing newline.
+ * \returns number of records printed. */
+unsigned int logring_print(void *ctx, unsigned int max,
+			   void (*print_cb)(const char *line, void *data), void *data)
+{
+	struct logring_copy *copies;
+	const struct logring *r;
+	size_t total = 0, n = 0, i;
+
+	/* The lock only keeps new threads from adding their ring meanwhile */
+	pthread_mutex_lock(&rings_lock);
+	for (r = rings; r; r = r->next)
+		total += OSMO_MIN(r->mask + 1, max);
+	copies = total ? talloc_array(ctx, struct logring_copy, total) : NULL;
+	if (!copies) {
+		pthread_mutex_unlock(&rings_lock);
+		return 0;
+	}
+
+	for (r = rings; r; r = r->next) {
+		uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+		uint64_t count = OSMO_MIN(OSMO_MIN(head, r->mask + 1), max);
+		uint64_t pos;
+
+		for (pos = head - count; pos < head; pos++) {
+			if (logring_read(r, pos, &copies[n]))
+				n++;
+		}
+	}
+	pthread_mutex_unlock(&rings_lock);
+
+	qsort(copies, n, sizeof(copies[0]), logring_copy_cmp);
+	i = n > max ? n - max : 0;
+	for (; i < n; i++)
+		logring_print_one(&copies[i], print_cb, data);
+
+	talloc_free(copies);
+	return n > max ? max : n;
+}
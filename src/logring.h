@@ -0,0 +1,191 @@
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <osmocom/core/logging.h>
+
+/* Binary log ring: instead of formatting a log line, LOGPR() copies a pointer to its format string and the
+ * raw arguments into a ring buffer of the calling thread. The lines are only formatted when someone looks at
+ * them ('show log-ring', 'log-ring dump FILE'), so detailed logging of hot paths can stay enabled under load.
+ * Each thread writes only to its own ring, without locks; the auth vector worker threads, which must not use
+ * the libosmocore logging, can log to their ring too. */
+
+/* Value of logring_level when the ring is off */
+#define LOGRING_OFF (LOGL_FATAL + 1)
+
+#define LOGRING_DEFAULT_ENTRIES 16384
+
+#define LOGRING_MAX_ARGS 8
+
+/*! A LOGPR() call site, the format id of its records */
+struct logring_site {
+	int subsys;
+	int level;
+	const char *file;
+	int line;
+	const char *fmt;
+};
+
+enum logring_arg_type {
+	LOGRING_ARG_INT,
+	LOGRING_ARG_DOUBLE,
+	LOGRING_ARG_PTR,
+	LOGRING_ARG_STR,
+	LOGRING_ARG_QUOTE,
+	LOGRING_ARG_HEXDUMP,
+	LOGRING_ARG_HEXDUMP_NOSPC,
+};
+
+/*! A buffer argument, to be printed by a %s as osmo_quote_str() or osmo_hexdump() would. */
+struct logring_buf {
+	enum logring_arg_type type;
+	const void *buf;
+	size_t len;
+};
+
+#define LOGRING_QUOTE(str, len) ((struct logring_buf){ LOGRING_ARG_QUOTE, str, len })
+#define LOGRING_HEXDUMP(buf, len) ((struct logring_buf){ LOGRING_ARG_HEXDUMP, buf, len })
+#define LOGRING_HEXDUMP_NOSPC(buf, len) ((struct logring_buf){ LOGRING_ARG_HEXDUMP_NOSPC, buf, len })
+
+/* Size of the text of a buffer argument when LOGPR() passes it to LOGP() */
+#define LOGRING_BUF_STR_LEN 128
+
+const char *logring_buf_str(char *str, size_t str_size, struct logring_buf b);
+
+struct logring_arg {
+	enum logring_arg_type type;
+	union {
+		int64_t i;
+		double d;
+		const void *p;
+	};
+	/* for buffers; strings are copied up to their terminating nul */
+	size_t len;
+};
+
+static inline struct logring_arg logring_arg_int(int64_t i)
+{
+	return (struct logring_arg){ .type = LOGRING_ARG_INT, .i = i };
+}
+
+static inline struct logring_arg logring_arg_double(double d)
+{
+	return (struct logring_arg){ .type = LOGRING_ARG_DOUBLE, .d = d };
+}
+
+static inline struct logring_arg logring_arg_ptr(const void *p)
+{
+	return (struct logring_arg){ .type = LOGRING_ARG_PTR, .p = p };
+}
+
+static inline struct logring_arg logring_arg_str(const char *s)
+{
+	return (struct logring_arg){ .type = LOGRING_ARG_STR, .p = s };
+}
+
+static inline struct logring_arg logring_arg_buf(struct logring_buf b)
+{
+	return (struct logring_arg){ .type = b.type, .p = b.buf, .len = b.len };
+}
+
+#define LOGRING_ARG(x) _Generic((x), \
+	char *: logring_arg_str, \
+	const char *: logring_arg_str, \
+	struct logring_buf: logring_arg_buf, \
+	float: logring_arg_double, \
+	double: logring_arg_double, \
+	void *: logring_arg_ptr, \
+	const void *: logring_arg_ptr, \
+	default: logring_arg_int)(x)
+
+/* Expand to the number of arguments and an array of them, up to LOGRING_MAX_ARGS */
+#define _LOGRING_MAP0()
+#define _LOGRING_MAP1(a) LOGRING_ARG(a),
+#define _LOGRING_MAP2(a, b) LOGRING_ARG(a), _LOGRING_MAP1(b)
+#define _LOGRING_MAP3(a, b...) LOGRING_ARG(a), _LOGRING_MAP2(b)
+#define _LOGRING_MAP4(a, b...) LOGRING_ARG(a), _LOGRING_MAP3(b)
+#define _LOGRING_MAP5(a, b...) LOGRING_ARG(a), _LOGRING_MAP4(b)
+#define _LOGRING_MAP6(a, b...) LOGRING_ARG(a), _LOGRING_MAP5(b)
+#define _LOGRING_MAP7(a, b...) LOGRING_ARG(a), _LOGRING_MAP6(b)
+#define _LOGRING_MAP8(a, b...) LOGRING_ARG(a), _LOGRING_MAP7(b)
+#define _LOGRING_SEL(_0, _1, _2, _3, _4, _5, _6, _7, _8, sel, ...) sel
+#define LOGRING_ARGS(args...) \
+	_LOGRING_SEL(_, ##args, 8, 7, 6, 5, 4, 3, 2, 1, 0), \
+	(const struct logring_arg[]){ \
+		_LOGRING_SEL(_, ##args, _LOGRING_MAP8, _LOGRING_MAP7, _LOGRING_MAP6, _LOGRING_MAP5, \
+			     _LOGRING_MAP4, _LOGRING_MAP3, _LOGRING_MAP2, _LOGRING_MAP1, _LOGRING_MAP0)(args) {} }
+
+/* A LOGPR() argument as passed to LOGP(): buffers as text, in a buffer on the stack of the LOGPR() */
+#define LOGRING_PRINTF_ARG(x) _Generic((x), \
+	struct logring_buf: logring_buf_str((char[LOGRING_BUF_STR_LEN]){ 0 }, LOGRING_BUF_STR_LEN, \
+					    _Generic((x), struct logring_buf: (x), default: (struct logring_buf){ 0 })), \
+	default: (x))
+
+/* Expand to the arguments for LOGP(), each with a leading comma */
+#define _LOGRING_PMAP0()
+#define _LOGRING_PMAP1(a) , LOGRING_PRINTF_ARG(a)
+#define _LOGRING_PMAP2(a, b...) , LOGRING_PRINTF_ARG(a) _LOGRING_PMAP1(b)
+#define _LOGRING_PMAP3(a, b...) , LOGRING_PRINTF_ARG(a) _LOGRING_PMAP2(b)
+#define _LOGRING_PMAP4(a, b...) , LOGRING_PRINTF_ARG(a) _LOGRING_PMAP3(b)
+#define _LOGRING_PMAP5(a, b...) , LOGRING_PRINTF_ARG(a) _LOGRING_PMAP4(b)
+#define _LOGRING_PMAP6(a, b...) , LOGRING_PRINTF_ARG(a) _LOGRING_PMAP5(b)
+#define _LOGRING_PMAP7(a, b...) , LOGRING_PRINTF_ARG(a) _LOGRING_PMAP6(b)
+#define _LOGRING_PMAP8(a, b...) , LOGRING_PRINTF_ARG(a) _LOGRING_PMAP7(b)
+#define LOGRING_PRINTF_ARGS(args...) \
+	_LOGRING_SEL(_, ##args, _LOGRING_PMAP8, _LOGRING_PMAP7, _LOGRING_PMAP6, _LOGRING_PMAP5, \
+		     _LOGRING_PMAP4, _LOGRING_PMAP3, _LOGRING_PMAP2, _LOGRING_PMAP1, _LOGRING_PMAP0)(args)
+
+/*! Like LOGP(), and in addition write to the calling thread's log ring, if it is enabled for the level and the
+ * category. The format and level must be constant; %s arguments may be LOGRING_QUOTE() and LOGRING_HEXDUMP()
+ * buffers. The arguments are evaluated once for LOGP() and once for the ring. */
+#define LOGPR(ss, level, fmt, args...) LOGPR_COND(true, ss, level, fmt, ##args)
+
+/*! Like LOGPR(), but only log with LOGP() if cond is true, e.g. not on threads other than the main thread. */
+#define LOGPR_COND(cond, ss, level, fmt, args...) do { \
+		if (cond) \
+			LOGP(ss, level, fmt LOGRING_PRINTF_ARGS(args)); \
+		if ((level) >= logring_level && logring_category_enabled(ss, cond)) { \
+			static const struct logring_site _logring_site = { ss, level, __FILE__, __LINE__, fmt }; \
+			logring_add(&_logring_site, LOGRING_ARGS(args)); \
+		} \
+	} while (0)
+
+/* Lowest level recorded to the ring, LOGRING_OFF to log as usual */
+extern int logring_level;
+/* Number of records per thread, for threads logging to the ring for the first time */
+extern unsigned int logring_entries;
+
+bool logring_category_enabled(int subsys, bool main_thread);
+
+/*! Whether LOGPR(ss, level, ...) would do anything, to skip collecting its arguments. */
+static inline bool logring_check_level(int subsys, int level, bool log)
+{
+	return (log && log_check_level(subsys, level))
+		|| (level >= logring_level && logring_category_enabled(subsys, log));
+}
+
+void logring_add(const struct logring_site *site, unsigned int nargs, const struct logring_arg *args);
+
+unsigned int logring_print(void *ctx, unsigned int max,
+			   void (*print_cb)(const char *line, void *data), void *data);
@@ -26,12 +26,12 @@
 
 #include <osmocom/core/logging.h>
 #include <osmocom/gsm/gsup.h>
-#include <osmocom/gsm/apn.h>
 
 #include "gsup_server.h"
 #include "gsup_router.h"
 #include "logging.h"
 #include "luop.h"
+#include "probes.h"
 
 const struct value_string lu_state_names[] = {
 	{ LU_S_NULL,			"NULL" },
@@ -44,6 +44,14 @@ const struct value_string lu_state_names[] = {
 	{ 0, NULL }
 };
 
+/* Transmit an encoded GSUP message to the peer of the given LU operation */
+static void _luop_tx_msgb(struct lu_operation *luop, struct msgb *msg_out)
+{
+	osmo_gsup_addr_send(luop->gsup_server, luop->peer,
+			    talloc_total_size(luop->peer),
+			    msg_out);
+}
+
 /* Transmit a given GSUP message for the given LU operation */
 static void _luop_tx_gsup(struct lu_operation *luop,
 			  const struct osmo_gsup_message *gsup)
@@ -54,9 +62,7 @@ static void _luop_tx_gsup(struct lu_operation *luop,
 	OSMO_ASSERT(msg_out);
 	osmo_gsup_encode(msg_out, gsup);
 
-	osmo_gsup_addr_send(luop->gsup_server, luop->peer,
-			    talloc_total_size(luop->peer),
-			    msg_out);
+	_luop_tx_msgb(luop, msg_out);
 }
 
 static inline void fill_gsup_msg(struct osmo_gsup_message *out,
@@ -162,6 +168,7 @@ void lu_op_statechg(struct lu_operation *luop, enum lu_state new_state)
 	DEBUGPC(DMAIN, "%s\n",
 		get_value_string(lu_state_names, new_state));
 
+	HLR_PROBE3(lu_op_state, (const char *)luop->subscr.imsi, old_state, new_state);
 	luop->state = new_state;
 }
 
@@ -216,9 +223,7 @@ void lu_op_tx_cancel_old(struct lu_operation *luop)
 void lu_op_tx_insert_subscr_data(struct lu_operation *luop)
 {
 	struct hlr_subscriber *subscr = &luop->subscr;
-	struct osmo_gsup_message gsup = { };
-	uint8_t msisdn_enc[OSMO_GSUP_MAX_CALLED_PARTY_BCD_LEN];
-	uint8_t apn[APN_MAXLEN];
+	struct msgb *msg_out;
 	enum osmo_gsup_cn_domain cn_domain;
 
 	OSMO_ASSERT(luop->state == LU_S_LU_RECEIVED ||
@@ -229,8 +234,9 @@ void lu_op_tx_insert_subscr_data(struct lu_operation *luop)
 	else
 		cn_domain = OSMO_GSUP_CN_DOMAIN_CS;
 
-	if (osmo_gsup_create_insert_subscriber_data_msg(&gsup, subscr->imsi, subscr->msisdn, msisdn_enc,
-							sizeof(msisdn_enc), apn, sizeof(apn), cn_domain) != 0) {
+	msg_out = isd_cache_msgb(luop->gsup_server ? luop->gsup_server->isd_cache : NULL,
+				 subscr->imsi, subscr->msisdn, cn_domain);
+	if (!msg_out) {
 		LOGP(DMAIN, LOGL_ERROR,
 		       "IMSI='%s': Cannot notify GSUP client; could not create gsup message "
 		       "for %s\n", subscr->imsi, luop->peer);
@@ -238,7 +244,7 @@ void lu_op_tx_insert_subscr_data(struct lu_operation *luop)
 	}
 
 	/* Send ISD to new VLR/SGSN */
-	_luop_tx_gsup(luop, &gsup);
+	_luop_tx_msgb(luop, msg_out);
 
 	lu_op_statechg(luop, LU_S_ISD_SENT);
 	osmo_timer_schedule(&luop->timer, ISD_TIMEOUT_SECS, 0);
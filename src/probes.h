@@ -0,0 +1,55 @@
+/* USDT static probes, see contrib/usdt/ */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+/* With sys/sdt.h (systemtap-sdt-dev) available, each probe compiles to a single nop plus a note in the ELF
+ * file that bpftrace, perf or systemtap attach to at runtime. Arguments are only evaluated into registers, so
+ * they should be cheap: pass numbers and existing strings, do not compute anything for probes.
+ *
+ * Provider "osmo_hlr", probes and their arguments:
+ *
+ *   gsup_rx(ind, msg_type, len)            GSUP message received from the client with 3G IND ind
+ *   gsup_tx(ind, msg_type, len)            GSUP message queued to the client with 3G IND ind
+ *   gsup_dispatch(ind, msg_type, imsi)     decoded GSUP message about to be handled by read_cb()
+ *   gsup_dispatch_done(ind, msg_type)      read_cb() is done with it
+ *   db_stmt_start(idx, name)               a prepared SQL statement (enum stmt_idx) starts executing
+ *   db_stmt_done(idx, name, us)            ... is done or reset, after us microseconds
+ *                                          (both only with database-statement-stats, see db_stmt_stats_enable())
+ *   auc_compute_start(num_vec, resync)     auth vector computation starts, possibly on a worker thread
+ *   auc_compute_done(rc)                   ... is done, rc as auc_compute_vectors()
+ *   lu_op_state(imsi, old, new)            Location Update operation state change (enum lu_state)
+ *   ss_session_start(imsi, session_id)     SS/USSD session created
+ *   ss_session_end(imsi, session_id)       SS/USSD session freed
+ *
+ * 'make check' runs contrib/usdt/check-probes.sh, which expects this list to match the probes fired in src/.
+ */
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+#define HLR_PROBE1(name, a)			DTRACE_PROBE1(osmo_hlr, name, a)
+#define HLR_PROBE2(name, a, b)			DTRACE_PROBE2(osmo_hlr, name, a, b)
+#define HLR_PROBE3(name, a, b, c)		DTRACE_PROBE3(osmo_hlr, name, a, b, c)
+#else
+#define HLR_PROBE1(name, a)			do { } while (0)
+#define HLR_PROBE2(name, a, b)			do { } while (0)
+#define HLR_PROBE3(name, a, b, c)		do { } while (0)
+#endif
@@ -0,0 +1,430 @@
+/* Test routing requests by IMSI range between the nodes of a cluster, or from a read replica to its primary,
+ * and passing back the answers */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/gsup.h>
+#include <osmocom/gsm/protocol/ipaccess.h>
+#include <osmocom/abis/ipa.h>
+#include <osmocom/gsupclient/gsup_client.h>
+
+#include "hlr.h"
+#include "hlr_cluster.h"
+#include "gsup_server.h"
+#include "gsup_router.h"
+#include "logging.h"
+
+#define comment_start() printf("\n===== %s\n", __func__)
+#define comment_end() printf("===== %s: SUCCESS\n\n", __func__)
+#define btw(fmt, args...) printf("\n" fmt "\n", ## args)
+
+#define VERBOSE_ASSERT(val, expect_op, fmt) \
+	do { \
+		printf(#val " == " fmt "\n", (val)); \
+		OSMO_ASSERT((val) expect_op); \
+	} while (0)
+
+/* Owned by the peer */
+#define IMSI1 "901700000000001"
+#define IMSI2 "901700000000002"
+/* Owned by this node */
+#define IMSI_LOCAL "901700000001001"
+/* In no range, also served by this node */
+#define IMSI_NONE "901700000002001"
+
+static void *ctx = NULL;
+
+struct hlr *g_hlr;
+static struct osmo_gsup_server *gs;
+static struct osmo_gsup_conn *msc;
+static struct osmo_gsup_conn *sgsn;
+
+/* The IPA name of each connection is set up by the test, instead of being received in an IPA ID response */
+int osmo_gsup_conn_ccm_get(const struct osmo_gsup_conn *clnt, uint8_t **addr, uint8_t tag)
+{
+	if (!TLVP_PRESENT(&clnt->ccm, tag))
+		return -ENODEV;
+	*addr = (uint8_t *) TLVP_VAL(&clnt->ccm, tag);
+	return TLVP_LEN(&clnt->ccm, tag);
+}
+
+static void print_gsup(const char *who, const char *what, struct msgb *msg)
+{
+	struct osmo_gsup_message gsup;
+	int rc;
+
+	rc = osmo_gsup_decode(msgb_data(msg), msgb_length(msg), &gsup);
+	OSMO_ASSERT(rc == 0);
+	printf("%s: %s %s %s", who, what, osmo_gsup_message_type_name(gsup.message_type), gsup.imsi);
+	if (gsup.session_state != OSMO_GSUP_SESSION_STATE_NONE)
+		printf(" session 0x%08x %s", gsup.session_id, osmo_gsup_session_state_name(gsup.session_state));
+	printf("\n");
+}
+
+/* Instead of queueing to the IPA connection, print what each VLR/SGSN would receive */
+int osmo_gsup_conn_send(struct osmo_gsup_conn *conn, struct msgb *msg)
+{
+	print_gsup((const char *)conn->ccm.lv[IPAC_IDTAG_SERNR].val, "rx", msg);
+	msgb_free(msg);
+	return 0;
+}
+
+/* The connections to the peers, without sockets: sending prints what the peer would receive */
+static osmo_gsup_client_read_cb_t peer_read_cb;
+
+struct osmo_gsup_client *osmo_gsup_client_create(void *talloc_ctx, const char *unit_name, const char *ip_addr,
+						 unsigned int tcp_port, osmo_gsup_client_read_cb_t read_cb,
+						 struct osmo_oap_client_config *oapc_config)
+{
+	struct osmo_gsup_client *gsupc = talloc_zero(talloc_ctx, struct osmo_gsup_client);
+	OSMO_ASSERT(gsupc);
+	gsupc->unit_name = unit_name;
+	gsupc->is_connected = 1;
+	peer_read_cb = read_cb;
+	return gsupc;
+}
+
+void osmo_gsup_client_destroy(struct osmo_gsup_client *gsupc)
+{
+	talloc_free(gsupc);
+}
+
+int osmo_gsup_client_send(struct osmo_gsup_client *gsupc, struct msgb *msg)
+{
+	struct hlr_cluster_peer *peer = gsupc->data;
+
+	print_gsup(peer->name, "rx", msg);
+	msgb_free(msg);
+	return 0;
+}
+
+static struct osmo_gsup_conn *conn_up(const char *name)
+{
+	struct osmo_gsup_conn *conn = talloc_zero(gs, struct osmo_gsup_conn);
+	OSMO_ASSERT(conn);
+
+	conn->server = gs;
+	conn->conn = talloc_zero(conn, struct ipa_server_conn);
+	OSMO_ASSERT(conn->conn);
+	conn->conn->addr = "10.0.0.1";
+	conn->ccm.lv[IPAC_IDTAG_SERNR].val = (uint8_t *) talloc_strdup(conn, name);
+	conn->ccm.lv[IPAC_IDTAG_SERNR].len = strlen(name) + 1;
+	llist_add_tail(&conn->list, &gs->clients);
+	gsup_route_add(conn, (uint8_t *) name, strlen(name) + 1);
+	return conn;
+}
+
+static struct msgb *gsup_msgb(enum osmo_gsup_message_type message_type, const char *imsi,
+			      enum osmo_gsup_session_state session_state, uint32_t session_id)
+{
+	struct osmo_gsup_message gsup = {
+		.message_type = message_type,
+		.session_state = session_state,
+		.session_id = session_id,
+	};
+	struct msgb *msg = msgb_alloc_headroom(1024, 64, __func__);
+
+	OSMO_ASSERT(msg);
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	osmo_gsup_encode(msg, &gsup);
+	msg->l2h = msg->data;
+	return msg;
+}
+
+/* Pass a message from a VLR/SGSN to cluster_forward_from_conn(), as read_cb() in hlr.c does; print whether it
+ * was handled locally */
+static void rx_from_conn(struct osmo_gsup_conn *conn, enum osmo_gsup_message_type message_type, const char *imsi,
+			 enum osmo_gsup_session_state session_state, uint32_t session_id)
+{
+	struct msgb *msg = gsup_msgb(message_type, imsi, session_state, session_id);
+	struct osmo_gsup_message gsup;
+
+	OSMO_ASSERT(osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup) == 0);
+	print_gsup((const char *)conn->ccm.lv[IPAC_IDTAG_SERNR].val, "tx", msg);
+	if (!cluster_forward_from_conn(conn, msg, &gsup)) {
+		printf("  handled locally\n");
+		msgb_free(msg);
+	}
+}
+
+/* Pass a message from the peer, as its GSUP client connection would */
+static void rx_from_peer(struct hlr_cluster_peer *peer, enum osmo_gsup_message_type message_type,
+			 const char *imsi, enum osmo_gsup_session_state session_state, uint32_t session_id)
+{
+	struct msgb *msg = gsup_msgb(message_type, imsi, session_state, session_id);
+
+	print_gsup(peer->name, "tx", msg);
+	peer_read_cb(peer->client, msg);
+}
+
+/* Pass a Send Auth Info request for a resync from a VLR/SGSN to cluster_forward_from_conn() */
+static void rx_resync_from_conn(struct osmo_gsup_conn *conn, const char *imsi)
+{
+	static const uint8_t rand[16], auts[14];
+	struct osmo_gsup_message gsup = {
+		.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST,
+		.rand = rand,
+		.auts = auts,
+	};
+	struct msgb *msg = msgb_alloc_headroom(1024, 64, __func__);
+
+	OSMO_ASSERT(msg);
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	osmo_gsup_encode(msg, &gsup);
+	msg->l2h = msg->data;
+	OSMO_ASSERT(osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup) == 0);
+	printf("%s: tx %s %s with AUTS\n", (const char *)conn->ccm.lv[IPAC_IDTAG_SERNR].val,
+	       osmo_gsup_message_type_name(gsup.message_type), gsup.imsi);
+	if (!cluster_forward_from_conn(conn, msg, &gsup)) {
+		printf("  handled locally\n");
+		msgb_free(msg);
+	}
+}
+
+static void setup_hlr(void)
+{
+	g_hlr = talloc_zero(ctx, struct hlr);
+	OSMO_ASSERT(g_hlr);
+	INIT_LLIST_HEAD(&g_hlr->cluster.peers);
+	INIT_LLIST_HEAD(&g_hlr->cluster.ranges);
+
+	gs = talloc_zero(g_hlr, struct osmo_gsup_server);
+	OSMO_ASSERT(gs);
+	gs->priv = g_hlr;
+	INIT_LLIST_HEAD(&gs->clients);
+	INIT_LLIST_HEAD(&gs->routes);
+	g_hlr->gs = gs;
+}
+
+static struct hlr_cluster_peer *setup(void)
+{
+	struct hlr_cluster_peer *peer;
+
+	setup_hlr();
+
+	peer = cluster_peer_alloc(g_hlr, "HLR-1", "10.0.0.2", 4222);
+	OSMO_ASSERT(peer);
+	OSMO_ASSERT(cluster_range_alloc(g_hlr, "901700000000000", "901700000000999", peer));
+	OSMO_ASSERT(cluster_range_alloc(g_hlr, "901700000001000", "901700000001999", NULL));
+	OSMO_ASSERT(hlr_cluster_start(g_hlr) == 0);
+
+	msc = conn_up("MSC-1");
+	sgsn = conn_up("SGSN-1");
+	return peer;
+}
+
+static void teardown(void)
+{
+	struct hlr_cluster_peer *peer, *peer2;
+
+	llist_for_each_entry_safe(peer, peer2, &g_hlr->cluster.peers, list)
+		cluster_peer_del(peer);
+	cluster_primary_del(g_hlr);
+	VERBOSE_ASSERT(cluster_proxy_count(), == 0, "%u");
+	talloc_free(g_hlr);
+	g_hlr = NULL;
+}
+
+static void print_range(const char *imsi)
+{
+	struct hlr_cluster_range *range = cluster_range_by_imsi(g_hlr, imsi);
+
+	printf("cluster_range_by_imsi(%s): ", imsi);
+	if (!range)
+		printf("none\n");
+	else
+		printf("%s..%s of %s\n", range->first, range->last, range->peer ? range->peer->name : "this node");
+}
+
+static void test_ranges(void)
+{
+	struct hlr_cluster_peer *peer;
+
+	comment_start();
+	peer = setup();
+
+	btw("The first and last IMSI are part of a range");
+	print_range("901700000000000");
+	print_range("901700000000999");
+	print_range("901700000001000");
+	print_range("901700000001999");
+
+	btw("Not in a range: before, after, between and of another length");
+	print_range("901699999999999");
+	print_range("901700000002000");
+	print_range("90170000000100");
+	print_range("9017000000010000");
+
+	btw("A range must not be reversed, nor have ends of different lengths");
+	OSMO_ASSERT(!cluster_range_alloc(g_hlr, "901700000003999", "901700000003000", NULL));
+	OSMO_ASSERT(!cluster_range_alloc(g_hlr, "90170000000300", "901700000003999", NULL));
+	VERBOSE_ASSERT(llist_count(&g_hlr->cluster.ranges), == 2, "%u");
+
+	btw("Requests for IMSIs of the peer are forwarded, the others handled locally");
+	rx_from_conn(msc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI_LOCAL, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI_NONE, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("Whatever the peer forwards to this node is handled locally");
+	rx_from_conn(conn_up("HLR-1"), OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1,
+		     OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("Without a connection to the peer, the VLR gets an error");
+	peer->client->is_connected = 0;
+	rx_from_conn(msc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI2, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	VERBOSE_ASSERT(peer->stats.tx_failed, == 1, "%lu");
+
+	teardown();
+	comment_end();
+}
+
+static void test_proxy(void)
+{
+	struct hlr_cluster_peer *peer;
+
+	comment_start();
+	peer = setup();
+
+	btw("The MSC and the SGSN attach the same subscriber, each gets its own proxy");
+	rx_from_conn(msc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(sgsn, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	VERBOSE_ASSERT(cluster_proxy_count(), == 2, "%u");
+
+	btw("The owner's Insert Subscriber Data goes to the first one waiting for its Update Location");
+	rx_from_peer(peer, OSMO_GSUP_MSGT_INSERT_DATA_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_INSERT_DATA_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("Then to the SGSN, still waiting");
+	rx_from_peer(peer, OSMO_GSUP_MSGT_INSERT_DATA_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(sgsn, OSMO_GSUP_MSGT_INSERT_DATA_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("Results go to the VLR/SGSN waiting for them, in the order of the requests");
+	rx_from_conn(sgsn, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_CHECK_IMEI_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_CHECK_IMEI_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("The owner's requests go to the VLR/SGSN that sent the latest request");
+	rx_from_peer(peer, OSMO_GSUP_MSGT_LOCATION_CANCEL_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("Messages of a session go to the VLR/SGSN of that session");
+	rx_from_conn(msc, OSMO_GSUP_MSGT_PROC_SS_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_BEGIN, 0x42);
+	rx_from_conn(sgsn, OSMO_GSUP_MSGT_PROC_SS_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_BEGIN, 0x23);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_PROC_SS_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_CONTINUE, 0x42);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_PROC_SS_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_CONTINUE, 0x42);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_PROC_SS_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_END, 0x23);
+	rx_from_peer(peer, OSMO_GSUP_MSGT_PROC_SS_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_END, 0x42);
+
+	btw("Nobody waits for other IMSIs");
+	rx_from_peer(peer, OSMO_GSUP_MSGT_INSERT_DATA_REQUEST, IMSI2, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_INSERT_DATA_RESULT, IMSI2, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("Once the range is served locally, the proxy of the VLR is dropped on its next request");
+	cluster_range_del(cluster_range_by_imsi(g_hlr, IMSI1));
+	rx_from_conn(msc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	VERBOSE_ASSERT(cluster_proxy_count(), == 1, "%u");
+
+	btw("Removing the peer drops its proxies");
+	teardown();
+	comment_end();
+}
+
+static void test_replica(void)
+{
+	struct hlr_cluster_peer *primary;
+	struct msgb *msg;
+	int rc;
+
+	comment_start();
+	setup_hlr();
+	OSMO_ASSERT(cluster_primary_set(g_hlr, "127.0.0.1", 4222) == 0);
+	OSMO_ASSERT(hlr_cluster_start(g_hlr) == 0);
+	primary = g_hlr->cluster.primary;
+	OSMO_ASSERT(primary && primary->client);
+	msc = conn_up("MSC-1");
+	sgsn = conn_up("SGSN-1");
+
+	btw("Reads are answered from the replica's database");
+	rx_from_conn(msc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(msc, OSMO_GSUP_MSGT_CHECK_IMEI_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("A resync, and Check IMEI with store-imei, go to the primary, the results back to the VLR");
+	rx_resync_from_conn(msc, IMSI1);
+	rx_from_peer(primary, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	g_hlr->store_imei = true;
+	rx_from_conn(msc, OSMO_GSUP_MSGT_CHECK_IMEI_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(primary, OSMO_GSUP_MSGT_CHECK_IMEI_RESULT, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	g_hlr->store_imei = false;
+
+	btw("Update Location goes to the primary, for any IMSI; so does the SGSN's Insert Data result");
+	rx_from_conn(sgsn, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI_LOCAL, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(primary, OSMO_GSUP_MSGT_INSERT_DATA_REQUEST, IMSI_LOCAL, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_conn(sgsn, OSMO_GSUP_MSGT_INSERT_DATA_RESULT, IMSI_LOCAL, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rx_from_peer(primary, OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT, IMSI_LOCAL, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("When UMTS AKA needs a new SQN, rx_send_auth_info() passes the request on");
+	msg = gsup_msgb(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI2, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rc = cluster_forward_to_primary(g_hlr, (const uint8_t *)"MSC-1", 6, msg, IMSI2,
+					OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST);
+	VERBOSE_ASSERT(rc, == 0, "%d");
+	rx_from_peer(primary, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI2, OSMO_GSUP_SESSION_STATE_NONE, 0);
+
+	btw("Without a connection to the primary, the VLR gets an error for writes");
+	primary->client->is_connected = 0;
+	rx_from_conn(msc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	msg = gsup_msgb(OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI2, OSMO_GSUP_SESSION_STATE_NONE, 0);
+	rc = cluster_forward_to_primary(g_hlr, (const uint8_t *)"MSC-1", 6, msg, IMSI2,
+					OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST);
+	VERBOSE_ASSERT(rc == -ENOTCONN, == true, "%d");
+	VERBOSE_ASSERT(primary->stats.tx_failed, == 2, "%lu");
+
+	teardown();
+	comment_end();
+}
+
+int main(int argc, char **argv)
+{
+	ctx = talloc_named_const(NULL, 0, "cluster_test");
+	osmo_init_logging2(ctx, &hlr_log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_print_timestamp(osmo_stderr_target, 0);
+	log_set_use_color(osmo_stderr_target, 0);
+	log_set_print_category(osmo_stderr_target, 1);
+
+	test_ranges();
+	test_proxy();
+	test_replica();
+
+	printf("Done\n");
+	return 0;
+}
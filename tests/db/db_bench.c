@@ -0,0 +1,244 @@
+/* Compare the throughput of the SQLite and LMDB database backends */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/* Not run by 'make check'. Run it on fresh databases, one per backend, e.g.
+ *
+ *   cd tests/db; rm -f bench.db*; ./db_bench bench.db lmdb:bench.mdb
+ *
+ * For each database, it creates subscribers with 3G auth data, then times
+ * random Send Auth Info lookups, SQN updates and Location Updates. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/core/logging.h>
+
+#include "db.h"
+#include "logging.h"
+
+#define IMSI_BASE 901700000000000ULL
+
+static struct {
+	unsigned int num_subscr;
+	unsigned int num_ops;
+} cmdline_opts = {
+	.num_subscr = 10000,
+	.num_ops = 100000,
+};
+
+static void *ctx = NULL;
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *db_file, const char *what, unsigned int ops, double started)
+{
+	double secs = now() - started;
+	printf("%-24s %-12s %8u ops %8.3f s %10.0f ops/s\n", db_file, what, ops, secs, secs > 0 ? ops / secs : 0);
+}
+
+static void mk_imsi(char *imsi, size_t imsi_len, unsigned int idx)
+{
+	snprintf(imsi, imsi_len, "%015" PRIu64, (uint64_t)(IMSI_BASE + idx));
+}
+
+static int bench_db(const char *db_file)
+{
+	const struct sub_auth_data_str aud = {
+		.type = OSMO_AUTH_TYPE_UMTS,
+		.algo = OSMO_AUTH_ALG_MILENAGE,
+		.u.umts = {
+			.opc = "beefedcafefaceacedaddeddecadefee",
+			.opc_is_op = 0,
+			.k = "c01ffedc1cadaeac1d1f1edacac1ab0a",
+			.ind_bitlen = 5,
+		},
+	};
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+	struct osmo_sub_auth_data aud2g, aud3g;
+	struct hlr_subscriber subscr;
+	struct db_context *dbc;
+	int64_t *ids;
+	unsigned int i;
+	double started;
+	int rc = 0;
+
+	dbc = db_open(ctx, db_file, false, true);
+	if (!dbc) {
+		fprintf(stderr, "%s: cannot open database\n", db_file);
+		return -EIO;
+	}
+
+	ids = talloc_zero_array(ctx, int64_t, cmdline_opts.num_subscr);
+	OSMO_ASSERT(ids);
+
+	started = now();
+	for (i = 0; i < cmdline_opts.num_subscr; i++) {
+		mk_imsi(imsi, sizeof(imsi), i);
+		if ((rc = db_subscr_create(dbc, imsi))
+		    || (rc = db_subscr_get_by_imsi(dbc, imsi, &subscr))
+		    || (rc = db_subscr_update_aud_by_id(dbc, subscr.id, &aud))) {
+			fprintf(stderr, "%s: cannot create subscriber %s (rc=%d), is the database fresh?\n",
+				db_file, imsi, rc);
+			goto out;
+		}
+		ids[i] = subscr.id;
+	}
+	report(db_file, "create", cmdline_opts.num_subscr, started);
+
+	srand(1);
+	started = now();
+	for (i = 0; i < cmdline_opts.num_ops; i++) {
+		mk_imsi(imsi, sizeof(imsi), rand() % cmdline_opts.num_subscr);
+		if ((rc = db_get_auth_data(dbc, imsi, &aud2g, &aud3g, NULL))) {
+			fprintf(stderr, "%s: cannot get auth data for %s (rc=%d)\n", db_file, imsi, rc);
+			goto out;
+		}
+	}
+	report(db_file, "auth-data", cmdline_opts.num_ops, started);
+
+	started = now();
+	for (i = 0; i < cmdline_opts.num_ops; i++) {
+		if ((rc = db_update_sqn(dbc, ids[rand() % cmdline_opts.num_subscr], i))) {
+			fprintf(stderr, "%s: cannot update SQN (rc=%d)\n", db_file, rc);
+			goto out;
+		}
+	}
+	report(db_file, "sqn-update", cmdline_opts.num_ops, started);
+
+	/* alternate between two VLRs, so that no Location Update is suppressed as unchanged */
+	started = now();
+	for (i = 0; i < cmdline_opts.num_ops; i++) {
+		if ((rc = db_subscr_lu(dbc, ids[rand() % cmdline_opts.num_subscr], (i & 1) ? "5952" : "5953",
+				       false))) {
+			fprintf(stderr, "%s: cannot update VLR number (rc=%d)\n", db_file, rc);
+			goto out;
+		}
+	}
+	report(db_file, "lu", cmdline_opts.num_ops, started);
+
+out:
+	talloc_free(ids);
+	db_close(dbc);
+	return rc;
+}
+
+static void print_help(const char *program)
+{
+	printf("Usage:\n"
+	       "  %s [-s NUM] [-n NUM] DATABASE [DATABASE...]\n"
+	       "  e.g. %s bench.db lmdb:bench.mdb\n"
+	       "Options:\n"
+	       "  -h --help            show this text.\n"
+	       "  -s --subscribers NUM number of subscribers to create (default: %u)\n"
+	       "  -n --ops NUM         number of operations to time per test (default: %u)\n",
+	       program, program, cmdline_opts.num_subscr, cmdline_opts.num_ops);
+}
+
+static void handle_options(int argc, char **argv)
+{
+	while (1) {
+		int option_index = 0, c;
+		static struct option long_options[] = {
+			{"help", 0, 0, 'h'},
+			{"subscribers", 1, 0, 's'},
+			{"ops", 1, 0, 'n'},
+			{0, 0, 0, 0}
+		};
+
+		c = getopt_long(argc, argv, "hs:n:",
+				long_options, &option_index);
+		if (c == -1)
+			break;
+
+		switch (c) {
+		case 'h':
+			print_help(argv[0]);
+			exit(0);
+		case 's':
+			cmdline_opts.num_subscr = atoi(optarg);
+			break;
+		case 'n':
+			cmdline_opts.num_ops = atoi(optarg);
+			break;
+		default:
+			/* catch unknown options *as well as* missing arguments. */
+			fprintf(stderr, "Error in command line options. Exiting.\n");
+			exit(-1);
+			break;
+		}
+	}
+
+	if (optind >= argc || !cmdline_opts.num_subscr) {
+		print_help(argv[0]);
+		exit(-1);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+	ctx = talloc_named_const(NULL, 1, "db_bench");
+
+	handle_options(argc, argv);
+
+	osmo_init_logging2(ctx, &hlr_log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_print_timestamp(osmo_stderr_target, 0);
+	log_set_use_color(osmo_stderr_target, 0);
+	log_set_print_category(osmo_stderr_target, 1);
+	log_set_log_level(osmo_stderr_target, LOGL_ERROR);
+
+	for (i = optind; i < argc; i++) {
+		if (bench_db(argv[i]))
+			return 1;
+	}
+	return 0;
+}
+
+/* stubs */
+int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
+			struct osmo_sub_auth_data *aud2g,
+			struct osmo_sub_auth_data *aud3g,
+			const uint8_t *rand_auts, const uint8_t *auts)
+{ OSMO_ASSERT(false); return -1; }
+int auc_compute_vectors_nolog(struct osmo_auth_vector *vec, unsigned int num_vec,
+			      struct osmo_sub_auth_data *aud2g,
+			      struct osmo_sub_auth_data *aud3g,
+			      const uint8_t *rand_auts, const uint8_t *auts)
+{ OSMO_ASSERT(false); return -1; }
+void *lu_op_alloc_conn(void *conn)
+{ OSMO_ASSERT(false); return NULL; }
+void lu_op_tx_del_subscr_data(void *luop)
+{ OSMO_ASSERT(false); }
+void lu_op_free(void *luop)
+{ OSMO_ASSERT(false); }
@@ -22,12 +22,19 @@
 #include <errno.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <string.h>
 
 #include <osmocom/core/application.h>
 #include <osmocom/core/utils.h>
 #include <osmocom/core/logging.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/select.h>
+#include <osmocom/core/rate_ctr.h>
 
 #include "db.h"
+#include "auc_image.h"
+#include "imsi_filter.h"
 #include "logging.h"
 
 #define comment_start() fprintf(stderr, "\n===== %s\n", __func__);
@@ -108,13 +115,36 @@ static void _fill_invalid(void *dest, size_t size)
 		ASSERT_RC(db_get_auc(dbc, imsi, 3, vec, N_VECTORS, NULL, NULL), expect_rc); \
 	} while (0)
 
-/* Not linking the real auc_compute_vectors(), just returning num_vec.
- * This gets called by db_get_auc(), but we're only interested in its rc. */
+/* Not linking the real auc_compute_vectors(). Just number the vectors in their RAND, so that tests can tell
+ * them apart, advance the SQN by one per vector and remember the IND. */
+static unsigned int g_vec_nr = 0;
+static unsigned int g_vec_ind = 0;
 int auc_compute_vectors(struct osmo_auth_vector *vec, unsigned int num_vec,
 			struct osmo_sub_auth_data *aud2g,
 			struct osmo_sub_auth_data *aud3g,
 			const uint8_t *rand_auts, const uint8_t *auts)
-{ return num_vec; }
+{
+	unsigned int i;
+
+	for (i = 0; i < num_vec; i++) {
+		memset(&vec[i], 0, sizeof(vec[i]));
+		vec[i].rand[0] = ++g_vec_nr;
+	}
+	if (aud3g && aud3g->algo) {
+		aud3g->u.umts.sqn += num_vec;
+		g_vec_ind = aud3g->u.umts.ind;
+	}
+	return num_vec;
+}
+
+/* Called on the worker thread of auc_pool.c in test_auc_async(), one at a time */
+int auc_compute_vectors_nolog(struct osmo_auth_vector *vec, unsigned int num_vec,
+			      struct osmo_sub_auth_data *aud2g,
+			      struct osmo_sub_auth_data *aud3g,
+			      const uint8_t *rand_auts, const uint8_t *auts)
+{
+	return auc_compute_vectors(vec, num_vec, aud2g, aud3g, rand_auts, auts);
+}
 
 static struct db_context *dbc = NULL;
 static void *ctx = NULL;
@@ -796,19 +826,1023 @@ static void test_subscr_sqn()
 	comment_end();
 }
 
+static struct auc_image *g_img = NULL;
+static uint32_t g_rec_idx;
+
+/* Do auc_image_get_auth_data() and verbosely assert that its return value is as expected.
+ * The results are then available in g_aud2g, g_aud3g and g_rec_idx. */
+#define ASSERT_IMG_AUD(imsi, expect_rc, expect_id) \
+	do { \
+		fill_invalid(g_aud2g); \
+		fill_invalid(g_aud3g); \
+		g_id = 0; \
+		ASSERT_RC(auc_image_get_auth_data(g_img, imsi, &g_aud2g, &g_aud3g, &g_id, &g_rec_idx), \
+			  expect_rc); \
+		if (!g_rc) { \
+			dump_aud("2G", &g_aud2g); \
+			dump_aud("3G", &g_aud3g); \
+		}\
+		if (g_id != expect_id) {\
+			fprintf(stderr, "MISMATCH: got subscriber id %"PRId64 \
+				", expected %"PRId64"\n", g_id, (int64_t)(expect_id)); \
+			OSMO_ASSERT(g_id == expect_id); \
+		} \
+		fprintf(stderr, "\n"); \
+	} while (0)
+
+static void img_open(const char *path)
+{
+	fprintf(stderr, "auc_image_open(ctx, \"%s\", NULL)\n", path);
+	g_img = auc_image_open(ctx, path, NULL);
+	OSMO_ASSERT(g_img);
+	fprintf(stderr, "\n");
+}
+
+static void img_close()
+{
+	auc_image_close(g_img);
+	g_img = NULL;
+}
+
+static void mk_img_rec(struct auc_image_rec *rec, const char *imsi, int64_t subscr_id)
+{
+	memset(rec, 0, sizeof(*rec));
+	osmo_strlcpy(rec->imsi, imsi, sizeof(rec->imsi));
+	rec->subscr_id = subscr_id;
+}
+
+static void test_auc_image()
+{
+	const char *img_path = "db_test.auc";
+	const char *bulk_path = "db_test_bulk.auc";
+	struct auc_image_rec recs[3];
+	struct auc_image_rec *bulk;
+	uint32_t num_bulk = 1000;
+	uint32_t idx0, idx1;
+	uint32_t i, found, missed;
+	char imsi[GSM23003_IMSI_MAX_DIGITS+1];
+
+	comment_start();
+
+	comment("Write an AUC image of three subscribers: 3G only, 2G only, no auth data");
+
+	mk_img_rec(&recs[0], imsi0, 1);
+	recs[0].flags = AUC_IMAGE_F_3G;
+	recs[0].algo_3g = OSMO_AUTH_ALG_MILENAGE;
+	recs[0].opc_is_op = 1;
+	recs[0].ind_bitlen = 5;
+	recs[0].sqn = 23315;
+	osmo_hexparse("BeefedCafeFaceAcedAddedDecadeFee", recs[0].opc, sizeof(recs[0].opc));
+	osmo_hexparse("C01ffedC1cadaeAc1d1f1edAcac1aB0a", recs[0].k, sizeof(recs[0].k));
+
+	mk_img_rec(&recs[1], imsi1, 2);
+	recs[1].flags = AUC_IMAGE_F_2G;
+	recs[1].algo_2g = OSMO_AUTH_ALG_COMP128v1;
+	osmo_hexparse("0123456789abcdef0123456789abcdef", recs[1].ki, sizeof(recs[1].ki));
+
+	mk_img_rec(&recs[2], imsi2, 3);
+
+	ASSERT_RC(auc_image_write(ctx, img_path, recs, ARRAY_SIZE(recs)), 0);
+	img_open(img_path);
+
+	comment("Every subscriber in the image is found");
+
+	ASSERT_IMG_AUD(imsi0, 0, 1);
+	idx0 = g_rec_idx;
+	ASSERT_IMG_AUD(imsi1, 0, 2);
+	idx1 = g_rec_idx;
+	ASSERT_IMG_AUD(imsi2, -ENOKEY, 3);
+
+	comment("Subscribers absent from the image miss");
+
+	ASSERT_IMG_AUD(unknown_imsi, -ENOENT, 0);
+	ASSERT_IMG_AUD(short_imsi, -ENOENT, 0);
+
+	comment("Update the SQN");
+
+	ASSERT_RC(auc_image_update_sqn(g_img, idx0, 42), 0);
+	ASSERT_IMG_AUD(imsi0, 0, 1);
+	ASSERT_RC(auc_image_update_sqn(g_img, idx1, 42), -ENOENT);
+	ASSERT_RC(auc_image_update_sqn(g_img, 3, 42), -ENOENT);
+
+	comment("Reopen the image: the SQN persists in the SQN file");
+
+	img_close();
+	img_open(img_path);
+	ASSERT_IMG_AUD(imsi0, 0, 1);
+
+	comment("Write a new image: the SQN file has a mismatching image_id and is discarded");
+
+	img_close();
+	ASSERT_RC(auc_image_write(ctx, img_path, recs, ARRAY_SIZE(recs)), 0);
+	img_open(img_path);
+	ASSERT_IMG_AUD(imsi0, 0, 1);
+	img_close();
+
+	comment("Image of %u subscribers: every IMSI is found, absent IMSIs miss", num_bulk);
+
+	bulk = talloc_zero_array(ctx, struct auc_image_rec, num_bulk);
+	OSMO_ASSERT(bulk);
+	for (i = 0; i < num_bulk; i++) {
+		snprintf(imsi, sizeof(imsi), "90170%010u", i * 7);
+		mk_img_rec(&bulk[i], imsi, 100 + i);
+		bulk[i].flags = AUC_IMAGE_F_2G;
+		bulk[i].algo_2g = OSMO_AUTH_ALG_COMP128v1;
+	}
+	ASSERT_RC(auc_image_write(ctx, bulk_path, bulk, num_bulk), 0);
+	img_open(bulk_path);
+
+	/* omit the per-IMSI lookup logging */
+	log_set_log_level(osmo_stderr_target, LOGL_NOTICE);
+	found = missed = 0;
+	for (i = 0; i < num_bulk; i++) {
+		int64_t subscr_id = 0;
+		snprintf(imsi, sizeof(imsi), "90170%010u", i * 7);
+		if (!auc_image_get_auth_data(g_img, imsi, &g_aud2g, &g_aud3g, &subscr_id, NULL)
+		    && subscr_id == 100 + i)
+			found++;
+		snprintf(imsi, sizeof(imsi), "90170%010u", i * 7 + 3);
+		if (auc_image_get_auth_data(g_img, imsi, &g_aud2g, &g_aud3g, &subscr_id, NULL) == -ENOENT)
+			missed++;
+	}
+	log_set_log_level(osmo_stderr_target, 0);
+	fprintf(stderr, "found %u of %u IMSIs, %u of %u absent IMSIs missed\n\n",
+		found, num_bulk, missed, num_bulk);
+	OSMO_ASSERT(found == num_bulk);
+	OSMO_ASSERT(missed == num_bulk);
+
+	img_close();
+	talloc_free(bulk);
+
+	comment_end();
+}
+
+static void check_digits_int(const char *digits, bool expect_ok, int64_t expect_val)
+{
+	int64_t val = 0;
+	bool ok = db_digits_to_int(digits, &val);
+
+	fprintf(stderr, "db_digits_to_int(%s) --> %s", osmo_quote_str(digits, -1), ok ? "true" : "false");
+	if (ok)
+		fprintf(stderr, ", %" PRId64, val);
+	fprintf(stderr, "\n");
+	OSMO_ASSERT(ok == expect_ok);
+	if (ok)
+		OSMO_ASSERT(val == expect_val);
+}
+
+static void test_digits_int()
+{
+	int64_t id[4];
+	int i;
+
+	comment_start();
+
+	comment("Leading zeros are kept by the prepended '1'");
+
+	check_digits_int("0", true, 10);
+	check_digits_int("00", true, 100);
+	check_digits_int("123", true, 1123);
+	check_digits_int("0123", true, 10123);
+
+	comment("15 digit IMSIs and the longest digit strings that fit");
+
+	check_digits_int("001010000000001", true, 1001010000000001LL);
+	check_digits_int("999999999999999", true, 1999999999999999LL);
+	check_digits_int("999999999999999999", true, 1999999999999999999LL);
+
+	comment("Digit strings that don't fit are not encoded");
+
+	check_digits_int("1234567890123456789", false, 0);
+	check_digits_int("", false, 0);
+	check_digits_int(NULL, false, 0);
+	check_digits_int("+49123", false, 0);
+	check_digits_int("12a4", false, 0);
+
+	comment("IMSIs that differ only in leading zeros are different subscribers");
+
+	ASSERT_RC(db_subscr_create(dbc, "1010000000001"), 0);
+	ASSERT_RC(db_subscr_create(dbc, "01010000000001"), 0);
+	ASSERT_RC(db_subscr_create(dbc, "001010000000001"), 0);
+	ASSERT_RC(db_subscr_create(dbc, "999999999999999"), 0);
+
+	ASSERT_SEL(imsi, "1010000000001", 0);
+	id[0] = g_subscr.id;
+	ASSERT_SEL(imsi, "01010000000001", 0);
+	id[1] = g_subscr.id;
+	ASSERT_SEL(imsi, "001010000000001", 0);
+	id[2] = g_subscr.id;
+	ASSERT_SEL(imsi, "999999999999999", 0);
+	id[3] = g_subscr.id;
+	ASSERT_SEL(imsi, "0001010000000001", -ENOENT);
+
+	comment("MSISDNs that differ only in leading zeros are different subscribers");
+
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, "1010000000001", "1"), 0);
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, "01010000000001", "01"), 0);
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, "001010000000001", "001"), 0);
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, "999999999999999", "999999999999999"), 0);
+
+	ASSERT_SEL(msisdn, "1", 0);
+	ASSERT_SEL(msisdn, "01", 0);
+	ASSERT_SEL(msisdn, "001", 0);
+	ASSERT_SEL(msisdn, "999999999999999", 0);
+	ASSERT_SEL(msisdn, "0001", -ENOENT);
+
+	comment("Delete subscribers");
+
+	for (i = 0; i < ARRAY_SIZE(id); i++)
+		ASSERT_RC(db_subscr_delete_by_id(dbc, id[i]), 0);
+
+	comment_end();
+}
+
+/* Print change log entries without their timestamp, to be validated by db_test.err */
+static int dump_change(const struct db_change *change, void *data)
+{
+	fprintf(stderr, "  %" PRId64 " %" PRId64 " '%s' %s '%s'\n", change->seq, change->subscr_id, change->imsi,
+		change->change, change->value);
+	return 0;
+}
+
+static void dump_changes_since(int64_t seq)
+{
+	int n;
+
+	fprintf(stderr, "db_change_since(dbc, %" PRId64 ", ...)\n", seq);
+	n = db_change_since(dbc, seq, 100, dump_change, NULL);
+	fprintf(stderr, "--> %d\n\n", n);
+	OSMO_ASSERT(n >= 0);
+}
+
+/* sqlite3_exec() callback printing one result row per line, to be validated by db_test.err */
+static int dump_row(void *data, int argc, char **argv, char **col_names)
+{
+	int i;
+
+	for (i = 0; i < argc; i++)
+		fprintf(stderr, "%s%s=%s", i ? " " : "  ", col_names[i], argv[i] ? : "NULL");
+	fprintf(stderr, "\n");
+	return 0;
+}
+
+/* hlr_db_v2.sql has subscribers as osmo-hlr wrote them before the imsi_int and
+ * msisdn_int columns were added in schema version 3. */
+static void test_db_upgrade()
+{
+	struct db_context *dbc_main = dbc;
+
+	comment_start();
+
+	comment("Upgrade a database of schema version 2");
+
+	log_set_log_level(osmo_stderr_target, LOGL_NOTICE);
+	dbc = db_open(ctx, "db_test_v2.db", false, true);
+	log_set_log_level(osmo_stderr_target, 0);
+	OSMO_ASSERT(dbc);
+
+	comment("Existing subscribers are found by integer encoded IMSI and MSISDN");
+
+	ASSERT_SEL(imsi, "001010000000001", 0);
+	ASSERT_SEL(imsi, "01010000000001", 0);
+	ASSERT_SEL(imsi, "901700000000003", 0);
+	ASSERT_SEL(imsi, "901700000000004", 0);
+	ASSERT_SEL(imsi, "1010000000001", -ENOENT);
+
+	ASSERT_SEL(msisdn, "0123", 0);
+	ASSERT_SEL(msisdn, "123", 0);
+	ASSERT_SEL(msisdn, "00123", -ENOENT);
+
+	comment("MSISDNs that don't fit an integer are found by their text");
+
+	ASSERT_SEL(msisdn, "1234567890123456789", 0);
+	OSMO_ASSERT(g_subscr.id == 3);
+	ASSERT_SEL(msisdn, "+49123", 0);
+	OSMO_ASSERT(g_subscr.id == 4);
+	ASSERT_SEL(msisdn, "+49124", -ENOENT);
+
+	comment("last_lu_seen is converted to seconds since the epoch");
+
+	ASSERT_SEL(imsi, "001010000000001", 0);
+	fprintf(stderr, "last_lu_seen = %" PRId64 "\n\n", (int64_t)g_subscr.last_lu_seen);
+	OSMO_ASSERT(g_subscr.last_lu_seen == 1551443696);
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "SELECT id, typeof(last_lu_seen) FROM subscriber ORDER BY id",
+			       dump_row, NULL, NULL),
+		  SQLITE_OK);
+
+	comment("The subscriber_compat view shows last_lu_seen as before, as datetime() text");
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "SELECT id, imsi, last_lu_seen, typeof(last_lu_seen) FROM subscriber_compat"
+			       " ORDER BY id", dump_row, NULL, NULL),
+		  SQLITE_OK);
+
+	comment("last_lu_seen is read as 64 bit integer, beyond 2038");
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "UPDATE subscriber SET last_lu_seen = 4102444800"
+			       " WHERE imsi = '001010000000001'", NULL, NULL, NULL),
+		  SQLITE_OK);
+	ASSERT_SEL(imsi, "001010000000001", 0);
+	fprintf(stderr, "last_lu_seen = %" PRId64 "\n\n", (int64_t)g_subscr.last_lu_seen);
+	OSMO_ASSERT((int64_t)g_subscr.last_lu_seen == 4102444800LL);
+	ASSERT_RC(sqlite3_exec(dbc->db, "SELECT id, last_lu_seen FROM subscriber_compat WHERE id = 1",
+			       dump_row, NULL, NULL),
+		  SQLITE_OK);
+
+	comment("Triggers fill imsi_int and msisdn_int for rows written by other tools");
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "INSERT INTO subscriber (imsi, msisdn)"
+			       " VALUES ('901700000000005', '49301234567')", NULL, NULL, NULL),
+		  SQLITE_OK);
+	ASSERT_SEL(imsi, "901700000000005", 0);
+	ASSERT_SEL(msisdn, "49301234567", 0);
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "UPDATE subscriber SET msisdn = '0555'"
+			       " WHERE imsi = '901700000000005'", NULL, NULL, NULL),
+		  SQLITE_OK);
+	ASSERT_SEL(msisdn, "49301234567", -ENOENT);
+	ASSERT_SEL(msisdn, "0555", 0);
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "UPDATE subscriber SET msisdn = '9876543210987654321'"
+			       " WHERE imsi = '901700000000005'", NULL, NULL, NULL),
+		  SQLITE_OK);
+	ASSERT_SEL(msisdn, "0555", -ENOENT);
+	ASSERT_SEL(msisdn, "9876543210987654321", 0);
+
+	comment("The change log triggers added by the upgrade look up the IMSI, SQN updates are not logged");
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "INSERT INTO auc_3g (subscriber_id, algo_id_3g, k, opc, sqn)"
+			       " SELECT id, 5, '000102030405060708090a0b0c0d0e0f', '101112131415161718191a1b1c1d1e1f', 1"
+			       " FROM subscriber WHERE imsi = '901700000000005'", NULL, NULL, NULL),
+		  SQLITE_OK);
+	ASSERT_RC(sqlite3_exec(dbc->db, "UPDATE auc_3g SET sqn = 33", NULL, NULL, NULL), SQLITE_OK);
+	ASSERT_RC(sqlite3_exec(dbc->db, "UPDATE subscriber SET nam_cs = 0, imei = '12345678901234'"
+			       " WHERE imsi = '901700000000005'", NULL, NULL, NULL),
+		  SQLITE_OK);
+	ASSERT_RC(sqlite3_exec(dbc->db, "DELETE FROM subscriber WHERE imsi = '901700000000005'", NULL, NULL, NULL),
+		  SQLITE_OK);
+	dump_changes_since(0);
+
+	/* the changes scheduled the change log timer */
+	osmo_timer_del(&dbc->change_log.timer);
+	db_close(dbc);
+	dbc = dbc_main;
+
+	comment_end();
+}
+
+#define ASSERT_CTR(idx, expect) do { \
+		int64_t _val = dbc->ctrs->ctr[idx].current; \
+		fprintf(stderr, #idx " == %" PRId64 "\n\n", _val); \
+		if (_val != (expect)) \
+			fprintf(stderr, "  MISMATCH: expected " #expect "\n"); \
+		OSMO_ASSERT(_val == (expect)); \
+	} while (0)
+
+static void test_subscr_write_suppressed()
+{
+	int64_t id;
+	const char *imsi = "123456789000001";
+	const char *unknown_imsi = "123456789000002";
+	struct timespec *now;
+
+	comment_start();
+
+	osmo_clock_override_enable(CLOCK_REALTIME, true);
+	now = osmo_clock_override_gettimespec(CLOCK_REALTIME);
+	now->tv_sec = 1551443696;
+	now->tv_nsec = 0;
+	dbc->last_lu_seen_granularity = 60;
+	rate_ctr_group_reset(dbc->ctrs);
+
+	ASSERT_RC(db_subscr_create(dbc, imsi), 0);
+	ASSERT_SEL(imsi, imsi, 0);
+	id = g_subscr.id;
+
+	comment("A Location Update from a new VLR writes");
+
+	ASSERT_RC(db_subscr_lu(dbc, id, "5952", false), 0);
+	ASSERT_CTR(DB_CTR_LU_SUPPRESSED, 0);
+
+	comment("The same VLR again within last-lu-seen-granularity is suppressed");
+
+	now->tv_sec += 59;
+	ASSERT_RC(db_subscr_lu(dbc, id, "5952", false), 0);
+	ASSERT_CTR(DB_CTR_LU_SUPPRESSED, 1);
+	ASSERT_SEL(imsi, imsi, 0);
+	OSMO_ASSERT(g_subscr.last_lu_seen == 1551443696);
+
+	comment("The same VLR after last-lu-seen-granularity writes");
+
+	now->tv_sec += 1;
+	ASSERT_RC(db_subscr_lu(dbc, id, "5952", false), 0);
+	ASSERT_CTR(DB_CTR_LU_SUPPRESSED, 1);
+	ASSERT_SEL(imsi, imsi, 0);
+	OSMO_ASSERT(g_subscr.last_lu_seen == 1551443756);
+
+	comment("Another VLR or an SGSN writes right away");
+
+	ASSERT_RC(db_subscr_lu(dbc, id, "5953", false), 0);
+	ASSERT_RC(db_subscr_lu(dbc, id, "5952", true), 0);
+	ASSERT_CTR(DB_CTR_LU_SUPPRESSED, 1);
+	ASSERT_RC(db_subscr_lu(dbc, id, "5952", true), 0);
+	ASSERT_CTR(DB_CTR_LU_SUPPRESSED, 2);
+
+	comment("An unchanged IMEI is suppressed");
+
+	ASSERT_RC(db_subscr_update_imei_by_imsi(dbc, imsi, "12345678901234"), 0);
+	ASSERT_CTR(DB_CTR_IMEI_SUPPRESSED, 0);
+	ASSERT_RC(db_subscr_update_imei_by_imsi(dbc, imsi, "12345678901234"), 0);
+	ASSERT_CTR(DB_CTR_IMEI_SUPPRESSED, 1);
+	ASSERT_RC(db_subscr_update_imei_by_imsi(dbc, imsi, "12345678901235"), 0);
+	ASSERT_CTR(DB_CTR_IMEI_SUPPRESSED, 1);
+
+	comment("An unchanged NAM is suppressed");
+
+	ASSERT_RC(db_subscr_nam(dbc, imsi, true, false), 0);
+	ASSERT_CTR(DB_CTR_NAM_SUPPRESSED, 1);
+	ASSERT_RC(db_subscr_nam(dbc, imsi, false, false), 0);
+	ASSERT_CTR(DB_CTR_NAM_SUPPRESSED, 1);
+	ASSERT_RC(db_subscr_nam(dbc, imsi, false, false), 0);
+	ASSERT_CTR(DB_CTR_NAM_SUPPRESSED, 2);
+	ASSERT_RC(db_subscr_nam(dbc, imsi, true, true), 0);
+	ASSERT_CTR(DB_CTR_NAM_SUPPRESSED, 3);
+
+	comment("An unknown subscriber is still an error, not a suppressed write");
+
+	ASSERT_RC(db_subscr_lu(dbc, 99, "5952", false), -ENOENT);
+	ASSERT_RC(db_subscr_update_imei_by_imsi(dbc, unknown_imsi, "12345678901234"), -ENOENT);
+	ASSERT_RC(db_subscr_nam(dbc, unknown_imsi, true, false), -ENOENT);
+	ASSERT_CTR(DB_CTR_LU_SUPPRESSED, 2);
+	ASSERT_CTR(DB_CTR_IMEI_SUPPRESSED, 1);
+	ASSERT_CTR(DB_CTR_NAM_SUPPRESSED, 3);
+
+	comment("Delete subscriber");
+
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id), 0);
+
+	dbc->last_lu_seen_granularity = 0;
+	osmo_clock_override_enable(CLOCK_REALTIME, false);
+
+	comment_end();
+}
+
+static void test_auc_readonly()
+{
+	struct osmo_auth_vector vec[3];
+	const char *imsi_2g = "123456789000011";
+	const char *imsi_3g = "123456789000012";
+	const char *img_path = "db_test_readonly.auc";
+	struct auc_image_rec rec;
+	int64_t id_2g, id_3g;
+
+	comment_start();
+
+	ASSERT_RC(db_subscr_create(dbc, imsi_2g), 0);
+	ASSERT_SEL(imsi, imsi_2g, 0);
+	id_2g = g_subscr.id;
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id_2g,
+		mk_aud_2g(OSMO_AUTH_ALG_COMP128v1, "BeadedBeeAced1EbbedDefacedFacade")), 0);
+	ASSERT_RC(db_subscr_create(dbc, imsi_3g), 0);
+	ASSERT_SEL(imsi, imsi_3g, 0);
+	id_3g = g_subscr.id;
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id_3g,
+		mk_aud_3g(OSMO_AUTH_ALG_MILENAGE, "BeadedBeeAced1EbbedDefacedFacade", false,
+			  "DeafBeddedBabeAcceededFadedDecaf", 5)), 0);
+
+	comment("A read replica answers 2G auth info, but cannot store the SQN of UMTS AKA");
+
+	/* Like db_open2(..., readonly = true), which LMDB allows only once per process */
+	dbc->readonly = true;
+	ASSERT_RC(db_get_auc(dbc, imsi_2g, 0, vec, ARRAY_SIZE(vec), NULL, NULL), 3);
+	ASSERT_RC(db_get_auc(dbc, imsi_3g, 0, vec, ARRAY_SIZE(vec), NULL, NULL), -EROFS);
+
+	comment("With an AUC image, which has its own SQN file, the read replica answers UMTS AKA as well");
+
+	mk_img_rec(&rec, imsi_3g, id_3g);
+	rec.flags = AUC_IMAGE_F_3G;
+	rec.algo_3g = OSMO_AUTH_ALG_MILENAGE;
+	rec.ind_bitlen = 5;
+	ASSERT_RC(auc_image_write(ctx, img_path, &rec, 1), 0);
+	img_open(img_path);
+	dbc->auc_image = g_img;
+	ASSERT_RC(db_get_auc(dbc, imsi_3g, 0, vec, ARRAY_SIZE(vec), NULL, NULL), 3);
+	dbc->auc_image = NULL;
+	img_close();
+	dbc->readonly = false;
+
+	comment("Delete subscribers");
+
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id_2g), 0);
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id_3g), 0);
+
+	comment_end();
+}
+
+/* Request vectors and print which ones came back, and the SQN stored afterwards */
+static void check_sai(const char *imsi, unsigned int ind, bool resync, unsigned int expect_first_vec,
+		      uint64_t expect_sqn)
+{
+	static const uint8_t rand_auts[16], auts[14];
+	struct osmo_auth_vector vec[N_VECTORS];
+	int rc;
+
+	fprintf(stderr, "db_get_auc(dbc, %s, %u, vec, N_VECTORS, %s) --> N_VECTORS\n", imsi, ind,
+		resync ? "rand_auts, auts" : "NULL, NULL");
+	rc = db_get_auc(dbc, imsi, ind, vec, N_VECTORS, resync ? rand_auts : NULL, resync ? auts : NULL);
+	OSMO_ASSERT(rc == N_VECTORS);
+
+	log_set_log_level(osmo_stderr_target, LOGL_NOTICE);
+	rc = db_get_auth_data(dbc, imsi, &g_aud2g, &g_aud3g, NULL);
+	log_set_log_level(osmo_stderr_target, 0);
+	OSMO_ASSERT(!rc);
+
+	fprintf(stderr, "vectors %u..%u, SQN=%" PRIu64 ", %u remembered\n\n", vec[0].rand[0],
+		vec[N_VECTORS - 1].rand[0], g_aud3g.u.umts.sqn, llist_count(&dbc->sai_coalesce.recent));
+	OSMO_ASSERT(vec[0].rand[0] == expect_first_vec);
+	OSMO_ASSERT(g_aud3g.u.umts.sqn == expect_sqn);
+}
+
+static void test_sai_coalesce()
+{
+	const char *imsi = "123456789000021";
+	struct timespec *now;
+	int64_t id;
+
+	comment_start();
+
+	ASSERT_RC(db_subscr_create(dbc, imsi), 0);
+	ASSERT_SEL(imsi, imsi, 0);
+	id = g_subscr.id;
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id,
+		mk_aud_3g(OSMO_AUTH_ALG_MILENAGE, "BeadedBeeAced1EbbedDefacedFacade", false,
+			  "DeafBeddedBabeAcceededFadedDecaf", 5)), 0);
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+	now = osmo_clock_override_gettimespec(CLOCK_MONOTONIC);
+	now->tv_sec = 23;
+	now->tv_nsec = 0;
+	rate_ctr_group_reset(dbc->ctrs);
+	g_vec_nr = 0;
+	db_sai_coalesce_window_set(dbc, 1000);
+
+	comment("A duplicate within the window gets the same vectors and leaves the SQN alone");
+
+	check_sai(imsi, 3, false, 1, 3);
+	osmo_clock_override_add(CLOCK_MONOTONIC, 0, 999000000);
+	check_sai(imsi, 3, false, 1, 3);
+	ASSERT_CTR(DB_CTR_SAI_COALESCED, 1);
+
+	comment("Another IND gets new vectors");
+
+	check_sai(imsi, 4, false, 4, 6);
+
+	comment("After the window, the same request gets new vectors");
+
+	osmo_clock_override_add(CLOCK_MONOTONIC, 0, 1000000);
+	check_sai(imsi, 3, false, 7, 9);
+	ASSERT_CTR(DB_CTR_SAI_COALESCED, 1);
+
+	comment("A resync gets new vectors, and they are not handed out again");
+
+	check_sai(imsi, 3, true, 10, 12);
+	check_sai(imsi, 3, false, 13, 15);
+	check_sai(imsi, 3, false, 13, 15);
+	ASSERT_CTR(DB_CTR_SAI_COALESCED, 2);
+
+	comment("Window 0 forgets all vectors");
+
+	db_sai_coalesce_window_set(dbc, 0);
+	fprintf(stderr, "%u remembered\n\n", llist_count(&dbc->sai_coalesce.recent));
+	OSMO_ASSERT(llist_empty(&dbc->sai_coalesce.recent));
+	OSMO_ASSERT(!dbc->sai_coalesce.buckets);
+	check_sai(imsi, 3, false, 16, 18);
+
+	comment("Delete subscriber");
+
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id), 0);
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, false);
+
+	comment_end();
+}
+
+/* Request vectors for a GSUP connection's IND and print the IND they were generated with */
+static void check_ind(const char *imsi, unsigned int ind, unsigned int expect_ind)
+{
+	struct osmo_auth_vector vec[N_VECTORS];
+	int rc;
+
+	fprintf(stderr, "db_get_auc(dbc, %s, %u, vec, N_VECTORS, NULL, NULL) --> N_VECTORS\n", imsi, ind);
+	g_vec_ind = UINT_MAX;
+	rc = db_get_auc(dbc, imsi, ind, vec, N_VECTORS, NULL, NULL);
+	OSMO_ASSERT(rc == N_VECTORS);
+	fprintf(stderr, "IND %u\n\n", g_vec_ind);
+	OSMO_ASSERT(g_vec_ind == expect_ind);
+}
+
+static void test_ind_partition()
+{
+	const char *imsi = "123456789000071";
+	int64_t id;
+
+	comment_start();
+
+	comment("node-id must be smaller than num-nodes");
+
+	ASSERT_RC(db_ind_partition_set(dbc, 3, 3), -EINVAL);
+	ASSERT_RC(db_ind_partition_set(dbc, 1, 1), -EINVAL);
+	ASSERT_RC(db_ind_partition_set(dbc, 1, 0), -EINVAL);
+	ASSERT_RC(db_ind_partition_set(dbc, 0, 1), 0);
+	OSMO_ASSERT(!db_ind_partitioned(dbc));
+
+	ASSERT_RC(db_subscr_create(dbc, imsi), 0);
+	ASSERT_SEL(imsi, imsi, 0);
+	id = g_subscr.id;
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id,
+		mk_aud_3g(OSMO_AUTH_ALG_MILENAGE, "BeadedBeeAced1EbbedDefacedFacade", false,
+			  "DeafBeddedBabeAcceededFadedDecaf", 5)), 0);
+
+	comment("Not partitioned, the IND is used as is");
+
+	check_ind(imsi, 2, 2);
+
+	comment("Node 1 of 3 uses IND 1, 4, 7, ... 28: ind * num_nodes + node_id");
+
+	ASSERT_RC(db_ind_partition_set(dbc, 1, 3), 0);
+	OSMO_ASSERT(db_ind_partitioned(dbc));
+	check_ind(imsi, 0, 1);
+	check_ind(imsi, 2, 7);
+	check_ind(imsi, 9, 28);
+
+	comment("An index beyond the 32 / 3 = 10 slots wraps within the node's own IND values");
+
+	check_ind(imsi, 10, 1);
+	check_ind(imsi, 12, 7);
+
+	comment("Node 2 of 3 uses the IND values right after node 1's");
+
+	ASSERT_RC(db_ind_partition_set(dbc, 2, 3), 0);
+	check_ind(imsi, 0, 2);
+	check_ind(imsi, 9, 29);
+
+	comment("An IND bitlen leaving no value for each node is refused");
+
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id,
+		mk_aud_3g(OSMO_AUTH_ALG_MILENAGE, "BeadedBeeAced1EbbedDefacedFacade", false,
+			  "DeafBeddedBabeAcceededFadedDecaf", 1)), 0);
+	ASSERT_DB_GET_AUC(imsi, -1);
+
+	comment("num-nodes 0 turns partitioning off again");
+
+	ASSERT_RC(db_ind_partition_set(dbc, 0, 0), 0);
+	OSMO_ASSERT(!db_ind_partitioned(dbc));
+	ASSERT_DB_GET_AUC(imsi, N_VECTORS);
+
+	comment("Delete subscriber");
+
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id), 0);
+
+	comment_end();
+}
+
+#define ASSERT_FILTER_STATS(expect_lookups, expect_by_filter, expect_by_cache, expect_false_pos) \
+	do { \
+		struct imsi_filter *f = dbc->imsi_filter; \
+		fprintf(stderr, "IMSI filter: %lu lookups, %lu rejected by filter, %lu rejected by cache," \
+			" %lu false positives\n\n", f->stats.lookups, f->stats.rejected_by_filter, \
+			f->stats.rejected_by_cache, f->stats.false_positives); \
+		OSMO_ASSERT(f->stats.lookups == (expect_lookups)); \
+		OSMO_ASSERT(f->stats.rejected_by_filter == (expect_by_filter)); \
+		OSMO_ASSERT(f->stats.rejected_by_cache == (expect_by_cache)); \
+		OSMO_ASSERT(f->stats.false_positives == (expect_false_pos)); \
+	} while (0)
+
+static void test_imsi_filter()
+{
+	const char *imsi0 = "123456789000031";
+	const char *imsi1 = "123456789000032";
+	const char *imsi2 = "123456789000033";
+	const char *unknown_imsi = "123456789000039";
+	struct imsi_filter *f;
+	struct timespec *now;
+	int64_t id0, id1, id2;
+	int rc;
+
+	comment_start();
+
+	ASSERT_RC(db_subscr_create(dbc, imsi0), 0);
+	ASSERT_SEL(imsi, imsi0, 0);
+	id0 = g_subscr.id;
+
+	rc = db_imsi_filter_enable(dbc, 30);
+	if (rc == -ENOTSUP) {
+		comment("The backend cannot iterate subscribers, no IMSI filter");
+		ASSERT_RC(db_subscr_delete_by_id(dbc, id0), 0);
+		comment_end();
+		return;
+	}
+	OSMO_ASSERT(!rc);
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+	now = osmo_clock_override_gettimespec(CLOCK_MONOTONIC);
+	now->tv_sec = 42;
+	now->tv_nsec = 0;
+
+	comment("Subscribers that existed and that are created later pass the filter");
+
+	ASSERT_RC(db_subscr_create(dbc, imsi1), 0);
+	ASSERT_SEL(imsi, imsi0, 0);
+	ASSERT_SEL(imsi, imsi1, 0);
+	id1 = g_subscr.id;
+	ASSERT_FILTER_STATS(2, 0, 0, 0);
+
+	comment("An unknown IMSI is rejected without a database lookup, i.e. without error log");
+
+	ASSERT_SEL(imsi, unknown_imsi, -ENOENT);
+	ASSERT_SEL_AUD(unknown_imsi, -ENOENT, 0);
+	ASSERT_FILTER_STATS(4, 2, 0, 0);
+
+	comment("A deleted subscriber stays in the filter; after one lookup, the cache rejects it");
+
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id1), 0);
+	ASSERT_SEL(imsi, imsi1, -ENOENT);
+	ASSERT_SEL(imsi, imsi1, -ENOENT);
+	ASSERT_SEL_AUD(imsi1, -ENOENT, 0);
+	ASSERT_FILTER_STATS(7, 2, 2, 1);
+
+	comment("The cache forgets the IMSI after unknown_ttl");
+
+	now->tv_sec += 29;
+	ASSERT_SEL(imsi, imsi1, -ENOENT);
+	now->tv_sec += 1;
+	ASSERT_SEL(imsi, imsi1, -ENOENT);
+	ASSERT_FILTER_STATS(9, 2, 3, 2);
+
+	comment("Creating the IMSI again removes it from the cache");
+
+	ASSERT_RC(db_subscr_create(dbc, imsi1), 0);
+	ASSERT_SEL(imsi, imsi1, 0);
+	id1 = g_subscr.id;
+	ASSERT_FILTER_STATS(10, 2, 3, 2);
+
+	comment("A filter sized for N IMSIs gets twice the bits for one more");
+
+	f = imsi_filter_alloc(ctx, IMSI_FILTER_MIN_BITS / IMSI_FILTER_BITS_PER_IMSI, 0);
+	fprintf(stderr, "capacity %u: %u bits\n", f->capacity, f->layers[0].num_bits);
+	OSMO_ASSERT(f->layers[0].num_bits == IMSI_FILTER_MIN_BITS);
+	talloc_free(f);
+	f = imsi_filter_alloc(ctx, IMSI_FILTER_MIN_BITS / IMSI_FILTER_BITS_PER_IMSI + 1, 0);
+	fprintf(stderr, "capacity %u: %u bits\n", f->capacity, f->layers[0].num_bits);
+	OSMO_ASSERT(f->layers[0].num_bits == 2 * IMSI_FILTER_MIN_BITS);
+	talloc_free(f);
+
+	comment("A full filter gets another layer with twice the bits, without reading the database");
+
+	f = dbc->imsi_filter;
+	f->layers[0].capacity = f->layers[0].num_imsis;
+	ASSERT_RC(db_subscr_create(dbc, imsi2), 0);
+	fprintf(stderr, "%u layers: %u + %u bits, %u + %u IMSIs\n", f->num_layers,
+		f->layers[0].num_bits, f->layers[1].num_bits, f->layers[0].num_imsis, f->layers[1].num_imsis);
+	OSMO_ASSERT(dbc->imsi_filter == f);
+	OSMO_ASSERT(f->num_layers == 2);
+	OSMO_ASSERT(f->layers[1].num_bits == 2 * f->layers[0].num_bits);
+	OSMO_ASSERT(f->num_imsis == 4);
+	ASSERT_SEL(imsi, imsi0, 0);
+	ASSERT_SEL(imsi, imsi1, 0);
+	ASSERT_SEL(imsi, imsi2, 0);
+	id2 = g_subscr.id;
+	ASSERT_SEL(imsi, unknown_imsi, -ENOENT);
+	ASSERT_FILTER_STATS(14, 3, 3, 2);
+
+	comment("Delete subscribers");
+
+	db_imsi_filter_disable(dbc);
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id0), 0);
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id1), 0);
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id2), 0);
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, false);
+
+	comment_end();
+}
+
+static int64_t g_notified_seq;
+static void change_log_notify(struct db_context *dbc, int64_t last_seq, void *data)
+{
+	fprintf(stderr, "change_log_notify(%" PRId64 ")\n", last_seq);
+	g_notified_seq = last_seq;
+}
+
+/* Fire the change log timer, like the main loop does after each iteration */
+static void change_log_flush()
+{
+	fprintf(stderr, "osmo_timers_update()\n");
+	osmo_timers_prepare();
+	osmo_timers_update();
+	fprintf(stderr, "\n");
+}
+
+static void test_change_log()
+{
+	const char *imsi = "123456789000041";
+	struct timespec *now;
+	int64_t id, seq0, seq;
+
+	comment_start();
+
+	change_log_flush();
+	dbc->change_log.notify_cb = change_log_notify;
+	ASSERT_RC(db_change_last_seq(dbc, &seq0), 0);
+
+	comment("Each change of a subscriber adds an entry, unchanged values and SQN updates do not");
+
+	ASSERT_RC(db_subscr_create(dbc, imsi), 0);
+	ASSERT_SEL(imsi, imsi, 0);
+	id = g_subscr.id;
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, imsi, "5432"), 0);
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, imsi, "5432"), 0);
+	ASSERT_RC(db_subscr_nam(dbc, imsi, false, true), 0);
+	ASSERT_RC(db_subscr_lu(dbc, id, "5952", false), 0);
+	ASSERT_RC(db_subscr_lu(dbc, id, "5952", false), 0);
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id,
+		mk_aud_2g(OSMO_AUTH_ALG_COMP128v1, "BeadedBeeAced1EbbedDefacedFacade")), 0);
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id,
+		mk_aud_3g(OSMO_AUTH_ALG_MILENAGE, "BeadedBeeAced1EbbedDefacedFacade", false,
+			  "DeafBeddedBabeAcceededFadedDecaf", 5)), 0);
+	ASSERT_RC(db_update_sqn(dbc, id, 42), 0);
+	ASSERT_DB_GET_AUC(imsi, N_VECTORS);
+	dbc->ind_part.node_id = 1;
+	dbc->ind_part.num_nodes = 2;
+	ASSERT_DB_GET_AUC(imsi, N_VECTORS);
+	ASSERT_DB_GET_AUC(imsi, N_VECTORS);
+	dbc->ind_part.node_id = 0;
+	dbc->ind_part.num_nodes = 0;
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id), 0);
+	dump_changes_since(seq0);
+
+	comment("The notify_cb gets the newest seq once, after the changes were committed");
+
+	OSMO_ASSERT(g_notified_seq < seq0 + 7);
+	change_log_flush();
+	OSMO_ASSERT(g_notified_seq == seq0 + 7);
+	change_log_flush();
+
+	comment("A rolled back change does not notify");
+
+	ASSERT_RC(sqlite3_exec(dbc->db, "BEGIN TRANSACTION;"
+			       " INSERT INTO subscriber (imsi) VALUES ('123456789000042');"
+			       " ROLLBACK", NULL, NULL, NULL), SQLITE_OK);
+	OSMO_ASSERT(osmo_timer_pending(&dbc->change_log.timer));
+	change_log_flush();
+	ASSERT_RC(db_change_last_seq(dbc, &seq), 0);
+	OSMO_ASSERT(seq == seq0 + 7);
+
+	comment("The log is trimmed to the newest 'keep' entries at most once per DB_CHANGE_LOG_TRIM_INTERVAL");
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+	now = osmo_clock_override_gettimespec(CLOCK_MONOTONIC);
+	now->tv_sec = 1000;
+	dbc->change_log.trim_time = now->tv_sec - DB_CHANGE_LOG_TRIM_INTERVAL;
+	dbc->change_log.keep = 2;
+
+	ASSERT_RC(db_subscr_create(dbc, imsi), 0);
+	change_log_flush();
+	dump_changes_since(0);
+
+	now->tv_sec += DB_CHANGE_LOG_TRIM_INTERVAL - 1;
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, imsi, "5432"), 0);
+	change_log_flush();
+	dump_changes_since(0);
+
+	now->tv_sec += 1;
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, imsi, "5433"), 0);
+	change_log_flush();
+	dump_changes_since(0);
+
+	ASSERT_SEL(imsi, imsi, 0);
+	ASSERT_RC(db_subscr_delete_by_id(dbc, g_subscr.id), 0);
+	change_log_flush();
+
+	dbc->change_log.keep = DB_CHANGE_LOG_KEEP_DEFAULT;
+	dbc->change_log.notify_cb = NULL;
+	osmo_clock_override_enable(CLOCK_MONOTONIC, false);
+
+	comment_end();
+}
+
+static unsigned int g_auc_async_pending;
+static void auc_async_cb(struct db_context *dbc, const char *imsi, int rc, const struct osmo_auth_vector *vec,
+			 void *data)
+{
+	const char *label = data;
+
+	if (rc > 0)
+		fprintf(stderr, "auc_async_cb(%s, %s) --> %d, vectors %u..%u\n", label, imsi, rc, vec[0].rand[0],
+			vec[rc - 1].rand[0]);
+	else
+		fprintf(stderr, "auc_async_cb(%s, %s) --> %s\n", label, imsi,
+			rc == -ENOENT ? "-ENOENT" : rc == -ECANCELED ? "-ECANCELED" : "unexpected error");
+	OSMO_ASSERT(g_auc_async_pending);
+	g_auc_async_pending--;
+}
+
+#define ASSERT_AUC_ASYNC(imsi, label) \
+	do { \
+		g_auc_async_pending++; \
+		ASSERT_RC(db_get_auc_async(dbc, imsi, 0, N_VECTORS, NULL, NULL, auc_async_cb, label), 0); \
+	} while (0)
+
+static void dump_auc_async_lists()
+{
+	fprintf(stderr, "busy: %u, waiting: %u\n\n", llist_count(&dbc->auc_async.busy),
+		llist_count(&dbc->auc_async.waiting));
+}
+
+static void test_auc_async()
+{
+	const char *imsi_a = "123456789000051";
+	const char *imsi_b = "123456789000052";
+	int64_t id_a, id_b;
+
+	comment_start();
+
+	ASSERT_RC(db_subscr_create(dbc, imsi_a), 0);
+	ASSERT_SEL(imsi, imsi_a, 0);
+	id_a = g_subscr.id;
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id_a,
+		mk_aud_3g(OSMO_AUTH_ALG_MILENAGE, "BeadedBeeAced1EbbedDefacedFacade", false,
+			  "DeafBeddedBabeAcceededFadedDecaf", 5)), 0);
+	ASSERT_RC(db_subscr_create(dbc, imsi_b), 0);
+	ASSERT_SEL(imsi, imsi_b, 0);
+	id_b = g_subscr.id;
+	ASSERT_RC(db_subscr_update_aud_by_id(dbc, id_b,
+		mk_aud_3g(OSMO_AUTH_ALG_MILENAGE, "BeadedBeeAced1EbbedDefacedFacade", false,
+			  "DeafBeddedBabeAcceededFadedDecaf", 5)), 0);
+
+	ASSERT_RC(db_get_auc_async(dbc, imsi_a, 0, N_VECTORS, NULL, NULL, auc_async_cb, NULL), -ENOTSUP);
+	ASSERT_RC(db_auc_workers_start(dbc, 1), 0);
+	ASSERT_RC(db_auc_workers_start(dbc, 1), -EBUSY);
+	g_vec_nr = 0;
+
+	comment("Requests for the same IMSI wait for the previous one, other IMSIs go ahead");
+
+	ASSERT_AUC_ASYNC(imsi_a, "a1");
+	ASSERT_AUC_ASYNC(imsi_a, "a2");
+	ASSERT_AUC_ASYNC(imsi_b, "b1");
+	ASSERT_AUC_ASYNC(imsi_a, "a3");
+	dump_auc_async_lists();
+
+	comment("An unknown IMSI is answered right away");
+
+	ASSERT_AUC_ASYNC(unknown_imsi, "u1");
+	dump_auc_async_lists();
+
+	comment("Each request for the IMSI continues from the SQN the previous one stored");
+
+	while (g_auc_async_pending)
+		osmo_select_main(0);
+	dump_auc_async_lists();
+
+	ASSERT_SEL_AUD(imsi_a, 0, id_a);
+	OSMO_ASSERT(g_aud3g.u.umts.sqn == 3 * N_VECTORS);
+	ASSERT_SEL_AUD(imsi_b, 0, id_b);
+	OSMO_ASSERT(g_aud3g.u.umts.sqn == N_VECTORS);
+
+	comment("Stopping the workers cancels the pending requests");
+
+	ASSERT_AUC_ASYNC(imsi_a, "a4");
+	ASSERT_AUC_ASYNC(imsi_a, "a5");
+	dump_auc_async_lists();
+	db_auc_workers_stop(dbc);
+	OSMO_ASSERT(!g_auc_async_pending);
+	dump_auc_async_lists();
+	ASSERT_RC(db_get_auc_async(dbc, imsi_a, 0, N_VECTORS, NULL, NULL, auc_async_cb, NULL), -ENOTSUP);
+
+	comment("Delete subscribers");
+
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id_a), 0);
+	ASSERT_RC(db_subscr_delete_by_id(dbc, id_b), 0);
+
+	comment_end();
+}
+
 static struct {
 	bool verbose;
+	const char *db_file;
 } cmdline_opts = {
 	.verbose = false,
+	.db_file = "db_test.db",
 };
 
 static void print_help(const char *program)
 {
 	printf("Usage:\n"
-	       "  %s [-v] [N [N...]]\n"
+	       "  %s [-v] [-d PATH] [N [N...]]\n"
 	       "Options:\n"
 	       "  -h --help      show this text.\n"
-	       "  -v --verbose   print source file and line numbers\n",
+	       "  -v --verbose   print source file and line numbers\n"
+	       "  -d --database PATH  database to test, e.g. 'lmdb:db_test.mdb' (default: db_test.db)\n",
 	       program
 	       );
 }
@@ -820,10 +1854,11 @@ static void handle_options(int argc, char **argv)
 		static struct option long_options[] = {
 			{"help", 0, 0, 'h'},
 			{"verbose", 1, 0, 'v'},
+			{"database", 1, 0, 'd'},
 			{0, 0, 0, 0}
 		};
 
-		c = getopt_long(argc, argv, "hv",
+		c = getopt_long(argc, argv, "hvd:",
 				long_options, &option_index);
 		if (c == -1)
 			break;
@@ -835,6 +1870,9 @@ static void handle_options(int argc, char **argv)
 		case 'v':
 			cmdline_opts.verbose = true;
 			break;
+		case 'd':
+			cmdline_opts.db_file = optarg;
+			break;
 		default:
 			/* catch unknown options *as well as* missing arguments. */
 			fprintf(stderr, "Error in command line options. Exiting.\n");
@@ -849,6 +1887,59 @@ static void handle_options(int argc, char **argv)
 	}
 }
 
+#define ASSERT_STMT_STATS(idx, expect_count, expect_changes) \
+	do { \
+		const struct db_stmt_stats *st = &dbc->stmt_stats.s[idx]; \
+		fprintf(stderr, "%s: %lu executions, %" PRIu64 " changes\n\n", db_stmt_name(idx), st->count, \
+			st->changes); \
+		OSMO_ASSERT(st->count == (expect_count)); \
+		OSMO_ASSERT(st->changes == (expect_changes)); \
+	} while (0)
+
+static void test_stmt_stats()
+{
+	const char *imsi = "123456789000061";
+
+	comment_start();
+
+	if (!dbc->db) {
+		ASSERT_RC(db_stmt_stats_enable(dbc, true), -ENOTSUP);
+		comment("The backend keeps no statement stats");
+		comment_end();
+		return;
+	}
+
+	comment("Off by default, no statement is accounted");
+
+	OSMO_ASSERT(!dbc->stmt_stats.enabled);
+	ASSERT_RC(db_subscr_create(dbc, imsi), 0);
+	ASSERT_SEL(imsi, imsi, 0);
+	ASSERT_STMT_STATS(DB_STMT_SUBSCR_CREATE, 0, 0);
+	ASSERT_STMT_STATS(DB_STMT_SEL_BY_IMSI, 0, 0);
+
+	comment("Enabled, each execution is found by its statement and accounted");
+
+	ASSERT_RC(db_stmt_stats_enable(dbc, true), 0);
+	ASSERT_RC(db_stmt_stats_enable(dbc, true), 0);
+	ASSERT_SEL(imsi, imsi, 0);
+	ASSERT_SEL(imsi, imsi, 0);
+	ASSERT_RC(db_subscr_update_msisdn_by_imsi(dbc, imsi, "5433"), 0);
+	ASSERT_RC(db_subscr_delete_by_id(dbc, g_subscr.id), 0);
+	ASSERT_STMT_STATS(DB_STMT_SEL_BY_IMSI, 2, 0);
+	ASSERT_STMT_STATS(DB_STMT_SET_MSISDN_BY_IMSI, 1, 1);
+	ASSERT_STMT_STATS(DB_STMT_DEL_BY_ID, 1, 1);
+
+	comment("Disabled again, the counters are kept but do not change");
+
+	ASSERT_RC(db_stmt_stats_enable(dbc, false), 0);
+	ASSERT_SEL(imsi, imsi, -ENOENT);
+	ASSERT_STMT_STATS(DB_STMT_SEL_BY_IMSI, 2, 0);
+	db_stmt_stats_reset(dbc);
+	ASSERT_STMT_STATS(DB_STMT_SEL_BY_IMSI, 0, 0);
+
+	comment_end();
+}
+
 int main(int argc, char **argv)
 {
 	printf("db_test.c\n");
@@ -868,13 +1959,26 @@ int main(int argc, char **argv)
 	log_set_log_level(osmo_stderr_target, LOGL_ERROR);
 	/* Disable SQLite logging so that we're not vulnerable on SQLite error messages changing across
 	 * library versions. */
-	dbc = db_open(ctx, "db_test.db", false, false);
+	dbc = db_open(ctx, cmdline_opts.db_file, false, false);
 	log_set_log_level(osmo_stderr_target, 0);
 	OSMO_ASSERT(dbc);
 
 	test_subscr_create_update_sel_delete();
 	test_subscr_aud();
 	test_subscr_sqn();
+	test_auc_image();
+	test_digits_int();
+	test_db_upgrade();
+	test_subscr_write_suppressed();
+	test_auc_readonly();
+	test_sai_coalesce();
+	test_ind_partition();
+	test_stmt_stats();
+	test_imsi_filter();
+	/* the LMDB backend keeps no change log */
+	if (dbc->ops->change_since)
+		test_change_log();
+	test_auc_async();
 
 	printf("Done\n");
 	return 0;
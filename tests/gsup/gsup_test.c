@@ -26,6 +26,7 @@
 
 #include "logging.h"
 #include "luop.h"
+#include "gsup_scan.h"
 
 struct osmo_gsup_server;
 
@@ -62,6 +63,54 @@ void test_gsup_tx_insert_subscr_data()
 	lu_op_tx_insert_subscr_data(&luop);
 }
 
+/* Verify that gsup_scan() finds the same routing IEs as osmo_gsup_decode() */
+void test_gsup_scan()
+{
+	static const uint8_t ss_info[] = { 0xa1, 0x03, 0x02, 0x01, 0x01 };
+	const struct osmo_gsup_message gsup_in = {
+		.message_type = OSMO_GSUP_MSGT_PROC_SS_REQUEST,
+		.imsi = "123456789012345",
+		.message_class = OSMO_GSUP_MESSAGE_CLASS_USSD,
+		.source_name = (const uint8_t *)"MSC-00-00-00-00-00-00",
+		.source_name_len = 22,
+		.destination_name = (const uint8_t *)"EUSE-foo",
+		.destination_name_len = 9,
+		.session_id = 0x12345678,
+		.session_state = OSMO_GSUP_SESSION_STATE_BEGIN,
+		.ss_info = ss_info,
+		.ss_info_len = sizeof(ss_info),
+	};
+	struct osmo_gsup_message scanned, decoded;
+	struct msgb *msg = msgb_alloc(1024, __func__);
+	int rc;
+
+	osmo_gsup_encode(msg, &gsup_in);
+	rc = gsup_scan(msgb_data(msg), msgb_length(msg), &scanned);
+	printf("gsup_scan() rc=%d\n", rc);
+	OSMO_ASSERT(osmo_gsup_decode(msgb_data(msg), msgb_length(msg), &decoded) == 0);
+
+	OSMO_ASSERT(scanned.message_type == decoded.message_type);
+	OSMO_ASSERT(!strcmp(scanned.imsi, decoded.imsi));
+	OSMO_ASSERT(scanned.message_class == decoded.message_class);
+	OSMO_ASSERT(scanned.source_name_len == decoded.source_name_len);
+	OSMO_ASSERT(!memcmp(scanned.source_name, decoded.source_name, decoded.source_name_len));
+	OSMO_ASSERT(scanned.destination_name_len == decoded.destination_name_len);
+	OSMO_ASSERT(!memcmp(scanned.destination_name, decoded.destination_name, decoded.destination_name_len));
+	OSMO_ASSERT(scanned.session_id == decoded.session_id);
+	OSMO_ASSERT(scanned.session_state == decoded.session_state);
+	printf("message_type=0x%02x IMSI=%s %s->%s session=0x%x\n", scanned.message_type, scanned.imsi,
+	       scanned.source_name, scanned.destination_name, scanned.session_id);
+	/* not decoded */
+	OSMO_ASSERT(!scanned.ss_info && !scanned.ss_info_len);
+
+	/* truncated message */
+	rc = gsup_scan(msgb_data(msg), msgb_length(msg) - 1, &scanned);
+	printf("gsup_scan() of truncated message rc=%d\n", rc);
+	OSMO_ASSERT(osmo_gsup_decode(msgb_data(msg), msgb_length(msg) - 1, &decoded) < 0);
+
+	msgb_free(msg);
+}
+
 const struct log_info_cat default_categories[] = {
 	[DMAIN] = {
 		.name = "DMAIN",
@@ -85,6 +134,7 @@ int main(int argc, char **argv)
 	log_set_print_category(osmo_stderr_target, 1);
 
 	test_gsup_tx_insert_subscr_data();
+	test_gsup_scan();
 
 	printf("Done.\n");
 	return EXIT_SUCCESS;
@@ -0,0 +1,726 @@
+/* Test the GSUP client library against a fake IPA link */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/gsup.h>
+#include <osmocom/gsm/ipa.h>
+#include <osmocom/gsm/protocol/ipaccess.h>
+#include <osmocom/abis/ipa.h>
+
+#include <osmocom/gsupclient/gsup_client.h>
+
+#define comment_start() printf("\n===== %s\n", __func__)
+#define comment_end() printf("===== %s: SUCCESS\n\n", __func__)
+#define btw(fmt, args...) printf("\n" fmt "\n", ## args)
+
+#define VERBOSE_ASSERT(val, expect_op, fmt) \
+	do { \
+		printf(#val " == " fmt "\n", (val)); \
+		OSMO_ASSERT((val) expect_op); \
+	} while (0)
+
+#define IMSI1 "901700000000001"
+#define IMSI2 "901700000000002"
+#define IMSI3 "901700000000003"
+
+static void *ctx = NULL;
+
+/* The auth vectors of the fake server are numbered in rand[0]; each one is to reach the application once */
+static bool vec_seen[256];
+
+static void print_gsup(const struct osmo_gsup_message *gsup)
+{
+	unsigned int i;
+
+	printf("%s IMSI=%s session_id=%u", osmo_gsup_message_type_name(gsup->message_type), gsup->imsi,
+	       gsup->session_id);
+	if (gsup->auts)
+		printf(" with AUTS");
+	if (gsup->num_auth_vectors)
+		printf(" vectors:");
+	for (i = 0; i < gsup->num_auth_vectors; i++)
+		printf(" %u", gsup->auth_vectors[i].rand[0]);
+	printf("\n");
+}
+
+/* Instead of libosmoabis, a fake IPA client link: what the client sends is printed, and the test brings the link
+ * up and down and passes the messages of the server to the client. */
+
+struct ipa_client_conn *ipa_client_conn_create(void *ctx, struct e1inp_ts *ts, int priv_nr,
+					       const char *addr, uint16_t port,
+					       void (*updown)(struct ipa_client_conn *link, int),
+					       int (*read_cb)(struct ipa_client_conn *link, struct msgb *msgb),
+					       int (*write_cb)(struct ipa_client_conn *link),
+					       void *data)
+{
+	struct ipa_client_conn *link = talloc_zero(ctx, struct ipa_client_conn);
+	OSMO_ASSERT(link);
+	link->addr = talloc_strdup(link, addr);
+	link->port = port;
+	link->updown_cb = updown;
+	link->read_cb = read_cb;
+	link->data = data;
+	return link;
+}
+
+void ipa_client_conn_destroy(struct ipa_client_conn *link)
+{
+	talloc_free(link);
+}
+
+int ipa_client_conn_open(struct ipa_client_conn *link)
+{
+	return 0;
+}
+
+void ipa_client_conn_close(struct ipa_client_conn *link)
+{
+}
+
+size_t ipa_client_conn_clear_queue(struct ipa_client_conn *link)
+{
+	return 0;
+}
+
+/* The fake server sends no IPA CCM messages */
+int ipaccess_bts_handle_ccm(struct ipa_client_conn *link, struct ipaccess_unit *dev, struct msgb *msg)
+{
+	return 0;
+}
+
+void ipa_client_conn_send(struct ipa_client_conn *link, struct msgb *msg)
+{
+	struct ipaccess_head *hh = (struct ipaccess_head *)msgb_data(msg);
+	struct osmo_gsup_message gsup;
+
+	/* IPA pings are not of interest here */
+	if (hh->proto == IPAC_PROTO_OSMO && hh->data[0] == IPAC_PROTO_EXT_GSUP) {
+		OSMO_ASSERT(osmo_gsup_decode(&hh->data[1], msgb_length(msg) - sizeof(*hh) - 1, &gsup) == 0);
+		printf("%s: tx ", link->addr);
+		print_gsup(&gsup);
+	}
+	msgb_free(msg);
+}
+
+static int read_cb(struct osmo_gsup_client *gsupc, struct msgb *msg)
+{
+	struct osmo_gsup_message gsup;
+	unsigned int i;
+
+	OSMO_ASSERT(osmo_gsup_decode(msgb_l2(msg), msgb_l2len(msg), &gsup) == 0);
+	printf("%s: read_cb() ", gsupc->link->addr);
+	print_gsup(&gsup);
+	for (i = 0; i < gsup.num_auth_vectors; i++) {
+		OSMO_ASSERT(!vec_seen[gsup.auth_vectors[i].rand[0]]);
+		vec_seen[gsup.auth_vectors[i].rand[0]] = true;
+	}
+	msgb_free(msg);
+	return 0;
+}
+
+static void resp_cb(struct osmo_gsup_client *gsupc, int rc, const struct osmo_gsup_message *resp, void *data)
+{
+	printf("%s: resp_cb(%s) rc=%d", gsupc->link->addr, (const char *)data, rc);
+	if (resp) {
+		printf(" ");
+		print_gsup(resp);
+	} else
+		printf("\n");
+}
+
+static void link_updown(struct osmo_gsup_client *gsupc, int up)
+{
+	printf("%s: link %s\n", gsupc->link->addr, up ? "up" : "down");
+	gsupc->link->updown_cb(gsupc->link, up);
+}
+
+static struct ipaccess_unit *ipa_dev_alloc(void)
+{
+	struct ipaccess_unit *ipa_dev = talloc_zero(ctx, struct ipaccess_unit);
+
+	ipa_dev->unit_name = talloc_strdup(ipa_dev, "gsup_client_test");
+	return ipa_dev;
+}
+
+static struct osmo_gsup_client *client_up(const char *addr)
+{
+	struct osmo_gsup_client *gsupc;
+
+	gsupc = osmo_gsup_client_create2(ctx, ipa_dev_alloc(), addr, OSMO_GSUP_PORT, read_cb, NULL);
+	OSMO_ASSERT(gsupc);
+	link_updown(gsupc, 1);
+	return gsupc;
+}
+
+/* Pass a GSUP message from the server to the client, with the IPA headers like libosmoabis */
+static void rx_gsup(struct osmo_gsup_client *gsupc, const struct osmo_gsup_message *gsup)
+{
+	struct msgb *msg = osmo_gsup_client_msgb_alloc();
+
+	OSMO_ASSERT(osmo_gsup_encode(msg, gsup) == 0);
+	ipa_prepend_header_ext(msg, IPAC_PROTO_EXT_GSUP);
+	ipa_msg_push_header(msg, IPAC_PROTO_OSMO);
+	msg->l2h = msgb_data(msg) + sizeof(struct ipaccess_head);
+
+	printf("%s: rx ", gsupc->link->addr);
+	print_gsup(gsup);
+	gsupc->link->read_cb(gsupc->link, msg);
+}
+
+static void rx(struct osmo_gsup_client *gsupc, enum osmo_gsup_message_type message_type, const char *imsi,
+	       uint32_t session_id)
+{
+	struct osmo_gsup_message gsup = {
+		.message_type = message_type,
+		.session_id = session_id,
+		.session_state = session_id ? OSMO_GSUP_SESSION_STATE_END : OSMO_GSUP_SESSION_STATE_NONE,
+	};
+
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	if (OSMO_GSUP_IS_MSGT_ERROR(message_type))
+		gsup.cause = GMM_CAUSE_NET_FAIL;
+	rx_gsup(gsupc, &gsup);
+}
+
+/* A Send Auth Info result with num vectors, numbered from first on */
+static void rx_vectors(struct osmo_gsup_client *gsupc, const char *imsi, unsigned int first, unsigned int num)
+{
+	struct osmo_gsup_message gsup = {
+		.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT,
+		.num_auth_vectors = num,
+	};
+	unsigned int i;
+
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	for (i = 0; i < num; i++) {
+		gsup.auth_vectors[i].auth_types = OSMO_AUTH_TYPE_GSM;
+		gsup.auth_vectors[i].rand[0] = first + i;
+	}
+	rx_gsup(gsupc, &gsup);
+}
+
+/* A Send Auth Info request of the application, re-synchronising if auts is given */
+static void send_sai(struct osmo_gsup_client *gsupc, const char *imsi, const uint8_t *auts)
+{
+	static const uint8_t rand[16] = { 0x42 };
+	struct osmo_gsup_message gsup = {
+		.message_type = OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST,
+		.auts = auts,
+		.rand = auts ? rand : NULL,
+	};
+
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	printf("send_sai(%s%s)\n", imsi, auts ? ", AUTS" : "");
+	OSMO_ASSERT(osmo_gsup_client_enc_send(gsupc, &gsup) == 0);
+}
+
+static struct osmo_gsup_client_trans *request(struct osmo_gsup_client *gsupc,
+					      enum osmo_gsup_message_type message_type, const char *imsi,
+					      uint32_t session_id, unsigned int timeout_ms, const char *name)
+{
+	struct osmo_gsup_message gsup = {
+		.message_type = message_type,
+		.session_id = session_id,
+		.session_state = session_id ? OSMO_GSUP_SESSION_STATE_BEGIN : OSMO_GSUP_SESSION_STATE_NONE,
+	};
+	struct osmo_gsup_client_trans *trans;
+
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	printf("request(%s), timeout %u ms\n", name, timeout_ms);
+	trans = osmo_gsup_client_request(gsupc, &gsup, timeout_ms, resp_cb, (void *)name);
+	OSMO_ASSERT(trans);
+	return trans;
+}
+
+static struct osmo_gsup_client_pool_trans *pool_request(struct osmo_gsup_client_pool *pool,
+							enum osmo_gsup_message_type message_type, const char *imsi,
+							unsigned int timeout_ms, const char *name)
+{
+	struct osmo_gsup_message gsup = {
+		.message_type = message_type,
+	};
+	struct osmo_gsup_client_pool_trans *ptrans;
+
+	OSMO_STRLCPY_ARRAY(gsup.imsi, imsi);
+	printf("pool_request(%s), timeout %u ms\n", name, timeout_ms);
+	ptrans = osmo_gsup_client_pool_request(pool, &gsup, timeout_ms, resp_cb, (void *)name);
+	printf("pool_request(%s) %s\n", name, ptrans ? "sent" : "failed");
+	return ptrans;
+}
+
+static void pool_pick(struct osmo_gsup_client_pool *pool, const char *imsi, const char *expect_addr)
+{
+	struct osmo_gsup_client *gsupc = osmo_gsup_client_pool_pick(pool, imsi);
+	const char *addr = gsupc ? gsupc->link->addr : "NULL";
+
+	printf("pick(%s) = %s\n", imsi ? imsi : "NULL", addr);
+	OSMO_ASSERT(!strcmp(addr, expect_addr));
+}
+
+static void time_passes(unsigned int ms)
+{
+	printf("(%u ms pass)\n", ms);
+	osmo_clock_override_add(CLOCK_MONOTONIC, ms / 1000, (ms % 1000) * 1000000);
+	osmo_timers_prepare();
+	osmo_timers_update();
+}
+
+static void test_request_match(void)
+{
+	struct osmo_gsup_client *gsupc;
+	struct osmo_gsup_client_trans *trans;
+
+	comment_start();
+
+	gsupc = client_up("10.0.0.1");
+
+	btw("Requests of different type, IMSI and session id, and two of the same");
+	request(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, 0, "SAI IMSI1");
+	request(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI2, 0, 0, "SAI IMSI2");
+	request(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, 0, 0, "UL IMSI1");
+	request(gsupc, OSMO_GSUP_MSGT_PROC_SS_REQUEST, IMSI1, 1, 0, "SS IMSI1 session 1");
+	request(gsupc, OSMO_GSUP_MSGT_PROC_SS_REQUEST, IMSI1, 2, 0, "SS IMSI1 session 2");
+	request(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, 0, "SAI IMSI1 again");
+	VERBOSE_ASSERT(gsupc->num_trans, == 6, "%u");
+
+	btw("Requests from the server match no request of the client");
+	rx(gsupc, OSMO_GSUP_MSGT_INSERT_DATA_REQUEST, IMSI1, 0);
+
+	btw("Responses go to the request they answer, in any order; those of the same request in the order sent");
+	rx(gsupc, OSMO_GSUP_MSGT_PROC_SS_RESULT, IMSI1, 2);
+	rx(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT, IMSI1, 0);
+	rx(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR, IMSI2, 0);
+	rx(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, 0);
+	rx(gsupc, OSMO_GSUP_MSGT_PROC_SS_ERROR, IMSI1, 1);
+	rx(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, 0);
+	VERBOSE_ASSERT(gsupc->num_trans, == 0, "%u");
+
+	btw("Responses matching no request go to read_cb");
+	rx(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, 0);
+	request(gsupc, OSMO_GSUP_MSGT_PROC_SS_REQUEST, IMSI2, 3, 0, "SS IMSI2 session 3");
+	rx(gsupc, OSMO_GSUP_MSGT_PROC_SS_RESULT, IMSI2, 4);
+	rx(gsupc, OSMO_GSUP_MSGT_PROC_SS_RESULT, IMSI1, 3);
+	rx(gsupc, OSMO_GSUP_MSGT_PROC_SS_RESULT, IMSI2, 3);
+
+	btw("A cancelled request is not called back, its response goes to read_cb");
+	trans = request(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI2, 0, 0, "UL IMSI2");
+	osmo_gsup_client_trans_cancel(trans);
+	VERBOSE_ASSERT(gsupc->num_trans, == 0, "%u");
+	rx(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT, IMSI2, 0);
+
+	osmo_gsup_client_destroy(gsupc);
+
+	comment_end();
+}
+
+static void test_request_timeout(void)
+{
+	struct osmo_gsup_client *gsupc;
+
+	comment_start();
+
+	gsupc = client_up("10.0.0.2");
+
+	request(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, 1000, "SAI IMSI1");
+	request(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI2, 0, 1000, "UL IMSI2");
+	request(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI2, 0, 3000, "SAI IMSI2");
+	request(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, 0, 0, "UL IMSI1");
+
+	btw("A response in time stops the timer");
+	time_passes(500);
+	rx(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT, IMSI2, 0);
+
+	btw("Without a response, the callback gets -ETIMEDOUT");
+	time_passes(499);
+	time_passes(1);
+	VERBOSE_ASSERT(gsupc->num_trans, == 2, "%u");
+
+	btw("A response after the timeout goes to read_cb");
+	rx(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, 0);
+
+	time_passes(2000);
+
+	btw("A request without timeout waits as long as the link is up");
+	time_passes(10000);
+	VERBOSE_ASSERT(gsupc->num_trans, == 1, "%u");
+	rx(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_RESULT, IMSI1, 0);
+	VERBOSE_ASSERT(gsupc->num_trans, == 0, "%u");
+
+	osmo_gsup_client_destroy(gsupc);
+
+	comment_end();
+}
+
+static void test_request_link_lost(void)
+{
+	struct osmo_gsup_client *gsupc;
+
+	comment_start();
+
+	gsupc = client_up("10.0.0.3");
+
+	request(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, 1000, "SAI IMSI1");
+	request(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, 0, 0, "UL IMSI1");
+	request(gsupc, OSMO_GSUP_MSGT_PROC_SS_REQUEST, IMSI2, 7, 0, "SS IMSI2 session 7");
+
+	btw("All pending requests get -ENOTCONN when the link goes down");
+	link_updown(gsupc, 0);
+	VERBOSE_ASSERT(gsupc->num_trans, == 0, "%u");
+
+	btw("Their timers are stopped");
+	time_passes(2000);
+
+	btw("After reconnecting, requests work as before");
+	link_updown(gsupc, 1);
+	request(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, 1000, "SAI IMSI1 again");
+	rx(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, 0);
+
+	btw("No IPA pong within the ping interval, the link is lost as well");
+	request(gsupc, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI2, 0, 0, "UL IMSI2");
+	time_passes(OSMO_GSUP_CLIENT_PING_INTERVAL * 1000);
+	VERBOSE_ASSERT(gsupc->num_trans, == 0, "%u");
+
+	osmo_gsup_client_destroy(gsupc);
+
+	comment_end();
+}
+
+static const struct osmo_gsup_client_pool_server pool_servers[] = {
+	{ "10.0.1.1", OSMO_GSUP_PORT },
+	{ "10.0.1.2", OSMO_GSUP_PORT },
+	{ "10.0.1.3", OSMO_GSUP_PORT },
+};
+
+static void test_pool_pick(void)
+{
+	struct osmo_gsup_client_pool *pool;
+	unsigned int i;
+
+	comment_start();
+
+	pool = osmo_gsup_client_pool_create(ctx, ipa_dev_alloc(), pool_servers, ARRAY_SIZE(pool_servers),
+					    OSMO_GSUP_CLIENT_POOL_ACTIVE_STANDBY, read_cb);
+	OSMO_ASSERT(pool);
+
+	btw("No server connected");
+	pool_pick(pool, IMSI1, "NULL");
+	for (i = 0; i < pool->num_clients; i++)
+		link_updown(pool->clients[i], 1);
+
+	btw("active-standby: always the first connected server");
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	pool_pick(pool, IMSI2, "10.0.1.1");
+	pool_pick(pool, NULL, "10.0.1.1");
+	link_updown(pool->clients[0], 0);
+	pool_pick(pool, IMSI1, "10.0.1.2");
+	link_updown(pool->clients[1], 0);
+	pool_pick(pool, IMSI1, "10.0.1.3");
+	link_updown(pool->clients[0], 1);
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	link_updown(pool->clients[1], 1);
+
+	btw("round-robin: each connected server in turn");
+	pool->policy = OSMO_GSUP_CLIENT_POOL_ROUND_ROBIN;
+	pool->next = 0;
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	pool_pick(pool, IMSI1, "10.0.1.2");
+	pool_pick(pool, IMSI1, "10.0.1.3");
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	link_updown(pool->clients[1], 0);
+	pool_pick(pool, IMSI1, "10.0.1.3");
+	pool_pick(pool, IMSI1, "10.0.1.3");
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	link_updown(pool->clients[1], 1);
+
+	btw("imsi-hash: the same server for the same IMSI");
+	pool->policy = OSMO_GSUP_CLIENT_POOL_IMSI_HASH;
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	pool_pick(pool, IMSI2, "10.0.1.3");
+	pool_pick(pool, IMSI3, "10.0.1.2");
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	pool_pick(pool, IMSI2, "10.0.1.3");
+	pool_pick(pool, IMSI3, "10.0.1.2");
+
+	btw("imsi-hash: when the server of the IMSI is down, the next one takes over");
+	link_updown(pool->clients[0], 0);
+	pool_pick(pool, IMSI1, "10.0.1.2");
+	pool_pick(pool, IMSI2, "10.0.1.3");
+	pool_pick(pool, IMSI3, "10.0.1.2");
+	link_updown(pool->clients[1], 0);
+	pool_pick(pool, IMSI1, "10.0.1.3");
+	pool_pick(pool, IMSI2, "10.0.1.3");
+	pool_pick(pool, IMSI3, "10.0.1.3");
+	link_updown(pool->clients[0], 1);
+	link_updown(pool->clients[1], 1);
+	pool_pick(pool, IMSI1, "10.0.1.1");
+	pool_pick(pool, IMSI2, "10.0.1.3");
+	pool_pick(pool, IMSI3, "10.0.1.2");
+
+	btw("imsi-hash: without IMSI, round-robin");
+	pool->next = 0;
+	pool_pick(pool, NULL, "10.0.1.1");
+	pool_pick(pool, "", "10.0.1.2");
+	pool_pick(pool, NULL, "10.0.1.3");
+
+	btw("No server connected");
+	for (i = 0; i < pool->num_clients; i++)
+		link_updown(pool->clients[i], 0);
+	pool_pick(pool, IMSI1, "NULL");
+	pool_pick(pool, NULL, "NULL");
+
+	osmo_gsup_client_pool_destroy(pool);
+
+	comment_end();
+}
+
+static void test_pool_request(void)
+{
+	struct osmo_gsup_client_pool *pool;
+	struct osmo_gsup_client_pool_trans *ptrans;
+	unsigned int i;
+
+	comment_start();
+
+	pool = osmo_gsup_client_pool_create(ctx, ipa_dev_alloc(), pool_servers, ARRAY_SIZE(pool_servers),
+					    OSMO_GSUP_CLIENT_POOL_ACTIVE_STANDBY, read_cb);
+	OSMO_ASSERT(pool);
+	for (i = 0; i < pool->num_clients; i++)
+		link_updown(pool->clients[i], 1);
+
+	btw("A request in flight moves to the next server when the link is lost");
+	pool_request(pool, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, "SAI IMSI1");
+	link_updown(pool->clients[0], 0);
+	VERBOSE_ASSERT(pool->clients[1]->num_trans, == 1, "%u");
+	rx(pool->clients[1], OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, 0);
+
+	btw("It gets -ENOTCONN when no other server is connected");
+	pool_request(pool, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI1, 0, "UL IMSI1");
+	link_updown(pool->clients[1], 0);
+	link_updown(pool->clients[2], 0);
+
+	btw("It is sent to each server once at most");
+	link_updown(pool->clients[0], 1);
+	link_updown(pool->clients[1], 1);
+	link_updown(pool->clients[2], 1);
+	pool_request(pool, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, IMSI2, 0, "UL IMSI2");
+	link_updown(pool->clients[0], 0);
+	link_updown(pool->clients[0], 1);
+	link_updown(pool->clients[1], 0);
+	link_updown(pool->clients[0], 0);
+	VERBOSE_ASSERT(pool->clients[2]->num_trans, == 0, "%u");
+	link_updown(pool->clients[0], 1);
+	link_updown(pool->clients[1], 1);
+
+	btw("Each server gets the full timeout");
+	pool_request(pool, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI2, 2000, "SAI IMSI2");
+	time_passes(500);
+	link_updown(pool->clients[0], 0);
+	time_passes(1999);
+	time_passes(1);
+	link_updown(pool->clients[0], 1);
+
+	btw("A cancelled request is not called back, also not when the link is lost");
+	ptrans = pool_request(pool, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, "SAI IMSI1 again");
+	osmo_gsup_client_pool_trans_cancel(ptrans);
+	VERBOSE_ASSERT(pool->clients[0]->num_trans, == 0, "%u");
+	rx(pool->clients[0], OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, IMSI1, 0);
+	link_updown(pool->clients[0], 0);
+	VERBOSE_ASSERT(pool->clients[1]->num_trans, == 0, "%u");
+
+	btw("No server connected");
+	link_updown(pool->clients[1], 0);
+	link_updown(pool->clients[2], 0);
+	OSMO_ASSERT(!pool_request(pool, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, IMSI1, 0, "SAI IMSI1 once more"));
+
+	osmo_gsup_client_pool_destroy(pool);
+
+	comment_end();
+}
+
+static void test_av_cache(void)
+{
+	struct osmo_gsup_client *gsupc;
+	struct osmo_gsup_client_av_cache *c;
+
+	comment_start();
+
+	gsupc = client_up("10.0.2.1");
+	c = osmo_gsup_client_av_cache_enable(gsupc, 16, 10, 1);
+
+	btw("Nothing cached yet: the request goes to the server, a second one waits for its result");
+	send_sai(gsupc, IMSI1, NULL);
+	send_sai(gsupc, IMSI1, NULL);
+	VERBOSE_ASSERT(c->stats.misses, == 2, "%lu");
+
+	btw("The result is cached, each waiting request gets one vector of it");
+	rx_vectors(gsupc, IMSI1, 1, 5);
+
+	btw("The next requests get the next vectors from the main loop, without asking the server");
+	send_sai(gsupc, IMSI1, NULL);
+	time_passes(0);
+	VERBOSE_ASSERT(c->stats.hits, == 1, "%lu");
+
+	btw("At low_water vectors left, the request also fetches the next ones from the server");
+	send_sai(gsupc, IMSI1, NULL);
+	time_passes(0);
+	VERBOSE_ASSERT(c->stats.prefetches, == 1, "%lu");
+	send_sai(gsupc, IMSI1, NULL);
+	time_passes(0);
+	VERBOSE_ASSERT(c->stats.prefetches, == 1, "%lu");
+
+	btw("All vectors used up: waiting for the result of the prefetch");
+	send_sai(gsupc, IMSI1, NULL);
+	time_passes(0);
+	rx_vectors(gsupc, IMSI1, 6, 5);
+	VERBOSE_ASSERT(c->stats.hits, == 3, "%lu");
+	VERBOSE_ASSERT(c->stats.misses, == 3, "%lu");
+
+	btw("Other IMSIs have their own vectors");
+	send_sai(gsupc, IMSI2, NULL);
+	rx_vectors(gsupc, IMSI2, 11, 5);
+	send_sai(gsupc, IMSI1, NULL);
+	send_sai(gsupc, IMSI2, NULL);
+	time_passes(0);
+
+	btw("A Send Auth Info error reaches each waiting request");
+	send_sai(gsupc, IMSI3, NULL);
+	send_sai(gsupc, IMSI3, NULL);
+	rx(gsupc, OSMO_GSUP_MSGT_SEND_AUTH_INFO_ERROR, IMSI3, 0);
+
+	osmo_gsup_client_destroy(gsupc);
+
+	comment_end();
+}
+
+static void test_av_cache_ttl(void)
+{
+	struct osmo_gsup_client *gsupc;
+	struct osmo_gsup_client_av_cache *c;
+
+	comment_start();
+
+	gsupc = client_up("10.0.2.2");
+	c = osmo_gsup_client_av_cache_enable(gsupc, 16, 10, 1);
+
+	send_sai(gsupc, IMSI1, NULL);
+	rx_vectors(gsupc, IMSI1, 21, 5);
+
+	btw("Vectors are handed out until the TTL is reached");
+	time_passes(9000);
+	send_sai(gsupc, IMSI1, NULL);
+	time_passes(0);
+	VERBOSE_ASSERT(c->stats.hits, == 1, "%lu");
+
+	btw("After the TTL, the unused vectors are discarded and the request goes to the server");
+	time_passes(1000);
+	send_sai(gsupc, IMSI1, NULL);
+	time_passes(0);
+	VERBOSE_ASSERT(c->stats.hits, == 1, "%lu");
+	VERBOSE_ASSERT(c->stats.misses, == 2, "%lu");
+	rx_vectors(gsupc, IMSI1, 26, 5);
+
+	osmo_gsup_client_destroy(gsupc);
+
+	comment_end();
+}
+
+static void test_av_cache_auts(void)
+{
+	static const uint8_t auts[14] = { 0x23 };
+	struct osmo_gsup_client *gsupc;
+	struct osmo_gsup_client_av_cache *c;
+
+	comment_start();
+
+	gsupc = client_up("10.0.2.3");
+	c = osmo_gsup_client_av_cache_enable(gsupc, 16, 10, 1);
+
+	send_sai(gsupc, IMSI1, NULL);
+	rx_vectors(gsupc, IMSI1, 31, 5);
+
+	btw("A request with AUTS goes to the server and discards the unused vectors, its result goes to the"
+	    " application");
+	send_sai(gsupc, IMSI1, auts);
+	time_passes(0);
+	rx_vectors(gsupc, IMSI1, 36, 5);
+	VERBOSE_ASSERT(c->stats.hits, == 0, "%lu");
+
+	btw("So the next request goes to the server as well");
+	send_sai(gsupc, IMSI1, NULL);
+	time_passes(0);
+	VERBOSE_ASSERT(c->stats.misses, == 2, "%lu");
+	rx_vectors(gsupc, IMSI1, 41, 5);
+
+	osmo_gsup_client_destroy(gsupc);
+
+	comment_end();
+}
+
+enum {
+	DMAIN,
+};
+
+static const struct log_info_cat default_categories[] = {
+	[DMAIN] = {
+		.name = "DMAIN",
+		.description = "Main Program",
+		.enabled = 1, .loglevel = LOGL_DEBUG,
+	},
+};
+
+static struct log_info info = {
+	.cat = default_categories,
+	.num_cat = ARRAY_SIZE(default_categories),
+};
+
+int main(int argc, char **argv)
+{
+	ctx = talloc_named_const(NULL, 0, "gsup_client_test");
+	osmo_init_logging2(ctx, &info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_print_timestamp(osmo_stderr_target, 0);
+	log_set_use_color(osmo_stderr_target, 0);
+	log_set_print_category(osmo_stderr_target, 1);
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+
+	test_request_match();
+	test_request_timeout();
+	test_request_link_lost();
+	test_pool_pick();
+	test_pool_request();
+	test_av_cache();
+	test_av_cache_ttl();
+	test_av_cache_auts();
+
+	printf("Done\n");
+	return 0;
+}
@@ -18,9 +18,25 @@
  *
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <osmocom/core/application.h>
+#include <osmocom/core/logging.h>
 #include <osmocom/core/utils.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/timer.h>
+#include <osmocom/core/bits.h>
+#include <osmocom/gsm/gsup.h>
+#include <osmocom/gsm/ipa.h>
 #include "gsup_server.h"
+#include "gsup_record.h"
+#include "isd_cache.h"
 
 #define comment_start() printf("\n===== %s\n", __func__)
 #define comment_end() printf("===== %s: SUCCESS\n\n", __func__)
@@ -34,6 +50,10 @@
 
 void osmo_gsup_server_add_conn(struct llist_head *clients,
 			       struct osmo_gsup_conn *conn);
+int osmo_gsup_conn_fd_cb(struct osmo_fd *ofd, unsigned int what);
+int osmo_gsup_server_read_cb(struct ipa_server_conn *conn, struct msgb *msg);
+
+static void *ctx = NULL;
 
 static void test_add_conn(void)
 {
@@ -134,11 +154,599 @@ static void test_add_conn(void)
 	comment_end();
 }
 
+/* Compare an ISD from the cache with a freshly encoded one */
+static bool isd_matches(struct isd_cache *c, const char *imsi, const char *msisdn,
+			enum osmo_gsup_cn_domain cn_domain)
+{
+	struct msgb *cached = isd_cache_msgb(c, imsi, msisdn, cn_domain);
+	struct msgb *fresh = isd_cache_msgb(NULL, imsi, msisdn, cn_domain);
+	bool match;
+
+	OSMO_ASSERT(cached && fresh);
+	match = msgb_length(cached) == msgb_length(fresh)
+		&& !memcmp(msgb_data(cached), msgb_data(fresh), msgb_length(fresh));
+	msgb_free(cached);
+	msgb_free(fresh);
+	return match;
+}
+
+static void test_isd_cache(void)
+{
+	struct isd_cache *c = isd_cache_alloc(NULL, 16);
+
+	comment_start();
+
+	btw("First ISD of a subscriber is encoded, the second one copied");
+	OSMO_ASSERT(isd_matches(c, "901700000000001", "42342", OSMO_GSUP_CN_DOMAIN_CS));
+	OSMO_ASSERT(isd_matches(c, "901700000000001", "42342", OSMO_GSUP_CN_DOMAIN_CS));
+	VERBOSE_ASSERT(c->stats.hits, == 1, "%lu");
+	VERBOSE_ASSERT(c->stats.misses, == 1, "%lu");
+
+	btw("PS has its own message, with the PDP info");
+	OSMO_ASSERT(isd_matches(c, "901700000000001", "42342", OSMO_GSUP_CN_DOMAIN_PS));
+	OSMO_ASSERT(isd_matches(c, "901700000000001", "42342", OSMO_GSUP_CN_DOMAIN_PS));
+	OSMO_ASSERT(isd_matches(c, "901700000000001", "42342", OSMO_GSUP_CN_DOMAIN_CS));
+	VERBOSE_ASSERT(c->stats.hits, == 3, "%lu");
+	VERBOSE_ASSERT(c->stats.misses, == 2, "%lu");
+
+	btw("A changed MSISDN misses, and drops both domains");
+	OSMO_ASSERT(isd_matches(c, "901700000000001", "23", OSMO_GSUP_CN_DOMAIN_CS));
+	OSMO_ASSERT(isd_matches(c, "901700000000001", "23", OSMO_GSUP_CN_DOMAIN_PS));
+	VERBOSE_ASSERT(c->stats.hits, == 3, "%lu");
+	VERBOSE_ASSERT(c->stats.misses, == 4, "%lu");
+
+	talloc_free(c);
+	comment_end();
+}
+
+/* The tx queue of a GSUP connection is written to one end of a socket pair, the test reads the other end */
+
+static struct osmo_gsup_server tx_gs;
+static int peer_fd = -1;
+/* Everything the client has received so far, as IPA messages */
+static uint8_t peer_buf[4 * 1024 * 1024];
+static size_t peer_len;
+/* Index of the next GSUP message the client should receive */
+static unsigned int next_idx;
+static unsigned int ipa_reads;
+
+/* Instead of libosmo-abis reading from the socket */
+static int fake_ipa_fd_cb(struct osmo_fd *ofd, unsigned int what)
+{
+	ipa_reads++;
+	return 0;
+}
+
+static struct osmo_gsup_conn *tx_conn_alloc(void)
+{
+	struct osmo_gsup_conn *conn;
+	int sv[2];
+
+	OSMO_ASSERT(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+	OSMO_ASSERT(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+	OSMO_ASSERT(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+	peer_fd = sv[1];
+	peer_len = 0;
+	next_idx = 0;
+
+	tx_gs = (struct osmo_gsup_server){
+		.epoll.ofd.fd = -1,
+		.tx_queue = {
+			.limit = OSMO_GSUP_TX_QUEUE_LIMIT_DEFAULT,
+			.high = OSMO_GSUP_TX_QUEUE_HIGH_DEFAULT,
+			.low = OSMO_GSUP_TX_QUEUE_LOW_DEFAULT,
+		},
+	};
+	INIT_LLIST_HEAD(&tx_gs.clients);
+	INIT_LLIST_HEAD(&tx_gs.routes);
+
+	conn = talloc_zero(ctx, struct osmo_gsup_conn);
+	OSMO_ASSERT(conn);
+	conn->server = &tx_gs;
+	conn->conn = talloc_zero(conn, struct ipa_server_conn);
+	OSMO_ASSERT(conn->conn);
+	conn->conn->addr = talloc_strdup(conn->conn, "10.0.0.1");
+	conn->conn->port = 1234;
+	conn->conn->data = conn;
+	conn->conn->ofd.fd = sv[0];
+	conn->conn->ofd.when = BSC_FD_READ;
+	conn->conn->ofd.data = conn->conn;
+	conn->conn->ofd.cb = osmo_gsup_conn_fd_cb;
+	INIT_LLIST_HEAD(&conn->tx.queue);
+	conn->tx.ipa_fd_cb = fake_ipa_fd_cb;
+	ipa_reads = 0;
+	return conn;
+}
+
+static void tx_conn_free(struct osmo_gsup_conn *conn)
+{
+	struct msgb *msg, *msg2;
+
+	llist_for_each_entry_safe(msg, msg2, &conn->tx.queue, list) {
+		llist_del(&msg->list);
+		msgb_free(msg);
+	}
+	close(conn->conn->ofd.fd);
+	close(peer_fd);
+	peer_fd = -1;
+	talloc_free(conn);
+}
+
+/* Queue a GSUP message of len bytes, numbered by idx */
+static int tx_gsup(struct osmo_gsup_conn *conn, unsigned int idx, unsigned int len)
+{
+	struct msgb *msg = msgb_alloc_headroom(len + 64, 64, __func__);
+	uint8_t *data;
+
+	OSMO_ASSERT(len >= 5);
+	data = msgb_put(msg, len);
+	memset(data, 0x2b, len);
+	data[0] = OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT;
+	osmo_store32be(idx, &data[1]);
+	return osmo_gsup_conn_send(conn, msg);
+}
+
+/* Pass a CCM message from the client to the GSUP server */
+static void rx_ccm(struct osmo_gsup_conn *conn, uint8_t msg_type)
+{
+	struct msgb *msg = msgb_alloc_headroom(64, 16, __func__);
+
+	msg->l2h = msgb_put(msg, 1);
+	msg->l2h[0] = msg_type;
+	ipa_msg_push_header(msg, IPAC_PROTO_IPACCESS);
+	OSMO_ASSERT(osmo_gsup_server_read_cb(conn->conn, msg) == 0);
+}
+
+static void peer_read(void)
+{
+	ssize_t rc;
+
+	while ((rc = read(peer_fd, peer_buf + peer_len, sizeof(peer_buf) - peer_len)) > 0)
+		peer_len += rc;
+	OSMO_ASSERT(rc < 0 && errno == EAGAIN);
+}
+
+/* Write the tx queue until it is empty, reading the client side in between */
+static void tx_flush_all(struct osmo_gsup_conn *conn)
+{
+	while (conn->conn->ofd.when & BSC_FD_WRITE) {
+		OSMO_ASSERT(osmo_gsup_conn_fd_cb(&conn->conn->ofd, BSC_FD_WRITE) == 0);
+		peer_read();
+	}
+}
+
+/* Print the IPA messages the client has received, counting runs of numbered GSUP messages; assert that the
+ * stream is intact and the GSUP messages come in order */
+static void peer_print(void)
+{
+	size_t pos = 0;
+	unsigned int run = 0;
+
+	while (pos < peer_len) {
+		const struct ipaccess_head *hh = (const struct ipaccess_head *)&peer_buf[pos];
+		uint16_t len;
+
+		OSMO_ASSERT(pos + sizeof(*hh) <= peer_len);
+		len = osmo_load16be(&hh->len);
+		OSMO_ASSERT(pos + sizeof(*hh) + len <= peer_len);
+
+		if (hh->proto == IPAC_PROTO_OSMO) {
+			OSMO_ASSERT(len >= 6 && hh->data[0] == IPAC_PROTO_EXT_GSUP);
+			OSMO_ASSERT(hh->data[1] == OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT);
+			OSMO_ASSERT(osmo_load32be(&hh->data[2]) == next_idx);
+			next_idx++;
+			run++;
+		} else {
+			if (run)
+				printf("client rx: %u GSUP messages\n", run);
+			run = 0;
+			OSMO_ASSERT(hh->proto == IPAC_PROTO_IPACCESS && len == 1);
+			printf("client rx: CCM %s\n",
+			       hh->data[0] == IPAC_MSGT_PONG ? "PONG" :
+			       hh->data[0] == IPAC_MSGT_ID_ACK ? "ID_ACK" : "?");
+		}
+		pos += sizeof(*hh) + len;
+	}
+	if (run)
+		printf("client rx: %u GSUP messages\n", run);
+	peer_len = 0;
+}
+
+static void test_tx_queue(void)
+{
+	struct osmo_gsup_conn *conn;
+	unsigned int i;
+
+	comment_start();
+	conn = tx_conn_alloc();
+
+	btw("Messages are queued, and written when the socket is writable");
+	for (i = 0; i < 5; i++)
+		tx_gsup(conn, i, 100);
+	VERBOSE_ASSERT(conn->tx.len, == 5, "%u");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_WRITE, != 0, "%u");
+	OSMO_ASSERT(osmo_gsup_conn_fd_cb(&conn->conn->ofd, BSC_FD_WRITE) == 0);
+	VERBOSE_ASSERT(conn->tx.len, == 0, "%u");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_WRITE, == 0, "%u");
+	peer_read();
+	peer_print();
+
+	btw("Reads still go to libosmo-abis");
+	OSMO_ASSERT(osmo_gsup_conn_fd_cb(&conn->conn->ofd, BSC_FD_READ) == 0);
+	VERBOSE_ASSERT(ipa_reads, == 1, "%u");
+
+	btw("More than the socket takes: the rest, possibly half a message, stays queued");
+	for (i = 5; i < 900; i++)
+		tx_gsup(conn, i, 1000);
+	OSMO_ASSERT(osmo_gsup_conn_fd_cb(&conn->conn->ofd, BSC_FD_WRITE) == 0);
+	VERBOSE_ASSERT(conn->tx.len > 0, == true, "%d");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_WRITE, != 0, "%u");
+
+	btw("CCM answers are queued behind them, not written into the middle of a message");
+	rx_ccm(conn, IPAC_MSGT_PING);
+	rx_ccm(conn, IPAC_MSGT_PONG);
+	rx_ccm(conn, IPAC_MSGT_ID_ACK);
+	tx_gsup(conn, 900, 100);
+	tx_flush_all(conn);
+	VERBOSE_ASSERT(conn->tx.len, == 0, "%u");
+	peer_print();
+
+	tx_conn_free(conn);
+	comment_end();
+}
+
+static void test_tx_queue_limits(void)
+{
+	struct osmo_gsup_conn *conn;
+	unsigned int i;
+	int rc;
+
+	comment_start();
+	conn = tx_conn_alloc();
+	tx_gs.tx_queue.high = 4;
+	tx_gs.tx_queue.low = 2;
+	tx_gs.tx_queue.limit = 6;
+
+	btw("Up to 'high' messages queued, the client is read from");
+	for (i = 0; i < 4; i++)
+		tx_gsup(conn, i, 100);
+	VERBOSE_ASSERT(conn->tx.throttled, == false, "%d");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_READ, != 0, "%u");
+
+	btw("Beyond 'high', reading stops");
+	tx_gsup(conn, 4, 100);
+	VERBOSE_ASSERT(conn->tx.throttled, == true, "%d");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_READ, == 0, "%u");
+	VERBOSE_ASSERT(conn->tx.stats.throttled, == 1, "%lu");
+
+	btw("Up to 'limit' messages are queued, more are dropped");
+	rc = tx_gsup(conn, 5, 100);
+	VERBOSE_ASSERT(rc, == 0, "%d");
+	rc = tx_gsup(conn, 6, 100);
+	VERBOSE_ASSERT(rc, == -ENOBUFS, "%d");
+	rc = tx_gsup(conn, 6, 100);
+	VERBOSE_ASSERT(rc, == -ENOBUFS, "%d");
+	VERBOSE_ASSERT(conn->tx.len, == 6, "%u");
+	VERBOSE_ASSERT(conn->tx.stats.dropped, == 2, "%lu");
+
+	btw("Once written down to 'low', reading resumes");
+	tx_flush_all(conn);
+	VERBOSE_ASSERT(conn->tx.throttled, == false, "%d");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_READ, != 0, "%u");
+	VERBOSE_ASSERT(conn->tx.stats.msgs, == 6, "%lu");
+	VERBOSE_ASSERT(conn->tx.stats.peak, == 6, "%u");
+	peer_print();
+
+	btw("While the client does not read, the queue stays above 'low', and reading stays off");
+	tx_gs.tx_queue.high = 1000;
+	tx_gs.tx_queue.limit = 3000;
+	for (i = 6; i < 2000; i++)
+		tx_gsup(conn, i, 1000);
+	VERBOSE_ASSERT(conn->tx.throttled, == true, "%d");
+	OSMO_ASSERT(osmo_gsup_conn_fd_cb(&conn->conn->ofd, BSC_FD_WRITE) == 0);
+	VERBOSE_ASSERT(conn->tx.len > tx_gs.tx_queue.low, == true, "%d");
+	VERBOSE_ASSERT(conn->tx.throttled, == true, "%d");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_READ, == 0, "%u");
+
+	btw("When it reads again, the queue is written and reading resumes");
+	tx_flush_all(conn);
+	VERBOSE_ASSERT(conn->tx.throttled, == false, "%d");
+	VERBOSE_ASSERT(conn->conn->ofd.when & BSC_FD_READ, != 0, "%u");
+	peer_print();
+
+	tx_conn_free(conn);
+	comment_end();
+}
+
+static struct timespec *stats_now;
+
+static void stats_clock_add_us(unsigned int us)
+{
+	stats_now->tv_nsec += (long)us * 1000;
+	stats_now->tv_sec += stats_now->tv_nsec / 1000000000;
+	stats_now->tv_nsec %= 1000000000;
+}
+
+/* Pass a GSUP message with an IMSI ending in imsi_last, and with session_id if not 0, to gsup_stats_rx/tx() */
+static void stats_msg(struct osmo_gsup_conn *conn, bool rx, uint8_t msg_type, uint8_t imsi_last,
+		      uint32_t session_id)
+{
+	uint8_t buf[32];
+	size_t len = 0;
+
+	buf[len++] = msg_type;
+	buf[len++] = OSMO_GSUP_IMSI_IE;
+	buf[len++] = 8;
+	memset(&buf[len], 0x21, 7);
+	buf[len + 7] = imsi_last;
+	len += 8;
+	if (session_id) {
+		buf[len++] = OSMO_GSUP_SESSION_ID_IE;
+		buf[len++] = 4;
+		osmo_store32be(session_id, &buf[len]);
+		len += 4;
+	}
+	if (rx)
+		gsup_stats_rx(conn, buf, len);
+	else
+		gsup_stats_tx(conn, buf, len);
+}
+
+static void stats_print(struct osmo_gsup_conn *conn)
+{
+	const struct gsup_conn_stats *s = &conn->traffic;
+	unsigned int pending_rx, pending_tx;
+
+	gsup_stats_pending_count(s, &pending_rx, &pending_tx);
+	printf("in flight: %u rx, %u tx\n", pending_rx, pending_tx);
+	printf("HLR latency: %lu replies, p50 < %u us, p90 < %u us, p99 < %u us\n", s->hlr_latency.count,
+	       gsup_latency_percentile_us(&s->hlr_latency, 50), gsup_latency_percentile_us(&s->hlr_latency, 90),
+	       gsup_latency_percentile_us(&s->hlr_latency, 99));
+	printf("client latency: %lu replies, p50 < %u us, p90 < %u us, p99 < %u us\n", s->peer_latency.count,
+	       gsup_latency_percentile_us(&s->peer_latency, 50), gsup_latency_percentile_us(&s->peer_latency, 90),
+	       gsup_latency_percentile_us(&s->peer_latency, 99));
+}
+
+#define STATS_CTR(conn, idx) (conn)->traffic.ctrs->ctr[idx].current
+
+static void test_gsup_stats(void)
+{
+	struct osmo_gsup_server gs = {
+		.latency_stats = true,
+	};
+	struct gsup_latency l = {};
+	struct osmo_gsup_conn *conn;
+	unsigned int i;
+
+	comment_start();
+
+	INIT_LLIST_HEAD(&gs.clients);
+	conn = talloc_zero(ctx, struct osmo_gsup_conn);
+	OSMO_ASSERT(conn);
+	conn->server = &gs;
+	llist_add_tail(&conn->list, &gs.clients);
+	gsup_stats_init(conn);
+	OSMO_ASSERT(conn->traffic.ctrs);
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, true);
+	stats_now = osmo_clock_override_gettimespec(CLOCK_MONOTONIC);
+	stats_now->tv_sec = 1000;
+	stats_now->tv_nsec = 0;
+
+	btw("Percentiles are the upper bound of the bucket holding them");
+	VERBOSE_ASSERT(gsup_latency_percentile_us(&l, 50), == 0, "%u");
+	l.buckets[0] = 50;
+	l.buckets[4] = 40;
+	l.buckets[10] = 9;
+	l.buckets[GSUP_LATENCY_BUCKETS - 1] = 1;
+	l.count = 100;
+	VERBOSE_ASSERT(gsup_latency_percentile_us(&l, 50), == 64, "%u");
+	VERBOSE_ASSERT(gsup_latency_percentile_us(&l, 51), == 1024, "%u");
+	VERBOSE_ASSERT(gsup_latency_percentile_us(&l, 90), == 1024, "%u");
+	VERBOSE_ASSERT(gsup_latency_percentile_us(&l, 99), == 65536, "%u");
+	VERBOSE_ASSERT(gsup_latency_percentile_us(&l, 100), == 1 << (GSUP_LATENCY_BUCKETS - 1 + GSUP_LATENCY_MIN_SHIFT),
+		       "%u");
+
+	btw("Messages are counted by direction and type");
+	stats_msg(conn, true, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, 0x01, 0);
+	stats_msg(conn, true, OSMO_GSUP_MSGT_UPDATE_LOCATION_REQUEST, 0x02, 0);
+	stats_msg(conn, false, OSMO_GSUP_MSGT_INSERT_DATA_REQUEST, 0x02, 0);
+	stats_msg(conn, true, OSMO_GSUP_MSGT_PROC_SS_REQUEST, 0x03, 7);
+	gsup_stats_rx(conn, NULL, 0);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_RX_MSGS), == 4, "%"PRIu64);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_RX_BYTES), == 3 * 11 + 6, "%"PRIu64);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_RX_SAI), == 1, "%"PRIu64);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_RX_UL), == 1, "%"PRIu64);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_RX_PROC_SS), == 1, "%"PRIu64);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_RX_INVALID), == 1, "%"PRIu64);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_TX_MSGS), == 1, "%"PRIu64);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_TX_ISD), == 1, "%"PRIu64);
+	stats_print(conn);
+
+	btw("Each reply is matched to its request, by type and IMSI");
+	stats_clock_add_us(100);
+	stats_msg(conn, false, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, 0x01, 0);
+	stats_clock_add_us(5000);
+	stats_msg(conn, true, OSMO_GSUP_MSGT_INSERT_DATA_RESULT, 0x02, 0);
+	stats_msg(conn, false, OSMO_GSUP_MSGT_UPDATE_LOCATION_ERROR, 0x02, 0);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_TX_ERRORS), == 1, "%"PRIu64);
+	stats_print(conn);
+
+	btw("... and by session ID");
+	stats_msg(conn, true, OSMO_GSUP_MSGT_PROC_SS_REQUEST, 0x03, 8);
+	stats_clock_add_us(1000);
+	stats_msg(conn, false, OSMO_GSUP_MSGT_PROC_SS_RESULT, 0x03, 8);
+	VERBOSE_ASSERT(conn->traffic.hlr_latency.buckets[4], == 1, "%lu");
+	stats_msg(conn, false, OSMO_GSUP_MSGT_PROC_SS_RESULT, 0x03, 9);
+	stats_print(conn);
+
+	btw("A retransmitted request: the reply answers the oldest one");
+	stats_msg(conn, true, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, 0x04, 0);
+	stats_clock_add_us(50000);
+	stats_msg(conn, true, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, 0x04, 0);
+	stats_msg(conn, false, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, 0x04, 0);
+	VERBOSE_ASSERT(conn->traffic.hlr_latency.buckets[10], == 1, "%lu");
+	stats_print(conn);
+
+	btw("Requests not answered in time are forgotten");
+	stats_now->tv_sec += GSUP_STATS_PENDING_TIMEOUT;
+	stats_print(conn);
+	stats_msg(conn, false, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, 0x04, 0);
+	stats_msg(conn, false, OSMO_GSUP_MSGT_PROC_SS_RESULT, 0x03, 7);
+	stats_print(conn);
+
+	btw("Beyond GSUP_STATS_PENDING_PROBE requests of one hash, the oldest is forgotten");
+	for (i = 0; i < GSUP_STATS_PENDING_PROBE + 2; i++) {
+		stats_msg(conn, true, OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, 0x05, 0);
+		stats_clock_add_us(1000);
+	}
+	stats_print(conn);
+
+	btw("Switched off, messages are still counted, but not matched");
+	gsup_stats_latency_enable(&gs, false);
+	VERBOSE_ASSERT(conn->traffic.pending == NULL, == true, "%d");
+	stats_msg(conn, false, OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, 0x05, 0);
+	VERBOSE_ASSERT(STATS_CTR(conn, GSUP_CONN_CTR_TX_MSGS), == 9, "%"PRIu64);
+	stats_print(conn);
+
+	osmo_clock_override_enable(CLOCK_MONOTONIC, false);
+	gsup_stats_free(conn);
+	talloc_free(conn);
+	comment_end();
+}
+
+static const struct log_info_cat default_categories[] = {
+};
+
+static struct log_info info = {
+	.cat = default_categories,
+	.num_cat = ARRAY_SIZE(default_categories),
+};
+
+static int record_read_cb(struct osmo_gsup_conn *conn, struct msgb *msg)
+{
+	msgb_free(msg);
+	return 0;
+}
+
+/* Pass a GSUP message from the client to the GSUP server */
+static void rx_gsup(struct osmo_gsup_conn *conn, const uint8_t *data, size_t len)
+{
+	struct msgb *msg = msgb_alloc_headroom(len + 64, 64, __func__);
+
+	memcpy(msgb_put(msg, len), data, len);
+	ipa_prepend_header_ext(msg, IPAC_PROTO_EXT_GSUP);
+	ipa_msg_push_header(msg, IPAC_PROTO_OSMO);
+	OSMO_ASSERT(osmo_gsup_server_read_cb(conn->conn, msg) == 0);
+}
+
+static void tx_gsup_data(struct osmo_gsup_conn *conn, const uint8_t *data, size_t len)
+{
+	struct msgb *msg = msgb_alloc_headroom(len + 64, 64, __func__);
+
+	memcpy(msgb_put(msg, len), data, len);
+	OSMO_ASSERT(osmo_gsup_conn_send(conn, msg) == 0);
+}
+
+static void test_gsup_record(void)
+{
+	const char *path = "gsup_server_test.rec";
+	static const char name[] = "MSC-1";
+	static const uint8_t sai_req[] = {
+		OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST,
+		OSMO_GSUP_IMSI_IE, 3, 0x21, 0x43, 0xf5,
+	};
+	static const uint8_t sai_res[] = {
+		OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT,
+		OSMO_GSUP_IMSI_IE, 3, 0x21, 0x43, 0xf5,
+		OSMO_GSUP_AUTH_TUPLE_IE, 2, 0xaa, 0xbb,
+	};
+	static const uint8_t purge_err[] = {
+		OSMO_GSUP_MSGT_PURGE_MS_ERROR,
+		OSMO_GSUP_CAUSE_IE, 1, 0x02,
+	};
+	/* Timestamps 1551443696.001000, .002000 and .003000 */
+	static const uint8_t expect[] = {
+		'G', 'S', 'U', 'P', 'R', 'E', 'C', '1',
+		/* received in full */
+		0x5c, 0x79, 0x26, 0xf0, 0x00, 0x00, 0x03, 0xe8, 0x00, 5, 0x00, 6,
+		'M', 'S', 'C', '-', '1',
+		OSMO_GSUP_MSGT_SEND_AUTH_INFO_REQUEST, OSMO_GSUP_IMSI_IE, 3, 0x21, 0x43, 0xf5,
+		/* sent, cut after the IMSI IE */
+		0x5c, 0x79, 0x26, 0xf0, 0x00, 0x00, 0x07, 0xd0, GSUP_RECORD_F_TX, 5, 0x00, 6,
+		'M', 'S', 'C', '-', '1',
+		OSMO_GSUP_MSGT_SEND_AUTH_INFO_RESULT, OSMO_GSUP_IMSI_IE, 3, 0x21, 0x43, 0xf5,
+		/* sent without IMSI IE, only the message type */
+		0x5c, 0x79, 0x26, 0xf0, 0x00, 0x00, 0x0b, 0xb8, GSUP_RECORD_F_TX, 5, 0x00, 1,
+		'M', 'S', 'C', '-', '1',
+		OSMO_GSUP_MSGT_PURGE_MS_ERROR,
+	};
+	struct osmo_gsup_conn *conn;
+	uint8_t buf[sizeof(expect) + 16];
+	size_t len;
+	FILE *f;
+
+	comment_start();
+
+	conn = tx_conn_alloc();
+	tx_gs.read_cb = record_read_cb;
+	tx_gs.record = gsup_record_start(ctx, path);
+	OSMO_ASSERT(tx_gs.record);
+	osmo_gettimeofday_override = true;
+	osmo_gettimeofday_override_time = (struct timeval){ .tv_sec = 1551443696 };
+
+	btw("A client that has not identified yet is not recorded, a replay could not impersonate it");
+	rx_gsup(conn, sai_req, sizeof(sai_req));
+	VERBOSE_ASSERT(tx_gs.record->msgs, == 0, "%lu");
+
+	btw("Received messages are recorded in full, sent ones up to the IMSI IE");
+	conn->ccm.lv[IPAC_IDTAG_SERNR].len = sizeof(name);
+	conn->ccm.lv[IPAC_IDTAG_SERNR].val = (const uint8_t *)name;
+	osmo_gettimeofday_override_time.tv_usec = 1000;
+	rx_gsup(conn, sai_req, sizeof(sai_req));
+	osmo_gettimeofday_override_time.tv_usec = 2000;
+	tx_gsup_data(conn, sai_res, sizeof(sai_res));
+	osmo_gettimeofday_override_time.tv_usec = 3000;
+	tx_gsup_data(conn, purge_err, sizeof(purge_err));
+	VERBOSE_ASSERT(tx_gs.record->msgs, == 3, "%lu");
+	VERBOSE_ASSERT(tx_gs.record->bytes, == sizeof(expect) - strlen(GSUP_RECORD_MAGIC), "%lu");
+	VERBOSE_ASSERT(tx_gs.record->errors, == 0, "%lu");
+
+	btw("The capture file holds the header and each message");
+	gsup_record_stop(tx_gs.record);
+	tx_gs.record = NULL;
+	f = fopen(path, "r");
+	OSMO_ASSERT(f);
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+	printf("%s\n", osmo_hexdump_nospc(buf, len));
+	OSMO_ASSERT(len == sizeof(expect));
+	OSMO_ASSERT(!memcmp(buf, expect, len));
+
+	osmo_gettimeofday_override = false;
+	unlink(path);
+	tx_conn_free(conn);
+
+	comment_end();
+}
+
 int main(int argc, char **argv)
 {
 	printf("test_gsup_server.c\n");
 
+	ctx = talloc_named_const(NULL, 0, "gsup_server_test");
+	osmo_init_logging2(ctx, &info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_print_timestamp(osmo_stderr_target, 0);
+	log_set_use_color(osmo_stderr_target, 0);
+	log_set_print_category(osmo_stderr_target, 1);
+
 	test_add_conn();
+	test_isd_cache();
+	test_tx_queue();
+	test_tx_queue_limits();
+	test_gsup_stats();
+	test_gsup_record();
 
 	printf("Done\n");
 	return 0;
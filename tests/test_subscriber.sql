@@ -15,3 +15,6 @@ INSERT INTO auc_3g (subscriber_id, algo_id_3g, k, opc, sqn) VALUES (3, 5, '00010
 -- A subscriber id > 7 and > 15 to check against octal and hex notations
 INSERT INTO subscriber (id, imsi, msisdn) VALUES (123, '123123', '123');
 INSERT INTO auc_2g (subscriber_id, algo_id_2g, ki) VALUES (123, 3, 'BeefedCafeFaceAcedAddedDecadeFee');
+
+-- Fixed timestamps for the change log entries the above wrote, see subscriber-changes in test_subscriber.ctrl
+UPDATE subscriber_change SET ts = 0;
@@ -0,0 +1,335 @@
+/* Test assigning USSD sessions to the connections of an EUSE */
+
+/* (C) 2019 by sysmocom - s.f.m.c. GmbH <info@sysmocom.de>
+ *
+ * All Rights Reserved
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <osmocom/core/application.h>
+#include <osmocom/core/logging.h>
+#include <osmocom/core/msgb.h>
+#include <osmocom/core/talloc.h>
+#include <osmocom/core/utils.h>
+#include <osmocom/gsm/gsup.h>
+#include <osmocom/gsm/protocol/ipaccess.h>
+#include <osmocom/abis/ipa.h>
+
+#include "hlr.h"
+#include "hlr_ussd.h"
+#include "gsup_server.h"
+#include "gsup_router.h"
+#include "logging.h"
+
+#define comment_start() printf("\n===== %s\n", __func__)
+#define comment_end() printf("===== %s: SUCCESS\n\n", __func__)
+#define btw(fmt, args...) printf("\n" fmt "\n", ## args)
+
+#define VERBOSE_ASSERT(val, expect_op, fmt) \
+	do { \
+		printf(#val " == " fmt "\n", (val)); \
+		OSMO_ASSERT((val) expect_op); \
+	} while (0)
+
+#define IMSI1 "901700000000001"
+#define VLR_NAME "MSC-00-00-00-00-00-00"
+#define EUSE_NAME "EUSE-foo"
+
+static void *ctx = NULL;
+
+struct hlr *g_hlr;
+static struct osmo_gsup_server *gs;
+static struct osmo_gsup_conn *vlr;
+static struct osmo_gsup_conn *euse_conn[3];
+
+/* Facility IE contents of a ProcessUnstructuredSS-Request invoke for "*#100#", with no USSD route configured it
+ * goes to the default EUSE */
+static const uint8_t ussd_req[] = {
+	0xa1, 0x13, 0x02, 0x01, 0x01, 0x02, 0x01, 0x3b,
+	0x30, 0x0b, 0x04, 0x01, 0x0f, 0x04, 0x06, 0xaa,
+	0x51, 0x0c, 0x06, 0x1b, 0x01,
+};
+
+/* The IPA name of each connection is set up by the test, instead of being received in an IPA ID response */
+int osmo_gsup_conn_ccm_get(const struct osmo_gsup_conn *clnt, uint8_t **addr, uint8_t tag)
+{
+	if (!TLVP_PRESENT(&clnt->ccm, tag))
+		return -ENODEV;
+	*addr = (uint8_t *) TLVP_VAL(&clnt->ccm, tag);
+	return TLVP_LEN(&clnt->ccm, tag);
+}
+
+/* Instead of queueing to the IPA connection, print what each GSUP client would receive */
+int osmo_gsup_conn_send(struct osmo_gsup_conn *conn, struct msgb *msg)
+{
+	struct osmo_gsup_message gsup;
+	int rc;
+
+	rc = osmo_gsup_decode(msgb_data(msg), msgb_length(msg), &gsup);
+	OSMO_ASSERT(rc == 0);
+	printf("%s:%u: rx %s %s/0x%08x %s\n", conn->conn->addr, conn->conn->port,
+	       osmo_gsup_message_type_name(gsup.message_type), gsup.imsi, gsup.session_id,
+	       osmo_gsup_session_state_name(gsup.session_state));
+	msgb_free(msg);
+	return 0;
+}
+
+/* The VLR is known from the GSUP route of its connection, so the subscriber is never looked up */
+int db_subscr_get_by_imsi(struct db_context *dbc, const char *imsi, struct hlr_subscriber *subscr)
+{
+	OSMO_ASSERT(false);
+	return -ENOENT;
+}
+
+static struct osmo_gsup_conn *conn_up(const char *name, const char *addr, uint16_t port)
+{
+	struct osmo_gsup_conn *conn = talloc_zero(gs, struct osmo_gsup_conn);
+	OSMO_ASSERT(conn);
+
+	conn->server = gs;
+	conn->conn = talloc_zero(conn, struct ipa_server_conn);
+	OSMO_ASSERT(conn->conn);
+	conn->conn->addr = talloc_strdup(conn->conn, addr);
+	conn->conn->port = port;
+	conn->ccm.lv[IPAC_IDTAG_SERNR].val = (uint8_t *) talloc_strdup(conn, name);
+	conn->ccm.lv[IPAC_IDTAG_SERNR].len = strlen(name) + 1;
+	llist_add_tail(&conn->list, &gs->clients);
+
+	/* as far as osmo_gsup_server_ccm_cb() matters here */
+	gsup_route_add(conn, (uint8_t *) name, strlen(name) + 1);
+	euse_conn_up(conn);
+	return conn;
+}
+
+static void conn_down(struct osmo_gsup_conn *conn)
+{
+	printf("%s:%u: connection lost\n", conn->conn->addr, conn->conn->port);
+	/* as far as osmo_gsup_server_closed_cb() matters here */
+	euse_conn_down(conn);
+	gsup_route_del_conn(conn);
+	llist_del(&conn->list);
+	talloc_free(conn);
+}
+
+/* Pass a USSD request of a session from conn to the HLR */
+static void rx_ussd(struct osmo_gsup_conn *conn, uint32_t session_id, enum osmo_gsup_session_state state)
+{
+	struct osmo_gsup_message gsup = {
+		.message_type = OSMO_GSUP_MSGT_PROC_SS_REQUEST,
+		.session_id = session_id,
+		.session_state = state,
+		.ss_info = ussd_req,
+		.ss_info_len = sizeof(ussd_req),
+	};
+
+	OSMO_STRLCPY_ARRAY(gsup.imsi, IMSI1);
+	printf("%s:%u: tx %s %s/0x%08x %s\n", conn->conn->addr, conn->conn->port,
+	       osmo_gsup_message_type_name(gsup.message_type), gsup.imsi, gsup.session_id,
+	       osmo_gsup_session_state_name(gsup.session_state));
+	rx_proc_ss_req(conn, &gsup);
+}
+
+static void print_members(const struct hlr_euse *euse)
+{
+	const struct hlr_euse_member *m;
+
+	printf("EUSE %s connections:\n", euse->name);
+	llist_for_each_entry(m, &euse->members, list)
+		printf("  %s:%u sessions=%u total=%lu\n", m->conn->conn->addr, m->conn->conn->port,
+		       m->sessions, m->sessions_total);
+}
+
+static struct hlr_euse *setup(enum hlr_euse_balance balance)
+{
+	struct hlr_euse *euse;
+
+	g_hlr = talloc_zero(ctx, struct hlr);
+	OSMO_ASSERT(g_hlr);
+	INIT_LLIST_HEAD(&g_hlr->euse_list);
+	INIT_LLIST_HEAD(&g_hlr->ussd_routes);
+	INIT_LLIST_HEAD(&g_hlr->ss_sessions);
+
+	gs = talloc_zero(g_hlr, struct osmo_gsup_server);
+	OSMO_ASSERT(gs);
+	gs->priv = g_hlr;
+	INIT_LLIST_HEAD(&gs->clients);
+	INIT_LLIST_HEAD(&gs->routes);
+	g_hlr->gs = gs;
+
+	euse = euse_alloc(g_hlr, "foo");
+	OSMO_ASSERT(euse);
+	euse->balance = balance;
+	g_hlr->euse_default = euse;
+
+	vlr = conn_up(VLR_NAME, "10.0.0.1", 2001);
+	euse_conn[0] = conn_up(EUSE_NAME, "10.0.1.1", 3001);
+	euse_conn[1] = conn_up(EUSE_NAME, "10.0.1.2", 3002);
+	euse_conn[2] = conn_up(EUSE_NAME, "10.0.1.3", 3003);
+	print_members(euse);
+	return euse;
+}
+
+static void teardown()
+{
+	struct osmo_gsup_conn *conn, *conn2;
+
+	llist_for_each_entry_safe(conn, conn2, &gs->clients, list)
+		conn_down(conn);
+	VERBOSE_ASSERT(llist_count(&g_hlr->ss_sessions), == 0, "%u");
+	talloc_free(g_hlr);
+	g_hlr = NULL;
+}
+
+static void test_least_sessions()
+{
+	struct hlr_euse *euse;
+
+	comment_start();
+	euse = setup(EUSE_BALANCE_LEAST_SESSIONS);
+
+	btw("Sessions go to the connection with the fewest sessions, the first of them on a tie");
+	rx_ussd(vlr, 1, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 2, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 3, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 4, OSMO_GSUP_SESSION_STATE_BEGIN);
+	print_members(euse);
+
+	btw("The other messages of a session go to the same connection");
+	rx_ussd(vlr, 1, OSMO_GSUP_SESSION_STATE_CONTINUE);
+	rx_ussd(vlr, 4, OSMO_GSUP_SESSION_STATE_CONTINUE);
+
+	btw("A session ended by the MS no longer counts");
+	rx_ussd(vlr, 2, OSMO_GSUP_SESSION_STATE_END);
+	print_members(euse);
+
+	btw("A session ended by the EUSE no longer counts");
+	rx_ussd(euse_conn[0], 1, OSMO_GSUP_SESSION_STATE_END);
+	print_members(euse);
+
+	btw("The next session goes to the idle connection, then all have one session and the first one wins");
+	rx_ussd(vlr, 5, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 6, OSMO_GSUP_SESSION_STATE_BEGIN);
+	print_members(euse);
+
+	btw("End all sessions");
+	rx_ussd(vlr, 3, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 4, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 5, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 6, OSMO_GSUP_SESSION_STATE_END);
+	print_members(euse);
+
+	teardown();
+	comment_end();
+}
+
+static void test_round_robin()
+{
+	struct hlr_euse *euse;
+
+	comment_start();
+	euse = setup(EUSE_BALANCE_ROUND_ROBIN);
+
+	btw("Sessions go to each connection in turn");
+	rx_ussd(vlr, 1, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 2, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 3, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 4, OSMO_GSUP_SESSION_STATE_BEGIN);
+	print_members(euse);
+
+	btw("The next session goes to the next connection, even though another one is idle");
+	rx_ussd(vlr, 1, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 4, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 5, OSMO_GSUP_SESSION_STATE_BEGIN);
+	print_members(euse);
+
+	btw("End all sessions");
+	rx_ussd(vlr, 2, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 3, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 5, OSMO_GSUP_SESSION_STATE_END);
+	print_members(euse);
+
+	teardown();
+	comment_end();
+}
+
+static void test_conn_lost()
+{
+	struct hlr_euse *euse;
+
+	comment_start();
+	euse = setup(EUSE_BALANCE_LEAST_SESSIONS);
+
+	rx_ussd(vlr, 1, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 2, OSMO_GSUP_SESSION_STATE_BEGIN);
+	print_members(euse);
+
+	btw("The connection serving session 1 is lost");
+	conn_down(euse_conn[0]);
+	print_members(euse);
+
+	btw("Session 1 is not moved to another connection, it fails");
+	rx_ussd(vlr, 1, OSMO_GSUP_SESSION_STATE_END);
+	VERBOSE_ASSERT(llist_count(&g_hlr->ss_sessions), == 1, "%u");
+
+	btw("Session 2 is not affected");
+	rx_ussd(vlr, 2, OSMO_GSUP_SESSION_STATE_CONTINUE);
+
+	btw("New sessions go to the remaining connections");
+	rx_ussd(vlr, 3, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 4, OSMO_GSUP_SESSION_STATE_BEGIN);
+	print_members(euse);
+
+	btw("The EUSE process connects again, and gets the next session");
+	conn_up(EUSE_NAME, "10.0.1.1", 3004);
+	rx_ussd(vlr, 5, OSMO_GSUP_SESSION_STATE_BEGIN);
+	print_members(euse);
+
+	btw("All connections are lost, the sessions fail");
+	while (!llist_empty(&euse->members))
+		conn_down(llist_first_entry(&euse->members, struct hlr_euse_member, list)->conn);
+	rx_ussd(vlr, 2, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 3, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 4, OSMO_GSUP_SESSION_STATE_END);
+	rx_ussd(vlr, 5, OSMO_GSUP_SESSION_STATE_END);
+
+	btw("And so do new sessions");
+	rx_ussd(vlr, 6, OSMO_GSUP_SESSION_STATE_BEGIN);
+	rx_ussd(vlr, 6, OSMO_GSUP_SESSION_STATE_END);
+
+	teardown();
+	comment_end();
+}
+
+int main(int argc, char **argv)
+{
+	ctx = talloc_named_const(NULL, 0, "ussd_test");
+	osmo_init_logging2(ctx, &hlr_log_info);
+	log_set_print_filename(osmo_stderr_target, 0);
+	log_set_print_timestamp(osmo_stderr_target, 0);
+	log_set_use_color(osmo_stderr_target, 0);
+	log_set_print_category(osmo_stderr_target, 1);
+
+	test_least_sessions();
+	test_round_robin();
+	test_conn_lost();
+
+	printf("Done\n");
+	return 0;
+}